@@ -0,0 +1,65 @@
+# Compare two native simulator benchmark results, see -bench and -json in src/native/Simulator.cpp,
+# or two board boot results from scripts/boot_bench.py
+#
+#   python scripts/bench_compare.py results.jsonl              last line against the one before it
+#   python scripts/bench_compare.py old.jsonl new.jsonl        last line of each
+# Exits with 1 if throughput dropped or p99 latency rose by more than --threshold percent, or the pipeline
+# started allocating, so it can stop a CI job.
+
+import argparse
+import json
+import sys
+
+Better = {"packets_per_second": 1, "p50_ns": -1, "p99_ns": -1, "max_ns": -1, "receive_max_ns": -1,
+          "history_flush_ns": -1, "heap_peak_bytes": -1, "pipeline_allocations": -1, "warm_save_ns": -1,
+          "warm_restore_ns": -1, "radio_ready_ms": -1, "first_packet_ms": -1, "setup_ms": -1,
+          "alert_eval_ns": -1, "config_load_ns": -1, "config_apply_ns": -1,
+          "update_pack_bytes": -1, "update_apply_ms": -1, "update_seconds": -1,
+          "decode_binary_ns": -1, "decode_text_ns": -1, "flash_bytes_per_reading": -1, "flash_write_amplification": -1,
+          "flash_block_erases_max": -1, "page_requests_per_second": 1, "page_heap_peak_bytes": -1,
+          "event_p99_ns": -1, "event_heap_bytes": -1,
+          "decode_packet_ns": -1, "decode_packet_allocations": -1}  # 1 higher is better, -1 lower is better
+Checked = ["packets_per_second", "p99_ns", "radio_ready_ms"]
+
+
+def LastResults(FileName, Count):
+    with open(FileName) as Results:
+        Lines = [Line for Line in Results.read().splitlines() if Line.strip()]
+    if len(Lines) < Count:
+        sys.exit(FileName + " needs at least " + str(Count) + " results")
+    return [json.loads(Line) for Line in Lines[-Count:]]
+
+
+def Main():
+    Parser = argparse.ArgumentParser(description=__doc__)
+    Parser.add_argument("files", nargs="+")
+    Parser.add_argument("--threshold", type=float, default=10.0, help="percent change counted as a regression")
+    Options = Parser.parse_args()
+    if len(Options.files) == 1:
+        Old, New = LastResults(Options.files[0], 2)
+    else:
+        Old = LastResults(Options.files[0], 1)[0]
+        New = LastResults(Options.files[1], 1)[0]
+    if Old.get("trace") != New.get("trace"):
+        print("warning: different traces, %s and %s" % (Old.get("trace"), New.get("trace")))
+
+    Regressed = []
+    print("%-22s %14s %14s %9s" % ("", Old.get("label") or "old", New.get("label") or "new", "change"))
+    for Key in Old:
+        if Key in ("label", "trace") or Key not in New:
+            continue
+        Change = (New[Key] - Old[Key]) * 100.0 / Old[Key] if Old[Key] else 0.0
+        Mark = ""
+        if Key in Better and Change * Better[Key] < -Options.threshold:
+            Mark = " worse"
+            if Key in Checked:
+                Regressed.append(Key)
+        print("%-22s %14s %14s %8.1f%%%s" % (Key, Old[Key], New[Key], Change, Mark))
+    if New.get("pipeline_allocations", 0) > Old.get("pipeline_allocations", 0):
+        Regressed.append("pipeline_allocations")
+    if Regressed:
+        print("regressed: " + ", ".join(Regressed))
+        sys.exit(1)
+
+
+Main()
@@ -0,0 +1,74 @@
+# Time a restart of the receiver on the board, how long until the radio listens and the first packet arrives
+#
+#   python scripts/boot_bench.py 192.168.0.22 --runs 5 --json boot.jsonl --label `git describe --always`
+#   python scripts/bench_compare.py boot.jsonl
+# Restarts it through /xstart and reads the water_boot_* metrics once it answers again. The first packet needs a
+# sender nearby, one sending every few seconds keeps first_packet_ms down to the boot rather than the sender's wait.
+# Each value in the JSON is the median of the runs.
+
+import argparse
+import json
+import statistics
+import sys
+import time
+import urllib.request
+
+XStartDelay = 5  # seconds the receiver waits after answering /xstart, XStartDisplayDelay in src/main.cpp
+
+
+def Metrics(Host):
+    with urllib.request.urlopen("http://%s/metrics" % Host, timeout=2) as Response:
+        Text = Response.read().decode()
+    Values = {}
+    for Line in Text.splitlines():
+        if Line.startswith("water_boot_"):
+            Name, Value = Line.split()
+            Values[Name] = float(Value)
+    return Values
+
+
+# restart and wait for the first packet, None if it never came
+def Run(Host, Timeout):
+    urllib.request.urlopen("http://%s/xstart" % Host, timeout=XStartDelay + 5).read()
+    Start = time.time()
+    while time.time() - Start < Timeout:
+        time.sleep(0.5)
+        try:
+            Values = Metrics(Host)
+        except OSError:
+            continue  # still restarting, or WiFi isn't up yet
+        if Values.get("water_boot_first_packet_seconds", 0) > 0:
+            return Values
+    return None
+
+
+def Main():
+    Parser = argparse.ArgumentParser(description="receiver boot benchmark")
+    Parser.add_argument("host")
+    Parser.add_argument("--runs", type=int, default=3)
+    Parser.add_argument("--timeout", type=float, default=120, help="seconds to wait for the first packet after each restart")
+    Parser.add_argument("--json", help="append the result to this file")
+    Parser.add_argument("--label", default="")
+    Options = Parser.parse_args()
+    Results = []
+    for Number in range(Options.runs):
+        Values = Run(Options.host, Options.timeout)
+        if Values is None:
+            sys.exit("run %d: no packet within %.0f seconds" % (Number + 1, Options.timeout))
+        print("run %d: radio %.0fms, setup %.0fms, first packet %.0fms, %s start" % (
+            Number + 1, Values["water_boot_radio_ready_seconds"] * 1000, Values["water_boot_setup_seconds"] * 1000,
+            Values["water_boot_first_packet_seconds"] * 1000, "warm" if Values["water_boot_warm"] else "cold"))
+        Results.append(Values)
+    Median = lambda Name: round(statistics.median(Values[Name] for Values in Results) * 1000)
+    Result = {"label": Options.label, "trace": "boot", "runs": Options.runs,
+              "radio_ready_ms": Median("water_boot_radio_ready_seconds"), "setup_ms": Median("water_boot_setup_seconds"),
+              "first_packet_ms": Median("water_boot_first_packet_seconds"),
+              "warm_starts": sum(1 for Values in Results if Values["water_boot_warm"])}
+    Json = json.dumps(Result, separators=(",", ":"))
+    print(Json)
+    if Options.json:
+        with open(Options.json, "a") as Output:
+            Output.write(Json + "\n")
+
+
+Main()
@@ -0,0 +1,107 @@
+# Compile the web page templates in data/*.html into src/Templates.h
+#
+# Each page becomes a list of parts, a run of fixed text followed by the slot number of the %Variable% that comes after it.
+# The firmware then sends the text straight out of flash and fills in the slots itself, no SPIFFS reads and no String
+# building per placeholder.  Run by PlatformIO before every build (see extra_scripts in platformio.ini) or by hand with
+#   python scripts/compile_templates.py
+
+import os
+import re
+
+try:
+    Import("env")  # running inside PlatformIO
+    ProjectDir = env.subst("$PROJECT_DIR")
+except NameError:  # running by hand
+    ProjectDir = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+DataDir = os.path.join(ProjectDir, "data")
+OutputFile = os.path.join(ProjectDir, "src", "Templates.h")
+Variable = re.compile(r"%([A-Za-z0-9_]+)%")  # same rule as the AsyncWebServer template processor
+
+
+def CString(Text):
+    # one C string literal per source line so the generated file stays readable
+    Lines = []
+    for Line in Text.splitlines(True):
+        Escaped = Line.replace("\\", "\\\\").replace('"', '\\"').replace("\r", "\\r").replace("\n", "\\n")
+        Lines.append('"' + Escaped + '"')
+    return "\r\n    ".join(Lines) if Lines else '""'
+
+
+def Main():
+    Pages = []
+    Slots = []
+    for FileName in sorted(os.listdir(DataDir)):
+        if not FileName.endswith(".html"):
+            continue
+        with open(os.path.join(DataDir, FileName), newline="") as Html:
+            Text = Html.read()
+        Parts = []
+        Position = 0
+        for Match in Variable.finditer(Text):
+            Name = Match.group(1)
+            if Name not in Slots:
+                Slots.append(Name)
+            Parts.append((Text[Position:Match.start()], "Slot" + Name))
+            Position = Match.end()
+        Parts.append((Text[Position:], "SlotNone"))
+        Pages.append(("Template" + FileName[:-5].capitalize(), Parts))
+
+    Out = []
+    Out.append("// Generated by scripts/compile_templates.py from data/*.html, do not edit, edit the html and rebuild")
+    Out.append("")
+    Out.append("#ifndef TEMPLATES_H")
+    Out.append("#define TEMPLATES_H")
+    Out.append("")
+    Out.append("#ifdef ARDUINO")
+    Out.append("#include <Arduino.h>")
+    Out.append("#else // the simulator, flash is ordinary memory on a PC")
+    Out.append("#include <string.h>")
+    Out.append("#include \"Hal.h\"")
+    Out.append("#define PROGMEM")
+    Out.append("#define memcpy_P memcpy")
+    Out.append("#endif")
+    Out.append("")
+    Out.append("// one per %Variable% used in any page")
+    Out.append("enum TemplateSlot : uint8_t")
+    Out.append("{")
+    for Name in Slots:
+        Out.append("  Slot" + Name + ",")
+    Out.append("  SlotNone, // end of the page, no variable after the text")
+    Out.append("};")
+    Out.append("// the names as they are in the html, the firmware doesn't use them so they aren't linked in")
+    Out.append("const char *const TemplateSlotNames[] = {")
+    for Name in Slots:
+        Out.append('    "' + Name + '",')
+    Out.append("};")
+    Out.append("")
+    Out.append("struct TemplatePart // fixed text then a variable")
+    Out.append("{")
+    Out.append("  const char *Text;")
+    Out.append("  uint16_t Length;")
+    Out.append("  TemplateSlot Slot;")
+    Out.append("};")
+    for PageName, Parts in Pages:
+        Out.append("")
+        for Index, (Text, Slot) in enumerate(Parts):
+            Out.append("const char %s%d[] PROGMEM = %s;" % (PageName, Index, CString(Text)))
+        Out.append("const TemplatePart %s[] = {" % PageName)
+        for Index, (Text, Slot) in enumerate(Parts):
+            Out.append("    {%s%d, %d, %s}," % (PageName, Index, len(Text.encode("utf-8")), Slot))
+        Out.append("};")
+        Out.append("const byte %sParts = %d;" % (PageName, len(Parts)))
+    Out.append("")
+    Out.append("#endif")
+    Out.append("")
+
+    Generated = "\r\n".join(Out)
+    if os.path.exists(OutputFile):
+        with open(OutputFile, newline="") as Existing:
+            if Existing.read() == Generated:
+                return  # unchanged, don't force a rebuild
+    with open(OutputFile, "w", newline="") as Header:
+        Header.write(Generated)
+    print("Compiled web page templates into " + OutputFile)
+
+
+Main()
@@ -0,0 +1,35 @@
+# Make gzip copies of the static files in data/ so the web server can send them compressed
+#
+# The .gz files sit next to the originals and go up with "Upload File System image".  The firmware sends the .gz copy
+# with Content-Encoding: gzip to any browser that accepts it.  Run by PlatformIO before every build and file system
+# image (see extra_scripts in platformio.ini) or by hand with
+#   python scripts/gzip_assets.py
+
+import gzip
+import os
+
+try:
+    Import("env")  # running inside PlatformIO
+    ProjectDir = env.subst("$PROJECT_DIR")
+except NameError:  # running by hand
+    ProjectDir = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+DataDir = os.path.join(ProjectDir, "data")
+Assets = ["style.css", "favicon.ico"]  # must match StaticAssets in main.cpp
+
+
+def Main():
+    for Asset in Assets:
+        with open(os.path.join(DataDir, Asset), "rb") as Original:
+            Compressed = gzip.compress(Original.read(), 9, mtime=0)  # no time stamp so the output only changes with the file
+        GzipFile = os.path.join(DataDir, Asset + ".gz")
+        if os.path.exists(GzipFile):
+            with open(GzipFile, "rb") as Existing:
+                if Existing.read() == Compressed:
+                    continue
+        with open(GzipFile, "wb") as Output:
+            Output.write(Compressed)
+        print("Compressed " + Asset + " into " + GzipFile)
+
+
+Main()
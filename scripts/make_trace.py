@@ -0,0 +1,86 @@
+# Write a synthetic packet trace for the native simulator, see src/native/Simulator.cpp for the format
+#
+# The same options and seed always give the same trace so benchmark results can be compared across commits.
+#   python scripts/make_trace.py --packets 20000 --senders 6 --burst 12 --errors 0.05 > traces/synthetic.txt
+# Bursts are packets that arrive in the same millisecond, bigger than the receive ring (8) they show up as drops.
+# Errors are a mix of bad CRC, wrong preamble, too long and old style text packets.
+# Outages take WiFi down for a while, packets keep arriving and pile up for the uplink to send when it comes back.
+
+import argparse
+import random
+import sys
+
+
+def CRC(Data):
+    # CRC-16/CCITT-FALSE, same as NodeFrameCRC in NodeFrame.h
+    Value = 0xFFFF
+    for Byte in Data:
+        Value ^= Byte << 8
+        for Bit in range(8):
+            Value = ((Value << 1) ^ 0x1021) & 0xFFFF if Value & 0x8000 else (Value << 1) & 0xFFFF
+    return Value
+
+
+def Frame(NodeID, Sequence, Water, VoltageRaw):
+    # binary packet as described in NodeFrame.h with water and volts fields
+    Data = bytes([0xA1, 1, NodeID, Sequence & 0xFF, (Sequence >> 8) & 0xFF, 2])
+    Data += bytes([1]) + (Water & 0xFFFF).to_bytes(2, "little")
+    Data += bytes([2]) + (VoltageRaw & 0xFFFF).to_bytes(2, "little")
+    return Data + CRC(Data).to_bytes(2, "little")
+
+
+def Main():
+    Parser = argparse.ArgumentParser(description=__doc__)
+    Parser.add_argument("--packets", type=int, default=10000)
+    Parser.add_argument("--senders", type=int, default=4, help="node IDs 1 up, more than 8 fills the node table")
+    Parser.add_argument("--interval", type=int, default=1000, help="milliseconds between packets outside bursts")
+    Parser.add_argument("--burst", type=int, default=0, help="packets per burst, 0 for none")
+    Parser.add_argument("--burst-every", type=int, default=100, help="packets between bursts")
+    Parser.add_argument("--errors", type=float, default=0.0, help="fraction of packets that are bad or old text packets")
+    Parser.add_argument("--loss", type=float, default=0.0, help="fraction of sequence numbers skipped, shows up as lost")
+    Parser.add_argument("--outage", type=int, default=0, help="milliseconds WiFi is down for, 0 for no outages")
+    Parser.add_argument("--outage-every", type=int, default=1000, help="packets between outages")
+    Parser.add_argument("--seed", type=int, default=1)
+    Options = Parser.parse_args()
+
+    Random = random.Random(Options.seed)
+    Sequence = [0] * (Options.senders + 1)
+    Out = sys.stdout
+    Out.write("# synthetic trace: " + " ".join(sys.argv[1:]) + "\n")
+    Time = 0
+    Sent = 0
+    UpAt = 0  # when WiFi comes back, 0 if it is up
+    while Sent < Options.packets:
+        Burst = Options.burst if Options.burst > 0 and Sent > 0 and Sent % Options.burst_every == 0 else 1
+        Time += Options.interval
+        if UpAt and Time >= UpAt:
+            Out.write("%d wifi up\n" % UpAt)
+            UpAt = 0
+        if Options.outage > 0 and not UpAt and Sent > 0 and Sent % Options.outage_every == 0:
+            Out.write("%d wifi down\n" % Time)
+            UpAt = Time + Options.outage
+        for i in range(min(Burst, Options.packets - Sent)):
+            Sent += 1
+            NodeID = Random.randint(1, Options.senders)
+            Sequence[NodeID] += 2 if Random.random() < Options.loss else 1
+            RSSI = Random.randint(-120, -40)
+            SNR = Random.randint(-80, 40)
+            Packet = Frame(NodeID, Sequence[NodeID], Random.randint(0, 1), Random.randint(330, 420))
+            if Random.random() < Options.errors:
+                Kind = Random.randint(0, 3)
+                if Kind == 0:  # corrupted, fails the CRC
+                    Packet = Packet[:-1] + bytes([Packet[-1] ^ 0x5A])
+                elif Kind == 1:  # someone else's packet
+                    Packet = bytes(Random.randint(0, 255) for j in range(Random.randint(1, 20)))
+                    Packet = bytes([0x42]) + Packet[1:]
+                elif Kind == 2:  # longer than LoraMaxPacketSize
+                    Packet = bytes(Random.randint(0, 255) for j in range(Random.randint(21, 255)))
+                else:  # old style text packet
+                    Out.write("%d text %d %d A1A%d%d\n" % (Time, RSSI, SNR, Random.randint(0, 1), Random.randint(330, 420)))
+                    continue
+            Out.write("%d rx %d %d %s\n" % (Time, RSSI, SNR, Packet.hex().upper()))
+    if UpAt:
+        Out.write("%d wifi up\n" % UpAt)
+
+
+Main()
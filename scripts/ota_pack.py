@@ -0,0 +1,263 @@
+# Make an update pack for /api/v1/update from a firmware or SPIFFS image, and optionally send it
+#
+#   python scripts/ota_pack.py .pio/build/ttgo-lora32-v1/firmware.bin --base old-firmware.bin -o update.wpk
+#   python scripts/ota_pack.py .pio/build/ttgo-lora32-v1/spiffs.bin --filesystem -o files.wpk
+#   python scripts/ota_pack.py firmware.bin --base old-firmware.bin --upload 192.168.0.22 --token yourtoken --compare
+# A pack is the image LZ77 compressed against itself and, with --base, against the firmware the board runs now so
+# only what changed is sent. --base must be the exact image the board was last updated with, keep a copy of each
+# firmware.bin you send. See src/Patch.h for the format, the pack is decoded back and checked before it is written.
+# --upload sends it and times it until the board answers, --compare then sends the whole image the same way
+# (the board has to be running the new firmware by then for the delta to match) so the two can be compared.
+# Prints one line of JSON for scripts/bench_compare.py.
+
+import argparse
+import hashlib
+import json
+import struct
+import sys
+import time
+import urllib.error
+import urllib.request
+
+Magic = 0x314B5057  # PatchMagic
+HeaderFormat = "<IBBHII32s32s"
+Window = 16384  # PatchWindowSize
+LengthEscape = 63  # PatchLengthEscape
+Literal, Match, Copy = 0, 1, 2
+Firmware, FileSystem = 0, 1
+Delta = 1
+BaseKey = 8  # bytes hashed to find copies from the base
+WindowKey = 4  # and matches in the window
+MinMatch = 6  # shorter matches cost as much as the literals they replace
+MinCopy = 4  # a copy carrying on from the last one is cheap
+
+
+def Varint(Value):
+    Bytes = bytearray()
+    while True:
+        Byte = Value & 0x7F
+        Value >>= 7
+        if Value == 0:
+            Bytes.append(Byte)
+            return Bytes
+        Bytes.append(Byte | 0x80)
+
+
+def OpBytes(Op, Length):
+    if Length <= LengthEscape:
+        return bytearray([Op | (Length - 1) << 2])
+    return bytearray([Op | LengthEscape << 2]) + Varint(Length - LengthEscape - 1)
+
+
+# how far Data[From:] matches Source[At:], up to Limit bytes. Compares in big steps first as bytes are slow in Python
+def MatchLength(Data, From, Source, At, Limit):
+    Length = 0
+    Step = 64
+    while Step > 0:
+        while Length + Step <= Limit and Data[From + Length:From + Length + Step] == Source[At + Length:At + Length + Step]:
+            Length += Step
+        Step //= 4
+    return Length
+
+
+def Encode(Image, Base):
+    Pack = bytearray()
+    BaseIndex = {}
+    for Position in range(0, len(Base) - BaseKey + 1, 4):  # every 4th is enough, a copy is extended backwards
+        BaseIndex.setdefault(Base[Position:Position + BaseKey], Position)
+    Recent = {}  # window key to the last position it was seen at
+    Literals = bytearray()
+    BaseNext = 0
+    Position = 0
+    Size = len(Image)
+
+    def Flush():
+        nonlocal Literals
+        if Literals:
+            Pack.extend(OpBytes(Literal, len(Literals)) + Literals)
+            Literals = bytearray()
+
+    def Remember(Start, End):
+        for At in range(max(Start, 0), min(End, Size - WindowKey + 1)):
+            Recent[Image[At:At + WindowKey]] = At
+
+    while Position < Size:
+        Limit = Size - Position
+        Best, Kind, Source = 0, None, 0
+        # a copy carrying on from the last one, code that moved keeps matching there after a changed address
+        if Base and BaseNext < len(Base):
+            Length = MatchLength(Image, Position, Base, BaseNext, min(Limit, len(Base) - BaseNext))
+            if Length >= MinCopy:
+                Best, Kind, Source = Length, Copy, BaseNext
+        Key = Image[Position:Position + BaseKey]
+        if Base and len(Key) == BaseKey and Key in BaseIndex:
+            At = BaseIndex[Key]
+            Length = MatchLength(Image, Position, Base, At, min(Limit, len(Base) - At))
+            if Length > Best + 2:
+                Best, Kind, Source = Length, Copy, At
+        At = Recent.get(Image[Position:Position + WindowKey])
+        if At is not None and Position - At <= Window:
+            Length = MatchLength(Image, Position, Image, At, Limit)
+            if Length >= MinMatch and Length > Best:
+                Best, Kind, Source = Length, Match, At
+        if Kind is None:
+            Literals.append(Image[Position])
+            Remember(Position, Position + 1)
+            Position += 1
+            continue
+        # take back literals the match also covers
+        Back = 0
+        Origin = Base if Kind == Copy else Image
+        while Back < len(Literals) and Source - Back > 0 and Image[Position - Back - 1] == Origin[Source - Back - 1]:
+            Back += 1
+        if Back:
+            del Literals[len(Literals) - Back:]
+        Position, Source, Best = Position - Back, Source - Back, Best + Back
+        Flush()
+        Pack.extend(OpBytes(Kind, Best))
+        if Kind == Match:
+            Pack.extend(Varint(Position - Source))
+        else:
+            Offset = Source - BaseNext
+            Pack.extend(Varint(Offset << 1 if Offset >= 0 else (-Offset << 1) - 1))
+            BaseNext = Source + Best
+        Remember(Position, Position + Best)
+        Position += Best
+    Flush()
+    return Pack
+
+
+# the whole image as literals, for comparing against
+def Stored(Image):
+    Pack = bytearray()
+    for Start in range(0, len(Image), 65536):
+        Part = Image[Start:Start + 65536]
+        Pack.extend(OpBytes(Literal, len(Part)) + Part)
+    return Pack
+
+
+def Header(Target, Image, Base):
+    return struct.pack(HeaderFormat, Magic, Target, Delta if Base else 0, 0, len(Image), len(Base),
+                       hashlib.sha256(Image).digest(), hashlib.sha256(Base).digest() if Base else bytes(32))
+
+
+# the same as PatchWrite, to check a pack before it goes anywhere
+def Decode(Pack, Base):
+    Image = bytearray()
+    Position = struct.calcsize(HeaderFormat)
+    BaseNext = 0
+
+    def Number():
+        nonlocal Position
+        Value, Shift = 0, 0
+        while True:
+            Byte = Pack[Position]
+            Position += 1
+            Value |= (Byte & 0x7F) << Shift
+            Shift += 7
+            if not Byte & 0x80:
+                return Value
+
+    while Position < len(Pack):
+        Op = Pack[Position]
+        Position += 1
+        Length = (Op >> 2) + 1
+        if Op >> 2 == LengthEscape:
+            Length = Number() + LengthEscape + 1
+        if Op & 3 == Literal:
+            Image += Pack[Position:Position + Length]
+            Position += Length
+        elif Op & 3 == Match:
+            Distance = Number()
+            for _ in range(Length):
+                Image.append(Image[-Distance])
+        else:
+            Zigzag = Number()
+            BaseNext += Zigzag >> 1 if not Zigzag & 1 else -((Zigzag + 1) >> 1)
+            Image += Base[BaseNext:BaseNext + Length]
+            BaseNext += Length
+    return bytes(Image)
+
+
+# POST a pack, returns the seconds until the board answered and its answer
+def Upload(Host, Token, Pack):
+    Request = urllib.request.Request("http://%s/api/v1/update" % Host, data=bytes(Pack), method="POST",
+                                     headers={"Content-Type": "application/octet-stream", "Authorization": "Bearer " + Token})
+    Start = time.time()
+    try:
+        with urllib.request.urlopen(Request, timeout=600) as Response:
+            Answer = Response.read().decode()
+    except urllib.error.HTTPError as Error:
+        sys.exit("upload refused, %d %s" % (Error.code, Error.read().decode().strip()))
+    return time.time() - Start, json.loads(Answer)
+
+
+# wait for the board to come back after restarting into the update
+def WaitForBoard(Host, Timeout):
+    time.sleep(8)  # XStartDisplayDelay and the restart
+    Start = time.time()
+    while time.time() - Start < Timeout:
+        try:
+            urllib.request.urlopen("http://%s/metrics" % Host, timeout=2).read()
+            return True
+        except OSError:
+            time.sleep(1)
+    return False
+
+
+def Main():
+    Parser = argparse.ArgumentParser(description="make an update pack for /api/v1/update")
+    Parser.add_argument("image", help="firmware.bin or spiffs.bin as built")
+    Parser.add_argument("--base", help="the firmware the board runs now, makes a delta")
+    Parser.add_argument("--filesystem", action="store_true", help="the image is SPIFFS, can't be a delta")
+    Parser.add_argument("--full", action="store_true", help="no compression, the whole image as it is")
+    Parser.add_argument("-o", "--output", help="write the pack here")
+    Parser.add_argument("--link-kbps", type=float, default=20, help="link speed for the estimated send times")
+    Parser.add_argument("--upload", metavar="HOST", help="send the pack to the receiver")
+    Parser.add_argument("--token", default="", help="the API token, api_token in /api/v1/config")
+    Parser.add_argument("--compare", action="store_true", help="after --upload, send the whole image too and time both")
+    Parser.add_argument("--json", help="append the result to this file")
+    Parser.add_argument("--label", default="")
+    Options = Parser.parse_args()
+    if Options.filesystem and Options.base:
+        sys.exit("a file system image can't be a delta, it overwrites what it would copy from")
+    Image = open(Options.image, "rb").read()
+    Base = open(Options.base, "rb").read() if Options.base and not Options.full else b""
+    Target = FileSystem if Options.filesystem else Firmware
+    Start = time.time()
+    Pack = Header(Target, Image, Base) + (Stored(Image) if Options.full else Encode(Image, Base))
+    PackSeconds = time.time() - Start
+    if Decode(Pack, Base) != Image:
+        sys.exit("the pack doesn't decode back to the image, not written")
+    if Options.output:
+        open(Options.output, "wb").write(Pack)
+    Result = {"label": Options.label, "image_bytes": len(Image), "update_pack_bytes": len(Pack),
+              "update_ratio": round(len(Pack) / len(Image), 3), "pack_seconds": round(PackSeconds, 1),
+              "estimated_seconds": round(len(Pack) * 8 / Options.link_kbps / 1000, 1),
+              "estimated_full_seconds": round(len(Image) * 8 / Options.link_kbps / 1000, 1)}
+    print("%s%s: %d bytes for %d, %.1f%%, about %.0fs at %gkbps against %.0fs for the whole image" % (
+        "delta" if Base else "full" if Options.full else "compressed", " file system" if Options.filesystem else "",
+        len(Pack), len(Image), 100.0 * len(Pack) / len(Image), Result["estimated_seconds"], Options.link_kbps,
+        Result["estimated_full_seconds"]))
+    if Options.upload:
+        Seconds, Answer = Upload(Options.upload, Options.token, Pack)
+        Result["update_seconds"] = round(Seconds, 1)
+        Result["update_decode_seconds"] = Answer.get("decode_seconds")
+        print("sent in %.1fs, %.1fs of it decoding and writing on the board" % (Seconds, Answer.get("decode_seconds", 0)))
+        if Options.compare:
+            if not WaitForBoard(Options.upload, 120):
+                sys.exit("the board didn't come back after the update")
+            Full = Header(Target, Image, b"") + Stored(Image)
+            Seconds, Answer = Upload(Options.upload, Options.token, Full)
+            Result["full_bytes"] = len(Full)
+            Result["full_seconds"] = round(Seconds, 1)
+            print("whole image sent in %.1fs, %d bytes" % (Seconds, len(Full)))
+    Line = json.dumps(Result)
+    print(Line)
+    if Options.json:
+        with open(Options.json, "a") as Results:
+            Results.write(Line + "\n")
+
+
+if __name__ == "__main__":
+    Main()
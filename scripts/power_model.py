@@ -0,0 +1,115 @@
+# Check the receiver's average current estimate against a model of its own, and size a solar supply
+#
+#   python scripts/power_model.py --metrics http://192.168.0.22/metrics
+#   .pio/build/native/program -channel 8 > channel.txt && python scripts/power_model.py --metrics channel.txt
+#   python scripts/power_model.py --senders 8 --interval 60 --acks
+# With --metrics it reads water_power_* and the traffic counters from /metrics (or a saved copy, or the simulator's
+# output) and works the average out again: the transmit time from the ack count and LoRa's time on air formula, the
+# CPU time from the task busy times, and the currents from its own table for the mode the board says it is in.
+# Exits with 1 if that and the board's estimate differ by more than --tolerance percent.
+# Without --metrics it predicts the average for normal and power save from the traffic described.
+
+import argparse
+import math
+import sys
+import urllib.request
+
+# datasheet currents in mA, kept apart from src/Power.cpp on purpose so a mistake in one shows up
+Currents = {
+    "normal": {"cpu_active": 68, "cpu_idle": 30, "wifi_modem_sleep": 15},
+    "saving": {"cpu_active": 31, "cpu_idle": 20, "wifi_modem_sleep": 5},
+    "light_sleep": {"cpu_active": 31, "cpu_idle": 0.8, "wifi_modem_sleep": 5},
+}
+Common = {"lora_receive": 11.5, "lora_transmit": 87, "wifi_active": 100, "wifi_off": 0}
+AckBytes = 9  # NodeAckSize in src/NodeFrame.h
+
+
+# LoRa time on air in seconds, Semtech AN1200.13, explicit header, no payload CRC, 4/5 coding, 8 symbol preamble
+def Airtime(SpreadingFactor, Length, Bandwidth=125000):
+    Symbol = (2 ** SpreadingFactor) / Bandwidth
+    LowRate = 1 if Symbol > 0.016 else 0
+    Payload = 8 + max(math.ceil((8 * Length - 4 * SpreadingFactor + 28) / (4 * (SpreadingFactor - 2 * LowRate))) * 5, 0)
+    return (8 + 4.25 + Payload) * Symbol
+
+
+def Metrics(Source):
+    if Source.startswith("http"):
+        with urllib.request.urlopen(Source, timeout=5) as Response:
+            Text = Response.read().decode()
+    else:
+        with open(Source) as File:
+            Text = File.read()
+    Values = {}
+    for Line in Text.splitlines():
+        if Line.startswith("water_"):
+            Name, Value = Line.rsplit(" ", 1)
+            Values[Name] = float(Value)
+    return Values
+
+
+def State(Values, Name):
+    return Values.get('water_power_state_seconds_total{state="%s"}' % Name, 0.0)
+
+
+def Check(Options):
+    Values = Metrics(Options.metrics)
+    if "water_power_average_milliamps" not in Values:
+        sys.exit("no water_power metrics in " + Options.metrics)
+    Mode = "normal"
+    if Values.get('water_power_state_milliamps{state="cpu_idle"}', 30) < 1:
+        Mode = "light_sleep"
+    elif Values.get("water_cpu_frequency_mhz", 240) < 240 and "water_cpu_frequency_mhz" in Values:
+        Mode = "saving"
+    Table = dict(Common, **Currents[Mode])
+    Elapsed = State(Values, "cpu_active") + State(Values, "cpu_idle")
+    if Elapsed == 0:
+        sys.exit("no time recorded yet")
+
+    # the model's own view of where the time went
+    SpreadingFactor = int(Values.get("water_link_spreading_factor", 7))
+    Transmit = Values.get("water_link_acks_total", 0) * Airtime(SpreadingFactor, AckBytes)
+    Busy = sum(Value for Name, Value in Values.items() if Name.startswith("water_task_busy_seconds_total")) / 2
+    WiFi = {Name: State(Values, Name) for Name in ("wifi_active", "wifi_modem_sleep", "wifi_off")}
+    Charge = (Busy * Table["cpu_active"] + (Elapsed - Busy) * Table["cpu_idle"] +
+              Transmit * Table["lora_transmit"] + (Elapsed - Transmit) * Table["lora_receive"] +
+              sum(Seconds * Table[Name] for Name, Seconds in WiFi.items()))
+    Model = Charge / Elapsed
+    Board = Values["water_power_average_milliamps"]
+    print("mode %s over %.0f seconds" % (Mode, Elapsed))
+    print("transmit %.1fs counted, %.1fs from %d acks" % (State(Values, "lora_transmit"), Transmit, Values.get("water_link_acks_total", 0)))
+    print("cpu active %.1fs counted, %.1fs from task busy time" % (State(Values, "cpu_active"), Busy))
+    print("average %.2fmA estimated on the board, %.2fmA modelled, %.1fmAh a day" % (Board, Model, Model * 24))
+    Difference = abs(Board - Model) * 100 / Model if Model else 0
+    if Difference > Options.tolerance:
+        print("differ by %.1f%%" % Difference)
+        sys.exit(1)
+
+
+def Predict(Options):
+    Packets = Options.senders * 3600.0 / Options.interval  # an hour
+    Transmit = Packets * Airtime(Options.sf, AckBytes) / 3600 if Options.acks else 0
+    Busy = Packets * Options.packet_ms / 1000 / 3600 / 2
+    for Mode in ("normal", "saving", "light_sleep"):
+        Table = dict(Common, **Currents[Mode])
+        Average = (Busy * Table["cpu_active"] + (1 - Busy) * Table["cpu_idle"] + Transmit * Table["lora_transmit"] +
+                   (1 - Transmit) * Table["lora_receive"] + Table["wifi_modem_sleep"])
+        print("%-12s %6.1fmA %7.0fmAh a day" % (Mode, Average, Average * 24))
+
+
+def Main():
+    Parser = argparse.ArgumentParser(description="receiver power model")
+    Parser.add_argument("--metrics", help="/metrics URL or a file holding its output")
+    Parser.add_argument("--tolerance", type=float, default=5.0, help="percent the board's estimate may differ by")
+    Parser.add_argument("--senders", type=int, default=4)
+    Parser.add_argument("--interval", type=float, default=60, help="seconds between readings from each sender")
+    Parser.add_argument("--sf", type=int, default=7)
+    Parser.add_argument("--acks", action="store_true", help="senders report their settings and get acks")
+    Parser.add_argument("--packet-ms", type=float, default=2.0, help="CPU time for each packet")
+    Options = Parser.parse_args()
+    if Options.metrics:
+        Check(Options)
+    else:
+        Predict(Options)
+
+
+Main()
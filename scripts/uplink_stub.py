@@ -0,0 +1,78 @@
+# Stand-in for the backend the receiver forwards readings to, for trying the uplink without the real thing
+#
+#   python scripts/uplink_stub.py --port 8080 --fail 0.1
+#   .pio/build/native/program -q -uplink-url http://127.0.0.1:8080/readings trace.txt
+# or point UplinkURL in src/main.cpp at the PC running it. Prints a line per batch and a summary on Ctrl-C.
+# Readings are counted once per node and sequence number, a batch resent after a lost reply shows up as duplicates.
+
+import argparse
+import http.server
+import json
+import random
+import sys
+
+
+class Backend:
+    Fail = 0.0
+    Random = random.Random(1)
+    Quiet = False
+    Batches = 0
+    Failed = 0
+    Readings = 0
+    Duplicates = 0
+    Seen = set()
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    def do_POST(self):
+        Body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        if Backend.Random.random() < Backend.Fail:
+            Backend.Failed += 1
+            self.send_response(503)
+            self.end_headers()
+            return
+        try:
+            Batch = json.loads(Body)
+            Fields = Batch["fields"]
+            Readings = [dict(zip(Fields, Row)) for Row in Batch["readings"]]
+        except (ValueError, KeyError, TypeError):
+            self.send_response(400)
+            self.end_headers()
+            return
+        Backend.Batches += 1
+        for Reading in Readings:
+            Key = (Reading["node"], Reading["sequence"], Reading["time"])
+            if Key in Backend.Seen:
+                Backend.Duplicates += 1
+            else:
+                Backend.Seen.add(Key)
+                Backend.Readings += 1
+        if not Backend.Quiet:
+            print("batch %d: %d readings, %d bytes" % (Backend.Batches, len(Readings), len(Body)))
+        self.send_response(204)
+        self.end_headers()
+
+    def log_message(self, Format, *Args):
+        pass
+
+
+def Main():
+    Parser = argparse.ArgumentParser(description="uplink backend stub")
+    Parser.add_argument("--port", type=int, default=8080)
+    Parser.add_argument("--fail", type=float, default=0.0, help="fraction of requests answered with 503")
+    Parser.add_argument("--seed", type=int, default=1)
+    Parser.add_argument("-q", action="store_true", help="only print the summary")
+    Options = Parser.parse_args()
+    Backend.Fail = Options.fail
+    Backend.Random = random.Random(Options.seed)
+    Backend.Quiet = Options.q
+    Server = http.server.HTTPServer(("", Options.port), Handler)
+    try:
+        Server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    print("%d batches, %d failed, %d readings, %d duplicates" % (Backend.Batches, Backend.Failed, Backend.Readings, Backend.Duplicates))
+    sys.exit(0)
+
+
+Main()
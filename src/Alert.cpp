@@ -0,0 +1,329 @@
+/*
+* Alerts, see Alert.h. AlertEvaluate and AlertTick change the alert states and must run in the same task as
+* LoraProcessing, AlertService empties the queue from another.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "Alert.h"
+
+// what a receiver watches for unless it is told otherwise
+const AlertRuleConfig AlertDefaultRules[] = {
+    {"Tank not full", -1, AlertWater, AlertBelow, 1, 0, 1800},  // for half an hour
+    {"Battery low", -1, AlertVolts, AlertBelow, 3.5, 0.1, 300}, // for 5 minutes, clears at 3.6V
+    {"Sender silent", -1, AlertSilence, AlertAbove, 1800, 0, 0}, // nothing for half an hour
+};
+const byte AlertDefaultRuleCount = sizeof(AlertDefaultRules) / sizeof(AlertDefaultRules[0]);
+// raw units per field unit, and the unit for display
+const int32_t AlertScale[] = {1, 100, 1, 4, 1000};
+const char *const AlertUnit[] = {"", "V", "dBm", "dB", "s"};
+
+// compiled rules, the ones for every sender first then the rest by node ID
+const AlertRuleConfig *AlertConfigs = NULL;
+AlertRule AlertRules[AlertMaxRules];
+byte AlertRuleCount = 0;
+byte AlertEveryCount = 0;
+byte AlertStart[257];  // first rule for each node ID after the every sender ones, the next node's start ends them
+AlertState AlertStates[AlertMaxStates];
+byte AlertActiveCount = 0;
+unsigned long AlertCompiledMillis = 0; // silence for a sender never heard is counted from here
+// alerts waiting for the notifier, single producer (whatever runs LoraProcessing) single consumer (AlertService)
+AlertEvent AlertQueue[AlertQueueSize];
+std::atomic<uint32_t> AlertQueueHead(0);
+std::atomic<uint32_t> AlertQueueTail(0);
+unsigned long AlertRetryAt = 0;
+char AlertPayload[AlertPayloadSize];
+// metrics
+MetricCounter MetricAlertsFired;
+MetricCounter MetricAlertsCleared;
+MetricCounter MetricAlertsSent;
+MetricCounter MetricAlertNotifyFailures;
+MetricCounter MetricAlertsDropped;
+MetricHistogram MetricAlertEvaluate;
+
+// turn rules as written into the table AlertEvaluate uses, false after saying why if they don't fit
+bool AlertCompile(const AlertRuleConfig *Configs, byte Count)
+{
+  byte Every = 0;
+  uint16_t States = 0;
+  byte Counts[256] = {0};
+  for (byte i = 0; i < Count; i++)
+  {
+    if (Configs[i].NodeID < 0)
+    {
+      Every++;
+      States += NodeTableSize;
+    }
+    else
+    {
+      Counts[Configs[i].NodeID & 0xFF]++;
+      States++;
+    }
+  }
+  if (Count > AlertMaxRules || States > AlertMaxStates)
+  {
+    ConsolePrintf("Alert rules don't fit, %u rules and %u states\n", Count, States);
+    return false;
+  }
+  AlertStart[0] = Every;
+  for (int ID = 0; ID < 256; ID++)
+    AlertStart[ID + 1] = AlertStart[ID] + Counts[ID];
+  byte Next[256];
+  memcpy(Next, AlertStart, sizeof(Next));
+  byte EveryNext = 0;
+  byte State = 0;
+  for (byte i = 0; i < Count; i++)
+  {
+    const AlertRuleConfig &Config = Configs[i];
+    bool Every = Config.NodeID < 0;
+    AlertRule &Rule = AlertRules[Every ? EveryNext++ : Next[Config.NodeID & 0xFF]++];
+    int32_t Scale = AlertScale[Config.Field];
+    Rule.Config = i;
+    Rule.NodeID = Every ? 0 : Config.NodeID;
+    Rule.Field = Config.Field;
+    Rule.Compare = Config.Compare;
+    Rule.Trigger = (int32_t)(Config.Threshold * Scale + (Config.Threshold < 0 ? -0.5 : 0.5));
+    int32_t Hysteresis = (int32_t)(Config.Hysteresis * Scale + 0.5);
+    Rule.Clear = Config.Compare == AlertBelow ? Rule.Trigger + Hysteresis : Rule.Trigger - Hysteresis;
+    Rule.SustainMillis = Config.SustainSeconds * 1000;
+    Rule.State = State;
+    Rule.Every = Every;
+    State += Every ? NodeTableSize : 1;
+  }
+  AlertConfigs = Configs;
+  AlertRuleCount = Count;
+  AlertEveryCount = Every;
+  memset(AlertStates, 0, sizeof(AlertStates));
+  AlertActiveCount = 0;
+  AlertCompiledMillis = Platform.Clock->Millis();
+  return true;
+}
+
+// a reading in the rule's raw units, false if the packet didn't have it
+bool AlertReading(AlertField Field, const NodeState &Node, int32_t &Value)
+{
+  switch (Field)
+  {
+  case AlertWater:
+    Value = Node.Water;
+    return Node.Water >= 0;
+  case AlertVolts:
+    Value = Node.VoltageRaw;
+    return true;
+  case AlertRSSI:
+    Value = Node.RSSI;
+    return true;
+  case AlertSNR:
+    Value = Node.SNRQuarterdB;
+    return true;
+  default: // AlertSilence, it has just been heard
+    Value = 0;
+    return true;
+  }
+}
+
+// a raw value as text in the field's units
+void AlertValueText(AlertField Field, int32_t Value, char *Text, size_t Size)
+{
+  if (Field == AlertWater)
+    snprintf(Text, Size, "%d", (int)Value);
+  else
+    snprintf(Text, Size, "%.2f%s", (double)Value / AlertScale[Field], AlertUnit[Field]);
+}
+
+// the alerts that are active, for the home page
+int AlertActiveText(char *Text, size_t Size)
+{
+  int Length = snprintf(Text, Size, "%s", AlertActiveCount == 0 ? "None" : "");
+  for (byte i = 0; i < AlertRuleCount && Length < (int)Size; i++)
+  {
+    const AlertRule &Rule = AlertRules[i];
+    for (byte s = 0; s < (Rule.Every ? NodeTableSize : 1) && Length < (int)Size; s++)
+    {
+      const AlertState &State = AlertStates[Rule.State + s];
+      if (State.Active)
+        Length += snprintf(Text + Length, Size - Length, "%s%s node %u", Length == 0 ? "" : ", ", AlertConfigs[Rule.Config].Name, State.NodeID);
+    }
+  }
+  return Length < (int)Size ? Length : Size - 1;
+}
+
+// the OLED line while any alert is active, false if none is
+bool AlertDisplayLine(char *Text, size_t Size)
+{
+  if (AlertActiveCount == 0)
+    return false;
+  char Active[OLEDLineLength];
+  AlertActiveText(Active, sizeof(Active));
+  snprintf(Text, Size, "! %s", Active);
+  return true;
+}
+
+// an alert has fired or cleared, tell everyone
+void AlertRaise(const AlertRule &Rule, byte StateIndex, uint8_t NodeID, bool Active, int32_t Value)
+{
+  AlertState &State = AlertStates[StateIndex];
+  State.Active = Active;
+  State.Pending = false;
+  State.NodeID = NodeID;
+  State.Value = Value;
+  if (Active)
+  {
+    AlertActiveCount++;
+    MetricAlertsFired.Add();
+  }
+  else
+  {
+    AlertActiveCount--;
+    MetricAlertsCleared.Add();
+  }
+  const char *Name = AlertConfigs[Rule.Config].Name;
+  char Reading[16];
+  AlertValueText(Rule.Field, Value, Reading, sizeof(Reading));
+  ConsolePrintf("Alert %s: %s, node %u, %s\n", Active ? "fired" : "cleared", Name, NodeID, Reading);
+  char Line[OLEDLineLength];
+  snprintf(Line, sizeof(Line), "%s %s node %u", Active ? "!" : "Cleared", Name, NodeID);
+  Platform.Display->SetLine(4, Line); // LoraProcessing or AlertTick updates the display
+  if (Platform.Network->Listeners() > 0)
+  {
+    char Data[WebCarrySize];
+    int Length = snprintf(Data, sizeof(Data), "{\"Alerts\":\"");
+    Length += AlertActiveText(Data + Length, sizeof(Data) - Length - 2);
+    snprintf(Data + Length, sizeof(Data) - Length, "\"}");
+    EventsQueue("alert", Data);
+  }
+  if (Platform.Notifier == NULL)
+    return;
+  uint32_t Head = AlertQueueHead.load(std::memory_order_relaxed);
+  if (Head - AlertQueueTail.load(std::memory_order_acquire) >= AlertQueueSize)
+  {
+    MetricAlertsDropped.Add();
+    return;
+  }
+  AlertEvent &Event = AlertQueue[Head % AlertQueueSize];
+  Event.Time = ClockUTC();
+  Event.State = StateIndex;
+  Event.Config = Rule.Config;
+  Event.NodeID = NodeID;
+  Event.Active = Active;
+  Event.Value = Value;
+  AlertQueueHead.store(Head + 1, std::memory_order_release);
+}
+
+// move one rule and sender on with a reading
+void AlertCheck(const AlertRule &Rule, byte StateIndex, uint8_t NodeID, int32_t Value, unsigned long Now)
+{
+  AlertState &State = AlertStates[StateIndex];
+  State.Value = Value;
+  if (State.Active)
+  {
+    if (Rule.Compare == AlertBelow ? Value >= Rule.Clear : Value <= Rule.Clear)
+      AlertRaise(Rule, StateIndex, NodeID, false, Value);
+    return;
+  }
+  if (Rule.Compare == AlertBelow ? Value >= Rule.Trigger : Value <= Rule.Trigger)
+  {
+    State.Pending = false;
+    return;
+  }
+  if (!State.Pending)
+  {
+    State.Pending = true;
+    State.Since = Now;
+  }
+  if (Now - State.Since >= Rule.SustainMillis)
+    AlertRaise(Rule, StateIndex, NodeID, true, Value);
+}
+
+// check a sender's rules against the packet it has just sent, only its own rules and the every sender ones are looked
+// at however many there are. Node must be in Nodes
+void AlertEvaluate(const NodeState &Node)
+{
+  unsigned long Start = Platform.Clock->Cycles();
+  unsigned long Now = Platform.Clock->Millis();
+  byte Slot = &Node - Nodes;
+  int32_t Value;
+  for (byte i = 0; i < AlertEveryCount; i++)
+    if (AlertReading(AlertRules[i].Field, Node, Value))
+      AlertCheck(AlertRules[i], AlertRules[i].State + Slot, Node.ID, Value, Now);
+  for (byte i = AlertStart[Node.ID]; i < AlertStart[Node.ID + 1]; i++)
+    if (AlertReading(AlertRules[i].Field, Node, Value))
+      AlertCheck(AlertRules[i], AlertRules[i].State, Node.ID, Value, Now);
+  MetricAlertEvaluate.Observe(Platform.Clock->Cycles() - Start);
+}
+
+// one rule and sender between packets, silence grows and sustained readings come due
+void AlertTickOne(const AlertRule &Rule, byte StateIndex, uint8_t NodeID, const NodeState *Node, unsigned long Now)
+{
+  const AlertState &State = AlertStates[StateIndex];
+  if (Rule.Field == AlertSilence)
+    AlertCheck(Rule, StateIndex, NodeID, Now - (Node != NULL ? Node->LastSeenMillis : AlertCompiledMillis), Now);
+  else if (State.Pending && Now - State.Since >= Rule.SustainMillis)
+    AlertRaise(Rule, StateIndex, NodeID, true, State.Value);
+}
+
+// the checks that don't need a packet, call every AlertTickInterval from the task that runs LoraProcessing
+void AlertTick()
+{
+  unsigned long Now = Platform.Clock->Millis();
+  uint32_t Raised = MetricAlertsFired.Read() + MetricAlertsCleared.Read();
+  for (byte i = 0; i < AlertRuleCount; i++)
+  {
+    const AlertRule &Rule = AlertRules[i];
+    if (Rule.Every)
+    {
+      for (byte Slot = 0; Slot < NodeCount; Slot++)
+        AlertTickOne(Rule, Rule.State + Slot, Nodes[Slot].ID, &Nodes[Slot], Now);
+    }
+    else
+      AlertTickOne(Rule, Rule.State, Rule.NodeID, NodeSlot[Rule.NodeID] != 0 ? &Nodes[NodeSlot[Rule.NodeID] - 1] : NULL, Now);
+  }
+  if (MetricAlertsFired.Read() + MetricAlertsCleared.Read() != Raised)
+    Platform.Display->Update();
+}
+
+// send the next queued alert to Platform.Notifier. Returns true if it sent one and more are waiting
+bool AlertService()
+{
+  if (Platform.Notifier == NULL)
+    return false;
+  uint32_t Tail = AlertQueueTail.load(std::memory_order_relaxed);
+  uint32_t Head = AlertQueueHead.load(std::memory_order_acquire);
+  unsigned long Now = Platform.Clock->Millis();
+  if (Tail == Head || !Platform.Network->Connected() || (long)(Now - AlertRetryAt) < 0)
+    return false;
+  const AlertEvent &Event = AlertQueue[Tail % AlertQueueSize];
+  const AlertRuleConfig &Config = AlertConfigs[Event.Config];
+  int Length = snprintf(AlertPayload, sizeof(AlertPayload), "{\"alert\":\"%s\",\"node\":%u,\"active\":%s,\"value\":%g,\"time\":%u}",
+                        Config.Name, Event.NodeID, Event.Active ? "true" : "false", (double)Event.Value / AlertScale[Config.Field],
+                        Event.Time);
+  if (!Platform.Notifier->Send(AlertPayload, Length))
+  {
+    MetricAlertNotifyFailures.Add();
+    AlertRetryAt = Now + AlertRetryMillis;
+    return false;
+  }
+  MetricAlertsSent.Add();
+  AlertQueueTail.store(Tail + 1, std::memory_order_release);
+  return Tail + 1 != Head;
+}
+
+double MetricReadAlertRules(byte Row) { return AlertRuleCount; }
+double MetricReadAlertsActive(byte Row) { return AlertActiveCount; }
+double MetricReadAlertsFired(byte Row) { return MetricAlertsFired.Read(); }
+double MetricReadAlertsCleared(byte Row) { return MetricAlertsCleared.Read(); }
+double MetricReadAlertsSent(byte Row) { return MetricAlertsSent.Read(); }
+double MetricReadAlertNotifyFailures(byte Row) { return MetricAlertNotifyFailures.Read(); }
+double MetricReadAlertsDropped(byte Row) { return MetricAlertsDropped.Read(); }
+
+const MetricExport AlertMetrics[] = {
+    {"water_alert_rules", "gauge", "Alert rules compiled", MetricReadAlertRules},
+    {"water_alerts_active", "gauge", "Alerts that have fired and not cleared", MetricReadAlertsActive},
+    {"water_alerts_fired_total", "counter", "Times an alert fired", MetricReadAlertsFired},
+    {"water_alerts_cleared_total", "counter", "Times an alert cleared", MetricReadAlertsCleared},
+    {"water_alerts_sent_total", "counter", "Alerts the notifier accepted", MetricReadAlertsSent},
+    {"water_alert_notify_failures_total", "counter", "Notifier requests that failed and will be retried", MetricReadAlertNotifyFailures},
+    {"water_alerts_dropped_total", "counter", "Alerts not sent because the queue was full", MetricReadAlertsDropped},
+    {"water_alert_evaluate_cycles", "histogram", "CPU cycles checking a packet against the alert rules", NULL, &MetricAlertEvaluate, 1},
+};
+const byte AlertMetricCount = sizeof(AlertMetrics) / sizeof(AlertMetrics[0]);
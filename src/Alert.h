@@ -0,0 +1,92 @@
+/*
+* Alerts, rules on each sender's readings checked as its packets arrive. A rule fires when a reading goes past its
+* threshold, optionally only once it has stayed there for a while, and clears once the reading is back past the
+* threshold by the hysteresis. AlertSilence rules fire when a sender hasn't been heard for a while instead.
+* AlertCompile turns the rules into a table sorted by node ID so a packet only looks at the rules for its sender.
+* Alerts show on the display and the home page and are POSTed to Platform.Notifier by AlertService.
+*/
+
+#ifndef ALERT_H
+#define ALERT_H
+
+#include "Receiver.h"
+
+const byte AlertMaxRules = 64;                 // rules after compiling, one per rule however many senders it covers
+const byte AlertMaxStates = 128;               // rule and sender pairs tracked, a rule for every sender takes NodeTableSize
+const byte AlertQueueSize = 16;                // alerts waiting for AlertService, must be a power of 2
+const unsigned long AlertTickInterval = 10000; // AlertTick should be called this often for silence and sustained rules
+const unsigned long AlertRetryMillis = 30000;  // wait after the notifier fails
+const size_t AlertPayloadSize = 192;
+
+enum AlertField : byte
+{
+  AlertWater,  // 0 not full, 1 full
+  AlertVolts,
+  AlertRSSI,   // dBm
+  AlertSNR,    // dB
+  AlertSilence // seconds since the sender was last heard
+};
+enum AlertCompare : byte
+{
+  AlertBelow,
+  AlertAbove
+};
+// a rule as written, i.e. in AlertDefaultRules
+struct AlertRuleConfig
+{
+  const char *Name;
+  int16_t NodeID;          // -1 for every sender
+  AlertField Field;
+  AlertCompare Compare;
+  float Threshold;         // in the field's units
+  float Hysteresis;        // how far back past Threshold the reading must go to clear
+  uint32_t SustainSeconds; // how long past Threshold before it fires, 0 straight away
+};
+// a compiled rule, thresholds are in the raw units NodeState keeps so checking one is integer compares
+struct AlertRule
+{
+  uint8_t Config;  // index into the rules it was compiled from, for the name
+  uint8_t NodeID;
+  AlertField Field;
+  AlertCompare Compare;
+  int32_t Trigger;
+  int32_t Clear;
+  uint32_t SustainMillis;
+  uint8_t State;   // first AlertState, every sender has its own after that for a rule with NodeID -1
+  bool Every;
+};
+struct AlertState
+{
+  bool Active;
+  bool Pending;        // past the threshold, waiting for SustainMillis
+  uint8_t NodeID;
+  unsigned long Since; // Platform.Clock->Millis() it went past the threshold
+  int32_t Value;       // raw reading when it fired or cleared
+};
+struct AlertEvent // one alert firing or clearing, queued for AlertService
+{
+  uint32_t Time; // UTC seconds
+  uint8_t State;
+  uint8_t Config; // the rule as written, compiled rules aren't in State order so State can't find it
+  uint8_t NodeID; // copied as LoraTask reuses the state for another sender while the event waits
+  bool Active;
+  int32_t Value;
+};
+
+extern const AlertRuleConfig AlertDefaultRules[];
+extern const byte AlertDefaultRuleCount;
+extern byte AlertActiveCount;
+extern MetricCounter MetricAlertsFired;
+extern MetricCounter MetricAlertsCleared;
+extern MetricHistogram MetricAlertEvaluate; // CPU cycles in each AlertEvaluate
+extern const MetricExport AlertMetrics[];
+extern const byte AlertMetricCount;
+
+bool AlertCompile(const AlertRuleConfig *Rules, byte Count);
+void AlertEvaluate(const NodeState &Node);
+void AlertTick();
+bool AlertDisplayLine(char *Text, size_t Size);
+int AlertActiveText(char *Text, size_t Size);
+bool AlertService();
+
+#endif
@@ -0,0 +1,334 @@
+/*
+* Runtime configuration, see Config.h. ConfigUpdate is only called from one task at a time (the web server on the
+* board), everyone else reads through ConfigRead. The copy is short so a HalLock is held rather than a SeqLock, which
+* would let a higher priority reader on the web server's core spin forever waiting for it.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Config.h"
+
+// any lower would drop the longest binary frames, or text packets with the longest preamble, as too long
+const uint8_t ConfigPacketLimitMin = NodeFrameMaxSize > LoraPreambleMaxSize ? NodeFrameMaxSize : LoraPreambleMaxSize;
+#define CONFIG_FIELD(Name, Type, Member, Min, Max, Group) \
+  { Name, Type, offsetof(ConfigValues, Member), sizeof(ConfigValues::Member), Min, Max, Group }
+const ConfigField ConfigFields[] = {
+    CONFIG_FIELD("wifi_ssid", ConfigText, WiFiSSID, 0, 0, ConfigWiFi),
+    CONFIG_FIELD("wifi_password", ConfigSecret, WiFiPassword, 0, 0, ConfigWiFi),
+    CONFIG_FIELD("wifi_ip", ConfigIP, WiFiIP, 0, 0, ConfigWiFi),
+    CONFIG_FIELD("wifi_gateway", ConfigIP, WiFiGateway, 0, 0, ConfigWiFi),
+    CONFIG_FIELD("wifi_subnet", ConfigIP, WiFiSubnet, 0, 0, ConfigWiFi),
+    CONFIG_FIELD("wifi_dns", ConfigIP, WiFiDNS, 0, 0, ConfigWiFi),
+    CONFIG_FIELD("wifi_dns2", ConfigIP, WiFiDNS2, 0, 0, ConfigWiFi),
+    CONFIG_FIELD("ntp_server", ConfigText, NTPServer, 0, 0, ConfigClock),
+    CONFIG_FIELD("time_zone", ConfigText, TimeZone, 0, 0, ConfigClock),
+    CONFIG_FIELD("lora_band", ConfigNumber, LoraBand, 137000000, 1020000000, ConfigRadio), // what the SX1276 tunes to
+    CONFIG_FIELD("lora_sync_word", ConfigNumber, LoraSyncWord, 0, 0xFF, ConfigRadio),
+    CONFIG_FIELD("lora_preamble", ConfigText, LoraPreamble, 0, 0, ConfigPacket),
+    CONFIG_FIELD("lora_packet_limit", ConfigNumber, LoraPacketLimit, ConfigPacketLimitMin, LoraMaxPacketSize, ConfigPacket),
+    CONFIG_FIELD("api_token", ConfigSecret, APIToken, 0, 0, ConfigAPI),
+};
+const byte ConfigFieldCount = sizeof(ConfigFields) / sizeof(ConfigFields[0]);
+
+ConfigValues ConfigCurrent; // the cache, only through ConfigRead outside ConfigUpdate
+HalLock ConfigLock;
+std::atomic<uint8_t> ConfigPending(0); // groups changed and not taken yet
+uint32_t ConfigGeneration = 0;
+// metrics
+unsigned long ConfigLoadMicros = 0;
+bool ConfigDefaulted = false; // the stored blob was missing or bad at boot
+MetricCounter MetricConfigUpdates;
+MetricCounter MetricConfigRejected;
+MetricCounter MetricConfigUnauthorized;
+MetricCounter MetricConfigSaveFailures;
+MetricHistogram MetricConfigUpdate; // microseconds to check, save and publish a change
+
+// checksum of a ConfigBlob, Version up to Check
+uint32_t ConfigChecksum(const ConfigBlob &Blob)
+{
+  uint32_t Hash = 2166136261UL;
+  const uint8_t *Bytes = (const uint8_t *)&Blob;
+  for (size_t i = offsetof(ConfigBlob, Version); i < offsetof(ConfigBlob, Check); i++)
+    Hash = (Hash ^ Bytes[i]) * 16777619UL;
+  return Hash;
+}
+
+// everything a setting can be, checked on the values as a whole so a blob from flash gets the same checks as an update
+bool ConfigValid(const ConfigValues &Values, char *Error, size_t ErrorSize)
+{
+  const uint8_t *Bytes = (const uint8_t *)&Values;
+  for (byte i = 0; i < ConfigFieldCount; i++)
+  {
+    const ConfigField &Field = ConfigFields[i];
+    const uint8_t *Value = Bytes + Field.Offset;
+    if ((Field.Type == ConfigText || Field.Type == ConfigSecret) && memchr(Value, '\0', Field.Size) == NULL)
+    {
+      snprintf(Error, ErrorSize, "%s is too long", Field.Name);
+      return false;
+    }
+    if (Field.Type == ConfigNumber)
+    {
+      uint32_t Number = Field.Size == 1 ? *Value : 0;
+      if (Field.Size == 4)
+        memcpy(&Number, Value, 4);
+      if (Number < Field.Min || Number > Field.Max)
+      {
+        snprintf(Error, ErrorSize, "%s must be %u to %u", Field.Name, Field.Min, Field.Max);
+        return false;
+      }
+    }
+  }
+  if (Values.WiFiSSID[0] == '\0' || Values.LoraPreamble[0] == '\0')
+  {
+    snprintf(Error, ErrorSize, "%s can't be empty", Values.WiFiSSID[0] == '\0' ? "wifi_ssid" : "lora_preamble");
+    return false;
+  }
+  return true;
+}
+
+// write the values to flash as the next generation
+bool ConfigSave(const ConfigValues &Values, uint32_t Generation)
+{
+  ConfigBlob Blob;
+  memset(&Blob, 0, sizeof(Blob)); // padding too, it is checksummed
+  Blob.Magic = ConfigMagic;
+  Blob.Version = ConfigVersion;
+  Blob.Size = sizeof(ConfigBlob);
+  Blob.Generation = Generation;
+  Blob.Values = Values;
+  Blob.Check = ConfigChecksum(Blob);
+  if (Platform.Store == NULL || Platform.Store->Save(&Blob, sizeof(Blob)))
+    return true;
+  MetricConfigSaveFailures.Add();
+  return false;
+}
+
+// load the config from flash into RAM, or the defaults if there isn't a good one there. Returns false if the defaults
+// were used, they are saved so the next boot finds them
+bool ConfigBegin(const ConfigValues &Defaults)
+{
+  unsigned long Start = Platform.Clock->Micros();
+  ConfigBlob Blob;
+  char Error[64] = "nothing saved";
+  size_t Length = Platform.Store == NULL ? 0 : Platform.Store->Load(&Blob, sizeof(Blob));
+  bool Good = Length == sizeof(Blob) && Blob.Magic == ConfigMagic && Blob.Version == ConfigVersion &&
+              Blob.Size == sizeof(ConfigBlob) && Blob.Check == ConfigChecksum(Blob);
+  if (Good)
+    Good = ConfigValid(Blob.Values, Error, sizeof(Error));
+  else if (Length != 0)
+    snprintf(Error, sizeof(Error), "stored config is %u bytes and doesn't check out", (unsigned)Length);
+  HalEnter(ConfigLock);
+  ConfigCurrent = Good ? Blob.Values : Defaults;
+  HalExit(ConfigLock);
+  ConfigGeneration = Good ? Blob.Generation : 0;
+  ConfigPending.store(0);
+  ConfigDefaulted = !Good;
+  if (!Good)
+  {
+    ConsolePrintf("Config: %s, using the defaults\n", Error);
+    ConfigSave(Defaults, 0);
+  }
+  ConfigLoadMicros = Platform.Clock->Micros() - Start;
+  return Good;
+}
+
+// a copy of the current config
+void ConfigRead(ConfigValues &Values)
+{
+  HalEnter(ConfigLock);
+  Values = ConfigCurrent;
+  HalExit(ConfigLock);
+}
+
+// which of Groups have changed since the last call, for the task that owns them. Clears them
+uint8_t ConfigTake(uint8_t Groups)
+{
+  return ConfigPending.fetch_and(~Groups) & Groups;
+}
+
+// read one setting from text into Values, false with Error set if it isn't valid
+bool ConfigParse(const ConfigField &Field, const char *Text, ConfigValues &Values, char *Error, size_t ErrorSize)
+{
+  uint8_t *Value = (uint8_t *)&Values + Field.Offset;
+  switch (Field.Type)
+  {
+  case ConfigText:
+  case ConfigSecret:
+    if (strlen(Text) >= Field.Size)
+    {
+      snprintf(Error, ErrorSize, "%s is longer than %u", Field.Name, Field.Size - 1);
+      return false;
+    }
+    memset(Value, 0, Field.Size);
+    memcpy(Value, Text, strlen(Text));
+    return true;
+  case ConfigIP:
+  {
+    unsigned Part[4];
+    char End;
+    if (sscanf(Text, "%u.%u.%u.%u%c", &Part[0], &Part[1], &Part[2], &Part[3], &End) != 4 ||
+        (Part[0] | Part[1] | Part[2] | Part[3]) > 255)
+    {
+      snprintf(Error, ErrorSize, "%s isn't an IP address", Field.Name);
+      return false;
+    }
+    for (byte i = 0; i < 4; i++)
+      Value[i] = Part[i];
+    return true;
+  }
+  default: // ConfigNumber, 0x for hex
+  {
+    char *End;
+    unsigned long Number = strtoul(Text, &End, 0);
+    if (*Text == '\0' || *End != '\0' || *Text == '-' || Number < Field.Min || Number > Field.Max)
+    {
+      snprintf(Error, ErrorSize, "%s must be %u to %u", Field.Name, Field.Min, Field.Max);
+      return false;
+    }
+    if (Field.Size == 1)
+      *Value = Number;
+    else
+    {
+      uint32_t Number32 = Number;
+      memcpy(Value, &Number32, 4);
+    }
+    return true;
+  }
+  }
+}
+
+// change settings by name, all of them or none. Returns the groups that changed, for the caller to wake their
+// owners, or -1 with Error set
+int ConfigUpdate(const char *const *Names, const char *const *Values, byte Count, char *Error, size_t ErrorSize)
+{
+  unsigned long Start = Platform.Clock->Micros();
+  ConfigValues New = ConfigCurrent; // only ever changed here so no lock needed to read it
+  bool Good = Count <= ConfigMaxUpdates;
+  if (!Good)
+    snprintf(Error, ErrorSize, "more than %u settings", ConfigMaxUpdates);
+  for (byte i = 0; i < Count && Good; i++)
+  {
+    byte f = 0;
+    while (f < ConfigFieldCount && strcmp(ConfigFields[f].Name, Names[i]) != 0)
+      f++;
+    if (f == ConfigFieldCount)
+    {
+      snprintf(Error, ErrorSize, "no setting called %s", Names[i]);
+      Good = false;
+    }
+    else
+      Good = ConfigParse(ConfigFields[f], Values[i], New, Error, ErrorSize);
+  }
+  if (Good && New.APIToken[0] == '\0') // it would refuse every request, this one included, until NVS is erased
+  {
+    snprintf(Error, ErrorSize, "api_token can't be empty");
+    Good = false;
+  }
+  if (!Good || !ConfigValid(New, Error, ErrorSize))
+  {
+    MetricConfigRejected.Add();
+    return -1;
+  }
+  uint8_t Changed = 0;
+  for (byte f = 0; f < ConfigFieldCount; f++)
+  {
+    const ConfigField &Field = ConfigFields[f];
+    if (memcmp((const uint8_t *)&New + Field.Offset, (const uint8_t *)&ConfigCurrent + Field.Offset, Field.Size) != 0)
+      Changed |= Field.Group;
+  }
+  if (Changed == 0)
+    return 0;
+  if (!ConfigSave(New, ConfigGeneration + 1))
+  {
+    snprintf(Error, ErrorSize, "couldn't save to flash, nothing changed");
+    return -1;
+  }
+  HalEnter(ConfigLock);
+  ConfigCurrent = New;
+  HalExit(ConfigLock);
+  ConfigGeneration++;
+  ConfigPending.fetch_or(Changed);
+  MetricConfigUpdates.Add();
+  MetricConfigUpdate.Observe(Platform.Clock->Micros() - Start);
+  return Changed;
+}
+
+// true if an Authorization header has the API token, compared in constant time. No token turns the API off
+bool ConfigAuthorized(const char *Authorization)
+{
+  const char Bearer[] = "Bearer ";
+  char Expected[ConfigTokenSize];
+  HalEnter(ConfigLock);
+  memcpy(Expected, ConfigCurrent.APIToken, sizeof(Expected));
+  HalExit(ConfigLock);
+  size_t Length = strlen(Expected);
+  bool Good = Length != 0 && strncmp(Authorization, Bearer, sizeof(Bearer) - 1) == 0 &&
+              strlen(Authorization + sizeof(Bearer) - 1) == Length;
+  uint8_t Difference = 0;
+  for (size_t i = 0; Good && i < Length; i++)
+    Difference |= Authorization[sizeof(Bearer) - 1 + i] ^ Expected[i];
+  Good = Good && Difference == 0;
+  if (!Good)
+    MetricConfigUnauthorized.Add();
+  return Good;
+}
+
+// the current config as JSON, secrets only say whether they are set
+int ConfigJson(char *Text, size_t Size)
+{
+  ConfigValues Values;
+  ConfigRead(Values);
+  const uint8_t *Bytes = (const uint8_t *)&Values;
+  int Length = snprintf(Text, Size, "{\"generation\":%u", ConfigGeneration);
+  for (byte f = 0; f < ConfigFieldCount && Length < (int)Size; f++)
+  {
+    const ConfigField &Field = ConfigFields[f];
+    const uint8_t *Value = Bytes + Field.Offset;
+    Length += snprintf(Text + Length, Size - Length, ",\"%s\":", Field.Name);
+    if (Length >= (int)Size)
+      break;
+    if (Field.Type == ConfigSecret)
+      Length += snprintf(Text + Length, Size - Length, "%s", Value[0] != '\0' ? "\"set\"" : "\"\"");
+    else if (Field.Type == ConfigIP)
+      Length += snprintf(Text + Length, Size - Length, "\"%u.%u.%u.%u\"", Value[0], Value[1], Value[2], Value[3]);
+    else if (Field.Type == ConfigNumber)
+    {
+      uint32_t Number = *Value;
+      if (Field.Size == 4)
+        memcpy(&Number, Value, 4);
+      Length += snprintf(Text + Length, Size - Length, "%u", Number);
+    }
+    else
+    {
+      Length += snprintf(Text + Length, Size - Length, "\"");
+      for (const char *c = (const char *)Value; *c != '\0' && Length < (int)Size; c++)
+        if ((uint8_t)*c >= ' ')
+          Length += snprintf(Text + Length, Size - Length, *c == '"' || *c == '\\' ? "\\%c" : "%c", *c);
+      Length += snprintf(Text + Length, Size - Length, "\"");
+    }
+  }
+  if (Length < (int)Size)
+    Length += snprintf(Text + Length, Size - Length, "}");
+  return Length < (int)Size ? Length : Size - 1;
+}
+
+double MetricReadConfigGeneration(byte Row) { return ConfigGeneration; }
+double MetricReadConfigDefaulted(byte Row) { return ConfigDefaulted; }
+double MetricReadConfigLoad(byte Row) { return ConfigLoadMicros / 1e6; }
+double MetricReadConfigUpdates(byte Row) { return MetricConfigUpdates.Read(); }
+double MetricReadConfigRejected(byte Row) { return MetricConfigRejected.Read(); }
+double MetricReadConfigUnauthorized(byte Row) { return MetricConfigUnauthorized.Read(); }
+double MetricReadConfigSaveFailures(byte Row) { return MetricConfigSaveFailures.Read(); }
+
+const MetricExport ConfigMetrics[] = {
+    {"water_config_generation", "gauge", "Config changes saved since the defaults", MetricReadConfigGeneration},
+    {"water_config_defaulted", "gauge", "1 if the stored config was missing or bad at boot", MetricReadConfigDefaulted},
+    {"water_config_load_seconds", "gauge", "Time to load and check the config at boot", MetricReadConfigLoad},
+    {"water_config_updates_total", "counter", "Config changes applied", MetricReadConfigUpdates},
+    {"water_config_rejected_total", "counter", "Config changes refused as invalid", MetricReadConfigRejected},
+    {"water_config_unauthorized_total", "counter", "Config requests without the API token", MetricReadConfigUnauthorized},
+    {"water_config_save_failures_total", "counter", "Config changes that couldn't be written to flash", MetricReadConfigSaveFailures},
+    {"water_config_update_seconds", "histogram", "Time to check, save and publish a config change", NULL, &MetricConfigUpdate, 1e-6},
+};
+const byte ConfigMetricCount = sizeof(ConfigMetrics) / sizeof(ConfigMetrics[0]);
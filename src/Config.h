@@ -0,0 +1,91 @@
+/*
+* Runtime configuration, the settings that were constants in main.cpp and Security.h. They are kept in flash as one
+* versioned blob through Platform.Store, checked at boot and cached in RAM. ConfigUpdate changes any of them while
+* running: the new values are checked as a whole and saved before anything sees them, so a change happens completely
+* or not at all, then only the groups that changed are passed on. The task that owns a group picks its change up with
+* ConfigTake and applies just that, nothing restarts.
+*/
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "Receiver.h"
+
+const uint32_t ConfigMagic = 0x43464721; // "CFG!"
+const uint16_t ConfigVersion = 1;        // change when ConfigValues changes, an old blob is then replaced by the defaults
+const byte ConfigTextSize = 64;
+const byte ConfigSecretSize = 65;        // WPA2 passphrases are up to 64 characters
+const byte ConfigTokenSize = 33;
+const byte ConfigMaxUpdates = 16;        // settings one ConfigUpdate can change
+const size_t ConfigJsonSize = 1024;      // enough for ConfigJson with every text setting full
+
+// what a change has to be passed on to, a bit each
+enum ConfigGroup : uint8_t
+{
+  ConfigWiFi = 1,   // WiFiTask reconnects
+  ConfigClock = 2,  // HousekeepingTask, NTP server and time zone
+  ConfigRadio = 4,  // LoraTask retunes the radio
+  ConfigPacket = 8, // LoraTask, LoraConfigure
+  ConfigAPI = 16    // read on every request, nothing to pass on
+};
+struct ConfigValues
+{
+  char WiFiSSID[33];
+  char WiFiPassword[ConfigSecretSize];
+  uint8_t WiFiIP[4]; // 0.0.0.0 for DHCP
+  uint8_t WiFiGateway[4];
+  uint8_t WiFiSubnet[4];
+  uint8_t WiFiDNS[4];
+  uint8_t WiFiDNS2[4];
+  char NTPServer[ConfigTextSize];
+  char TimeZone[ConfigTextSize]; // POSIX TZ, daylight saving rules included
+  uint32_t LoraBand;             // Hz
+  uint8_t LoraSyncWord;
+  char LoraPreamble[LoraPreambleMaxSize]; // text packets start with this
+  uint8_t LoraPacketLimit;                // longer packets are bad, NodeFrameMaxSize to LoraMaxPacketSize
+  char APIToken[ConfigTokenSize];         // bearer token for /api/v1/config, "" turns it off
+};
+// as kept in flash
+struct ConfigBlob
+{
+  uint32_t Magic;
+  uint16_t Version;
+  uint16_t Size;       // sizeof(ConfigBlob), catches a layout change that ConfigVersion missed
+  uint32_t Generation; // saves since the defaults
+  ConfigValues Values;
+  uint32_t Check;      // FNV-1a from Version up to here
+};
+enum ConfigType : byte
+{
+  ConfigText,
+  ConfigSecret, // text that is never sent back
+  ConfigIP,
+  ConfigNumber
+};
+// one setting by name, how the API and ConfigJson see ConfigValues
+struct ConfigField
+{
+  const char *Name;
+  ConfigType Type;
+  uint16_t Offset; // into ConfigValues
+  uint8_t Size;    // bytes, 1 or 4 for numbers
+  uint32_t Min;    // numbers only
+  uint32_t Max;
+  ConfigGroup Group;
+};
+
+extern const ConfigField ConfigFields[];
+extern const byte ConfigFieldCount;
+extern uint32_t ConfigGeneration;
+extern unsigned long ConfigLoadMicros; // how long ConfigBegin took
+extern const MetricExport ConfigMetrics[];
+extern const byte ConfigMetricCount;
+
+bool ConfigBegin(const ConfigValues &Defaults);
+void ConfigRead(ConfigValues &Values);
+uint8_t ConfigTake(uint8_t Groups);
+int ConfigUpdate(const char *const *Names, const char *const *Values, byte Count, char *Error, size_t ErrorSize);
+bool ConfigAuthorized(const char *Authorization);
+int ConfigJson(char *Text, size_t Size);
+
+#endif
@@ -0,0 +1,138 @@
+/*
+* Thin hardware layer between the packet pipeline in Receiver.cpp and the board.
+* main.cpp implements it with LoRa, SSD1306, NTP, SPIFFS and the web server,
+* src/native implements it on Linux so the pipeline can run on a PC.
+* No Arduino calls in here.
+*/
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef ARDUINO
+#include <freertos/FreeRTOS.h>
+#else
+#include <mutex>
+#endif
+
+typedef uint8_t byte; // same as Arduino.h
+
+// OLED display, text is kept as lines and only the lines that change are redrawn
+const byte OLEDLines = 5;       // lines of text that fit on the display
+const byte OLEDLineLength = 40; // characters kept per line
+
+// the radio, only used from the receive callback for the packet that has just arrived, apart from Send
+class HalRadio
+{
+public:
+  virtual int Available() = 0;      // bytes of the packet not read yet
+  virtual int Read() = 0;           // next byte of the packet
+  virtual int PacketRSSI() = 0;
+  virtual int8_t PacketSNRRaw() = 0; // SNR in 1/4 dB steps, float can't be used in the receive callback
+  virtual bool Send(const uint8_t *Data, size_t Length) = 0; // transmit then go back to receiving, blocks while on air
+};
+
+// lines of text, SetLine returns straight away and Update gets them drawn
+class HalDisplay
+{
+public:
+  virtual void SetLine(byte Line, const char *Text) = 0;
+  virtual void Update() = 0;
+};
+
+class HalClock
+{
+public:
+  virtual unsigned long Millis() = 0;
+  virtual unsigned long Micros() = 0;
+  virtual unsigned long Cycles() = 0; // CPU cycles, for timing very short pieces of code
+  virtual uint32_t UTC() = 0;         // seconds since 1970
+  virtual void Format(char *Date, size_t DateSize, char *Time, size_t TimeSize) = 0; // local date and time for display
+};
+
+// whole file calls, the pipeline only ever appends to or reads a block of a file
+class HalFileSystem
+{
+public:
+  virtual bool Exists(const char *Path) = 0;
+  virtual size_t Size(const char *Path) = 0;
+  virtual size_t Read(const char *Path, size_t Offset, void *Data, size_t Length) = 0; // returns bytes read, 0 if there is no such file
+  virtual bool Write(const char *Path, const void *Data, size_t Length, bool Append) = 0; // creates the file, or empties it unless Append
+};
+
+class HalNetwork
+{
+public:
+  virtual bool Connected() = 0;
+  virtual int RSSI() = 0;
+  virtual size_t Listeners() = 0; // open pages waiting for events
+  virtual void Publish(const char *Event, const char *Data, uint32_t ID) = 0;
+};
+
+// the backend readings are forwarded to, or alerts are sent to, Send blocks until the backend answers or gives up
+class HalUplink
+{
+public:
+  virtual bool Send(const char *Body, size_t Length) = 0; // true once the backend has accepted the batch
+};
+
+// one small blob kept in flash apart from the file system, NVS on the board. Save replaces it whole or not at all
+class HalStore
+{
+public:
+  virtual size_t Load(void *Data, size_t Size) = 0; // returns bytes read, 0 if nothing has been saved
+  virtual bool Save(const void *Data, size_t Length) = 0;
+};
+
+// where an update is written, the next OTA partition or SPIFFS on the board. Nothing changes what runs until End(true)
+class HalImage
+{
+public:
+  virtual bool Begin(byte Target, size_t Size) = 0; // Target is a PatchTarget
+  virtual bool Write(const uint8_t *Data, size_t Length) = 0;
+  virtual size_t ReadBase(size_t Offset, void *Data, size_t Length) = 0; // from the firmware running now, returns bytes read
+  virtual bool End(bool Commit) = 0; // Commit switches to the new image, false throws it away
+};
+
+// serial on the board, stdout on a PC
+class HalConsole
+{
+public:
+  virtual void Print(const char *Text) = 0;
+};
+
+struct HalPlatform
+{
+  HalRadio *Radio;
+  HalDisplay *Display;
+  HalClock *Clock;
+  HalFileSystem *Files;
+  HalNetwork *Network;
+  HalConsole *Console;
+  HalUplink *Uplink;   // NULL if readings aren't forwarded anywhere
+  HalUplink *Notifier; // NULL if alerts aren't sent anywhere
+  HalStore *Store;     // the config, NULL to run on the defaults
+  HalImage *Image;     // NULL if updates can't be applied
+};
+extern HalPlatform Platform; // defined by whichever of main.cpp or src/native is being built
+
+// short critical section around data shared between tasks, a spinlock on the board
+#ifdef ARDUINO
+struct HalLock
+{
+  portMUX_TYPE Mux = portMUX_INITIALIZER_UNLOCKED;
+};
+inline void HalEnter(HalLock &Lock) { portENTER_CRITICAL(&Lock.Mux); }
+inline void HalExit(HalLock &Lock) { portEXIT_CRITICAL(&Lock.Mux); }
+#else
+struct HalLock
+{
+  std::mutex Mux;
+};
+inline void HalEnter(HalLock &Lock) { Lock.Mux.lock(); }
+inline void HalExit(HalLock &Lock) { Lock.Mux.unlock(); }
+#endif
+
+#endif
@@ -0,0 +1,209 @@
+/*
+* Link control, see Link.h. LinkUpdate and LinkAck run wherever LoraProcessing does, the rest reads the sender
+* table through NodeRead so it can be used from anywhere.
+*/
+
+#include <algorithm>
+#include <stdio.h>
+#include "Link.h"
+#include "Power.h"
+
+MetricCounter MetricLinkAcks;
+MetricCounter MetricLinkAckFailures;
+MetricCounter MetricLinkPowerChanges;
+
+// lowest SNR the radio can still decode at a spreading factor, from the SX1276 datasheet
+float LinkFloor(byte SpreadingFactor)
+{
+  return -7.5 - 2.5 * (SpreadingFactor - LinkMinSF);
+}
+
+// time on air for a packet with the radio settings in Link.h, Semtech's formula from AN1200.13.
+// Explicit header and no payload CRC, the LoRa library's defaults, the frames carry their own
+uint32_t LinkAirtimeMicros(byte SpreadingFactor, int Length)
+{
+  float Symbol = (float)(1UL << SpreadingFactor) * 1e6 / LoraBandwidth;
+  int LowRate = Symbol > 16000 ? 1 : 0; // low data rate optimisation, on for SF11 and SF12 at 125kHz
+  int Bits = 8 * Length - 4 * SpreadingFactor + 28;
+  int Step = 4 * (SpreadingFactor - 2 * LowRate);
+  int PayloadSymbols = 8 + std::max((Bits + Step - 1) / Step * LoraCodingRate, 0);
+  return (LoraPreambleLength + 4.25 + PayloadSymbols) * Symbol;
+}
+
+// share of the last Span sequence numbers that arrived, 1 for a sender that doesn't number its packets
+float LinkDelivery(const NodeState &Node, byte Span)
+{
+  Span = std::min(Span, Node.WindowSize);
+  if (Span == 0)
+    return 1;
+  uint32_t Mask = Span >= 32 ? 0xFFFFFFFFUL : (1UL << Span) - 1;
+  return __builtin_popcount(Node.Window & Mask) / (float)Span;
+}
+
+// dB of rolling SNR above what the sender's spreading factor needs
+float LinkMargin(const NodeState &Node)
+{
+  return Node.SNRAverage - LinkFloor(Node.SpreadingFactor != 0 ? Node.SpreadingFactor : LoraSpreadingFactor);
+}
+
+// fastest spreading factor the sender could keep LinkTargetMargin at with full power. Senders that don't report
+// their settings are taken to be at full power already
+byte LinkNeededSF(const NodeState &Node)
+{
+  float Headroom = Node.SpreadingFactor != 0 ? LinkMaxTXPower - Node.TXPower : 0;
+  for (byte SF = LinkMinSF; SF < LinkMaxSF; SF++)
+    if (Node.SNRAverage + Headroom - LinkFloor(SF) >= LinkTargetMargin)
+      return SF;
+  return LinkMaxSF;
+}
+
+// fastest spreading factor every sender heard lately can use, the receiver would have to be set to it with the senders
+byte LinkRecommendedSF()
+{
+  byte Needed = LinkMinSF;
+  unsigned long Now = Platform.Clock->Millis();
+  for (byte i = 0; i < NodeCount; i++)
+  {
+    NodeState Node;
+    NodeRead(i, Node);
+    if (Now - Node.LastSeenMillis < LinkActiveMillis)
+      Needed = std::max(Needed, LinkNeededSF(Node));
+  }
+  return Needed;
+}
+
+// work out the TX power a sender should use. Lost packets turn it up a step, otherwise it follows the SNR margin.
+// Nothing changes until LinkSettlePackets sequence numbers have gone by since the last change, so the rolling SNR has
+// caught up and the delivery ratio is all from the new setting
+void LinkAdvise(NodeState &Node, uint16_t Sequence)
+{
+  if (!Node.Advised)
+  {
+    Node.Advised = true;
+    Node.AdviseTXPower = Node.TXPower;
+    Node.AdviseSequence = Sequence;
+  }
+  if ((uint16_t)(Sequence - Node.AdviseSequence) < LinkSettlePackets)
+    return;
+  float Excess = LinkMargin(Node) - LinkTargetMargin;
+  int Power = Node.TXPower;
+  if (LinkDelivery(Node, LinkSettlePackets) < LinkMinDelivery)
+    Power += LinkPowerStep;
+  else if (Excess >= LinkHysteresis || Excess <= -LinkHysteresis)
+    Power -= (int)Excess;
+  Power = std::min(std::max(Power, (int)LinkMinTXPower), (int)LinkMaxTXPower);
+  if (Power == Node.AdviseTXPower)
+    return;
+  Node.AdviseTXPower = Power;
+  Node.AdviseSequence = Sequence;
+  MetricLinkPowerChanges.Add();
+}
+
+// update a sender's link statistics from a good packet, Gap is how far its sequence number moved on.
+// Called by NodeRecord with the sender table locked
+void LinkUpdate(NodeState &Node, const LoraReading &Reading, const LoraFrame &Frame, uint16_t Gap)
+{
+  if (Gap >= NodeMaxSequenceGap) // the sender restarted
+  {
+    Node.Window = 1;
+    Node.WindowSize = 1;
+  }
+  else if (Gap > 0) // 0 is the same packet again
+  {
+    Node.Window = Gap >= 32 ? 1 : (Node.Window << Gap) | 1;
+    Node.WindowSize = std::min((int)LinkWindow, Node.WindowSize + Gap);
+  }
+  float SNR = Frame.SNRQuarterdB / 4.0;
+  if (Node.Received == 0)
+    Node.SNRAverage = SNR;
+  else
+  {
+    if (Reading.SpreadingFactor != 0 && Node.SpreadingFactor != 0)
+      Node.SNRAverage += Reading.TXPower - Node.TXPower; // the sender changed power, the average moves with it
+    Node.SNRAverage += (SNR - Node.SNRAverage) * LinkSNRWeight;
+  }
+  Node.SpreadingFactor = Reading.SpreadingFactor;
+  Node.TXPower = Reading.TXPower;
+  uint32_t Airtime = LinkAirtimeMicros(Node.SpreadingFactor != 0 ? Node.SpreadingFactor : LoraSpreadingFactor, Frame.Size);
+  Node.AirtimeMicros += Airtime;
+  Node.AirtimeSavedMicros += LinkAirtimeMicros(LinkMaxSF, Frame.Size) - Airtime;
+  if (Node.SpreadingFactor != 0)
+    LinkAdvise(Node, Reading.Sequence);
+}
+
+// answer a sender that reported its settings with the ones it should use. Goes out straight away as the sender
+// only listens for a short while after sending, the radio can't receive until it has gone
+void LinkAck(const NodeState &Node)
+{
+  NodeAck Ack;
+  Ack.NodeID = Node.ID;
+  Ack.Sequence = Node.LastSequence;
+  Ack.SpreadingFactor = LoraSpreadingFactor;
+  Ack.TXPower = Node.AdviseTXPower;
+  uint8_t Buffer[NodeAckSize];
+  size_t Length = NodeAckEncode(Ack, Buffer, sizeof(Buffer));
+  if (Platform.Radio->Send(Buffer, Length))
+  {
+    MetricLinkAcks.Add();
+    PowerMove(PowerLoraTransmit, LinkAirtimeMicros(LoraSpreadingFactor, Length));
+  }
+  else
+    MetricLinkAckFailures.Add();
+}
+
+double MetricReadLinkSF(byte Row) { return LoraSpreadingFactor; }
+double MetricReadLinkRecommendedSF(byte Row) { return LinkRecommendedSF(); }
+double MetricReadLinkAcks(byte Row) { return MetricLinkAcks.Read(); }
+double MetricReadLinkAckFailures(byte Row) { return MetricLinkAckFailures.Read(); }
+double MetricReadLinkPowerChanges(byte Row) { return MetricLinkPowerChanges.Read(); }
+double MetricReadNodeDelivery(byte Row)
+{
+  NodeState Node;
+  NodeRead(Row, Node);
+  return LinkDelivery(Node);
+}
+double MetricReadNodeMargin(byte Row)
+{
+  NodeState Node;
+  NodeRead(Row, Node);
+  return LinkMargin(Node);
+}
+double MetricReadNodeTXPower(byte Row)
+{
+  NodeState Node;
+  NodeRead(Row, Node);
+  return Node.TXPower;
+}
+double MetricReadNodeAdviseTXPower(byte Row)
+{
+  NodeState Node;
+  NodeRead(Row, Node);
+  return Node.AdviseTXPower;
+}
+double MetricReadNodeAirtime(byte Row)
+{
+  NodeState Node;
+  NodeRead(Row, Node);
+  return Node.AirtimeMicros / 1e6;
+}
+double MetricReadNodeAirtimeSaved(byte Row)
+{
+  NodeState Node;
+  NodeRead(Row, Node);
+  return Node.AirtimeSavedMicros / 1e6;
+}
+
+const MetricExport LinkMetrics[] = {
+    {"water_link_spreading_factor", "gauge", "Spreading factor the receiver listens on", MetricReadLinkSF},
+    {"water_link_recommended_spreading_factor", "gauge", "Fastest spreading factor every sender heard in the last hour can use", MetricReadLinkRecommendedSF},
+    {"water_link_acks_total", "counter", "Acks sent to senders", MetricReadLinkAcks},
+    {"water_link_ack_failures_total", "counter", "Acks the radio couldn't send", MetricReadLinkAckFailures},
+    {"water_link_power_changes_total", "counter", "Times a sender was asked to change its TX power", MetricReadLinkPowerChanges},
+    {"water_node_delivery_ratio", "gauge", "Share of each sender's last 32 sequence numbers that arrived", MetricReadNodeDelivery, NULL, 0, MetricNodeLabel},
+    {"water_node_snr_margin_db", "gauge", "Rolling SNR above the demodulation floor for each sender", MetricReadNodeMargin, NULL, 0, MetricNodeLabel},
+    {"water_node_tx_power_dbm", "gauge", "TX power each sender reports, 0 if it doesn't", MetricReadNodeTXPower, NULL, 0, MetricNodeLabel},
+    {"water_node_advised_tx_power_dbm", "gauge", "TX power each sender was last asked to use", MetricReadNodeAdviseTXPower, NULL, 0, MetricNodeLabel},
+    {"water_node_airtime_seconds_total", "counter", "Time on air of each sender's packets", MetricReadNodeAirtime, NULL, 0, MetricNodeLabel},
+    {"water_node_airtime_saved_seconds_total", "counter", "Time on air each sender saved against always using SF12", MetricReadNodeAirtimeSaved, NULL, 0, MetricNodeLabel},
+};
+const byte LinkMetricCount = sizeof(LinkMetrics) / sizeof(LinkMetrics[0]);
@@ -0,0 +1,48 @@
+/*
+* Link control, rolling link statistics for each sender and the radio settings it should use.
+* A sender that reports its settings in NodeFieldLink gets a NodeAck after each packet with the TX power to use,
+* so a strong link turns down and a weak one turns up before packets are lost. The receiver's radio only hears one
+* spreading factor at a time so that can't change per sender, LinkRecommendedSF is the fastest every sender can use.
+*/
+
+#ifndef LINK_H
+#define LINK_H
+
+#include "Receiver.h"
+
+// radio settings, the receiver listens with these and senders have to match
+const byte LoraSpreadingFactor = 7; // 7 is the fastest, each step up doubles the time on air and gains 2.5dB
+const long LoraBandwidth = 125000;
+const byte LoraCodingRate = 5;      // 4/5
+const byte LoraPreambleLength = 8;
+const int LoraAckTXPower = 17;      // dBm the receiver sends acks at
+// link control
+const byte LinkMinSF = 7;
+const byte LinkMaxSF = 12;
+const byte LinkWindow = 32;               // sequence numbers the delivery ratio is worked out over
+const byte LinkSettlePackets = 8;         // sequence numbers after a power change before the next, and the delivery ratio it is judged on
+const float LinkSNRWeight = 0.125;        // weight of each packet in the rolling SNR
+const float LinkTargetMargin = 10;        // dB of SNR to keep above the demodulation floor, covers fading
+const float LinkHysteresis = 3;           // dB the margin must be off target by before the power is changed
+const float LinkMinDelivery = 0.9;        // below this the power goes up whatever the SNR says
+const int8_t LinkMinTXPower = 2;          // dBm, the SX1276 PA_BOOST range
+const int8_t LinkMaxTXPower = 20;
+const int8_t LinkPowerStep = 3;           // dBm added when packets are being lost
+const unsigned long LinkActiveMillis = 3600000; // senders heard within this long count towards LinkRecommendedSF
+
+extern MetricCounter MetricLinkAcks;         // acks sent
+extern MetricCounter MetricLinkAckFailures;  // acks the radio couldn't send
+extern MetricCounter MetricLinkPowerChanges; // times a sender was asked to change its TX power
+extern const MetricExport LinkMetrics[];
+extern const byte LinkMetricCount;
+
+float LinkFloor(byte SpreadingFactor);
+uint32_t LinkAirtimeMicros(byte SpreadingFactor, int Length);
+void LinkUpdate(NodeState &Node, const LoraReading &Reading, const LoraFrame &Frame, uint16_t Gap);
+float LinkDelivery(const NodeState &Node, byte Span = LinkWindow);
+float LinkMargin(const NodeState &Node);
+byte LinkNeededSF(const NodeState &Node);
+byte LinkRecommendedSF();
+void LinkAck(const NodeState &Node);
+
+#endif
@@ -0,0 +1,81 @@
+/*
+* Counters and histograms for /metrics, cheap enough to record on the radio path.
+* Each one has a single writer task, so recording is a relaxed load, add and store rather than a locked
+* read-modify-write, and readers on the other core see a whole value. MetricSharedCounter is for the few counts that
+* more than one task adds to. No Arduino calls in here.
+*/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint8_t byte; // same as Arduino.h
+
+// log-linear histogram, each power of 2 is split into MetricSubBuckets equal buckets
+const byte MetricSubBuckets = 4;         // must be a power of 2, worst case bucket width is 25% of the value
+const byte MetricHistogramBuckets = 96;  // values from 0 up to 2^24 get their own bucket, the last also counts everything above
+
+struct MetricCounter
+{
+  std::atomic<uint32_t> Value;
+  void Add(uint32_t Amount = 1) { Value.store(Value.load(std::memory_order_relaxed) + Amount, std::memory_order_relaxed); }
+  uint32_t Read() const { return Value.load(std::memory_order_relaxed); }
+};
+
+// a counter with more than one writer, the add is a locked read-modify-write so none are lost. Keep it off the radio path
+struct MetricSharedCounter
+{
+  std::atomic<uint32_t> Value;
+  void Add(uint32_t Amount = 1) { Value.fetch_add(Amount, std::memory_order_relaxed); }
+  uint32_t Read() const { return Value.load(std::memory_order_relaxed); }
+};
+
+// bucket a value goes in, small values exactly then MetricSubBuckets per power of 2
+inline byte MetricBucket(uint32_t Value)
+{
+  if (Value < MetricSubBuckets)
+    return Value;
+  byte Octave = 31 - __builtin_clz(Value); // a single instruction on the ESP32
+  uint32_t Index = (Octave - 1) * MetricSubBuckets + ((Value >> (Octave - 2)) & (MetricSubBuckets - 1));
+  return Index < MetricHistogramBuckets ? Index : MetricHistogramBuckets - 1;
+}
+
+// smallest value that goes in a bucket, the one after it starts at the next bucket's lower bound
+inline uint32_t MetricBucketLower(byte Bucket)
+{
+  if (Bucket < MetricSubBuckets)
+    return Bucket;
+  byte Octave = Bucket / MetricSubBuckets + 1;
+  return (uint32_t)(MetricSubBuckets + Bucket % MetricSubBuckets) << (Octave - 2);
+}
+
+// Sum wraps at 2^32, Prometheus treats that the same as a restart
+struct MetricHistogram
+{
+  MetricCounter Buckets[MetricHistogramBuckets];
+  MetricCounter Count;
+  MetricCounter Sum;
+  void Observe(uint32_t Value)
+  {
+    Buckets[MetricBucket(Value)].Add();
+    Count.Add();
+    Sum.Add(Value);
+  }
+};
+
+// one metric on /metrics, counters and gauges have Read, histograms have Histogram
+struct MetricExport
+{
+  const char *Name;
+  const char *Type; // counter, gauge or histogram, as Prometheus names them
+  const char *Help;
+  double (*Read)(byte Row); // Row picks the series for labelled metrics, i.e. the index into Nodes
+  const MetricHistogram *Histogram;
+  double Scale;             // histogram values are multiplied by this, i.e. 1e-6 to turn microseconds into seconds
+  bool (*Label)(byte Row, char *Text, size_t Size); // one series per row with these labels, false past the last row
+};
+
+#endif
@@ -0,0 +1,181 @@
+/*
+* Binary lora packet shared by the water level sender and receiver.
+* Copy this file into the sender project so that both ends agree on the layout.
+* No Arduino calls in here so it can be used anywhere.
+*
+* Byte 0     NodeFrameMagic, not a printable character so old "A1A" text packets can still be told apart
+* Byte 1     NodeFrameVersion
+* Byte 2     node ID, one per sender
+* Byte 3-4   sequence number, little endian, goes up by one for every packet sent
+* Byte 5     number of fields that follow, up to NodeFrameMaxFields
+* Then 3 bytes per field, the field type then a signed 16 bit value, little endian
+* Last 2     CRC-16/CCITT-FALSE of everything before it, little endian
+*
+* A sender that includes NodeFieldLink listens for an ack for a moment after each packet:
+* Byte 0     NodeAckMagic
+* Byte 1     NodeFrameVersion
+* Byte 2     node ID the ack is for
+* Byte 3-4   sequence number of the packet being acknowledged, little endian
+* Byte 5     spreading factor to use
+* Byte 6     TX power to use, dBm
+* Byte 7-8   CRC-16/CCITT-FALSE of everything before it, little endian
+*/
+
+#ifndef NODEFRAME_H
+#define NODEFRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+const uint8_t NodeFrameMagic = 0xA1;
+const uint8_t NodeFrameVersion = 1;
+const uint8_t NodeFrameMaxFields = 4;
+const uint8_t NodeFrameHeaderSize = 6;
+const uint8_t NodeFrameFieldSize = 3;
+const uint8_t NodeFrameCRCSize = 2;
+const uint8_t NodeFrameMaxSize = NodeFrameHeaderSize + NodeFrameMaxFields * NodeFrameFieldSize + NodeFrameCRCSize;
+const uint8_t NodeAckMagic = 0xA2;
+const uint8_t NodeAckSize = 9;
+
+// field types, new ones go on the end so old receivers can skip them
+enum NodeFieldType : uint8_t
+{
+  NodeFieldWater = 1,       // 0 not full, 1 full, or a percentage for senders that can measure it
+  NodeFieldVolts = 2,       // battery voltage * 100
+  NodeFieldTemperature = 3, // degrees C * 10
+  NodeFieldLink = 4,        // the sender's radio settings, spreading factor * 256 + TX power in dBm
+};
+
+struct NodeField
+{
+  uint8_t Type;
+  int16_t Value;
+};
+
+struct NodeFrame
+{
+  uint8_t NodeID;
+  uint16_t Sequence;
+  uint8_t FieldCount;
+  NodeField Fields[NodeFrameMaxFields];
+};
+
+struct NodeAck
+{
+  uint8_t NodeID;
+  uint16_t Sequence;
+  uint8_t SpreadingFactor;
+  int8_t TXPower;
+};
+
+// CRC-16/CCITT-FALSE, poly 0x1021, start 0xFFFF. Bitwise as the packets are tiny and it saves a 512 byte table
+inline uint16_t NodeFrameCRC(const uint8_t *Data, size_t Length)
+{
+  uint16_t CRC = 0xFFFF;
+  for (size_t i = 0; i < Length; i++)
+  {
+    CRC ^= (uint16_t)Data[i] << 8;
+    for (uint8_t Bit = 0; Bit < 8; Bit++)
+      CRC = (CRC & 0x8000) ? (CRC << 1) ^ 0x1021 : CRC << 1;
+  }
+  return CRC;
+}
+
+// write Frame into Buffer, returns the number of bytes used or 0 if it doesn't fit
+inline size_t NodeFrameEncode(const NodeFrame &Frame, uint8_t *Buffer, size_t Size)
+{
+  if (Frame.FieldCount > NodeFrameMaxFields)
+    return 0;
+  size_t Length = NodeFrameHeaderSize + Frame.FieldCount * NodeFrameFieldSize + NodeFrameCRCSize;
+  if (Length > Size)
+    return 0;
+  Buffer[0] = NodeFrameMagic;
+  Buffer[1] = NodeFrameVersion;
+  Buffer[2] = Frame.NodeID;
+  Buffer[3] = Frame.Sequence & 0xFF;
+  Buffer[4] = Frame.Sequence >> 8;
+  Buffer[5] = Frame.FieldCount;
+  uint8_t *Field = Buffer + NodeFrameHeaderSize;
+  for (uint8_t i = 0; i < Frame.FieldCount; i++, Field += NodeFrameFieldSize)
+  {
+    Field[0] = Frame.Fields[i].Type;
+    Field[1] = (uint16_t)Frame.Fields[i].Value & 0xFF;
+    Field[2] = (uint16_t)Frame.Fields[i].Value >> 8;
+  }
+  uint16_t CRC = NodeFrameCRC(Buffer, Length - NodeFrameCRCSize);
+  Buffer[Length - 2] = CRC & 0xFF;
+  Buffer[Length - 1] = CRC >> 8;
+  return Length;
+}
+
+// check and unpack a received packet, returns false if it is not a valid frame. Never reads past Length
+inline bool NodeFrameDecode(const uint8_t *Buffer, size_t Length, NodeFrame &Frame)
+{
+  if (Length < NodeFrameHeaderSize + NodeFrameCRCSize || Buffer[0] != NodeFrameMagic || Buffer[1] != NodeFrameVersion)
+    return false;
+  uint8_t FieldCount = Buffer[5];
+  if (FieldCount > NodeFrameMaxFields || Length != (size_t)(NodeFrameHeaderSize + FieldCount * NodeFrameFieldSize + NodeFrameCRCSize))
+    return false;
+  uint16_t CRC = Buffer[Length - 2] | (Buffer[Length - 1] << 8);
+  if (CRC != NodeFrameCRC(Buffer, Length - NodeFrameCRCSize))
+    return false;
+  Frame.NodeID = Buffer[2];
+  Frame.Sequence = Buffer[3] | (Buffer[4] << 8);
+  Frame.FieldCount = FieldCount;
+  const uint8_t *Field = Buffer + NodeFrameHeaderSize;
+  for (uint8_t i = 0; i < FieldCount; i++, Field += NodeFrameFieldSize)
+  {
+    Frame.Fields[i].Type = Field[0];
+    Frame.Fields[i].Value = (int16_t)(Field[1] | (Field[2] << 8));
+  }
+  return true;
+}
+
+// write an ack into Buffer, returns the number of bytes used or 0 if it doesn't fit
+inline size_t NodeAckEncode(const NodeAck &Ack, uint8_t *Buffer, size_t Size)
+{
+  if (Size < NodeAckSize)
+    return 0;
+  Buffer[0] = NodeAckMagic;
+  Buffer[1] = NodeFrameVersion;
+  Buffer[2] = Ack.NodeID;
+  Buffer[3] = Ack.Sequence & 0xFF;
+  Buffer[4] = Ack.Sequence >> 8;
+  Buffer[5] = Ack.SpreadingFactor;
+  Buffer[6] = (uint8_t)Ack.TXPower;
+  uint16_t CRC = NodeFrameCRC(Buffer, NodeAckSize - NodeFrameCRCSize);
+  Buffer[7] = CRC & 0xFF;
+  Buffer[8] = CRC >> 8;
+  return NodeAckSize;
+}
+
+// check and unpack a received ack, returns false if it is not a valid one. The sender also checks NodeID is its own
+inline bool NodeAckDecode(const uint8_t *Buffer, size_t Length, NodeAck &Ack)
+{
+  if (Length != NodeAckSize || Buffer[0] != NodeAckMagic || Buffer[1] != NodeFrameVersion)
+    return false;
+  uint16_t CRC = Buffer[7] | (Buffer[8] << 8);
+  if (CRC != NodeFrameCRC(Buffer, NodeAckSize - NodeFrameCRCSize))
+    return false;
+  Ack.NodeID = Buffer[2];
+  Ack.Sequence = Buffer[3] | (Buffer[4] << 8);
+  Ack.SpreadingFactor = Buffer[5];
+  Ack.TXPower = (int8_t)Buffer[6];
+  return true;
+}
+
+// find a field by type, returns false if the sender didn't include it
+inline bool NodeFrameGetField(const NodeFrame &Frame, uint8_t Type, int16_t &Value)
+{
+  for (uint8_t i = 0; i < Frame.FieldCount; i++)
+  {
+    if (Frame.Fields[i].Type == Type)
+    {
+      Value = Frame.Fields[i].Value;
+      return true;
+    }
+  }
+  return false;
+}
+
+#endif
@@ -0,0 +1,124 @@
+/*
+* Compiled web pages, see Page.h. PageFill runs on the web server's task, the values it reads from the pipeline are
+* either copies taken in PageBegin or go through NodeRead and the atomics.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "Page.h"
+#include "Link.h"
+#include "Alert.h"
+
+// the time and last packet as they are now, call before the first PageFill
+void PageBegin(PageStream &Page, const TemplatePart *Parts, byte PartCount)
+{
+  Page.Parts = Parts;
+  Page.PartCount = PartCount;
+  UpdateClock(Page.Clock);
+  LatestRead(Page.Latest);
+}
+
+// number of rows a page variable has, most are a single value but the sender table is a row per sender
+byte PageRows(TemplateSlot Slot)
+{
+  return Slot == SlotNodes ? NodeCount : TemplateRows(Slot);
+}
+
+// write a page variable into Text without using String, returns the length
+int PageValue(const PageStream &Page, TemplateSlot Slot, byte Row, char *Text, size_t Size)
+{
+  char Number[16];
+  const LoraLatest &Latest = Page.Latest;
+  switch (Slot)
+  {
+  case SlotFormattedDate:
+    return snprintf(Text, Size, "%s", Page.Clock.Date);
+  case SlotFormattedTime:
+    return snprintf(Text, Size, "%s", Page.Clock.Time);
+  // index.html
+  case SlotRxDate:
+    return snprintf(Text, Size, "%s", Latest.RxDate);
+  case SlotRxTime:
+    return snprintf(Text, Size, "%s", Latest.RxTime);
+  case SlotRSSI:
+    return snprintf(Text, Size, "%d", Latest.RSSI);
+  case SlotSNR:
+    return snprintf(Text, Size, "%.2f", Latest.SNR);
+  case SlotPacket:
+    return snprintf(Text, Size, "%s", Latest.Packet);
+  case SlotPacketSize:
+    return snprintf(Text, Size, "%d", Latest.PacketSize);
+  case SlotWaterLevel:
+    return Latest.WaterLevel < 0 ? 0 : snprintf(Text, Size, "%d", Latest.WaterLevel);
+  case SlotVolts:
+    return snprintf(Text, Size, "%.2f", Latest.Volts);
+  case SlotAlerts: // LoraTask may be changing them, at worst this is a packet behind
+    return AlertActiveText(Text, Size);
+  case SlotReceived:
+    return snprintf(Text, Size, "%u", LoraFramesReceived.load(std::memory_order_relaxed));
+  case SlotDropped:
+    return snprintf(Text, Size, "%u", LoraFramesDropped.load(std::memory_order_relaxed));
+  case SlotNodes:
+  {
+    NodeState Node;
+    NodeRead(Row, Node);
+    char Power[24] = "";
+    if (Node.SpreadingFactor != 0)
+      snprintf(Power, sizeof(Power), "%ddBm, asked %d", Node.TXPower, Node.AdviseTXPower);
+    return snprintf(Text, Size, "<tr id=\"node%u\"><td>%u</td><td>%d</td><td>%.2f</td><td>%lus</td><td>%d</td><td>%.2f</td><td>%u</td><td>%.1f%%</td>"
+                                "<td>%.0f%%</td><td>%.1fdB</td><td>%s</td></tr>",
+                    Node.ID, Node.ID, Node.Water, Node.VoltageRaw / 100.0, (Platform.Clock->Millis() - Node.LastSeenMillis) / 1000, Node.RSSI, Node.SNRQuarterdB / 4.0, Node.Received, NodeLossRate(Node),
+                    LinkDelivery(Node) * 100, LinkMargin(Node), Power);
+  }
+  // system.html
+  case SlotHistoryWritten:
+  {
+    char Flushes[16];
+    FormatNumber(HistoryBytesWritten, Number, sizeof(Number));
+    FormatNumber(HistoryFlushes, Flushes, sizeof(Flushes));
+    return snprintf(Text, Size, "%sB in %s flushes", Number, Flushes);
+  }
+  case SlotHistoryDropped:
+    return FormatNumber(HistoryDropped, Text, Size);
+  default:
+    return TemplateValue(Page, Slot, Row, Text, Size);
+  }
+}
+
+// chunked response filler for the web pages, called by the web server until it returns 0
+size_t PageFill(PageStream &Page, uint8_t *Buffer, size_t MaxLength)
+{
+  uint8_t *Out = Buffer;
+  size_t Room = MaxLength;
+  char Text[WebCarrySize];
+  while (Room > 0)
+  {
+    if (CarryDrain(Page.Carry, Out, Room)) // finish what didn't fit last time
+      continue;
+    if (Page.Part >= Page.PartCount)
+      break;
+    const TemplatePart &Part = Page.Parts[Page.Part];
+    if (Page.Offset < Part.Length) // fixed text, straight out of flash
+    {
+      size_t Length = Part.Length - Page.Offset;
+      if (Length > Room)
+        Length = Room;
+      memcpy_P(Out, Part.Text + Page.Offset, Length);
+      Out += Length;
+      Room -= Length;
+      Page.Offset += Length;
+    }
+    else if (Part.Slot != SlotNone && Page.Row < PageRows(Part.Slot))
+    {
+      int Length = PageValue(Page, Part.Slot, Page.Row++, Text, sizeof(Text));
+      CarryPut(Page.Carry, Out, Room, Text, Length);
+    }
+    else
+    {
+      Page.Part++;
+      Page.Offset = 0;
+      Page.Row = 0;
+    }
+  }
+  return Out - Buffer;
+}
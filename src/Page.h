@@ -0,0 +1,35 @@
+/*
+* Web pages compiled from the html in data by scripts/compile_templates.py and streamed out a chunk at a time, so a page
+* never has to be held whole in RAM. The values that come from the receive pipeline are filled in here, the board's
+* own through TemplateRows and TemplateValue, which main.cpp defines on the board and the simulator on a PC.
+*/
+
+#ifndef PAGE_H
+#define PAGE_H
+
+#include "Receiver.h"
+#include "Templates.h"
+
+// state of one streamed page
+struct PageStream
+{
+  const TemplatePart *Parts;
+  byte PartCount;
+  byte Part;       // part being sent
+  uint16_t Offset; // bytes of its text already sent, once all sent its variable is next
+  byte Row;        // rows of the variable already sent
+  LoraLatest Latest; // the last packet as it was when the page was asked for
+  ClockText Clock;   // and the time
+  ResponseCarry Carry;
+};
+
+// defined by the platform for the variables that aren't the pipeline's
+byte TemplateRows(TemplateSlot Slot);
+int TemplateValue(const PageStream &Page, TemplateSlot Slot, byte Row, char *Text, size_t Size);
+
+void PageBegin(PageStream &Page, const TemplatePart *Parts, byte PartCount);
+byte PageRows(TemplateSlot Slot);
+int PageValue(const PageStream &Page, TemplateSlot Slot, byte Row, char *Text, size_t Size);
+size_t PageFill(PageStream &Page, uint8_t *Buffer, size_t MaxLength);
+
+#endif
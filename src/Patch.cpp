@@ -0,0 +1,451 @@
+/*
+* Pack decoding, see Patch.h. One update at a time, PatchBegin refuses a second. Everything is checked as it is
+* decoded so a bad pack fails as soon as it goes wrong, and whatever it gets wrong the hash catches before the switch.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Patch.h"
+
+// SHA-256, plain C so the simulator checks the same code. Small rather than fast, writing flash takes far longer
+struct PatchSha
+{
+  uint32_t State[8];
+  uint64_t Length; // bytes so far
+  uint8_t Block[64];
+  byte Fill;
+};
+const uint32_t PatchShaRounds[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+inline uint32_t PatchRotate(uint32_t Value, byte Bits) { return (Value >> Bits) | (Value << (32 - Bits)); }
+
+void PatchShaBlock(PatchSha &Sha, const uint8_t *Block)
+{
+  uint32_t W[64];
+  for (byte i = 0; i < 16; i++)
+    W[i] = (uint32_t)Block[i * 4] << 24 | (uint32_t)Block[i * 4 + 1] << 16 | (uint32_t)Block[i * 4 + 2] << 8 | Block[i * 4 + 3];
+  for (byte i = 16; i < 64; i++)
+  {
+    uint32_t S0 = PatchRotate(W[i - 15], 7) ^ PatchRotate(W[i - 15], 18) ^ (W[i - 15] >> 3);
+    uint32_t S1 = PatchRotate(W[i - 2], 17) ^ PatchRotate(W[i - 2], 19) ^ (W[i - 2] >> 10);
+    W[i] = W[i - 16] + S0 + W[i - 7] + S1;
+  }
+  uint32_t V[8];
+  memcpy(V, Sha.State, sizeof(V));
+  for (byte i = 0; i < 64; i++)
+  {
+    uint32_t T1 = V[7] + (PatchRotate(V[4], 6) ^ PatchRotate(V[4], 11) ^ PatchRotate(V[4], 25)) + ((V[4] & V[5]) ^ (~V[4] & V[6])) +
+                  PatchShaRounds[i] + W[i];
+    uint32_t T2 = (PatchRotate(V[0], 2) ^ PatchRotate(V[0], 13) ^ PatchRotate(V[0], 22)) + ((V[0] & V[1]) ^ (V[0] & V[2]) ^ (V[1] & V[2]));
+    memmove(V + 1, V, 7 * sizeof(uint32_t));
+    V[4] += T1;
+    V[0] = T1 + T2;
+  }
+  for (byte i = 0; i < 8; i++)
+    Sha.State[i] += V[i];
+}
+
+void PatchShaBegin(PatchSha &Sha)
+{
+  const uint32_t Initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+  memcpy(Sha.State, Initial, sizeof(Initial));
+  Sha.Length = 0;
+  Sha.Fill = 0;
+}
+
+void PatchShaAdd(PatchSha &Sha, const uint8_t *Data, size_t Length)
+{
+  Sha.Length += Length;
+  while (Length > 0)
+  {
+    if (Sha.Fill == 0 && Length >= sizeof(Sha.Block))
+    {
+      PatchShaBlock(Sha, Data); // whole blocks straight from the caller
+      Data += sizeof(Sha.Block);
+      Length -= sizeof(Sha.Block);
+      continue;
+    }
+    size_t Part = sizeof(Sha.Block) - Sha.Fill < Length ? sizeof(Sha.Block) - Sha.Fill : Length;
+    memcpy(Sha.Block + Sha.Fill, Data, Part);
+    Sha.Fill += Part;
+    Data += Part;
+    Length -= Part;
+    if (Sha.Fill == sizeof(Sha.Block))
+    {
+      PatchShaBlock(Sha, Sha.Block);
+      Sha.Fill = 0;
+    }
+  }
+}
+
+void PatchShaEnd(PatchSha &Sha, uint8_t Hash[32])
+{
+  uint64_t Bits = Sha.Length * 8;
+  uint8_t Pad[72] = {0x80};
+  size_t PadLength = (Sha.Fill < 56 ? 56 : 120) - Sha.Fill;
+  for (byte i = 0; i < 8; i++)
+    Pad[PadLength + i] = Bits >> (56 - i * 8);
+  PatchShaAdd(Sha, Pad, PadLength + 8);
+  for (byte i = 0; i < 32; i++)
+    Hash[i] = Sha.State[i / 4] >> (24 - (i % 4) * 8);
+}
+
+// SHA-256 of a whole buffer, for the simulator and anything else that has the image in memory
+void PatchHash(const uint8_t *Data, size_t Length, uint8_t Hash[32])
+{
+  PatchSha Sha;
+  PatchShaBegin(Sha);
+  PatchShaAdd(Sha, Data, Length);
+  PatchShaEnd(Sha, Hash);
+}
+
+enum PatchStep : byte
+{
+  PatchStepHeader,
+  PatchStepOp,
+  PatchStepLength,   // the varint after PatchLengthEscape
+  PatchStepDistance, // a match's
+  PatchStepOffset,   // a copy's
+  PatchStepLiteral,
+  PatchStepFailed    // everything else is ignored until PatchEnd or PatchAbort
+};
+struct PatchState
+{
+  bool Active;  // between PatchBegin and PatchEnd or PatchAbort
+  bool Writing; // Platform.Image has begun
+  PatchStep Step;
+  PatchHeader Header;
+  size_t HeaderFill;
+  byte Op;
+  uint32_t Length; // bytes the op still has to make
+  uint32_t Varint;
+  byte Shift;
+  uint32_t BaseNext; // where the last copy ended in the running firmware
+  uint32_t Done;     // image bytes made
+  uint8_t *Window;   // the last PatchWindowSize image bytes, for matches
+  uint8_t Output[PatchOutputSize];
+  size_t OutputFill;
+  PatchSha Sha;
+  uint32_t Received; // pack bytes
+  unsigned long StartMillis;
+  unsigned long DecodeMicros; // in PatchWrite, the rest of an update's time is the network
+  char Error[64];
+};
+PatchState Patch;
+// metrics, the last update's stay until the next one starts
+MetricCounter MetricPatchStarted;
+MetricCounter MetricPatchApplied;
+MetricCounter MetricPatchFailed;
+MetricCounter MetricPatchReceived;
+MetricCounter MetricPatchImage;
+float PatchLastSeconds = 0;
+float PatchLastRatio = 0; // pack bytes over image bytes
+
+// stop decoding and throw away what has been written, returns false for the caller to return
+bool PatchFail(const char *Error)
+{
+  if (Patch.Step == PatchStepFailed)
+    return false;
+  snprintf(Patch.Error, sizeof(Patch.Error), "%s", Error);
+  Patch.Step = PatchStepFailed;
+  if (Patch.Writing)
+    Platform.Image->End(false);
+  Patch.Writing = false;
+  return false;
+}
+
+// hash and write out what has been made so far
+bool PatchFlush()
+{
+  PatchShaAdd(Patch.Sha, Patch.Output, Patch.OutputFill);
+  bool Good = Platform.Image->Write(Patch.Output, Patch.OutputFill);
+  Patch.OutputFill = 0;
+  return Good || PatchFail("couldn't write the image");
+}
+
+// one image byte, into the window and out to Platform.Image a piece at a time
+inline bool PatchEmit(uint8_t Byte)
+{
+  Patch.Window[Patch.Done++ & (PatchWindowSize - 1)] = Byte;
+  Patch.Output[Patch.OutputFill++] = Byte;
+  return Patch.OutputFill < PatchOutputSize || PatchFlush();
+}
+
+// the header has arrived, check it and the base before anything is written
+bool PatchStart()
+{
+  const PatchHeader &Header = Patch.Header;
+  bool Delta = Header.Flags & PatchDelta;
+  if (Header.Magic != PatchMagic)
+    return PatchFail("not a pack");
+  if (Header.Target > PatchFileSystem || (Header.Flags & ~PatchDelta) != 0 || Header.Size == 0)
+    return PatchFail("pack is for something this doesn't know");
+  if (Delta && (Header.Target != PatchFirmware || Header.BaseSize == 0))
+    return PatchFail("only firmware can be a delta");
+  if (Delta)
+  {
+    PatchShaBegin(Patch.Sha);
+    for (uint32_t Offset = 0; Offset < Header.BaseSize; Offset += PatchOutputSize)
+    {
+      size_t Part = Header.BaseSize - Offset < PatchOutputSize ? Header.BaseSize - Offset : PatchOutputSize;
+      if (Platform.Image->ReadBase(Offset, Patch.Output, Part) != Part)
+        return PatchFail("couldn't read the running firmware");
+      PatchShaAdd(Patch.Sha, Patch.Output, Part);
+    }
+    uint8_t Hash[32];
+    PatchShaEnd(Patch.Sha, Hash);
+    if (memcmp(Hash, Header.BaseHash, sizeof(Hash)) != 0)
+      return PatchFail("delta is from firmware this isn't running");
+  }
+  if (!Platform.Image->Begin(Header.Target, Header.Size))
+    return PatchFail("couldn't start writing the image");
+  Patch.Writing = true;
+  PatchShaBegin(Patch.Sha);
+  ConsolePrintf("Update: %s%s, %u bytes\n", Header.Target == PatchFirmware ? "firmware" : "file system", Delta ? " delta" : "",
+                Header.Size);
+  return true;
+}
+
+// an op's length is known, check it fits then read the rest of it
+bool PatchOpReady()
+{
+  if (Patch.Length > Patch.Header.Size - Patch.Done)
+    return PatchFail("pack makes more than the image");
+  Patch.Step = Patch.Op == PatchLiteral ? PatchStepLiteral : Patch.Op == PatchMatch ? PatchStepDistance : PatchStepOffset;
+  return true;
+}
+
+// repeat earlier output, Distance can be less than the length to repeat a run
+bool PatchMatchRun(uint32_t Distance)
+{
+  if (Distance == 0 || Distance > Patch.Done || Distance > PatchWindowSize)
+    return PatchFail("match reaches back too far");
+  for (uint32_t i = 0; i < Patch.Length; i++)
+    if (!PatchEmit(Patch.Window[(Patch.Done - Distance) & (PatchWindowSize - 1)]))
+      return false;
+  Patch.Step = PatchStepOp;
+  return true;
+}
+
+// copy from the running firmware, Zigzag is how far from where the last copy ended
+bool PatchCopyRun(uint32_t Zigzag)
+{
+  int64_t From = (int64_t)Patch.BaseNext + (int32_t)((Zigzag >> 1) ^ -(int32_t)(Zigzag & 1));
+  if (!(Patch.Header.Flags & PatchDelta) || From < 0 || From + Patch.Length > Patch.Header.BaseSize)
+    return PatchFail("copy is outside the running firmware");
+  uint8_t Base[256];
+  for (uint32_t Offset = 0; Offset < Patch.Length; Offset += sizeof(Base))
+  {
+    size_t Part = Patch.Length - Offset < sizeof(Base) ? Patch.Length - Offset : sizeof(Base);
+    if (Platform.Image->ReadBase(From + Offset, Base, Part) != Part)
+      return PatchFail("couldn't read the running firmware");
+    for (size_t i = 0; i < Part; i++)
+      if (!PatchEmit(Base[i]))
+        return false;
+  }
+  Patch.BaseNext = From + Patch.Length;
+  Patch.Step = PatchStepOp;
+  return true;
+}
+
+// start taking a pack, false if one is already being taken or updates can't be written anywhere
+bool PatchBegin()
+{
+  if (Patch.Active || Platform.Image == NULL)
+    return false;
+  uint8_t *Window = (uint8_t *)malloc(PatchWindowSize);
+  if (Window == NULL)
+    return false;
+  memset(&Patch, 0, sizeof(Patch));
+  Patch.Window = Window;
+  Patch.Active = true;
+  Patch.StartMillis = Platform.Clock->Millis();
+  MetricPatchStarted.Add();
+  return true;
+}
+
+// decode the next piece of the pack, false once it has failed
+bool PatchWrite(const uint8_t *Data, size_t Length)
+{
+  if (!Patch.Active || Patch.Step == PatchStepFailed)
+    return false;
+  unsigned long Start = Platform.Clock->Micros();
+  Patch.Received += Length;
+  MetricPatchReceived.Add(Length);
+  const uint8_t *End = Data + Length;
+  bool Good = true;
+  while (Data < End && Good)
+  {
+    switch (Patch.Step)
+    {
+    case PatchStepHeader:
+    {
+      size_t Part = sizeof(PatchHeader) - Patch.HeaderFill < (size_t)(End - Data) ? sizeof(PatchHeader) - Patch.HeaderFill : End - Data;
+      memcpy((uint8_t *)&Patch.Header + Patch.HeaderFill, Data, Part);
+      Data += Part;
+      Patch.HeaderFill += Part;
+      if (Patch.HeaderFill == sizeof(PatchHeader))
+      {
+        Patch.Step = PatchStepOp;
+        Good = PatchStart();
+      }
+      break;
+    }
+    case PatchStepOp:
+    {
+      uint8_t Op = *Data++;
+      Patch.Op = Op & 3;
+      if (Patch.Op > PatchCopy)
+        Good = PatchFail("pack has an op this doesn't know");
+      else if ((Op >> 2) == PatchLengthEscape)
+        Patch.Step = PatchStepLength;
+      else
+      {
+        Patch.Length = (Op >> 2) + 1;
+        Good = PatchOpReady();
+      }
+      break;
+    }
+    case PatchStepLength:
+    case PatchStepDistance:
+    case PatchStepOffset:
+    {
+      uint8_t Byte = *Data++;
+      if (Patch.Shift > 28)
+      {
+        Good = PatchFail("pack has a number that is too long");
+        break;
+      }
+      Patch.Varint |= (uint32_t)(Byte & 0x7F) << Patch.Shift;
+      Patch.Shift += 7;
+      if (Byte & 0x80)
+        break;
+      uint32_t Value = Patch.Varint;
+      Patch.Varint = 0;
+      Patch.Shift = 0;
+      if (Patch.Step == PatchStepLength)
+      {
+        Patch.Length = Value > Patch.Header.Size ? Patch.Header.Size + 1 : Value + PatchLengthEscape + 1; // a huge one fails next
+        Good = PatchOpReady();
+      }
+      else if (Patch.Step == PatchStepDistance)
+        Good = PatchMatchRun(Value);
+      else
+        Good = PatchCopyRun(Value);
+      break;
+    }
+    case PatchStepLiteral:
+    {
+      size_t Part = Patch.Length < (size_t)(End - Data) ? Patch.Length : End - Data;
+      for (size_t i = 0; i < Part && Good; i++)
+        Good = PatchEmit(Data[i]);
+      Data += Part;
+      Patch.Length -= Part;
+      if (Patch.Length == 0)
+        Patch.Step = PatchStepOp;
+      break;
+    }
+    default:
+      Good = false;
+    }
+  }
+  Patch.DecodeMicros += Platform.Clock->Micros() - Start;
+  return Good;
+}
+
+// the pack has finished or given up, count it and let the next one start
+void PatchFinish(bool Applied)
+{
+  (Applied ? MetricPatchApplied : MetricPatchFailed).Add();
+  if (Applied)
+    MetricPatchImage.Add(Patch.Done);
+  PatchLastSeconds = (Platform.Clock->Millis() - Patch.StartMillis) / 1000.0;
+  PatchLastRatio = Patch.Done == 0 ? 0 : (float)Patch.Received / Patch.Done;
+  free(Patch.Window);
+  Patch.Window = NULL;
+  Patch.Active = false;
+  if (Applied)
+    ConsolePrintf("Update applied, %u bytes sent for %u, %.1fs\n", Patch.Received, Patch.Done, PatchLastSeconds);
+  else
+    ConsolePrintf("Update failed, %s\n", Patch.Error);
+}
+
+// the whole pack has arrived. Switches to the new image if it is all there and matches its hash, true if it did
+bool PatchEnd()
+{
+  if (!Patch.Active)
+    return false;
+  unsigned long Start = Platform.Clock->Micros();
+  bool Good = Patch.Step != PatchStepFailed;
+  if (Good && (Patch.Step != PatchStepOp || Patch.Done != Patch.Header.Size))
+    Good = PatchFail("pack ended early");
+  if (Good && Patch.OutputFill > 0)
+    Good = PatchFlush();
+  if (Good)
+  {
+    uint8_t Hash[32];
+    PatchShaEnd(Patch.Sha, Hash);
+    if (memcmp(Hash, Patch.Header.Hash, sizeof(Hash)) != 0)
+      Good = PatchFail("image doesn't match its hash");
+  }
+  if (Good)
+  {
+    Patch.Writing = false;
+    if (!Platform.Image->End(true))
+      Good = PatchFail("couldn't switch to the new image");
+  }
+  Patch.DecodeMicros += Platform.Clock->Micros() - Start;
+  PatchFinish(Good);
+  return Good;
+}
+
+// the upload stopped part way, i.e. the connection dropped
+void PatchAbort()
+{
+  if (!Patch.Active)
+    return;
+  PatchFail("upload stopped part way");
+  PatchFinish(false);
+}
+
+bool PatchActive() { return Patch.Active; }
+
+// how the last or current update went, for the API
+int PatchJson(char *Text, size_t Size)
+{
+  const PatchHeader &Header = Patch.Header;
+  bool Failed = Patch.Step == PatchStepFailed;
+  return snprintf(Text, Size, "{\"target\":\"%s\",\"delta\":%s,\"received\":%u,\"image\":%u,\"decode_seconds\":%.3f,\"error\":\"%s\"}",
+                  Header.Target == PatchFileSystem ? "filesystem" : "firmware", Header.Flags & PatchDelta ? "true" : "false",
+                  Patch.Received, Patch.Done, Patch.DecodeMicros / 1e6, Failed ? Patch.Error : "");
+}
+
+double MetricReadPatchStarted(byte Row) { return MetricPatchStarted.Read(); }
+double MetricReadPatchApplied(byte Row) { return MetricPatchApplied.Read(); }
+double MetricReadPatchFailed(byte Row) { return MetricPatchFailed.Read(); }
+double MetricReadPatchReceived(byte Row) { return MetricPatchReceived.Read(); }
+double MetricReadPatchImage(byte Row) { return MetricPatchImage.Read(); }
+double MetricReadPatchProgress(byte Row) { return Patch.Active && Patch.Header.Size != 0 ? 100.0 * Patch.Done / Patch.Header.Size : 0; }
+double MetricReadPatchSeconds(byte Row) { return PatchLastSeconds; }
+double MetricReadPatchRatio(byte Row) { return PatchLastRatio; }
+
+const MetricExport PatchMetrics[] = {
+    {"water_update_started_total", "counter", "Updates started through /api/v1/update", MetricReadPatchStarted},
+    {"water_update_applied_total", "counter", "Updates that matched their hash and were switched to", MetricReadPatchApplied},
+    {"water_update_failed_total", "counter", "Updates thrown away", MetricReadPatchFailed},
+    {"water_update_received_bytes_total", "counter", "Pack bytes received", MetricReadPatchReceived},
+    {"water_update_image_bytes_total", "counter", "Image bytes the applied packs made", MetricReadPatchImage},
+    {"water_update_progress_percent", "gauge", "Progress of the current update", MetricReadPatchProgress},
+    {"water_update_last_seconds", "gauge", "Time from the first byte of the last update to its end", MetricReadPatchSeconds},
+    {"water_update_last_ratio", "gauge", "Pack bytes over image bytes for the last update", MetricReadPatchRatio},
+};
+const byte PatchMetricCount = sizeof(PatchMetrics) / sizeof(PatchMetrics[0]);
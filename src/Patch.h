@@ -0,0 +1,59 @@
+/*
+* Firmware and file system updates sent as packs made by scripts/ota_pack.py, which are smaller than the image they
+* make. A pack is a PatchHeader then ops: literal bytes, a copy of earlier output within PatchWindowSize (LZ77) or,
+* for a delta, a copy from the firmware the board is running now. PatchWrite decodes a pack as it arrives, in pieces
+* of any size, and writes the image through Platform.Image while hashing it. PatchEnd only lets Platform.Image switch
+* to the new image once its size and SHA-256 match the header, anything else throws it away.
+*/
+
+#ifndef PATCH_H
+#define PATCH_H
+
+#include "Receiver.h"
+
+const uint32_t PatchMagic = 0x314B5057; // "WPK1"
+const size_t PatchWindowSize = 16384;   // how far back a match can reach, must be a power of 2
+const size_t PatchOutputSize = 1024;    // image bytes gathered before each Platform.Image->Write
+const byte PatchLengthEscape = 63;      // in an op byte, the length carries on in a varint
+
+enum PatchTarget : uint8_t
+{
+  PatchFirmware,  // the next OTA app partition, deltas allowed
+  PatchFileSystem // the SPIFFS partition, being overwritten so it can't be a delta's base
+};
+enum PatchFlag : uint8_t
+{
+  PatchDelta = 1 // has copies from the running firmware
+};
+// an op byte is the PatchOp in the low 2 bits and length - 1 above, PatchLengthEscape means 64 + a varint.
+// A match is followed by a varint distance back, a copy by a zigzag varint from where the last copy ended
+enum PatchOp : uint8_t
+{
+  PatchLiteral, // length bytes follow
+  PatchMatch,
+  PatchCopy
+};
+struct PatchHeader
+{
+  uint32_t Magic;
+  uint8_t Target;
+  uint8_t Flags;
+  uint16_t Reserved;
+  uint32_t Size;         // image bytes
+  uint32_t BaseSize;     // bytes of the firmware the delta was made from, 0 if not a delta
+  uint8_t Hash[32];      // SHA-256 of the image
+  uint8_t BaseHash[32];  // SHA-256 of the firmware the delta was made from
+};
+
+extern const MetricExport PatchMetrics[];
+extern const byte PatchMetricCount;
+
+bool PatchBegin();
+bool PatchWrite(const uint8_t *Data, size_t Length);
+bool PatchEnd();
+void PatchAbort();
+bool PatchActive();
+int PatchJson(char *Text, size_t Size);
+void PatchHash(const uint8_t *Data, size_t Length, uint8_t Hash[32]);
+
+#endif
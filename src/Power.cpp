@@ -0,0 +1,119 @@
+/*
+* Power accounting, see Power.h. Time is kept per state in microseconds, the open stretch of each part's current
+* state is added up to now whenever it is read so nothing has to run periodically.
+*/
+
+#include <stdio.h>
+#include "Power.h"
+
+PowerStateInfo PowerStates[PowerStateCount] = {
+    {"cpu_active", PowerCPU, 68},          // both cores busy, the CPU figures are for the whole chip with the radio off
+    {"cpu_idle", PowerCPU, 30},
+    {"lora_receive", PowerLora, 11.5},     // LNA boost on, the LoRa library's default
+    {"lora_transmit", PowerLora, 87},      // 17dBm on PA_BOOST, LoraAckTXPower
+    {"wifi_active", PowerWiFi, 100},       // receiving, transmits are short and counted in with it
+    {"wifi_modem_sleep", PowerWiFi, 15},   // waking for every beacon, the Arduino default
+    {"wifi_off", PowerWiFi, 0},
+};
+uint64_t PowerMicros[PowerStateCount]; // finished stretches and moved time
+PowerState PowerCurrent[PowerPartCount];
+unsigned long PowerSince[PowerPartCount]; // Platform.Clock->Millis() the current state's stretch started
+uint64_t PowerMoved[PowerPartCount];      // time counted elsewhere by PowerMove that the open stretch has to give up
+HalLock PowerLock;
+
+// add a part's open stretch up to Now to its state, less what PowerMove has already counted elsewhere
+void PowerClose(byte Part, unsigned long Now)
+{
+  uint64_t Stretch = (uint64_t)(Now - PowerSince[Part]) * 1000;
+  uint64_t Taken = PowerMoved[Part] < Stretch ? PowerMoved[Part] : Stretch;
+  PowerMicros[PowerCurrent[Part]] += Stretch - Taken;
+  PowerMoved[Part] -= Taken;
+  PowerSince[Part] = Now;
+}
+
+// start accounting, one state for each part
+void PowerBegin(PowerState CPU, PowerState Lora, PowerState WiFi)
+{
+  unsigned long Now = Platform.Clock->Millis();
+  HalEnter(PowerLock);
+  PowerCurrent[PowerCPU] = CPU;
+  PowerCurrent[PowerLora] = Lora;
+  PowerCurrent[PowerWiFi] = WiFi;
+  for (byte Part = 0; Part < PowerPartCount; Part++)
+    PowerSince[Part] = Now;
+  HalExit(PowerLock);
+}
+
+// move a part to a new state from now
+void PowerSet(PowerState State)
+{
+  byte Part = PowerStates[State].Part;
+  unsigned long Now = Platform.Clock->Millis();
+  HalEnter(PowerLock);
+  if (PowerCurrent[Part] != State)
+  {
+    PowerClose(Part, Now);
+    PowerCurrent[Part] = State;
+  }
+  HalExit(PowerLock);
+}
+
+// Micros of the part's current state were spent in State instead, i.e. a task's busy time or an ack's time on air
+void PowerMove(PowerState State, uint32_t Micros)
+{
+  HalEnter(PowerLock);
+  PowerMicros[State] += Micros;
+  PowerMoved[PowerStates[State].Part] += Micros;
+  HalExit(PowerLock);
+}
+
+// time in each state up to now
+void PowerRead(uint64_t Micros[PowerStateCount])
+{
+  unsigned long Now = Platform.Clock->Millis();
+  HalEnter(PowerLock);
+  for (byte Part = 0; Part < PowerPartCount; Part++)
+    PowerClose(Part, Now);
+  for (byte State = 0; State < PowerStateCount; State++)
+    Micros[State] = PowerMicros[State];
+  HalExit(PowerLock);
+}
+
+// average current since PowerBegin, every part adds its share
+float PowerAverageMilliamps()
+{
+  uint64_t Micros[PowerStateCount];
+  PowerRead(Micros);
+  double Charge = 0; // milliamp microseconds
+  uint64_t Elapsed = 0;
+  for (byte State = 0; State < PowerStateCount; State++)
+  {
+    Charge += (double)Micros[State] * PowerStates[State].Milliamps;
+    if (PowerStates[State].Part == PowerCPU)
+      Elapsed += Micros[State];
+  }
+  return Elapsed == 0 ? 0 : Charge / Elapsed;
+}
+
+double MetricReadPowerSeconds(byte Row)
+{
+  uint64_t Micros[PowerStateCount];
+  PowerRead(Micros);
+  return Micros[Row] / 1e6;
+}
+double MetricReadPowerMilliamps(byte Row) { return PowerStates[Row].Milliamps; }
+double MetricReadPowerAverage(byte Row) { return PowerAverageMilliamps(); }
+bool MetricPowerLabel(byte Row, char *Text, size_t Size)
+{
+  if (Row >= PowerStateCount)
+    return false;
+  snprintf(Text, Size, "state=\"%s\"", PowerStates[Row].Name);
+  return true;
+}
+
+const MetricExport PowerMetrics[] = {
+    {"water_power_state_seconds_total", "counter", "Time each part of the board spent in each power state", MetricReadPowerSeconds, NULL, 0, MetricPowerLabel},
+    {"water_power_state_milliamps", "gauge", "Datasheet current the estimate uses for each power state", MetricReadPowerMilliamps, NULL, 0, MetricPowerLabel},
+    {"water_power_average_milliamps", "gauge", "Estimated average current since boot", MetricReadPowerAverage},
+};
+const byte PowerMetricCount = sizeof(PowerMetrics) / sizeof(PowerMetrics[0]);
@@ -0,0 +1,48 @@
+/*
+* Power accounting, an estimate of the average current from the time each part of the board spends in each state and
+* the datasheet current for that state. The board has nothing to measure current with, scripts/power_model.py checks
+* the estimate against a model of its own. Each part is always in exactly one state, PowerSet moves it to another
+* and PowerMove counts a short burst, i.e. an ack going out, without the caller keeping track of what it interrupted.
+*/
+
+#ifndef POWER_H
+#define POWER_H
+
+#include "Receiver.h"
+
+enum PowerPart : byte
+{
+  PowerCPU,
+  PowerLora,
+  PowerWiFi,
+  PowerPartCount
+};
+enum PowerState : byte
+{
+  PowerCPUActive,
+  PowerCPUIdle,        // every task waiting, light sleep if the board has it on
+  PowerLoraReceive,
+  PowerLoraTransmit,
+  PowerWiFiActive,     // connecting, or connected without power save
+  PowerWiFiModemSleep, // connected, the modem only wakes for beacons and traffic
+  PowerWiFiOff,
+  PowerStateCount
+};
+struct PowerStateInfo
+{
+  const char *Name; // label on /metrics
+  PowerPart Part;
+  float Milliamps;
+};
+// ESP32 and SX1276 datasheet figures at 240MHz, the board changes the CPU ones when it runs slower or light sleeps
+extern PowerStateInfo PowerStates[PowerStateCount];
+extern const MetricExport PowerMetrics[];
+extern const byte PowerMetricCount;
+
+void PowerBegin(PowerState CPU, PowerState Lora, PowerState WiFi);
+void PowerSet(PowerState State);
+void PowerMove(PowerState State, uint32_t Micros);
+void PowerRead(uint64_t Micros[PowerStateCount]);
+float PowerAverageMilliamps();
+
+#endif
@@ -0,0 +1,1039 @@
+/*
+* The receive pipeline, from the receive callback to history and the API.
+* Only talks to the board through Platform so it runs the same on a PC, see Hal.h
+*/
+
+#include <algorithm>
+#include <ctype.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "Receiver.h"
+#include "Link.h"
+#include "Uplink.h"
+#include "Alert.h"
+
+// clock
+ClockText LoraClock; // only touched by LoraProcessing and EventsPublish, both on LoraTask
+// single producer (LoraReceive) single consumer (LoraRingPop) ring of received packets, indexes only ever increase
+LoraFrame LoraRing[LoraRingSize];
+std::atomic<uint32_t> LoraRingHead(0);       // written only by LoraReceive
+std::atomic<uint32_t> LoraRingTail(0);       // written only by LoraRingPop
+std::atomic<uint32_t> LoraFramesReceived(0); // every packet the radio has given us
+std::atomic<uint32_t> LoraFramesDropped(0);  // packets lost because the ring was full
+LoraLatest LoraWorking = {0, 0, 0.0, "", 0, -1};   // only touched by LoraProcessing
+LoraLatest LoraPublished = {0, 0, 0.0, "", 0, -1}; // what LatestRead copies
+SeqLock LoraPublishedLock;
+unsigned long LoraDecodeCycles = 0; // CPU cycles taken by the last LoraDecodePacket call, for tuning
+char LoraTextPreamble[LoraPreambleMaxSize] = "A1A"; // only touched by LoraConfigure and LoraProcessing, from the same task
+byte LoraTextPreambleSize = sizeof(LoraPacketPreAmble) - 1;
+int LoraPacketLimit = LoraMaxPacketSize;
+// senders
+NodeState Nodes[NodeTableSize];
+byte NodeCount = 0;
+byte NodeSlot[256];         // index into Nodes + 1 for each node ID, 0 if not seen yet
+uint32_t NodeTableFull = 0; // packets ignored because there was no room for another sender
+uint32_t NodeUpdates = 0;   // goes up whenever any sender's entry changes, used for the API ETag
+SeqLock NodeLock;           // held by NodeRecord while it changes the table
+// metrics, only written by whatever runs LoraProcessing
+MetricCounter MetricPacketsGood;
+MetricCounter MetricPacketsNotForUs; // wrong preamble or failed the CRC
+MetricCounter MetricPacketsTooLong;
+MetricHistogram MetricLoraProcessing;
+MetricHistogram MetricLoraLatency;
+MetricSharedCounter MetricSnapshotRetries; // written by every task that reads a snapshot, WarmSave on LoraTask too
+MetricSharedCounter MetricSnapshotTorn;
+MetricCounter MetricEventsQueued;  // written by EventsQueue on LoraTask
+MetricCounter MetricEventsDropped;
+float MetricCounterCycles = 0;
+float MetricHistogramCycles = 0;
+// history
+struct HistorySummary // hourly or daily record being built for one sender
+{
+  bool Active;
+  uint8_t NodeID;
+  uint32_t PeriodStart;
+  uint16_t Count;
+  int16_t WaterMin;
+  int32_t VoltageSum;
+  int16_t VoltageMin;
+  int32_t RSSISum;
+  int32_t SNRSum;
+};
+HistorySegmentState HistoryState[HistoryTierCount];
+HistorySummary HistorySummaries[HistoryTierCount - 1][NodeTableSize]; // only touched by HistoryFlush
+HistoryRecord HistoryPending[HistoryPendingSize]; // readings waiting for HistoryFlush to write them
+byte HistoryPendingCount = 0;
+HalLock HistoryMux;
+uint32_t HistoryDropped = 0;      // readings lost because flash writes fell behind
+uint32_t HistoryFlushes = 0;
+uint32_t HistoryBytesWritten = 0; // everything sent to flash including segment headers, for wear
+
+// Format a whole number with commas, mainly used to display the system information values and file sizes, i.e. 240,000,000MHz clock speed
+// Writes into Text without using String, returns the length
+int FormatNumber(uint32_t Number, char *Text, size_t Size)
+{
+  char Reversed[16]; // 4,294,967,295 is the longest
+  int Length = 0;
+  do
+  {
+    if (Length % 4 == 3) // a comma every 3 digits, working from right hand side to left
+      Reversed[Length++] = ',';
+    Reversed[Length++] = '0' + Number % 10;
+    Number /= 10;
+  } while (Number > 0);
+  if (Length >= (int)Size)
+    Length = Size - 1;
+  for (int i = 0; i < Length; i++)
+    Text[i] = Reversed[Length - 1 - i];
+  Text[Length] = '\0';
+  return Length;
+}
+
+// printf to serial, or stdout on a PC
+void ConsolePrintf(const char *Format, ...)
+{
+  char Text[160];
+  va_list Args;
+  va_start(Args, Format);
+  vsnprintf(Text, sizeof(Text), Format, Args);
+  va_end(Args);
+  Platform.Console->Print(Text);
+}
+
+// format the date and time strings, only done when something is going to use them and at most once per second
+void UpdateClock(ClockText &Text)
+{
+  unsigned long Second = Platform.Clock->Millis() / 1000;
+  if (Second == Text.Second)
+    return;
+  Platform.Clock->Format(Text.Date, sizeof(Text.Date), Text.Time, sizeof(Text.Time));
+  Text.Second = Second;
+}
+
+// seconds since 1970 UTC, used to time stamp history
+uint32_t ClockUTC()
+{
+  return Platform.Clock->UTC();
+}
+
+// text packet preamble and longest good packet from the config, call from whatever runs LoraProcessing
+void LoraConfigure(const char *Preamble, int PacketLimit)
+{
+  snprintf(LoraTextPreamble, sizeof(LoraTextPreamble), "%s", Preamble);
+  LoraTextPreambleSize = strlen(LoraTextPreamble);
+  LoraPacketLimit = PacketLimit < LoraMaxPacketSize ? PacketLimit : LoraMaxPacketSize;
+}
+
+// Decode a packet in place, no String or heap use.  Returns false if the packet is not for us
+// Binary packets are described in NodeFrame.h.  Old text packets are the preamble, one water level character, then the voltage * 100 as ASCII digits
+bool LoraDecodePacket(const char *Packet, int Length, LoraReading &Reading)
+{
+  if (Length > 0 && (uint8_t)Packet[0] == NodeFrameMagic)
+  {
+    NodeFrame Frame;
+    if (!NodeFrameDecode((const uint8_t *)Packet, Length, Frame))
+      return false;
+    int16_t Value;
+    Reading.NodeID = Frame.NodeID;
+    Reading.HasSequence = true;
+    Reading.Sequence = Frame.Sequence;
+    Reading.Water = NodeFrameGetField(Frame, NodeFieldWater, Value) ? Value : -1;
+    Reading.VoltageRaw = NodeFrameGetField(Frame, NodeFieldVolts, Value) ? Value : 0;
+    Reading.Volts = Reading.VoltageRaw / 100.0;
+    Reading.SpreadingFactor = 0;
+    Reading.TXPower = 0;
+    if (NodeFrameGetField(Frame, NodeFieldLink, Value))
+    {
+      Reading.SpreadingFactor = (uint16_t)Value >> 8;
+      Reading.TXPower = (int8_t)(Value & 0xFF);
+    }
+    return true;
+  }
+  if (Length <= LoraTextPreambleSize || memcmp(Packet, LoraTextPreamble, LoraTextPreambleSize) != 0)
+    return false;
+  Reading.NodeID = NodeLegacyID;
+  Reading.HasSequence = false;
+  Reading.Sequence = 0;
+  Reading.Water = isdigit(Packet[LoraTextPreambleSize]) ? Packet[LoraTextPreambleSize] - '0' : -1;
+  // whole hundredths up to the first non digit, senders never send a fraction. Unlike the old String.toFloat() a '.'
+  // ends the number rather than adding a fraction
+  int i = LoraTextPreambleSize + 1;
+  bool Negative = false;
+  if (i < Length && (Packet[i] == '-' || Packet[i] == '+'))
+    Negative = (Packet[i++] == '-');
+  long Raw = 0;
+  for (; i < Length && isdigit(Packet[i]); i++)
+  {
+    Raw = Raw * 10 + (Packet[i] - '0');
+    if (Raw > INT16_MAX) // more than NodeState keeps, a garbled packet rather than a real voltage
+      return false;
+  }
+  Reading.VoltageRaw = Negative ? -Raw : Raw;
+  Reading.Volts = Reading.VoltageRaw / 100.0;
+  Reading.SpreadingFactor = 0;
+  Reading.TXPower = 0;
+  return true;
+}
+
+// find the sender in the node table, adding it if there is room. Returns NULL if the table is full
+NodeState *NodeFind(uint8_t ID)
+{
+  if (NodeSlot[ID] != 0)
+    return &Nodes[NodeSlot[ID] - 1];
+  if (NodeCount >= NodeTableSize)
+    return NULL;
+  NodeState *Node = &Nodes[NodeCount++];
+  memset(Node, 0, sizeof(NodeState));
+  Node->ID = ID;
+  NodeSlot[ID] = NodeCount;
+  return Node;
+}
+
+// update a sender's entry from a good packet, counting any gap in sequence numbers as lost packets
+NodeState *NodeRecord(const LoraReading &Reading, const LoraFrame &Frame)
+{
+  NodeLock.WriteBegin();
+  NodeState *Node = NodeFind(Reading.NodeID);
+  if (Node == NULL)
+  {
+    NodeLock.WriteEnd();
+    NodeTableFull++;
+    return NULL;
+  }
+  uint16_t Gap = 1; // the first packet, and every text packet, is taken as the next one
+  if (Node->HasSequence && Reading.HasSequence)
+  {
+    Gap = Reading.Sequence - Node->LastSequence;
+    if (Gap > 1 && Gap < NodeMaxSequenceGap)
+      Node->Lost += Gap - 1;
+  }
+  LinkUpdate(*Node, Reading, Frame, Gap);
+  Node->HasSequence = Reading.HasSequence;
+  Node->LastSequence = Reading.Sequence;
+  Node->Water = Reading.Water;
+  Node->VoltageRaw = Reading.VoltageRaw;
+  Node->RSSI = Frame.RSSI;
+  Node->SNRQuarterdB = Frame.SNRQuarterdB;
+  Node->LastSeenMillis = Platform.Clock->Millis();
+  Node->Received++;
+  NodeUpdates++;
+  NodeLock.WriteEnd();
+  return Node;
+}
+
+// copy a sender's entry for another task, Row must be below NodeCount
+void NodeRead(byte Row, NodeState &Node)
+{
+  while (true)
+  {
+    uint32_t Start = NodeLock.ReadBegin();
+    memcpy(&Node, &Nodes[Row], sizeof(Node));
+    if (!NodeLock.ReadRetry(Start))
+      return;
+    MetricSnapshotRetries.Add();
+  }
+}
+
+// checksum of a LoraLatest, everything before Check
+uint32_t LatestChecksum(const LoraLatest &Latest)
+{
+  uint32_t Hash = 2166136261UL;
+  const uint8_t *Bytes = (const uint8_t *)&Latest;
+  for (size_t i = 0; i < offsetof(LoraLatest, Check); i++)
+    Hash = (Hash ^ Bytes[i]) * 16777619UL;
+  return Hash;
+}
+
+// true if a copy is whole, the copy from before the first packet has nothing to check
+bool LatestCheck(const LoraLatest &Latest)
+{
+  return Latest.Published == 0 || Latest.Check == LatestChecksum(Latest);
+}
+
+// make LoraWorking visible to LatestRead
+void LatestPublish()
+{
+  LoraWorking.Published++;
+  LoraWorking.Check = LatestChecksum(LoraWorking);
+  LoraPublishedLock.WriteBegin();
+  memcpy(&LoraPublished, &LoraWorking, sizeof(LoraPublished));
+  LoraPublishedLock.WriteEnd();
+}
+
+// copy the last packet for another task
+void LatestRead(LoraLatest &Latest)
+{
+  while (true)
+  {
+    uint32_t Start = LoraPublishedLock.ReadBegin();
+    memcpy(&Latest, &LoraPublished, sizeof(Latest));
+    if (!LoraPublishedLock.ReadRetry(Start))
+      break;
+    MetricSnapshotRetries.Add();
+  }
+  if (!LatestCheck(Latest))
+    MetricSnapshotTorn.Add();
+}
+
+// percentage of a sender's packets that never arrived
+float NodeLossRate(const NodeState &Node)
+{
+  uint32_t Expected = Node.Received + Node.Lost;
+  return Expected == 0 ? 0.0 : Node.Lost * 100.0 / Expected;
+}
+
+// add a packet latency to the histogram and print it every LatencyReportPackets packets
+void LatencyRecord(unsigned long Micros)
+{
+  MetricLoraLatency.Observe(Micros);
+  uint32_t Count = MetricLoraLatency.Count.Read();
+  if (Count % LatencyReportPackets != 0)
+    return;
+  ConsolePrintf("Packet to display latency, %u packets:\n", Count);
+  for (byte i = 0; i < MetricHistogramBuckets; i++)
+  {
+    uint32_t InBucket = MetricLoraLatency.Buckets[i].Read();
+    if (InBucket == 0)
+      continue;
+    if (i == MetricHistogramBuckets - 1)
+      ConsolePrintf("  >=%uus: %u\n", MetricBucketLower(i), InBucket);
+    else
+      ConsolePrintf("  %u-%uus: %u\n", MetricBucketLower(i), MetricBucketLower(i + 1) - 1, InBucket);
+  }
+}
+
+// queue a reading for HistoryFlush, only copies into RAM so it is safe on the radio path
+void HistoryAppend(const NodeState &Node)
+{
+  HistoryRecord Record;
+  Record.Time = ClockUTC();
+  Record.NodeID = Node.ID;
+  Record.Count = 1;
+  Record.Water = Node.Water;
+  Record.VoltageRaw = Node.VoltageRaw;
+  Record.VoltageMin = Node.VoltageRaw;
+  Record.RSSI = Node.RSSI;
+  Record.SNRQuarterdB = Node.SNRQuarterdB;
+  Record.Reserved = 0;
+  HalEnter(HistoryMux);
+  if (HistoryPendingCount < HistoryPendingSize)
+    HistoryPending[HistoryPendingCount++] = Record;
+  else
+    HistoryDropped++;
+  HalExit(HistoryMux);
+}
+
+// live page events, formatted where they happen and sent by EventsService from the web server's core so LoraTask
+// never waits on the web server's lock or its allocation of a copy for each page
+struct EventsItem
+{
+  const char *Name; // a string literal
+  uint32_t ID;
+  char Data[EventsDataSize];
+};
+EventsItem EventsRing[EventsRingSize];
+std::atomic<uint32_t> EventsHead(0); // written only by EventsQueue
+std::atomic<uint32_t> EventsTail(0); // written only by EventsService
+
+// queue an event for every open page, call from LoraTask. If EventsService has fallen behind the event is dropped,
+// the next packet updates the page anyway
+bool EventsQueue(const char *Name, const char *Data)
+{
+  uint32_t Head = EventsHead.load(std::memory_order_relaxed);
+  if (Head - EventsTail.load(std::memory_order_acquire) >= EventsRingSize)
+  {
+    MetricEventsDropped.Add();
+    return false;
+  }
+  EventsItem &Item = EventsRing[Head & (EventsRingSize - 1)];
+  Item.Name = Name;
+  Item.ID = Platform.Clock->Millis();
+  snprintf(Item.Data, sizeof(Item.Data), "%s", Data);
+  EventsHead.store(Head + 1, std::memory_order_release);
+  MetricEventsQueued.Add();
+  return true;
+}
+
+bool EventsPending()
+{
+  return EventsTail.load(std::memory_order_relaxed) != EventsHead.load(std::memory_order_acquire);
+}
+
+// send the oldest queued event to the open pages, returns false once there are none. Only ever call from one task
+bool EventsService()
+{
+  uint32_t Tail = EventsTail.load(std::memory_order_relaxed);
+  if (Tail == EventsHead.load(std::memory_order_acquire))
+    return false;
+  const EventsItem &Item = EventsRing[Tail & (EventsRingSize - 1)];
+  Platform.Network->Publish(Item.Name, Item.Data, Item.ID);
+  EventsTail.store(Tail + 1, std::memory_order_release); // the slot can be reused
+  return true;
+}
+
+// push a good packet to every open home page, the keys are the ids of the page elements to update
+void EventsPublish(const NodeState &Node)
+{
+  if (Platform.Network->Listeners() == 0)
+    return;
+  const LoraLatest &Latest = LoraWorking; // same task as LoraProcessing so no need for a copy
+  char Packet[sizeof(Latest.Packet)]; // old text packets can hold anything, keep the JSON valid
+  for (byte i = 0; i < sizeof(Packet); i++)
+  {
+    char c = Latest.Packet[i];
+    Packet[i] = (c == '\0' || (c >= ' ' && c <= '~' && c != '"' && c != '\\')) ? c : '?';
+    if (c == '\0')
+      break;
+  }
+  char Power[24] = ""; // senders that don't report it leave the cell empty
+  if (Node.SpreadingFactor != 0)
+    snprintf(Power, sizeof(Power), "%ddBm, asked %d", Node.TXPower, Node.AdviseTXPower);
+  char Data[EventsDataSize];
+  snprintf(Data, sizeof(Data),
+           "{\"FormattedDate\":\"%s\",\"FormattedTime\":\"%s\",\"RxDate\":\"%s\",\"RxTime\":\"%s\",\"RSSI\":%d,\"SNR\":\"%.2f\","
+           "\"Packet\":\"%s\",\"PacketSize\":%d,\"WaterLevel\":%d,\"Volts\":\"%.2f\",\"Received\":%u,\"Dropped\":%u,"
+           "\"Node\":[%u,%d,\"%.2f\",\"0s\",%d,\"%.2f\",%u,\"%.1f%%\",\"%.0f%%\",\"%.1fdB\",\"%s\"]}",
+           LoraClock.Date, LoraClock.Time, Latest.RxDate, Latest.RxTime, Latest.RSSI, Latest.SNR,
+           Packet, Latest.PacketSize, Latest.WaterLevel, Latest.Volts, LoraFramesReceived.load(std::memory_order_relaxed), LoraFramesDropped.load(std::memory_order_relaxed),
+           Node.ID, Node.Water, Node.VoltageRaw / 100.0, Node.RSSI, Node.SNRQuarterdB / 4.0, Node.Received, NodeLossRate(Node),
+           LinkDelivery(Node) * 100, LinkMargin(Node), Power);
+  EventsQueue("packet", Data);
+}
+
+void LoraProcessing(const LoraFrame &Frame) // process a received packet, called for each packet taken out of the ring
+{
+  HalDisplay *Display = Platform.Display;
+  LoraLatest &Latest = LoraWorking;
+  const NodeState *AckNode = NULL; // sender waiting for an ack
+  unsigned long Start = Platform.Clock->Micros();
+  Latest.RSSI = Frame.RSSI;
+  Latest.SNR = Frame.SNRQuarterdB / 4.0;
+  UpdateClock(LoraClock);
+  char OLEDLine[OLEDLineLength];      // one line of the OLED display
+  snprintf(OLEDLine, sizeof(OLEDLine), "RSSI: %d, SNR: %.2f", Latest.RSSI, Latest.SNR);
+  Display->SetLine(0, OLEDLine);
+  snprintf(OLEDLine, sizeof(OLEDLine), "Received %d bytes", Frame.Size);
+  Display->SetLine(1, OLEDLine);
+
+  // see if it is valid and for us
+  if (Frame.Size <= LoraPacketLimit)
+  {
+    LoraReading Reading;
+    unsigned long DecodeStart = Platform.Clock->Cycles();
+    bool GoodPacket = LoraDecodePacket(Frame.Packet, Frame.Length, Reading);
+    LoraDecodeCycles = Platform.Clock->Cycles() - DecodeStart;
+    NodeState *Node = GoodPacket ? NodeRecord(Reading, Frame) : NULL;
+    if (Node != NULL)
+    {
+      HistoryAppend(*Node);
+      UplinkAdd(*Node);
+    }
+    if (GoodPacket && Node == NULL)
+    { // NodeRecord has counted it in NodeTableFull
+      snprintf(OLEDLine, sizeof(OLEDLine), "Node %u", Reading.NodeID);
+      Display->SetLine(2, OLEDLine);
+      Display->SetLine(3, "Too many senders");
+      snprintf(OLEDLine, sizeof(OLEDLine), "%s %s", LoraClock.Date, LoraClock.Time);
+      Display->SetLine(4, OLEDLine);
+    }
+    else if (GoodPacket) // only process if it has the correct preamble otherwise ignore it as it's not for us
+    {
+      Latest.WaterLevel = Reading.Water;
+      Latest.Volts = Reading.Volts;
+      memcpy(Latest.RxDate, LoraClock.Date, sizeof(Latest.RxDate)); // keep the received date and time
+      memcpy(Latest.RxTime, LoraClock.Time, sizeof(Latest.RxTime));
+      if (Reading.HasSequence) // binary packet, keep it as hex so it can be shown
+      {
+        for (byte i = 0; i < Frame.Length; i++)
+          snprintf(Latest.Packet + 2 * i, 3, "%02X", (uint8_t)Frame.Packet[i]);
+        snprintf(OLEDLine, sizeof(OLEDLine), "Node %u #%u, lost %.1f%%", Node->ID, Reading.Sequence, NodeLossRate(*Node));
+        Display->SetLine(2, OLEDLine);
+      }
+      else
+      {
+        memcpy(Latest.Packet, Frame.Packet, Frame.Length + 1);
+        Display->SetLine(2, Frame.Packet);
+      }
+      Latest.PacketSize = Frame.Size;
+      snprintf(OLEDLine, sizeof(OLEDLine), "Water: %d, Voltage: %.2f", Latest.WaterLevel, Latest.Volts);
+      Display->SetLine(3, OLEDLine);
+      snprintf(OLEDLine, sizeof(OLEDLine), "%s %s", Latest.RxDate, Latest.RxTime);
+      Display->SetLine(4, OLEDLine);
+      AlertEvaluate(*Node);
+      if (AlertDisplayLine(OLEDLine, sizeof(OLEDLine))) // an active alert takes the date's place
+        Display->SetLine(4, OLEDLine);
+      ConsolePrintf("Packet received: %s %s - Node:%u, Packet:%s, Size:%d\n", Latest.RxDate, Latest.RxTime, Node->ID, Latest.Packet, Frame.Size);
+      ConsolePrintf("Lora RSSI: %d, SNR: %.2f\n", Latest.RSSI, Latest.SNR);
+      ConsolePrintf("Water: %d, Voltage: %.2f, Decode cycles: %lu\n\n", Latest.WaterLevel, Latest.Volts, LoraDecodeCycles);
+      EventsPublish(*Node);
+      MetricPacketsGood.Add();
+      if (Reading.SpreadingFactor != 0)
+        AckNode = Node;
+    }
+    else
+    { // packet doesn't match preamble or failed its CRC, can't be for us or is corrupted
+      Display->SetLine(2, "");
+      Display->SetLine(3, "Packet not for us");
+      MetricPacketsNotForUs.Add();
+      snprintf(OLEDLine, sizeof(OLEDLine), "%s %s", LoraClock.Date, LoraClock.Time);
+      Display->SetLine(4, OLEDLine);
+    }
+  }
+  else
+  { // packet is longer than LoraPacketLimit, only the first LoraMaxPacketSize bytes were kept
+    Display->SetLine(2, "");
+    Display->SetLine(3, "Packet too long");
+    MetricPacketsTooLong.Add();
+    snprintf(OLEDLine, sizeof(OLEDLine), "%s %s", LoraClock.Date, LoraClock.Time);
+    Display->SetLine(4, OLEDLine);
+  }
+  LatestPublish();
+  Display->Update();
+  unsigned long End = Platform.Clock->Micros();
+  MetricLoraProcessing.Observe(End - Start);
+  LatencyRecord(End - Frame.RxMicros);
+  if (AckNode != NULL) // last so its time on air isn't counted as processing
+    LinkAck(*AckNode);
+}
+
+// checksum of a WarmState, Version up to Check
+uint32_t WarmChecksum(const WarmState &State)
+{
+  uint32_t Hash = 2166136261UL;
+  const uint8_t *Bytes = (const uint8_t *)&State;
+  for (size_t i = offsetof(WarmState, Version); i < offsetof(WarmState, Check); i++)
+    Hash = (Hash ^ Bytes[i]) * 16777619UL;
+  return Hash;
+}
+
+// copy the sender table and the last packet to somewhere that outlives a restart. Magic goes last so a reset part
+// way through leaves nothing to restore rather than half of it
+void WarmSave(WarmState &State)
+{
+  State.Magic = 0;
+  State.Version = WarmVersion;
+  State.Size = sizeof(WarmState);
+  State.UTC = ClockUTC();
+  State.Millis = Platform.Clock->Millis();
+  State.NodeCount = NodeCount;
+  for (byte i = 0; i < State.NodeCount; i++)
+    NodeRead(i, State.Nodes[i]);
+  LatestRead(State.Latest);
+  State.Check = WarmChecksum(State);
+  State.Magic = WarmMagic;
+}
+
+// put back what WarmSave kept, before the radio starts. Returns false, changing nothing, if there is nothing valid
+// to restore, i.e. after power on or an update that changed the layout. LastSeenMillis is moved to the new Millis,
+// counting the time the restart took when the clock knows it
+bool WarmRestore(const WarmState &State)
+{
+  if (State.Magic != WarmMagic || State.Version != WarmVersion || State.Size != sizeof(WarmState) ||
+      State.NodeCount > NodeTableSize || State.Check != WarmChecksum(State))
+    return false;
+  unsigned long Now = Platform.Clock->Millis();
+  uint32_t UTC = ClockUTC();
+  unsigned long Away = State.UTC >= ClockValidUTC && UTC > State.UTC ? (UTC - State.UTC) * 1000 : 0;
+  NodeLock.WriteBegin();
+  memset(NodeSlot, 0, sizeof(NodeSlot));
+  NodeCount = State.NodeCount;
+  for (byte i = 0; i < NodeCount; i++)
+  {
+    Nodes[i] = State.Nodes[i];
+    Nodes[i].LastSeenMillis = Now - Away - (State.Millis - State.Nodes[i].LastSeenMillis);
+    NodeSlot[Nodes[i].ID] = i + 1;
+  }
+  NodeUpdates++;
+  NodeLock.WriteEnd();
+  if (State.Latest.Published != 0)
+  {
+    LoraWorking = State.Latest;
+    LatestPublish();
+  }
+  return true;
+}
+
+// a packet has been received, copy it into the ring. packetSize from Lora.onReceive
+// Returns true if the packet was queued and whatever empties the ring should be woken
+bool LoraReceive(int packetSize)
+{
+  // runs in the DIO0 interrupt so no display, serial, heap or float in here
+  HalRadio *Radio = Platform.Radio;
+  uint32_t Head = LoraRingHead.load(std::memory_order_relaxed);
+  LoraFramesReceived.fetch_add(1, std::memory_order_relaxed);
+  if (Head - LoraRingTail.load(std::memory_order_acquire) >= LoraRingSize) // ring full, LoraTask has fallen behind
+  {
+    LoraFramesDropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  LoraFrame &Frame = LoraRing[Head & (LoraRingSize - 1)];
+  Frame.Size = packetSize;
+  Frame.Length = 0;
+  while (Radio->Available())
+  {
+    int PacketByte = Radio->Read();
+    if (Frame.Length < LoraMaxPacketSize) // drain and drop anything too long
+      Frame.Packet[Frame.Length++] = (char)PacketByte;
+  }
+  Frame.Packet[Frame.Length] = '\0';
+  Frame.RSSI = Radio->PacketRSSI();
+  Frame.SNRQuarterdB = Radio->PacketSNRRaw();
+  Frame.RxMicros = Platform.Clock->Micros();
+  LoraRingHead.store(Head + 1, std::memory_order_release); // publish the frame
+  return true;
+}
+
+// take the oldest packet out of the ring, returns false if the ring is empty
+bool LoraRingPop(LoraFrame &Frame)
+{
+  uint32_t Tail = LoraRingTail.load(std::memory_order_relaxed);
+  if (Tail == LoraRingHead.load(std::memory_order_acquire))
+    return false;
+  Frame = LoraRing[Tail & (LoraRingSize - 1)];
+  LoraRingTail.store(Tail + 1, std::memory_order_release); // hand the slot back to LoraReceive
+  return true;
+}
+
+// name of a history segment file, i.e. /hist/r3.bin
+void HistoryFileName(byte Tier, byte Segment, char *Name, size_t Size)
+{
+  snprintf(Name, Size, "/hist/%c%u.bin", HistoryTiers[Tier].Name, Segment);
+}
+
+// start a new segment file, throwing away the oldest one in the circle
+void HistoryNextSegment(byte Tier)
+{
+  HistorySegmentState &State = HistoryState[Tier];
+  char Name[24];
+  State.Segment = (State.Segment + 1) % HistoryTiers[Tier].Segments;
+  State.Generation++;
+  State.Records = 0;
+  HistoryFileName(Tier, State.Segment, Name, sizeof(Name));
+  Platform.Files->Write(Name, &State.Generation, sizeof(State.Generation), false);
+  HistoryBytesWritten += sizeof(State.Generation);
+}
+
+// find the newest segment of each tier after a restart
+void HistoryBegin()
+{
+  char Name[24];
+  for (byte Tier = 0; Tier < HistoryTierCount; Tier++)
+  {
+    HistorySegmentState &State = HistoryState[Tier];
+    State.Generation = 0;
+    for (byte Segment = 0; Segment < HistoryTiers[Tier].Segments; Segment++)
+    {
+      HistoryFileName(Tier, Segment, Name, sizeof(Name));
+      if (!Platform.Files->Exists(Name))
+        continue;
+      uint32_t Generation = 0;
+      if (Platform.Files->Read(Name, 0, &Generation, sizeof(Generation)) == sizeof(Generation) && Generation > State.Generation)
+      {
+        State.Segment = Segment;
+        State.Generation = Generation;
+        State.Records = (Platform.Files->Size(Name) - sizeof(Generation)) / sizeof(HistoryRecord);
+      }
+    }
+    if (State.Generation == 0) // nothing stored yet, NextSegment moves on from the last one to segment 0
+    {
+      State.Segment = HistoryTiers[Tier].Segments - 1;
+      HistoryNextSegment(Tier);
+    }
+  }
+}
+
+// append records to a tier, one write per segment touched
+void HistoryWrite(byte Tier, const HistoryRecord *Records, byte Count)
+{
+  char Name[24];
+  while (Count > 0)
+  {
+    HistorySegmentState &State = HistoryState[Tier];
+    if (State.Records >= HistoryTiers[Tier].SegmentRecords)
+      HistoryNextSegment(Tier);
+    byte Batch = std::min((uint16_t)Count, (uint16_t)(HistoryTiers[Tier].SegmentRecords - State.Records));
+    HistoryFileName(Tier, State.Segment, Name, sizeof(Name));
+    Platform.Files->Write(Name, Records, Batch * sizeof(HistoryRecord), true);
+    HistoryBytesWritten += Batch * sizeof(HistoryRecord);
+    State.Records += Batch;
+    Records += Batch;
+    Count -= Batch;
+  }
+}
+
+// turn a finished hourly or daily summary into a record
+void HistorySummaryRecord(const HistorySummary &Summary, HistoryRecord &Record)
+{
+  Record.Time = Summary.PeriodStart;
+  Record.NodeID = Summary.NodeID;
+  Record.Count = std::min(Summary.Count, (uint16_t)255);
+  Record.Water = Summary.WaterMin;
+  Record.VoltageRaw = Summary.VoltageSum / Summary.Count;
+  Record.VoltageMin = Summary.VoltageMin;
+  Record.RSSI = Summary.RSSISum / Summary.Count;
+  Record.SNRQuarterdB = Summary.SNRSum / Summary.Count;
+  Record.Reserved = 0;
+}
+
+// fold a raw reading into the hourly and daily summaries, returns how many finished summaries were put in Done
+byte HistorySummarise(const HistoryRecord &Record, byte Tier, HistoryRecord *Done)
+{
+  HistorySummary *Summaries = HistorySummaries[Tier - 1];
+  uint32_t PeriodStart = Record.Time - Record.Time % HistoryTiers[Tier].Period;
+  byte Slot = NodeTableSize;
+  byte Free = NodeTableSize;
+  for (byte i = 0; i < NodeTableSize; i++)
+  {
+    if (Summaries[i].Active && Summaries[i].NodeID == Record.NodeID)
+      Slot = i;
+    else if (!Summaries[i].Active && Free == NodeTableSize)
+      Free = i;
+  }
+  byte Finished = 0;
+  if (Slot < NodeTableSize && Summaries[Slot].PeriodStart != PeriodStart) // moved into a new period, the old one is done
+  {
+    HistorySummaryRecord(Summaries[Slot], Done[Finished++]);
+    Summaries[Slot].Active = false;
+  }
+  if (Slot == NodeTableSize || !Summaries[Slot].Active)
+  {
+    if (Slot == NodeTableSize)
+      Slot = Free;
+    if (Slot == NodeTableSize) // can't happen while the node table is the same size
+      return Finished;
+    HistorySummary &Summary = Summaries[Slot];
+    Summary.Active = true;
+    Summary.NodeID = Record.NodeID;
+    Summary.PeriodStart = PeriodStart;
+    Summary.Count = 0;
+    Summary.WaterMin = Record.Water;
+    Summary.VoltageSum = 0;
+    Summary.VoltageMin = Record.VoltageRaw;
+    Summary.RSSISum = 0;
+    Summary.SNRSum = 0;
+  }
+  HistorySummary &Summary = Summaries[Slot];
+  Summary.Count++;
+  if (Record.Water >= 0 && (Summary.WaterMin < 0 || Record.Water < Summary.WaterMin)) // -1 is a missing reading
+    Summary.WaterMin = Record.Water;
+  Summary.VoltageSum += Record.VoltageRaw;
+  Summary.VoltageMin = std::min(Summary.VoltageMin, Record.VoltageRaw);
+  Summary.RSSISum += Record.RSSI;
+  Summary.SNRSum += Record.SNRQuarterdB;
+  return Finished;
+}
+
+// enough readings are waiting that they should be written now rather than at the next HistoryFlushInterval
+bool HistoryFlushDue()
+{
+  return HistoryPendingCount >= HistoryFlushAt;
+}
+
+// write everything waiting in RAM to flash
+void HistoryFlush()
+{
+  HistoryRecord Batch[HistoryPendingSize];
+  HalEnter(HistoryMux);
+  byte Count = HistoryPendingCount;
+  memcpy(Batch, HistoryPending, Count * sizeof(HistoryRecord));
+  HistoryPendingCount = 0;
+  HalExit(HistoryMux);
+  if (Count == 0)
+    return;
+  HistoryWrite(0, Batch, Count);
+  HistoryRecord Done[HistoryPendingSize];
+  for (byte Tier = 1; Tier < HistoryTierCount; Tier++)
+  {
+    byte DoneCount = 0;
+    for (byte i = 0; i < Count; i++)
+      DoneCount += HistorySummarise(Batch[i], Tier, Done + DoneCount);
+    HistoryWrite(Tier, Done, DoneCount);
+  }
+  HistoryFlushes++;
+}
+
+// copy text into the response chunk, anything that doesn't fit is carried over to the next chunk
+void CarryPut(ResponseCarry &Carry, uint8_t *&Out, size_t &Room, const char *Text, int Length)
+{
+  Length = std::max(0, std::min(Length, WebCarrySize - 1)); // snprintf returns the untruncated length
+  size_t Fits = std::min((size_t)Length, Room);
+  memcpy(Out, Text, Fits);
+  Out += Fits;
+  Room -= Fits;
+  if (Fits < (size_t)Length)
+  {
+    Carry.Length = Length - Fits;
+    memcpy(Carry.Text, Text + Fits, Carry.Length);
+    Carry.Start = 0;
+  }
+}
+
+// send what didn't fit last time, returns false if there was nothing carried over
+bool CarryDrain(ResponseCarry &Carry, uint8_t *&Out, size_t &Room)
+{
+  if (Carry.Length == 0)
+    return false;
+  size_t Fits = std::min((size_t)Carry.Length, Room);
+  memcpy(Out, Carry.Text + Carry.Start, Fits);
+  Out += Fits;
+  Room -= Fits;
+  Carry.Start += Fits;
+  Carry.Length -= Fits;
+  return true;
+}
+
+// write one history record as JSON or CSV, returns the length
+int ApiFormatRecord(ApiStream &Stream, const HistoryRecord &Record, char *Text, size_t Size)
+{
+  if (Stream.CSV)
+    return snprintf(Text, Size, "%u,%u,%u,%d,%.2f,%.2f,%d,%.2f\n", Record.Time, Record.NodeID, Record.Count, Record.Water,
+                    Record.VoltageRaw / 100.0, Record.VoltageMin / 100.0, Record.RSSI, Record.SNRQuarterdB / 4.0);
+  int Length = snprintf(Text, Size, "%s{\"time\":%u,\"node\":%u,\"count\":%u,\"water\":%d,\"volts\":%.2f,\"voltsMin\":%.2f,\"rssi\":%d,\"snr\":%.2f}",
+                        Stream.First ? "" : ",", Record.Time, Record.NodeID, Record.Count, Record.Water,
+                        Record.VoltageRaw / 100.0, Record.VoltageMin / 100.0, Record.RSSI, Record.SNRQuarterdB / 4.0);
+  Stream.First = false;
+  return Length;
+}
+
+// write one sender's latest reading as JSON or CSV, returns the length
+int ApiFormatNode(ApiStream &Stream, const NodeState &Node, char *Text, size_t Size)
+{
+  unsigned long Age = (Platform.Clock->Millis() - Node.LastSeenMillis) / 1000;
+  if (Stream.CSV)
+    return snprintf(Text, Size, "%u,%d,%.2f,%lu,%d,%.2f,%u,%u,%.3f,%.1f,%d\n", Node.ID, Node.Water, Node.VoltageRaw / 100.0, Age,
+                    Node.RSSI, Node.SNRQuarterdB / 4.0, Node.Received, Node.Lost, LinkDelivery(Node), LinkMargin(Node), Node.TXPower);
+  int Length = snprintf(Text, Size, "%s{\"node\":%u,\"water\":%d,\"volts\":%.2f,\"age\":%lu,\"rssi\":%d,\"snr\":%.2f,\"received\":%u,\"lost\":%u,"
+                                    "\"delivery\":%.3f,\"snr_margin\":%.1f,\"tx_power\":%d}",
+                        Stream.First ? "" : ",", Node.ID, Node.Water, Node.VoltageRaw / 100.0, Age,
+                        Node.RSSI, Node.SNRQuarterdB / 4.0, Node.Received, Node.Lost, LinkDelivery(Node), LinkMargin(Node), Node.TXPower);
+  Stream.First = false;
+  return Length;
+}
+
+// read history records from flash into Out until the chunk is full, oldest segment first
+void ApiFillHistory(ApiStream &Stream, uint8_t *&Out, size_t &Room)
+{
+  char Name[24];
+  char Text[WebCarrySize];
+  HistoryRecord Records[ApiReadRecords];
+  while (Room > 0 && Stream.Carry.Length == 0 && Stream.Item > 0)
+  {
+    HistoryFileName(Stream.Tier, Stream.Segment, Name, sizeof(Name));
+    size_t Read = Platform.Files->Read(Name, Stream.Offset, Records, sizeof(Records)) / sizeof(HistoryRecord);
+    if (Read == 0) // finished this segment, move on to the next newest
+    {
+      Stream.Segment = (Stream.Segment + 1) % HistoryTiers[Stream.Tier].Segments;
+      Stream.Offset = sizeof(uint32_t); // skip the generation
+      Stream.Item--;
+      continue;
+    }
+    size_t i = 0;
+    for (; i < Read && Room > 0 && Stream.Carry.Length == 0; i++)
+    {
+      const HistoryRecord &Record = Records[i];
+      if (Record.Time < Stream.From || Record.Time > Stream.To || (Stream.NodeID >= 0 && Record.NodeID != Stream.NodeID))
+        continue;
+      int Length = ApiFormatRecord(Stream, Record, Text, sizeof(Text));
+      CarryPut(Stream.Carry, Out, Room, Text, Length);
+    }
+    Stream.Offset += i * sizeof(HistoryRecord);
+  }
+}
+
+// chunked response filler for the API, called by the web server until it returns 0
+size_t ApiFill(ApiStream &Stream, uint8_t *Buffer, size_t MaxLength)
+{
+  uint8_t *Out = Buffer;
+  size_t Room = MaxLength;
+  char Text[WebCarrySize];
+  while (Room > 0)
+  {
+    if (CarryDrain(Stream.Carry, Out, Room)) // finish what didn't fit last time
+      continue;
+    if (Stream.Stage == 0)
+    {
+      const char *Header;
+      if (Stream.CSV)
+        Header = Stream.History ? "time,node,count,water,volts,volts_min,rssi,snr\n" : "node,water,volts,age,rssi,snr,received,lost,delivery,snr_margin,tx_power\n";
+      else
+        Header = Stream.History ? "{\"records\":[" : "{\"nodes\":[";
+      CarryPut(Stream.Carry, Out, Room, Header, strlen(Header));
+      Stream.Stage = 1;
+    }
+    else if (Stream.Stage == 1)
+    {
+      if (Stream.History)
+      {
+        ApiFillHistory(Stream, Out, Room);
+        if (Stream.Item == 0)
+          Stream.Stage = 2;
+      }
+      else if (Stream.Item < NodeCount)
+      {
+        NodeState Node;
+        NodeRead(Stream.Item++, Node);
+        int Length = ApiFormatNode(Stream, Node, Text, sizeof(Text));
+        CarryPut(Stream.Carry, Out, Room, Text, Length);
+      }
+      else
+        Stream.Stage = 2;
+    }
+    else if (Stream.Stage == 2)
+    {
+      if (!Stream.CSV)
+      {
+        int Length = snprintf(Text, sizeof(Text), "],\"time\":%u}", ClockUTC());
+        CarryPut(Stream.Carry, Out, Room, Text, Length);
+      }
+      Stream.Stage = 3;
+    }
+    else
+      break;
+  }
+  return Out - Buffer;
+}
+
+// node="ID" for the metrics with a series per sender
+bool MetricNodeLabel(byte Row, char *Text, size_t Size)
+{
+  if (Row >= NodeCount)
+    return false;
+  snprintf(Text, Size, "node=\"%u\"", Nodes[Row].ID);
+  return true;
+}
+
+// time recording a metric, on the board this is a few cycles as nothing is locked
+void MetricsCalibrate()
+{
+  static MetricCounter Counter; // not the real ones so nothing shows up on /metrics
+  static MetricHistogram Histogram;
+  unsigned long Start = Platform.Clock->Cycles();
+  for (int i = 0; i < MetricCalibrateRuns; i++)
+    Counter.Add();
+  MetricCounterCycles = (float)(Platform.Clock->Cycles() - Start) / MetricCalibrateRuns;
+  Start = Platform.Clock->Cycles();
+  for (int i = 0; i < MetricCalibrateRuns; i++)
+    Histogram.Observe(i * 37);
+  MetricHistogramCycles = (float)(Platform.Clock->Cycles() - Start) / MetricCalibrateRuns;
+}
+
+double MetricReadReceived(byte Row) { return LoraFramesReceived.load(std::memory_order_relaxed); }
+double MetricReadDropped(byte Row) { return LoraFramesDropped.load(std::memory_order_relaxed); }
+double MetricReadGood(byte Row) { return MetricPacketsGood.Read(); }
+double MetricReadNotForUs(byte Row) { return MetricPacketsNotForUs.Read(); }
+double MetricReadTooLong(byte Row) { return MetricPacketsTooLong.Read(); }
+double MetricReadTableFull(byte Row) { return NodeTableFull; }
+// a sender's row through NodeLock, the metrics are read on the web server's core while LoraTask changes the table
+NodeState MetricNodeRead(byte Row)
+{
+  NodeState Node;
+  NodeRead(Row, Node);
+  return Node;
+}
+double MetricReadNodeReceived(byte Row) { return MetricNodeRead(Row).Received; }
+double MetricReadNodeLost(byte Row) { return MetricNodeRead(Row).Lost; }
+double MetricReadNodeAge(byte Row) { return (Platform.Clock->Millis() - MetricNodeRead(Row).LastSeenMillis) / 1000.0; }
+double MetricReadNodeRSSI(byte Row) { return MetricNodeRead(Row).RSSI; }
+double MetricReadNodeSNR(byte Row) { return MetricNodeRead(Row).SNRQuarterdB / 4.0; }
+double MetricReadNodeVolts(byte Row) { return MetricNodeRead(Row).VoltageRaw / 100.0; }
+double MetricReadNodeWater(byte Row) { return MetricNodeRead(Row).Water; }
+double MetricReadHistoryBytes(byte Row) { return HistoryBytesWritten; }
+double MetricReadHistoryFlushes(byte Row) { return HistoryFlushes; }
+double MetricReadHistoryDropped(byte Row) { return HistoryDropped; }
+double MetricReadSnapshotRetries(byte Row) { return MetricSnapshotRetries.Read(); }
+double MetricReadSnapshotTorn(byte Row) { return MetricSnapshotTorn.Read(); }
+double MetricReadEventsQueued(byte Row) { return MetricEventsQueued.Read(); }
+double MetricReadEventsDropped(byte Row) { return MetricEventsDropped.Read(); }
+double MetricReadCounterCycles(byte Row) { return MetricCounterCycles; }
+double MetricReadHistogramCycles(byte Row) { return MetricHistogramCycles; }
+
+// everything the pipeline measures, main.cpp adds the board's own
+const MetricExport ReceiverMetrics[] = {
+    {"water_lora_packets_received_total", "counter", "Packets the radio has given us", MetricReadReceived},
+    {"water_lora_packets_dropped_total", "counter", "Packets lost because the receive ring was full", MetricReadDropped},
+    {"water_lora_packets_good_total", "counter", "Packets decoded and recorded", MetricReadGood},
+    {"water_lora_packets_not_for_us_total", "counter", "Packets with the wrong preamble or a bad CRC", MetricReadNotForUs},
+    {"water_lora_packets_too_long_total", "counter", "Packets longer than any sender sends", MetricReadTooLong},
+    {"water_lora_packets_table_full_total", "counter", "Good packets ignored as the sender table was full", MetricReadTableFull},
+    {"water_lora_processing_seconds", "histogram", "Time spent on each packet in LoraProcessing", NULL, &MetricLoraProcessing, 1e-6},
+    {"water_lora_latency_seconds", "histogram", "Receive callback to display updated", NULL, &MetricLoraLatency, 1e-6},
+    {"water_node_received_total", "counter", "Packets received from each sender", MetricReadNodeReceived, NULL, 0, MetricNodeLabel},
+    {"water_node_lost_total", "counter", "Sequence numbers never seen from each sender", MetricReadNodeLost, NULL, 0, MetricNodeLabel},
+    {"water_node_last_seen_seconds", "gauge", "Time since each sender was last heard", MetricReadNodeAge, NULL, 0, MetricNodeLabel},
+    {"water_node_rssi_dbm", "gauge", "RSSI of each sender's last packet", MetricReadNodeRSSI, NULL, 0, MetricNodeLabel},
+    {"water_node_snr_db", "gauge", "SNR of each sender's last packet", MetricReadNodeSNR, NULL, 0, MetricNodeLabel},
+    {"water_node_volts", "gauge", "Battery voltage each sender last reported", MetricReadNodeVolts, NULL, 0, MetricNodeLabel},
+    {"water_node_water", "gauge", "Water level each sender last reported, -1 if it didn't", MetricReadNodeWater, NULL, 0, MetricNodeLabel},
+    {"water_history_bytes_written_total", "counter", "Bytes written to flash for history", MetricReadHistoryBytes},
+    {"water_history_flushes_total", "counter", "History writes to flash", MetricReadHistoryFlushes},
+    {"water_history_dropped_total", "counter", "Readings lost because history writes fell behind", MetricReadHistoryDropped},
+    {"water_snapshot_retries_total", "counter", "Copies of the latest packet or a sender taken again as it was being written", MetricReadSnapshotRetries},
+    {"water_snapshot_torn_total", "counter", "Copies of the latest packet that failed their checksum, should stay 0", MetricReadSnapshotTorn},
+    {"water_web_events_total", "counter", "Live page events queued to be sent", MetricReadEventsQueued},
+    {"water_web_events_dropped_total", "counter", "Live page events dropped as the sender had fallen behind", MetricReadEventsDropped},
+    {"water_metrics_counter_cycles", "gauge", "CPU cycles to record a counter", MetricReadCounterCycles},
+    {"water_metrics_histogram_cycles", "gauge", "CPU cycles to record a histogram value", MetricReadHistogramCycles},
+};
+const byte ReceiverMetricCount = sizeof(ReceiverMetrics) / sizeof(ReceiverMetrics[0]);
+
+// write one line of a metric into Text, returns the length or -1 once the metric has no more lines
+int MetricsLine(MetricsStream &Stream, const MetricExport &Metric, char *Text, size_t Size)
+{
+  if (Stream.Row == 0)
+    return snprintf(Text, Size, "# HELP %s %s\n# TYPE %s %s\n", Metric.Name, Metric.Help, Metric.Name, Metric.Type);
+  uint16_t Row = Stream.Row - 1;
+  if (Metric.Histogram == NULL)
+  {
+    char Labels[48];
+    if (Metric.Label != NULL)
+      return Row < 256 && Metric.Label(Row, Labels, sizeof(Labels)) ? snprintf(Text, Size, "%s{%s} %.10g\n", Metric.Name, Labels, Metric.Read(Row)) : -1;
+    return Row == 0 ? snprintf(Text, Size, "%s %.10g\n", Metric.Name, Metric.Read(0)) : -1;
+  }
+  const MetricHistogram &Histogram = *Metric.Histogram;
+  if (Row < MetricHistogramBuckets)
+  {
+    Stream.Cumulative += Histogram.Buckets[Row].Read();
+    if (Row == MetricHistogramBuckets - 1)
+      return snprintf(Text, Size, "%s_bucket{le=\"+Inf\"} %u\n", Metric.Name, Stream.Cumulative);
+    return snprintf(Text, Size, "%s_bucket{le=\"%.6g\"} %u\n", Metric.Name, (MetricBucketLower(Row + 1) - 1) * Metric.Scale, Stream.Cumulative);
+  }
+  if (Row == MetricHistogramBuckets)
+    return snprintf(Text, Size, "%s_sum %.10g\n", Metric.Name, Histogram.Sum.Read() * Metric.Scale);
+  if (Row == MetricHistogramBuckets + 1)
+    return snprintf(Text, Size, "%s_count %u\n", Metric.Name, Stream.Cumulative); // same as the +Inf bucket even if more arrived meanwhile
+  return -1;
+}
+
+// chunked response filler for /metrics in Prometheus text format, called by the web server until it returns 0
+size_t MetricsFill(MetricsStream &Stream, uint8_t *Buffer, size_t MaxLength)
+{
+  uint8_t *Out = Buffer;
+  size_t Room = MaxLength;
+  char Text[WebCarrySize];
+  while (Room > 0)
+  {
+    if (CarryDrain(Stream.Carry, Out, Room)) // finish what didn't fit last time
+      continue;
+    if (Stream.Table >= MetricTables)
+      break;
+    if (Stream.Metric >= Stream.TableSizes[Stream.Table])
+    {
+      Stream.Table++;
+      Stream.Metric = 0;
+      continue;
+    }
+    int Length = MetricsLine(Stream, Stream.Tables[Stream.Table][Stream.Metric], Text, sizeof(Text));
+    if (Length < 0) // on to the next metric
+    {
+      Stream.Metric++;
+      Stream.Row = 0;
+      Stream.Cumulative = 0;
+      continue;
+    }
+    Stream.Row++;
+    CarryPut(Stream.Carry, Out, Room, Text, Length);
+  }
+  return Out - Buffer;
+}
@@ -0,0 +1,273 @@
+/*
+* The receive pipeline: packet ring, decoding, sender table, history and the API.
+* Everything the board does goes through Platform (Hal.h) so this also builds on a PC.
+*/
+
+#ifndef RECEIVER_H
+#define RECEIVER_H
+
+#include <atomic>
+#include "Hal.h"
+#include "Metrics.h"
+#include "NodeFrame.h"
+
+// Lora packet
+const char LoraPacketPreAmble[] = "A1A"; // LoraPacketPreAmble - received packet must start with this, until LoraConfigure
+const int LoraMaxPacketSize = NodeFrameMaxSize; // Sanity check, anything longer than this is a bad packet, LoraConfigure can lower it
+const byte LoraPreambleMaxSize = 8;       // including the null
+const byte LoraRingSize = 8;             // number of received packets that can wait for processing, must be a power of 2
+// senders
+const byte NodeTableSize = 8;             // most senders we keep track of
+const byte NodeLegacyID = 0;              // node ID given to old "A1A" text packets as they don't carry one
+const uint16_t NodeMaxSequenceGap = 1000; // a bigger jump in sequence number is a sender restart, not lost packets
+// history kept in flash, each tier is a circle of segment files that are only ever appended to
+const byte HistoryTierCount = 3;                // raw readings, hourly and daily summaries
+const byte HistoryPendingSize = 32;             // readings held in RAM between flushes
+const byte HistoryFlushAt = 16;                 // flush early once this many readings are waiting
+const unsigned long HistoryFlushInterval = 600000; // write to flash at least every 10 minutes
+// web pages and API
+const byte WebCarrySize = 240; // longest single value, page row or API record streamed out
+const byte EventsRingSize = 8;    // live page events waiting for EventsService, must be a power of 2
+const int EventsDataSize = 480;   // longest event
+const byte ApiReadRecords = 8; // history records read from flash at a time while streaming
+// packet latency histogram
+const int LatencyReportPackets = 20;   // print the histogram after this many packets
+// metrics
+const int MetricCalibrateRuns = 1000;  // records timed to work out what one costs
+const byte MetricTables = 8;           // tables of metrics on /metrics, the pipeline's, the link's, the uplink's, power, alerts, config, updates and the board's
+// date and time strings
+const byte ClockTextSize = 20; // "30 September 2019" is the longest date, two still fit on one OLED line
+const uint32_t ClockValidUTC = 1546300800; // 1 January 2019, anything earlier is a clock that hasn't been set
+// warm restart
+const uint32_t WarmMagic = 0x5741524D; // "WARM"
+const uint16_t WarmVersion = 2;        // change when NodeState or LoraLatest change, so an update doesn't restore them wrongly
+
+// local date and time as text, each task formats its own so none sees another's half written
+struct ClockText
+{
+  char Date[ClockTextSize];
+  char Time[ClockTextSize];
+  unsigned long Second = ~0UL; // Platform.Clock->Millis() / 1000 when last formatted
+};
+// Lora packets
+struct LoraReading // decoded contents of a good packet, filled in place by LoraDecodePacket
+{
+  uint8_t NodeID;
+  bool HasSequence; // old text packets don't have a sequence number
+  uint16_t Sequence;
+  int Water;       // 0 not full, 1 full, -1 if the packet didn't have it
+  long VoltageRaw; // sender multiplies the voltage by 100 to send it as an integer
+  float Volts;
+  uint8_t SpreadingFactor; // the sender's radio settings if it sent NodeFieldLink, 0 if not
+  int8_t TXPower;
+};
+struct LoraFrame // one received packet as captured by the receive callback
+{
+  char Packet[LoraMaxPacketSize + 1]; // first LoraMaxPacketSize bytes of the packet, null terminated
+  byte Length;                        // number of bytes kept in Packet
+  int Size;                           // packet size reported by the radio, may be more than was kept
+  int RSSI;
+  int8_t SNRQuarterdB; // raw SNR register, float can't be used in the receive callback as it runs in the interrupt
+  unsigned long RxMicros; // when the receive callback ran, for latency
+};
+// the last packet as shown on the home page. LoraProcessing fills in its own copy and publishes it whole,
+// the web server on the other core takes a copy through LatestRead so it never sees half of one packet and half of the next
+struct LoraLatest
+{
+  uint32_t Published; // packets published, 0 until the first
+  int RSSI;
+  float SNR;
+  char Packet[2 * LoraMaxPacketSize + 1]; // binary packets are kept as hex
+  int PacketSize;
+  int WaterLevel; // -1 if the packet didn't have it
+  float Volts;
+  char RxDate[ClockTextSize];
+  char RxTime[ClockTextSize];
+  uint32_t Check; // FNV-1a of everything above, lets a reader prove its copy is whole
+};
+// one writer and any number of readers that never hold it up, a reader tries again if the writer was part way through.
+// The writer must not be preempted by a reader on its own core, LoraTask has the highest priority of anything that reads
+struct SeqLock
+{
+  std::atomic<uint32_t> Sequence; // odd while the writer is part way through
+  void WriteBegin()
+  {
+    Sequence.store(Sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+  void WriteEnd() { Sequence.store(Sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+  uint32_t ReadBegin()
+  {
+    uint32_t Start;
+    while ((Start = Sequence.load(std::memory_order_acquire)) & 1)
+      ;
+    return Start;
+  }
+  bool ReadRetry(uint32_t Start)
+  {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return Sequence.load(std::memory_order_relaxed) != Start;
+  }
+};
+// senders, indexed by node ID through NodeSlot so a lookup is one array read
+struct NodeState
+{
+  uint8_t ID;
+  bool HasSequence;
+  uint16_t LastSequence;
+  int16_t Water;
+  int16_t VoltageRaw;
+  int16_t RSSI;
+  int8_t SNRQuarterdB;
+  unsigned long LastSeenMillis;
+  uint32_t Received;
+  uint32_t Lost; // sequence numbers we never saw
+  // link statistics, see Link.h
+  uint32_t Window;         // bit n set if sequence number LastSequence - n arrived
+  byte WindowSize;         // sequence numbers Window covers, up to LinkWindow
+  uint8_t SpreadingFactor; // as the sender reported, 0 if it doesn't
+  int8_t TXPower;          // dBm as the sender reported
+  int8_t AdviseTXPower;    // dBm it was last asked to use
+  bool Advised;            // AdviseTXPower has been set, 0dBm is a power like any other
+  uint16_t AdviseSequence; // sequence number when AdviseTXPower last changed
+  float SNRAverage;        // dB, rolling
+  uint64_t AirtimeMicros;
+  uint64_t AirtimeSavedMicros; // against sending at SF12
+};
+// what a restart brings back so the home page and node table carry on where they were, the board keeps it in
+// RTC memory which a software reset doesn't clear. WarmSave copies through NodeRead and LatestRead so it is whole
+struct WarmState
+{
+  uint32_t Magic;        // WarmMagic once the rest is written
+  uint16_t Version;
+  uint16_t Size;         // sizeof(WarmState), catches a layout change that WarmVersion missed
+  uint32_t UTC;          // clock when saved
+  unsigned long Millis;  // Platform.Clock->Millis() when saved, LastSeenMillis is made relative to it
+  byte NodeCount;
+  NodeState Nodes[NodeTableSize];
+  LoraLatest Latest;
+  uint32_t Check;        // FNV-1a from Version up to here
+};
+// history
+struct HistoryRecord // 16 bytes, written to flash as is
+{
+  uint32_t Time;      // UTC seconds, start of the period for hourly and daily records
+  uint8_t NodeID;
+  uint8_t Count;      // readings folded into this record, 1 for raw records
+  int16_t Water;      // lowest over the period so a "not full" always shows up
+  int16_t VoltageRaw; // average over the period
+  int16_t VoltageMin;
+  int16_t RSSI;       // average over the period
+  int8_t SNRQuarterdB;
+  uint8_t Reserved;
+};
+struct HistoryTier
+{
+  char Name;               // used in the segment file names
+  byte Segments;           // files in the circle, the oldest is emptied when the newest fills
+  uint16_t SegmentRecords; // records per file
+  uint32_t Period;         // seconds summarised per record, 0 for raw
+};
+// raw 64KB, hourly 32KB (about 3 months for one sender), daily 16KB (years)
+const HistoryTier HistoryTiers[HistoryTierCount] = {{'r', 8, 512, 0}, {'h', 4, 512, 3600}, {'d', 2, 512, 86400}};
+struct HistorySegmentState
+{
+  byte Segment;        // file being appended to
+  uint32_t Generation; // stored at the start of each file so the newest can be found after a restart
+  uint16_t Records;    // records already in the file
+};
+// text that didn't fit in the last chunk of a streamed response
+struct ResponseCarry
+{
+  char Text[WebCarrySize];
+  byte Start;
+  byte Length;
+};
+// state of one streamed /metrics response
+struct MetricsStream
+{
+  const MetricExport *Tables[MetricTables];
+  byte TableSizes[MetricTables];
+  byte Table;
+  byte Metric;
+  uint16_t Row;        // 0 for the HELP and TYPE lines, then the series
+  uint32_t Cumulative; // histogram buckets are sent as running totals
+  ResponseCarry Carry;
+};
+// state of one streamed API response, one small allocation per request however much history is asked for
+struct ApiStream
+{
+  bool History;         // history records rather than the latest reading from each sender
+  bool CSV;             // CSV rather than JSON
+  byte Tier;            // history tier
+  uint32_t From;        // UTC seconds
+  uint32_t To;          // UTC seconds
+  int NodeID;           // -1 for all senders
+  byte Stage;           // 0 header, 1 records, 2 footer, 3 finished
+  byte Item;            // sender in the node table, or segment files left to read for history
+  byte Segment;         // history segment file being read
+  uint32_t Offset;      // next byte to read in the segment file
+  bool First;           // no comma before the first JSON record
+  ResponseCarry Carry;
+};
+
+// receive ring and the last good packet
+extern std::atomic<uint32_t> LoraFramesReceived;
+extern std::atomic<uint32_t> LoraFramesDropped;
+extern unsigned long LoraDecodeCycles;
+// senders
+extern NodeState Nodes[NodeTableSize];
+extern byte NodeCount;
+extern byte NodeSlot[256]; // index into Nodes + 1 for each node ID, 0 if not seen yet
+extern uint32_t NodeTableFull;
+extern uint32_t NodeUpdates;
+// metrics
+extern MetricCounter MetricPacketsGood;
+extern MetricCounter MetricPacketsNotForUs;
+extern MetricCounter MetricPacketsTooLong;
+extern MetricHistogram MetricLoraProcessing; // microseconds in LoraProcessing
+extern MetricHistogram MetricLoraLatency;    // microseconds from the receive callback to the display being updated
+extern MetricSharedCounter MetricSnapshotRetries; // LatestRead and NodeRead copies taken again as LoraProcessing was writing
+extern MetricSharedCounter MetricSnapshotTorn;    // LatestRead copies that failed their check anyway, should stay 0
+extern MetricCounter MetricEventsQueued;     // live page events handed to EventsService
+extern MetricCounter MetricEventsDropped;    // and ones dropped as it had fallen behind
+extern float MetricCounterCycles;            // CPU cycles to record a metric, measured by MetricsCalibrate
+extern float MetricHistogramCycles;
+extern const MetricExport ReceiverMetrics[];
+extern const byte ReceiverMetricCount;
+// history
+extern HistorySegmentState HistoryState[HistoryTierCount];
+extern uint32_t HistoryDropped;
+extern uint32_t HistoryFlushes;
+extern uint32_t HistoryBytesWritten;
+
+int FormatNumber(uint32_t Number, char *Text, size_t Size);
+void ConsolePrintf(const char *Format, ...);
+void UpdateClock(ClockText &Text);
+uint32_t ClockUTC();
+void LoraConfigure(const char *Preamble, int PacketLimit);
+bool LoraDecodePacket(const char *Packet, int Length, LoraReading &Reading);
+NodeState *NodeFind(uint8_t ID);
+void NodeRead(byte Row, NodeState &Node);
+void LatestRead(LoraLatest &Latest);
+bool LatestCheck(const LoraLatest &Latest);
+float NodeLossRate(const NodeState &Node);
+void WarmSave(WarmState &State);
+bool WarmRestore(const WarmState &State);
+bool LoraReceive(int packetSize);
+bool LoraRingPop(LoraFrame &Frame);
+void LoraProcessing(const LoraFrame &Frame);
+bool EventsQueue(const char *Name, const char *Data);
+bool EventsPending();
+bool EventsService();
+void HistoryBegin();
+bool HistoryFlushDue();
+void HistoryFlush();
+void CarryPut(ResponseCarry &Carry, uint8_t *&Out, size_t &Room, const char *Text, int Length);
+bool CarryDrain(ResponseCarry &Carry, uint8_t *&Out, size_t &Room);
+size_t ApiFill(ApiStream &Stream, uint8_t *Buffer, size_t MaxLength);
+bool MetricNodeLabel(byte Row, char *Text, size_t Size);
+void MetricsCalibrate();
+size_t MetricsFill(MetricsStream &Stream, uint8_t *Buffer, size_t MaxLength);
+
+#endif
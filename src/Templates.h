@@ -0,0 +1,583 @@
+// Generated by scripts/compile_templates.py from data/*.html, do not edit, edit the html and rebuild
+
+#ifndef TEMPLATES_H
+#define TEMPLATES_H
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else // the simulator, flash is ordinary memory on a PC
+#include <string.h>
+#include "Hal.h"
+#define PROGMEM
+#define memcpy_P memcpy
+#endif
+
+// one per %Variable% used in any page
+enum TemplateSlot : uint8_t
+{
+  SlotFaviconVersion,
+  SlotStyleVersion,
+  SlotVersion,
+  SlotFormattedDate,
+  SlotFormattedTime,
+  SlotRSSI,
+  SlotSNR,
+  SlotRxDate,
+  SlotRxTime,
+  SlotPacket,
+  SlotPacketSize,
+  SlotWaterLevel,
+  SlotVolts,
+  SlotAlerts,
+  SlotReceived,
+  SlotDropped,
+  SlotNodes,
+  SlotWIFISSID,
+  SlotLocalIP,
+  SlotLocalMac,
+  SlotLocalSubNet,
+  SlotLocalGateway,
+  SlotLocalDNS,
+  SlotWebStatus,
+  SlotWebRSSI,
+  SlotWiFiReconnects,
+  SlotChipID,
+  SlotChipRevision,
+  SlotChipFrequency,
+  SlotFlashSize,
+  SlotFlashSpeed,
+  SlotHeapSize,
+  SlotFreeHeap,
+  SlotSketchSpaceFree,
+  SlotSketchSize,
+  SlotBootTime,
+  SlotPacketTime,
+  SlotBootRadio,
+  SlotBootFirstPacket,
+  SlotPower,
+  SlotMaintenance,
+  SlotRadio,
+  SlotLinkAcks,
+  SlotHistoryWritten,
+  SlotHistoryDropped,
+  SlotLiveClients,
+  SlotMinFreeHeap,
+  SlotAssetCache,
+  SlotTasks,
+  SlotNone, // end of the page, no variable after the text
+};
+// the names as they are in the html, the firmware doesn't use them so they aren't linked in
+const char *const TemplateSlotNames[] = {
+    "FaviconVersion",
+    "StyleVersion",
+    "Version",
+    "FormattedDate",
+    "FormattedTime",
+    "RSSI",
+    "SNR",
+    "RxDate",
+    "RxTime",
+    "Packet",
+    "PacketSize",
+    "WaterLevel",
+    "Volts",
+    "Alerts",
+    "Received",
+    "Dropped",
+    "Nodes",
+    "WIFISSID",
+    "LocalIP",
+    "LocalMac",
+    "LocalSubNet",
+    "LocalGateway",
+    "LocalDNS",
+    "WebStatus",
+    "WebRSSI",
+    "WiFiReconnects",
+    "ChipID",
+    "ChipRevision",
+    "ChipFrequency",
+    "FlashSize",
+    "FlashSpeed",
+    "HeapSize",
+    "FreeHeap",
+    "SketchSpaceFree",
+    "SketchSize",
+    "BootTime",
+    "PacketTime",
+    "BootRadio",
+    "BootFirstPacket",
+    "Power",
+    "Maintenance",
+    "Radio",
+    "LinkAcks",
+    "HistoryWritten",
+    "HistoryDropped",
+    "LiveClients",
+    "MinFreeHeap",
+    "AssetCache",
+    "Tasks",
+};
+
+struct TemplatePart // fixed text then a variable
+{
+  const char *Text;
+  uint16_t Length;
+  TemplateSlot Slot;
+};
+
+const char TemplateIndex0[] PROGMEM = "<!DOCTYPE html>\r\n"
+    "<html lang=\"en\">\r\n"
+    "\r\n"
+    "<head>\r\n"
+    "  <title>Water Level Monitor</title>\r\n"
+    "  <meta charset=\"UTF-8\" />\r\n"
+    "  <meta name=\"viewport\" content=\"width=device-width, initial-scale=1\" />\r\n"
+    "  <link rel=\"icon\" href=\"/favicon.ico?v=";
+const char TemplateIndex1[] PROGMEM = "\" type=\"image/icon\" />\r\n"
+    "  <link rel=\"stylesheet\" type=\"text/css\" href=\"/style.css?v=";
+const char TemplateIndex2[] PROGMEM = "\" />\r\n"
+    "</head>\r\n"
+    "\r\n"
+    "<body>\r\n"
+    "  <header>\r\n"
+    "    <h1>Water Level Monitor</h1>\r\n"
+    "    <h2>Readings</h2>\r\n"
+    "    <p>Version: ";
+const char TemplateIndex3[] PROGMEM = "</p>\r\n"
+    "    <p><span id=\"FormattedDate\">";
+const char TemplateIndex4[] PROGMEM = "</span> <span id=\"FormattedTime\">";
+const char TemplateIndex5[] PROGMEM = "</span></p>\r\n"
+    "  </header>\r\n"
+    "  <main>\r\n"
+    "    <h3>Lora RSSI: <span id=\"RSSI\">";
+const char TemplateIndex6[] PROGMEM = "</span>, SNR: <span id=\"SNR\">";
+const char TemplateIndex7[] PROGMEM = "</span></h3>\r\n"
+    "    <p>Last good packed received: <span id=\"RxDate\">";
+const char TemplateIndex8[] PROGMEM = "</span> <span id=\"RxTime\">";
+const char TemplateIndex9[] PROGMEM = "</span></p>\r\n"
+    "    <table>\r\n"
+    "      <tr>\r\n"
+    "        <td>Last Good Packet:</td>\r\n"
+    "        <td id=\"Packet\">";
+const char TemplateIndex10[] PROGMEM = "</td>\r\n"
+    "        <td>Size:</td>\r\n"
+    "        <td id=\"PacketSize\">";
+const char TemplateIndex11[] PROGMEM = "</td>\r\n"
+    "      </tr>\r\n"
+    "      <tr>\r\n"
+    "        <td>Water:</td>\r\n"
+    "        <td id=\"WaterLevel\">";
+const char TemplateIndex12[] PROGMEM = "</td>\r\n"
+    "      </tr>\r\n"
+    "      <tr>\r\n"
+    "        <td>Voltage:</td>\r\n"
+    "        <td id=\"Volts\">";
+const char TemplateIndex13[] PROGMEM = "</td>\r\n"
+    "      </tr>\r\n"
+    "      <tr>\r\n"
+    "        <td>Alerts:</td>\r\n"
+    "        <td id=\"Alerts\">";
+const char TemplateIndex14[] PROGMEM = "</td>\r\n"
+    "      </tr>\r\n"
+    "      <tr>\r\n"
+    "        <td>Packets:</td>\r\n"
+    "        <td id=\"Received\">";
+const char TemplateIndex15[] PROGMEM = "</td>\r\n"
+    "        <td>Dropped:</td>\r\n"
+    "        <td id=\"Dropped\">";
+const char TemplateIndex16[] PROGMEM = "</td>\r\n"
+    "      </tr>\r\n"
+    "    </table>\r\n"
+    "    <h3>Senders</h3>\r\n"
+    "    <table id=\"Nodes\">\r\n"
+    "      <tr>\r\n"
+    "        <td>Node</td>\r\n"
+    "        <td>Water</td>\r\n"
+    "        <td>Voltage</td>\r\n"
+    "        <td>Last Seen</td>\r\n"
+    "        <td>RSSI</td>\r\n"
+    "        <td>SNR</td>\r\n"
+    "        <td>Packets</td>\r\n"
+    "        <td>Lost</td>\r\n"
+    "        <td>Delivery</td>\r\n"
+    "        <td>Margin</td>\r\n"
+    "        <td>Power</td>\r\n"
+    "      </tr>\r\n"
+    "      ";
+const char TemplateIndex17[] PROGMEM = "\r\n"
+    "    </table>\r\n"
+    "  </main>\r\n"
+    "  <footer>\r\n"
+    "    <nav>\r\n"
+    "      <ul class=\"selection\">\r\n"
+    "        <li class=\"current\"><a href=\"/\">Home</a></li>\r\n"
+    "        <li><a href=\"/system\">System</a></li>\r\n"
+    "        <li><a href=\"/network\">Network</a></li>\r\n"
+    "        <li><a href=\"/restart\">Restart</a></li>\r\n"
+    "      </ul>\r\n"
+    "    </nav>\r\n"
+    "  </footer>\r\n"
+    "  <script>\r\n"
+    "    // the receiver pushes each good packet here so the page updates in place, no need to reload it\r\n"
+    "    var Events = new EventSource(\"/events\");\r\n"
+    "    Events.addEventListener(\"packet\", function (Event) {\r\n"
+    "      var Packet = JSON.parse(Event.data);\r\n"
+    "      for (var Id in Packet) {\r\n"
+    "        if (Id != \"Node\")\r\n"
+    "          document.getElementById(Id).textContent = Packet[Id];\r\n"
+    "      }\r\n"
+    "      var Row = document.getElementById(\"node\" + Packet.Node[0]);\r\n"
+    "      if (!Row) {\r\n"
+    "        Row = document.getElementById(\"Nodes\").insertRow(-1);\r\n"
+    "        Row.id = \"node\" + Packet.Node[0];\r\n"
+    "      }\r\n"
+    "      Row.innerHTML = \"\";\r\n"
+    "      Packet.Node.forEach(function (Value) {\r\n"
+    "        Row.insertCell(-1).textContent = Value;\r\n"
+    "      });\r\n"
+    "    });\r\n"
+    "    Events.addEventListener(\"alert\", function (Event) {\r\n"
+    "      document.getElementById(\"Alerts\").textContent = JSON.parse(Event.data).Alerts;\r\n"
+    "    });\r\n"
+    "  </script>\r\n"
+    "</body>\r\n"
+    "\r\n"
+    "</html>";
+const TemplatePart TemplateIndex[] = {
+    {TemplateIndex0, 225, SlotFaviconVersion},
+    {TemplateIndex1, 84, SlotStyleVersion},
+    {TemplateIndex2, 110, SlotVersion},
+    {TemplateIndex3, 38, SlotFormattedDate},
+    {TemplateIndex4, 33, SlotFormattedTime},
+    {TemplateIndex5, 71, SlotRSSI},
+    {TemplateIndex6, 29, SlotSNR},
+    {TemplateIndex7, 66, SlotRxDate},
+    {TemplateIndex8, 26, SlotRxTime},
+    {TemplateIndex9, 98, SlotPacket},
+    {TemplateIndex10, 59, SlotPacketSize},
+    {TemplateIndex11, 85, SlotWaterLevel},
+    {TemplateIndex12, 82, SlotVolts},
+    {TemplateIndex13, 82, SlotAlerts},
+    {TemplateIndex14, 85, SlotReceived},
+    {TemplateIndex15, 59, SlotDropped},
+    {TemplateIndex16, 382, SlotNodes},
+    {TemplateIndex17, 1238, SlotNone},
+};
+const byte TemplateIndexParts = 18;
+
+const char TemplateNetwork0[] PROGMEM = "<!DOCTYPE html>\r\n"
+    "<html lang=\"en\">\r\n"
+    "\r\n"
+    "<head>\r\n"
+    "  <title>Water Level Monitor</title>\r\n"
+    "  <meta charset=\"UTF-8\" />\r\n"
+    "  <meta name=\"viewport\" content=\"width=device-width, initial-scale=1\" />\r\n"
+    "  <meta http-equiv=\"refresh\" content=\"20; url=/network\" />\r\n"
+    "  <link rel=\"stylesheet\" type=\"text/css\" href=\"/style.css?v=";
+const char TemplateNetwork1[] PROGMEM = "\" />\r\n"
+    "</head>\r\n"
+    "\r\n"
+    "<body>\r\n"
+    "  <header>\r\n"
+    "    <h1>Water Level Monitor</h1>\r\n"
+    "    <h2>Network Settings</h2>\r\n"
+    "    <p>";
+const char TemplateNetwork2[] PROGMEM = " ";
+const char TemplateNetwork3[] PROGMEM = "</p>\r\n"
+    "  </header>\r\n"
+    "  <main>\r\n"
+    "    <h3>WiFi SSID: ";
+const char TemplateNetwork4[] PROGMEM = "</h3>\r\n"
+    "    <table>\r\n"
+    "      <tr>\r\n"
+    "        <td>Local IP:</td>\r\n"
+    "        <td>";
+const char TemplateNetwork5[] PROGMEM = "</td>\r\n"
+    "      </tr>\r\n"
+    "      <tr>\r\n"
+    "        <td>Local Mac:</td>\r\n"
+    "        <td>";
+const char TemplateNetwork6[] PROGMEM = "</td>\r\n"
+    "      </tr>\r\n"
+    "      <tr>\r\n"
+    "        <td>Local Sub Net:</td>\r\n"
+    "        <td>";
+const char TemplateNetwork7[] PROGMEM = "</td>\r\n"
+    "      </tr>\r\n"
+    "      <tr>\r\n"
+    "        <td>Local Gateway:</td>\r\n"
+    "        <td>";
+const char TemplateNetwork8[] PROGMEM = "</td>\r\n"
+    "      </tr>\r\n"
+    "      <tr>\r\n"
+    "        <td>Local DNS:</td>\r\n"
+    "        <td>";
+const char TemplateNetwork9[] PROGMEM = "</td>\r\n"
+    "      </tr>\r\n"
+    "      <tr>\r\n"
+    "        <td>WiFi Status:</td>\r\n"
+    "        <td>";
+const char TemplateNetwork10[] PROGMEM = "</td>\r\n"
+    "      </tr>\r\n"
+    "      <tr>\r\n"
+    "        <td>WiFi RSSI:</td>\r\n"
+    "        <td>";
+const char TemplateNetwork11[] PROGMEM = "</td>\r\n"
+    "      </tr>\r\n"
+    "      <tr>\r\n"
+    "        <td>WiFi Reconnects:</td>\r\n"
+    "        <td>";
+const char TemplateNetwork12[] PROGMEM = "</td>\r\n"
+    "      </tr>\r\n"
+    "    </table>\r\n"
+    "  </main>\r\n"
+    "  <footer>\r\n"
+    "    <nav>\r\n"
+    "      <ul class=\"selection\">\r\n"
+    "        <li><a href=\"/\">Home</a></li>\r\n"
+    "        <li><a href=\"/system\">System</a></li>\r\n"
+    "        <li class=\"current\"><a href=\"/network\">Network</a></li>\r\n"
+    "        <li><a href=\"/restart\">Restart</a></li>\r\n"
+    "      </ul>\r\n"
+    "    </nav>\r\n"
+    "  </footer>\r\n"
+    "</body>\r\n"
+    "\r\n"
+    "</html>";
+const TemplatePart TemplateNetwork[] = {
+    {TemplateNetwork0, 305, SlotStyleVersion},
+    {TemplateNetwork1, 109, SlotFormattedDate},
+    {TemplateNetwork2, 1, SlotFormattedTime},
+    {TemplateNetwork3, 48, SlotWIFISSID},
+    {TemplateNetwork4, 72, SlotLocalIP},
+    {TemplateNetwork5, 73, SlotLocalMac},
+    {TemplateNetwork6, 77, SlotLocalSubNet},
+    {TemplateNetwork7, 77, SlotLocalGateway},
+    {TemplateNetwork8, 73, SlotLocalDNS},
+    {TemplateNetwork9, 75, SlotWebStatus},
+    {TemplateNetwork10, 73, SlotWebRSSI},
+    {TemplateNetwork11, 79, SlotWiFiReconnects},
+    {TemplateNetwork12, 354, SlotNone},
+};
+const byte TemplateNetworkParts = 13;
+
+const char TemplateRestart0[] PROGMEM = "<!DOCTYPE html>\r\n"
+    "<html lang=\"en\">\r\n"
+    "\r\n"
+    "<head>\r\n"
+    "  <title>Lora</title>\r\n"
+    "  <meta charset=\"UTF-8\">\r\n"
+    "  <meta name=\"viewport\" content=\"width=device-width, initial-scale=1\">\r\n"
+    "  <link rel=\"stylesheet\" type=\"text/css\" href=\"/style.css?v=";
+const char TemplateRestart1[] PROGMEM = "\">\r\n"
+    "</head>\r\n"
+    "\r\n"
+    "<body>\r\n"
+    "  <header>\r\n"
+    "      <h1>Water Level Monitor</h1>\r\n"
+    "      <h2>Restart</h2>\r\n"
+    "    <p>";
+const char TemplateRestart2[] PROGMEM = " ";
+const char TemplateRestart3[] PROGMEM = "</p>\r\n"
+    "  </header>\r\n"
+    "  <main>\r\n"
+    "    <ul class=\"selectiontop\">\r\n"
+    "      <li><a href=\"/xstart\">Restart</a></li>\r\n"
+    "    </ul>\r\n"
+    "    <br />\r\n"
+    "  <p>Press RESTART to restart the ESP32.</p>\r\n"
+    "  <p>You will lose all data.</p>\r\n"
+    "  </main>\r\n"
+    "  <footer>\r\n"
+    "    <nav>\r\n"
+    "      <ul class=\"selection\">\r\n"
+    "        <li><a href=\"/\">Home</a></li>\r\n"
+    "        <li><a href=\"/system\">System</a></li>\r\n"
+    "        <li><a href=\"/network\">Network</a></li>\r\n"
+    "        <li class=\"current\"><a href=\"/restart\">Restart</a></li>\r\n"
+    "      </ul>\r\n"
+    "    </nav>\r\n"
+    "  </footer>\r\n"
+    "  </nav>\r\n"
+    "</body>\r\n"
+    "\r\n"
+    "\r\n"
+    "</html>";
+const TemplatePart TemplateRestart[] = {
+    {TemplateRestart0, 226, SlotStyleVersion},
+    {TemplateRestart1, 102, SlotFormattedDate},
+    {TemplateRestart2, 1, SlotFormattedTime},
+    {TemplateRestart3, 541, SlotNone},
+};
+const byte TemplateRestartParts = 4;
+
+const char TemplateSystem0[] PROGMEM = "<!DOCTYPE html>\r\n"
+    "<html lang=\"en\">\r\n"
+    "\r\n"
+    "<head>\r\n"
+    "  <title>Water Level Monitor</title>\r\n"
+    "  <meta charset=\"UTF-8\" />\r\n"
+    "  <meta name=\"viewport\" content=\"width=device-width, initial-scale=1\" />\r\n"
+    "  <link rel=\"stylesheet\" type=\"text/css\" href=\"/style.css?v=";
+const char TemplateSystem1[] PROGMEM = "\" />\r\n"
+    "</head>\r\n"
+    "\r\n"
+    "<body>\r\n"
+    "  <header>\r\n"
+    "    <h1>Water Level Monitor</h1>\r\n"
+    "    <h2>System Settings</h2>\r\n"
+    "    <p>";
+const char TemplateSystem2[] PROGMEM = " ";
+const char TemplateSystem3[] PROGMEM = "</p>\r\n"
+    "  </header>\r\n"
+    "  <main>\r\n"
+    "    <br />\r\n"
+    "    <table>\r\n"
+    "      <tr>\r\n"
+    "        <td>Chip ID:</td>\r\n"
+    "        <td>";
+const char TemplateSystem4[] PROGMEM = "</td>\r\n"
+    "        <td>Chip Revision:</td>\r\n"
+    "        <td>";
+const char TemplateSystem5[] PROGMEM = "</td>\r\n"
+    "        <td>Chip Frequency:</td>\r\n"
+    "        <td>";
+const char TemplateSystem6[] PROGMEM = "</td>\r\n"
+    "      </tr>\r\n"
+    "      <tr>\r\n"
+    "        <td>Flash Size:</td>\r\n"
+    "        <td>";
+const char TemplateSystem7[] PROGMEM = "</td>\r\n"
+    "        <td>Flash Speed:</td>\r\n"
+    "        <td>";
+const char TemplateSystem8[] PROGMEM = "</td>\r\n"
+    "      </tr>\r\n"
+    "      <tr>\r\n"
+    "        <td>Heap Size:</td>\r\n"
+    "        <td>";
+const char TemplateSystem9[] PROGMEM = "</td>\r\n"
+    "        <td>Heap Free:</td>\r\n"
+    "        <td>";
+const char TemplateSystem10[] PROGMEM = "</td>\r\n"
+    "      </tr>\r\n"
+    "      <tr>\r\n"
+    "        <td>Sketch Space Size:</td>\r\n"
+    "        <td>";
+const char TemplateSystem11[] PROGMEM = "</td>\r\n"
+    "        <td>Sketch Size:</td>\r\n"
+    "        <td>";
+const char TemplateSystem12[] PROGMEM = "</td>\r\n"
+    "      </tr>\r\n"
+    "      <tr>\r\n"
+    "        <td>Boot Time:</td>\r\n"
+    "        <td>";
+const char TemplateSystem13[] PROGMEM = "</td>\r\n"
+    "        <td>Packet Time:</td>\r\n"
+    "        <td>";
+const char TemplateSystem14[] PROGMEM = "</td>\r\n"
+    "      </tr>\r\n"
+    "      <tr>\r\n"
+    "        <td>Radio Ready:</td>\r\n"
+    "        <td>";
+const char TemplateSystem15[] PROGMEM = "</td>\r\n"
+    "        <td>First Packet:</td>\r\n"
+    "        <td>";
+const char TemplateSystem16[] PROGMEM = "</td>\r\n"
+    "      </tr>\r\n"
+    "      <tr>\r\n"
+    "        <td>Power:</td>\r\n"
+    "        <td>";
+const char TemplateSystem17[] PROGMEM = "</td>\r\n"
+    "        <td>Maintenance:</td>\r\n"
+    "        <td>";
+const char TemplateSystem18[] PROGMEM = "</td>\r\n"
+    "      </tr>\r\n"
+    "      <tr>\r\n"
+    "        <td>Radio:</td>\r\n"
+    "        <td>";
+const char TemplateSystem19[] PROGMEM = "</td>\r\n"
+    "        <td>Acks Sent:</td>\r\n"
+    "        <td>";
+const char TemplateSystem20[] PROGMEM = "</td>\r\n"
+    "      </tr>\r\n"
+    "      <tr>\r\n"
+    "        <td>History Written:</td>\r\n"
+    "        <td>";
+const char TemplateSystem21[] PROGMEM = "</td>\r\n"
+    "        <td>History Dropped:</td>\r\n"
+    "        <td>";
+const char TemplateSystem22[] PROGMEM = "</td>\r\n"
+    "      </tr>\r\n"
+    "      <tr>\r\n"
+    "        <td>Live Pages:</td>\r\n"
+    "        <td>";
+const char TemplateSystem23[] PROGMEM = "</td>\r\n"
+    "        <td>Free Heap Low:</td>\r\n"
+    "        <td>";
+const char TemplateSystem24[] PROGMEM = "</td>\r\n"
+    "      </tr>\r\n"
+    "      <tr>\r\n"
+    "        <td>Static Files:</td>\r\n"
+    "        <td>";
+const char TemplateSystem25[] PROGMEM = "</td>\r\n"
+    "      </tr>\r\n"
+    "    </table>\r\n"
+    "    <br />\r\n"
+    "    <table>\r\n"
+    "      <tr>\r\n"
+    "        <td>Task</td>\r\n"
+    "        <td>Core</td>\r\n"
+    "        <td>Priority</td>\r\n"
+    "        <td>CPU</td>\r\n"
+    "        <td>Stack Free</td>\r\n"
+    "      </tr>\r\n"
+    "      ";
+const char TemplateSystem26[] PROGMEM = "\r\n"
+    "    </table>\r\n"
+    "  </main>\r\n"
+    "  <footer>\r\n"
+    "    <nav>\r\n"
+    "      <ul class=\"selection\">\r\n"
+    "        <li><a href=\"/\">Home</a></li>\r\n"
+    "        <li class=\"current\"><a href=\"/system\">System</a></li>\r\n"
+    "        <li><a href=\"/network\">Network</a></li>\r\n"
+    "        <li><a href=\"/restart\">Restart</a></li>\r\n"
+    "      </ul>\r\n"
+    "    </nav>\r\n"
+    "  </footer>\r\n"
+    "</body>\r\n"
+    "\r\n"
+    "</html>";
+const TemplatePart TemplateSystem[] = {
+    {TemplateSystem0, 245, SlotStyleVersion},
+    {TemplateSystem1, 108, SlotFormattedDate},
+    {TemplateSystem2, 1, SlotFormattedTime},
+    {TemplateSystem3, 105, SlotChipID},
+    {TemplateSystem4, 52, SlotChipRevision},
+    {TemplateSystem5, 53, SlotChipFrequency},
+    {TemplateSystem6, 74, SlotFlashSize},
+    {TemplateSystem7, 50, SlotFlashSpeed},
+    {TemplateSystem8, 73, SlotHeapSize},
+    {TemplateSystem9, 48, SlotFreeHeap},
+    {TemplateSystem10, 81, SlotSketchSpaceFree},
+    {TemplateSystem11, 50, SlotSketchSize},
+    {TemplateSystem12, 73, SlotBootTime},
+    {TemplateSystem13, 50, SlotPacketTime},
+    {TemplateSystem14, 75, SlotBootRadio},
+    {TemplateSystem15, 51, SlotBootFirstPacket},
+    {TemplateSystem16, 69, SlotPower},
+    {TemplateSystem17, 50, SlotMaintenance},
+    {TemplateSystem18, 69, SlotRadio},
+    {TemplateSystem19, 48, SlotLinkAcks},
+    {TemplateSystem20, 79, SlotHistoryWritten},
+    {TemplateSystem21, 54, SlotHistoryDropped},
+    {TemplateSystem22, 74, SlotLiveClients},
+    {TemplateSystem23, 52, SlotMinFreeHeap},
+    {TemplateSystem24, 76, SlotAssetCache},
+    {TemplateSystem25, 214, SlotTasks},
+    {TemplateSystem26, 336, SlotNone},
+};
+const byte TemplateSystemParts = 27;
+
+#endif
@@ -0,0 +1,225 @@
+/*
+* Store and forward uplink, see Uplink.h. UplinkAdd runs wherever LoraProcessing does, everything else
+* only from whatever calls UplinkService so there is one request in flight at most.
+*/
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include "Uplink.h"
+
+// single producer (UplinkAdd) single consumer (UplinkService) ring, indexes only ever increase
+UplinkRecord UplinkRing[UplinkRingSize];
+std::atomic<uint32_t> UplinkRingHead(0); // written only by UplinkAdd
+std::atomic<uint32_t> UplinkRingTail(0); // written only by UplinkService
+// the rest is only touched by UplinkService
+uint32_t UplinkSpoolHead = 0;
+uint32_t UplinkSpoolSize = 0;
+unsigned long UplinkRetryAt = 0;   // no sends before this millis
+unsigned long UplinkRetryWait = 0; // 0 while sends are working
+unsigned long UplinkBatchStart = 0; // millis when the ring was last seen empty, about when its oldest reading arrived
+unsigned long UplinkLastSentMillis = 0;
+UplinkRecord UplinkBatch[UplinkBatchRecords];
+char UplinkPayload[UplinkPayloadSize];
+// metrics
+MetricCounter MetricUplinkRingFull;
+MetricCounter MetricUplinkSpoolFull;
+MetricCounter MetricUplinkSpooled;
+MetricCounter MetricUplinkSent;
+MetricCounter MetricUplinkBatches;
+MetricCounter MetricUplinkFailures;
+MetricHistogram MetricUplinkSend;
+
+// queue a good reading to be sent, never waits. Called from LoraProcessing
+void UplinkAdd(const NodeState &Node)
+{
+  if (Platform.Uplink == NULL)
+    return;
+  uint32_t Head = UplinkRingHead.load(std::memory_order_relaxed);
+  if (Head - UplinkRingTail.load(std::memory_order_acquire) >= UplinkRingSize)
+  {
+    MetricUplinkRingFull.Add();
+    return;
+  }
+  UplinkRecord &Record = UplinkRing[Head % UplinkRingSize];
+  Record.Time = ClockUTC();
+  Record.NodeID = Node.ID;
+  Record.HasSequence = Node.HasSequence;
+  Record.Sequence = Node.LastSequence;
+  Record.Water = Node.Water;
+  Record.VoltageRaw = Node.VoltageRaw;
+  Record.RSSI = Node.RSSI;
+  Record.SNRQuarterdB = Node.SNRQuarterdB;
+  Record.Reserved = 0;
+  UplinkRingHead.store(Head + 1, std::memory_order_release);
+}
+
+// pick up readings spooled before a restart
+void UplinkBegin()
+{
+  HalFileSystem *Files = Platform.Files;
+  UplinkSpoolSize = Files->Size(UplinkSpoolPath);
+  UplinkSpoolHead = 0;
+  Files->Read(UplinkSpoolHeadPath, 0, &UplinkSpoolHead, sizeof(UplinkSpoolHead));
+  if (UplinkSpoolSize % sizeof(UplinkRecord) != 0 || UplinkSpoolHead % sizeof(UplinkRecord) != 0 || UplinkSpoolHead > UplinkSpoolSize)
+  { // a write was cut short by a restart, can't tell where the records start so start again
+    ConsolePrintf("Uplink spool damaged, %u bytes discarded\n", UplinkSpoolSize);
+    UplinkSpoolSize = UplinkSpoolHead = 0;
+    Files->Write(UplinkSpoolPath, &UplinkSpoolHead, 0, false);
+    Files->Write(UplinkSpoolHeadPath, &UplinkSpoolHead, 0, false);
+  }
+  if (UplinkSpoolSize > UplinkSpoolHead)
+    ConsolePrintf("Uplink spool has %u readings to send\n", (unsigned)((UplinkSpoolSize - UplinkSpoolHead) / sizeof(UplinkRecord)));
+}
+
+// readings not yet accepted by the backend
+uint32_t UplinkBacklog()
+{
+  return UplinkRingHead.load(std::memory_order_relaxed) - UplinkRingTail.load(std::memory_order_relaxed) +
+         (UplinkSpoolSize - UplinkSpoolHead) / sizeof(UplinkRecord);
+}
+
+// move everything in the ring to the end of the spool
+void UplinkSpill()
+{
+  uint32_t Tail = UplinkRingTail.load(std::memory_order_relaxed);
+  uint32_t Head = UplinkRingHead.load(std::memory_order_acquire);
+  while (Tail != Head)
+  {
+    byte Count = std::min<uint32_t>(Head - Tail, UplinkBatchRecords);
+    for (byte i = 0; i < Count; i++)
+      UplinkBatch[i] = UplinkRing[(Tail + i) % UplinkRingSize];
+    Tail += Count;
+    UplinkRingTail.store(Tail, std::memory_order_release);
+    size_t Length = Count * sizeof(UplinkRecord);
+    if (UplinkSpoolSize + Length > UplinkSpoolMaxBytes || !Platform.Files->Write(UplinkSpoolPath, UplinkBatch, Length, true))
+    { // keep the oldest, the backend can at least see when the gap started
+      MetricUplinkSpoolFull.Add(Count);
+      continue;
+    }
+    UplinkSpoolSize += Length;
+    MetricUplinkSpooled.Add(Count);
+  }
+}
+
+// compact JSON for a batch, the field names are sent once rather than per reading
+size_t UplinkFormat(const UplinkRecord *Records, byte Count, char *Text, size_t Size)
+{
+  int Length = snprintf(Text, Size, "{\"fields\":[\"time\",\"node\",\"sequence\",\"water\",\"volts\",\"rssi\",\"snr\"],\"readings\":[");
+  for (byte i = 0; i < Count && Length < (int)Size; i++)
+  {
+    const UplinkRecord &Record = Records[i];
+    char Sequence[8] = "null";
+    if (Record.HasSequence)
+      snprintf(Sequence, sizeof(Sequence), "%u", Record.Sequence);
+    Length += snprintf(Text + Length, Size - Length, "%s[%u,%u,%s,%d,%.2f,%d,%.2f]", i == 0 ? "" : ",", Record.Time, Record.NodeID,
+                       Sequence, Record.Water, Record.VoltageRaw / 100.0, Record.RSSI, Record.SNRQuarterdB / 4.0);
+  }
+  if (Length < (int)Size)
+    Length += snprintf(Text + Length, Size - Length, "]}");
+  return std::min<size_t>(Length, Size - 1);
+}
+
+// send the next batch if there is one and it is time. Returns true if it sent a batch and more are waiting,
+// so a backlog goes out as fast as the backend takes it, otherwise call again after UplinkServiceInterval
+bool UplinkService()
+{
+  if (Platform.Uplink == NULL)
+    return false;
+  HalFileSystem *Files = Platform.Files;
+  unsigned long Now = Platform.Clock->Millis();
+  bool Up = Platform.Network->Connected();
+  uint32_t Tail = UplinkRingTail.load(std::memory_order_relaxed);
+  uint32_t InRing = UplinkRingHead.load(std::memory_order_acquire) - Tail;
+  if (InRing == 0)
+    UplinkBatchStart = Now;
+  // once anything is spooled everything goes through the spool to keep the order, and the ring isn't left to fill while we can't send
+  bool Waiting = !Up || (long)(Now - UplinkRetryAt) < 0;
+  if (InRing > 0 && (UplinkSpoolHead < UplinkSpoolSize || (Waiting && (!Up || InRing >= UplinkRingSize / 2))))
+  {
+    UplinkSpill();
+    InRing = 0;
+  }
+  if (Waiting)
+    return false;
+
+  bool FromSpool = UplinkSpoolHead < UplinkSpoolSize;
+  byte Count;
+  if (FromSpool)
+  {
+    size_t Length = std::min<size_t>(UplinkSpoolSize - UplinkSpoolHead, sizeof(UplinkBatch));
+    Count = Files->Read(UplinkSpoolPath, UplinkSpoolHead, UplinkBatch, Length) / sizeof(UplinkRecord);
+    if (Count == 0)
+    { // spool has gone, nothing to be done about it
+      MetricUplinkSpoolFull.Add((UplinkSpoolSize - UplinkSpoolHead) / sizeof(UplinkRecord));
+      UplinkSpoolSize = UplinkSpoolHead = 0;
+      return false;
+    }
+  }
+  else
+  {
+    if (InRing == 0 || (InRing < UplinkBatchRecords && Now - UplinkBatchStart < UplinkBatchMillis))
+      return false;
+    Count = std::min<uint32_t>(InRing, UplinkBatchRecords);
+    for (byte i = 0; i < Count; i++)
+      UplinkBatch[i] = UplinkRing[(Tail + i) % UplinkRingSize];
+  }
+
+  size_t Length = UplinkFormat(UplinkBatch, Count, UplinkPayload, sizeof(UplinkPayload));
+  bool Sent = Platform.Uplink->Send(UplinkPayload, Length);
+  unsigned long End = Platform.Clock->Millis();
+  MetricUplinkSend.Observe(End - Now);
+  if (!Sent)
+  {
+    MetricUplinkFailures.Add();
+    UplinkRetryWait = UplinkRetryWait == 0 ? UplinkRetryMin : std::min(UplinkRetryWait * 2, UplinkRetryMax);
+    UplinkRetryAt = End + UplinkRetryWait;
+    ConsolePrintf("Uplink send failed, %u readings waiting, trying again in %lus\n", UplinkBacklog(), UplinkRetryWait / 1000);
+    return false;
+  }
+  UplinkRetryWait = 0;
+  UplinkRetryAt = End;
+  UplinkLastSentMillis = End;
+  MetricUplinkBatches.Add();
+  MetricUplinkSent.Add(Count);
+  if (!FromSpool)
+  {
+    UplinkRingTail.store(Tail + Count, std::memory_order_release);
+    UplinkBatchStart = End; // what is left has only just been looked at
+    return InRing - Count >= UplinkBatchRecords;
+  }
+  UplinkSpoolHead += Count * sizeof(UplinkRecord);
+  if (UplinkSpoolHead >= UplinkSpoolSize) // all sent, start the spool again. Head first, a restart in between resends rather than loses
+  {
+    UplinkSpoolSize = UplinkSpoolHead = 0;
+    Files->Write(UplinkSpoolHeadPath, &UplinkSpoolHead, sizeof(UplinkSpoolHead), false);
+    Files->Write(UplinkSpoolPath, &UplinkSpoolHead, 0, false);
+    return false;
+  }
+  Files->Write(UplinkSpoolHeadPath, &UplinkSpoolHead, sizeof(UplinkSpoolHead), false);
+  return true;
+}
+
+double MetricReadUplinkBacklog(byte Row) { return UplinkBacklog(); }
+double MetricReadUplinkSpoolBytes(byte Row) { return UplinkSpoolSize - UplinkSpoolHead; }
+double MetricReadUplinkSent(byte Row) { return MetricUplinkSent.Read(); }
+double MetricReadUplinkBatches(byte Row) { return MetricUplinkBatches.Read(); }
+double MetricReadUplinkFailures(byte Row) { return MetricUplinkFailures.Read(); }
+double MetricReadUplinkSpooled(byte Row) { return MetricUplinkSpooled.Read(); }
+double MetricReadUplinkRingFull(byte Row) { return MetricUplinkRingFull.Read(); }
+double MetricReadUplinkSpoolFull(byte Row) { return MetricUplinkSpoolFull.Read(); }
+double MetricReadUplinkAge(byte Row) { return (Platform.Clock->Millis() - UplinkLastSentMillis) / 1000.0; }
+
+const MetricExport UplinkMetrics[] = {
+    {"water_uplink_backlog_readings", "gauge", "Readings waiting to be sent to the backend", MetricReadUplinkBacklog},
+    {"water_uplink_spool_bytes", "gauge", "Flash used by readings waiting for the network", MetricReadUplinkSpoolBytes},
+    {"water_uplink_sent_total", "counter", "Readings the backend has accepted", MetricReadUplinkSent},
+    {"water_uplink_batches_total", "counter", "Requests the backend has accepted", MetricReadUplinkBatches},
+    {"water_uplink_failures_total", "counter", "Requests that failed and will be retried", MetricReadUplinkFailures},
+    {"water_uplink_spooled_total", "counter", "Readings written to flash to wait for the network", MetricReadUplinkSpooled},
+    {"water_uplink_ring_full_total", "counter", "Readings lost because the uplink fell behind", MetricReadUplinkRingFull},
+    {"water_uplink_spool_full_total", "counter", "Readings lost because the spool was full", MetricReadUplinkSpoolFull},
+    {"water_uplink_last_sent_seconds", "gauge", "Time since the backend last accepted a request", MetricReadUplinkAge},
+    {"water_uplink_send_seconds", "histogram", "Time taken by each request", NULL, &MetricUplinkSend, 1e-3},
+};
+const byte UplinkMetricCount = sizeof(UplinkMetrics) / sizeof(UplinkMetrics[0]);
@@ -0,0 +1,54 @@
+/*
+* Store and forward of good readings to a backend through Platform.Uplink.
+* LoraProcessing queues each reading in RAM without waiting, UplinkService batches them up and sends them,
+* moving them to a spool file in flash while the network is down so nothing is lost across outages or restarts.
+*/
+
+#ifndef UPLINK_H
+#define UPLINK_H
+
+#include "Receiver.h"
+
+const byte UplinkRingSize = 64;                    // readings waiting in RAM, must be a power of 2
+const byte UplinkBatchRecords = 32;                // most readings sent in one request
+const unsigned long UplinkBatchMillis = 30000;     // send a part batch once its oldest reading has waited this long
+const unsigned long UplinkServiceInterval = 1000;  // how often UplinkService should be called when it has nothing more to do
+const unsigned long UplinkRetryMin = 5000;         // wait after the first failed send, doubled after each failure
+const unsigned long UplinkRetryMax = 600000;       // longest wait between sends while the backend keeps failing
+const uint32_t UplinkSpoolMaxBytes = 65536;        // 4096 readings, about 3 days from one sender
+const size_t UplinkPayloadSize = 128 + UplinkBatchRecords * 48; // JSON for a full batch
+const char UplinkSpoolPath[] = "/uplink.q";        // readings waiting to be sent, oldest first
+const char UplinkSpoolHeadPath[] = "/uplink.h";    // bytes at the start of the spool that have been sent
+
+struct UplinkRecord // 16 bytes, written to the spool as is
+{
+  uint32_t Time; // UTC seconds when it was received
+  uint8_t NodeID;
+  uint8_t HasSequence;
+  uint16_t Sequence; // lets the backend drop a batch it gets twice after a lost reply
+  int16_t Water;
+  int16_t VoltageRaw;
+  int16_t RSSI;
+  int8_t SNRQuarterdB;
+  uint8_t Reserved;
+};
+
+extern uint32_t UplinkSpoolHead; // bytes of the spool already sent
+extern uint32_t UplinkSpoolSize;
+extern MetricCounter MetricUplinkRingFull;  // readings lost because UplinkService fell behind
+extern MetricCounter MetricUplinkSpoolFull; // readings lost because the spool was full or couldn't be written
+extern MetricCounter MetricUplinkSpooled;   // readings written to flash to wait for the network
+extern MetricCounter MetricUplinkSent;      // readings the backend has accepted
+extern MetricCounter MetricUplinkBatches;
+extern MetricCounter MetricUplinkFailures;
+extern MetricHistogram MetricUplinkSend; // milliseconds per request
+extern const MetricExport UplinkMetrics[];
+extern const byte UplinkMetricCount;
+
+void UplinkAdd(const NodeState &Node);
+void UplinkBegin();
+bool UplinkService();
+uint32_t UplinkBacklog();
+size_t UplinkFormat(const UplinkRecord *Records, byte Count, char *Text, size_t Size);
+
+#endif
@@ -5,15 +5,31 @@
 * module and is presented as a curiosity for review.
 */
 
+#include <memory>              // Built in library, shared_ptr keeps streamed web responses alive
+#include <sys/time.h>          // Built in library, settimeofday so the clock carries on through a software reset
+#include <esp_system.h>        // Built in library, esp_reset_reason
+#include <esp_wifi.h>          // Built in library, esp_wifi_set_ps
 #include <SPI.h>               // Built in library
 #include <LoRa.h>              // installed from Platformio
 #include <Wire.h>              // Built in library
 #include <SSD1306.h>           // installed from Platformio
 #include <ArduinoOTA.h>        // Built in library
-#include "Security.h"          // text file with Wifi username and password
+#include <Update.h>            // Built in library, writes /api/v1/update images
+#include <esp_ota_ops.h>       // Built in library, the running firmware a delta copies from
+#include "Security.h"          // text file with Wifi username and password, the config's defaults
+#include <Preferences.h>       // Built in library, NVS where the config is kept
 #include <NTP.h>               // by Stefan Staub, installed from Platformio but also available at https://github.com/sstaub/NTP
 #include <SPIFFS.h>            // Built in library
 #include <ESPAsyncWebServer.h> // installed from Platformio but also available at https://github.com/me-no-dev/ESPAsyncWebServer
+#include <HTTPClient.h>        // Built in library
+#include "Receiver.h"          // the receive pipeline, talks to the board through Platform
+#include "Link.h"              // radio settings and per sender link control
+#include "Uplink.h"            // forwards readings to the backend
+#include "Power.h"             // estimated current draw
+#include "Alert.h"             // alert rules checked on each packet
+#include "Config.h"            // settings kept in flash and changed through /api/v1/config
+#include "Patch.h"             // compressed and delta update packs
+#include "Page.h"              // web pages compiled from data/*.html by scripts/compile_templates.py
 
 const String Version = "20190517-001";
 
@@ -26,110 +42,286 @@ const byte BuiltInLED = 2;
 #define SS 18                         // GPIO18 -- SX1278's CS
 #define RST 14                        // GPIO14 -- SX1278's RESET
 #define DIO0 26                       // GPIO26 -- SX1278's IRQ(Interrupt Request)
-const unsigned long LoraBand = 915E6; // 915E6, 868E6, 433E6
+#define LoraRegPktSnrValue 0x19       // SX1278 register holding the last packet SNR in 1/4 dB steps
+const unsigned long LoraBand = 915E6; // 915E6, 868E6, 433E6, the config's default
+const uint8_t LoraSyncWord = 0xA1;    // ranges from 0-0xFF, default 0x34, see API docs - doesn't seem to work reliably
 // OLED display
 const byte OLEDResetPin = 16; // reset pin for OLED display
 const byte OLEDSDA = 4;
 const byte OLEDSCL = 15;
 // wifi
-const byte WiFiMaxCycle = 10;  // number of cycles before disconnect and reconnect
-const int WiFiLoopWait = 2000; // wait for wifi to settle, probably not needed
-const byte WiFiLoopCycle = 10; // number of cycles before reboot
-const IPAddress WiFiIP(192, 168, 0, 22);
-const IPAddress WiFiGateway(192, 168, 0, 1);
-const IPAddress WiFiSubnet(255, 255, 0, 0);
-const IPAddress WiFiPrimaryDNS(192, 168, 0, 1); //must have if not using DHCP
-const IPAddress WiFiSecondaryDNS(8, 8, 4, 4);   //optional
+const unsigned long WiFiAttemptTimeout = 15000; // give up on a connection attempt that has no address by then
+const unsigned long WiFiBackoffMin = 1000;      // wait after the first failed attempt, doubled after each failure
+const unsigned long WiFiBackoffMax = 120000;    // longest wait between attempts
+const unsigned long WiFiConfigDelay = 1000;     // after a settings change before reconnecting, so the answer gets out
+// the config's defaults, used until something is stored. 0.0.0.0 for DHCP
+const uint8_t WiFiIP[4] = {192, 168, 0, 22};
+const uint8_t WiFiGateway[4] = {192, 168, 0, 1};
+const uint8_t WiFiSubnet[4] = {255, 255, 0, 0};
+const uint8_t WiFiPrimaryDNS[4] = {192, 168, 0, 1}; //must have if not using DHCP
+const uint8_t WiFiSecondaryDNS[4] = {8, 8, 4, 4};   //optional
+// /api/v1/config needs this token until the config has one, put #define CONFIG_TOKEN "..." in Security.h
+#ifndef CONFIG_TOKEN
+#define CONFIG_TOKEN ""
+#endif
 //
 const byte LEDOn = HIGH;
 const byte LEDOff = LOW;
 // delays
 const int SerialStartDelay = 100; //delay after starting the serial interface to let things settle
 // Main Loop delays
-const int MainLoopCycleTime = 100;   // have a leisurely romp through the main loop
+const int MainLoopCycleTime = 1000;  // HousekeepingTask keeps NTP in sync this often, packets wake LoraTask directly
 const int OTALoopCycleTime = 50;     // stop OTA being in a tight loop
+const unsigned long TaskReportInterval = 10000; // task CPU use is worked out over this long
+const unsigned long EventsListenerRefresh = 1000; // EventsTask counts the open pages this often, and when one opens
 const int XStartDisplayDelay = 5000; // delay the restart to give time for the web page to be displayed
+const unsigned long FilesQuiesceWait = 5000; // a file system update waits this long for file responses to finish
+
+// power, POWER_SAVE is set by the solar env in platformio.ini
+#ifndef POWER_SAVE
+#define POWER_SAVE 0
+#endif
+#if POWER_SAVE && CONFIG_PM_ENABLE && CONFIG_FREERTOS_USE_TICKLESS_IDLE
+#include <esp_pm.h>            // Built in library, automatic light sleep
+#include <esp_sleep.h>
+#include <driver/gpio.h>
+#endif
+const bool PowerSave = POWER_SAVE;
+const uint32_t PowerCPUMHz = 80;                           // lowest clock the WiFi driver works at
+const uint32_t PowerCPUMinMHz = 40;                        // between events when the CPU can light sleep
+const unsigned long PowerHousekeepingInterval = 10000;     // HousekeepingTask wakes this often outside the maintenance window
+const unsigned long MaintenanceWindowMillis = 600000;      // OTA listens this long after boot or /maintenance when saving power
 
 // NTP
 const unsigned long NTPRefresh = 60000 * 60 * 24;  // refresh time in milliseconds, i.e. once per day
-const char NTPServerName[] = "msltime.irl.cri.nz"; // New Zealand time server, use the closest one to your location
-// delay to display message on OLED display
-const int OLEDDisplayDelay = 400; // pause after displaying a message while starting up so that it can be read
-// Lora packet
-const String LoraPacketPreAmble = "A1A"; // LoraPacketPreAmble - received packet must start with this
-const int LoraMaxPacketSize = 10;        // Sanity check, anything longer than this is a bad packet
+const char NTPServerName[] = "msltime.irl.cri.nz"; // New Zealand time server, use the closest one to your location, the config's default
+const char ClockTimeZone[] = "NZST-12NZDT,M9.5.0,M4.1.0/3"; // New Zealand with daylight saving, the config's default
+// uplink
+const char UplinkURL[] = "http://192.168.0.10:8080/readings"; // readings are POSTed here as JSON, "" turns the uplink off
+const uint16_t UplinkTimeout = 5000;                          // milliseconds to wait for the backend
+const char AlertURL[] = "";                                   // alerts are POSTed here as JSON, i.e. a webhook, "" doesn't send them
+// OLED display, OLEDLines and OLEDLineLength are in Hal.h
+const byte OLEDLineHeight = 12; // pixels between lines
+const byte OLEDFontHeight = 13; // ArialMT_Plain_10 including descenders, overlaps the next line by a pixel
+const byte LEDQueueSize = 4;    // LED patterns that can wait behind the one playing
+// web pages
+const size_t AssetCacheMaxSize = 4096; // static files up to this size are kept in RAM
 
 // Web Server
 AsyncWebServer WebServer(80);
+AsyncEventSource Events("/events"); // pushes each good packet to open home pages
+// static files in SPIFFS, sent gzipped if scripts/gzip_assets.py made a .gz copy
+struct StaticAsset
+{
+  const char *Path;        // URL and SPIFFS file name
+  const char *GzipPath;    // SPIFFS name of the gzipped copy
+  const char *ContentType;
+  bool Gzip;               // the gzipped copy is in SPIFFS
+  uint32_t Hash;           // FNV-1a of the file, used for the ETag and the ?v= on page links
+  uint8_t *Cache;          // the file as sent, gzipped if possible, when small enough to keep in RAM
+  size_t CacheSize;
+};
+StaticAsset StaticAssets[] = {{"/style.css", "/style.css.gz", "text/css"}, {"/favicon.ico", "/favicon.ico.gz", "image/x-icon"}};
+const byte StaticAssetStyle = 0;
+const byte StaticAssetFavicon = 1;
+uint32_t AssetHits = 0;        // sent from RAM
+uint32_t AssetMisses = 0;      // read from flash
+uint32_t AssetNotModified = 0; // browser already had it
+// SPIFFS, unmounted for a file system update
+SemaphoreHandle_t FilesMutex = NULL; // held around each Platform.Files call so SPIFFS is never unmounted part way through one
+bool FilesMounted = false;
+bool WebFilesClosed = false;         // file responses get a 503 while SPIFFS is being updated
+std::atomic<int> WebFilesOpen(0);    // responses still reading SPIFFS
 // NTP Server
 WiFiUDP NTPUDP;
 NTP NTPTime(NTPUDP);
-String FormattedDate = ""; // used in the web pages
-String FormattedTime = "";
+char NTPServer[ConfigTextSize];      // from the config, NTPTime keeps a pointer to it
+SemaphoreHandle_t ClockMutex = NULL; // the time zone and setting the time, read from LoraTask and the web server. NTPTime
+                                     // itself is only used by HousekeepingTask
 // SSD1306
 SSD1306 OLEDDisplay(0x3c, OLEDSDA, OLEDSCL);
-// Lora packets
-String LoraRSSI = "";
-String LoraSNR = "";
-String LoraPackSize = "";
-String LoraPacket = "";
-String LoraLastGoodPacket = "";
-String LoraLastGoodPacketSize = "";
-String WaterLevel = "";
-String VoltageLevel = "";
-String LoraRxDate = "";
-String LoraRxTime = "";
-float Volts = 0.0;
-bool LoraPacketFlag = false; // indicates if a packet has been received by the lora receive callback
-int LoraPacketSize = 0;      // holds the current packet size
-// WiFi info
-String LocalIP = "";
-String LocalMac = "";
-String LocalSubNet = "";
-String LocalGateway = "";
-String LocalDNS = "";
-String WebStatus = "";
-String WebRSSI = "";
+char OLEDText[OLEDLines][OLEDLineLength]; // what should be on the display, written by anyone through OLEDSetLine
+byte OLEDDirty = 0;                       // bit per line that has changed since DisplayTask last drew it
+portMUX_TYPE OLEDMux = portMUX_INITIALIZER_UNLOCKED;
+TaskHandle_t DisplayTaskHandle = NULL;
+// LED
+struct LEDPattern
+{
+  int OnTime;
+  int OffTime;
+  int Repeat;
+};
+QueueHandle_t LEDQueue = NULL;
+TimerHandle_t LEDTimer = NULL;
+LEDPattern LEDCurrent; // pattern being played, only touched by LEDTimerCallback
+int LEDStepsLeft = 0;  // on and off steps left in LEDCurrent
+// boot and packet timing, shown on the system page
+RTC_NOINIT_ATTR WarmState BoardWarm; // saved by LoraTask after every packet, survives OTA, /xstart and crashes but not power off
+bool BootWarm = false;               // BoardWarm was restored
+unsigned long BootRadioMillis = 0;   // the radio was listening
+unsigned long BootReadyMillis = 0;
+unsigned long BootFirstPacketMillis = 0; // the first packet arrived, 0 until then
+unsigned long PacketBlockMicros = 0;    // time LoraTask spent on the last packet
+unsigned long PacketBlockMaxMicros = 0; // longest time LoraTask spent on a packet
+// tasks woken when there is work for them
+TaskHandle_t LoraTaskHandle = NULL;    // woken by LoraReceiveInterrupt when a packet is in the ring
+TaskHandle_t HistoryTaskHandle = NULL; // woken by LoraTask when enough readings are waiting
+TaskHandle_t WiFiTaskHandle = NULL;    // woken by WiFiEvent when the connection comes or goes
+TaskHandle_t UplinkTaskHandle = NULL;
+TaskHandle_t HousekeepingTaskHandle = NULL;
+TaskHandle_t EventsTaskHandle = NULL;  // woken by LoraTask when it has queued live page updates
+// the tasks we start, see Tasks for where each runs
+enum TaskID : byte
+{
+  TaskLora,
+  TaskDisplay,
+  TaskWiFi,
+  TaskUplink,
+  TaskHistory,
+  TaskHousekeeping,
+  TaskEvents,
+  TaskCount
+};
+MetricCounter TaskBusyMillis[TaskCount]; // time each task spent working rather than waiting, only written by the task itself
+uint32_t TaskBusyRemainder[TaskCount];   // microseconds not yet a whole millisecond, kept so short waits still add up
+float TaskBusyPercent[TaskCount];        // of one core over the last TaskReportInterval, worked out by HousekeepingTask
+// board metrics for /metrics, each has one writer task
+MetricCounter MetricWiFiConnects;     // WiFi.begin calls
+MetricCounter MetricWiFiReconnects;   // connections after the first one
+MetricCounter MetricWiFiDowntime;     // milliseconds without WiFi since it first connected
+MetricCounter MetricNTPSyncs;         // times NTP went to the network
+MetricCounter MetricOTAStarts;
+MetricCounter MetricOTAErrors;
+MetricHistogram MetricWiFiConnect;    // milliseconds from losing WiFi, or boot, to having an address again
+MetricHistogram MetricLoraTask;       // microseconds LoraTask spent on each packet, including the LED and history wakeup
+MetricHistogram MetricWebRequest;     // microseconds in each web handler, the response is streamed after it returns
+unsigned long NTPLastSyncMillis = 0;
+unsigned long MaintenanceOpenedMillis = 0; // boot or the last /maintenance, see MaintenanceOpen
+bool PowerLightSleep = false;              // the CPU light sleeps whenever every task is waiting
+uint32_t OTAProgress = 0;             // percent of the current OTA update
+AsyncWebServerRequest *UpdateRequest = NULL; // the /api/v1/update upload being decoded, one at a time
+bool UpdateRestart = false;                  // an update has been switched to, HousekeepingTask restarts into it
+// WiFi info, written by WiFiTask and copied out under WiFiInfoLock by the web pages
+struct WiFiInfo
+{
+  char LocalIP[16];
+  char LocalMac[18];
+  char LocalSubNet[16];
+  char LocalGateway[16];
+  char LocalDNS[16];
+  char WebStatus[24];
+  char WebRSSI[8];
+};
+WiFiInfo WiFiShown = {};
+HalLock WiFiInfoLock;
+std::atomic<bool> WiFiUp(false);      // set by WiFiEvent, has an address
+unsigned long WiFiDownSince = 0;      // millis when WiFi was lost
+unsigned long WiFiLastOutageMillis = 0;
 
 // sub routines
+// add the time since Start to a task's busy time, called by the task itself when it is about to wait again
+void TaskBusy(TaskID Task, unsigned long Start)
+{
+  unsigned long Busy = micros() - Start;
+  uint32_t Micros = TaskBusyRemainder[Task] + Busy; // milliseconds so the counter lasts 49 days rather than 71 minutes
+  TaskBusyMillis[Task].Add(Micros / 1000);
+  TaskBusyRemainder[Task] = Micros % 1000;
+  if (Task != TaskUplink) // its busy time is mostly HTTPClient waiting on the network with the CPU idle
+    PowerMove(PowerCPUActive, Busy / 2); // the CPU figures are for both cores
+}
+
+// OTA listens all the time unless saving power, then only for a while after boot or /maintenance
+bool MaintenanceOpen()
+{
+  return !PowerSave || millis() - MaintenanceOpenedMillis < MaintenanceWindowMillis;
+}
+
 //-----------------------------------------------
+// set one line of the OLED display, returns straight away, DisplayTask does the drawing
+void OLEDSetLine(byte Line, const char *Text)
+{
+  if (Line >= OLEDLines)
+    return;
+  portENTER_CRITICAL(&OLEDMux);
+  if (strncmp(OLEDText[Line], Text, OLEDLineLength - 1) != 0)
+  {
+    strncpy(OLEDText[Line], Text, OLEDLineLength - 1);
+    OLEDText[Line][OLEDLineLength - 1] = '\0';
+    OLEDDirty |= 1 << Line;
+  }
+  portEXIT_CRITICAL(&OLEDMux);
+}
+
+// tell DisplayTask there is something to draw
+void OLEDUpdate()
+{
+  if (DisplayTaskHandle != NULL)
+    xTaskNotifyGive(DisplayTaskHandle);
+}
+
 // common oled display setup
-void OLEDMessage(String OLEDText) // must be first as used immediately after serial setup to display setup progress
+void OLEDMessage(const char *Text) // must be first as used immediately after serial setup to display setup progress
 {
-  OLEDDisplay.clear();
-  OLEDDisplay.drawString(0, 0, OLEDText);
-  OLEDDisplay.display();
+  OLEDSetLine(0, Text);
+  for (byte i = 1; i < OLEDLines; i++)
+    OLEDSetLine(i, "");
+  OLEDUpdate();
 }
 
-// Format a numeric string with commas, mainly used to display the system information values and file sizes, i.e. 240,000,000MHz clock speed
-// Do not use for numbers with decimal places or non-mumerics
-String FormatString(String RawNumber)
+// the only place the OLED is written to, redraws the changed lines when woken by OLEDUpdate
+void DisplayTask(void *p)
 {
-  RawNumber.trim();
-  // do some sanity checks
-  if (RawNumber.length() < 1)
-    return "Not a valid number length";
-  if (RawNumber.length() < 4)
-    return RawNumber; // no need to add commas
-  for (int i = 0; i < RawNumber.length(); i++)
+  char Text[OLEDLines][OLEDLineLength];
+  while (true)
   {
-    if (!isDigit(RawNumber.charAt(i)))
-      return "Not a valid whole number";
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    unsigned long Start = micros();
+    portENTER_CRITICAL(&OLEDMux);
+    byte Dirty = OLEDDirty;
+    OLEDDirty = 0;
+    memcpy(Text, OLEDText, sizeof(Text));
+    portEXIT_CRITICAL(&OLEDMux);
+    if (Dirty == 0)
+    {
+      TaskBusy(TaskDisplay, Start);
+      continue;
+    }
+    Dirty |= (Dirty << 1) & ((1 << OLEDLines) - 1); // clearing a line also clears the top pixel row of the one below it
+    OLEDDisplay.setColor(BLACK);
+    for (byte i = 0; i < OLEDLines; i++)
+      if (Dirty & (1 << i))
+        OLEDDisplay.fillRect(0, i * OLEDLineHeight, 128, OLEDFontHeight);
+    OLEDDisplay.setColor(WHITE);
+    for (byte i = 0; i < OLEDLines; i++)
+      if (Dirty & (1 << i))
+        OLEDDisplay.drawString(0, i * OLEDLineHeight, Text[i]);
+    OLEDDisplay.display();
+    TaskBusy(TaskDisplay, Start);
   }
-  String FinalNumber = ""; // working strings
-  String WorkingNumber = "";
-  int j = 0;
-  for (j = RawNumber.length(); j > 3; j = j - 3) // work from right hand side to left in multiples of 3, i.e. thousands
+}
+
+// plays queued LED patterns one step at a time, runs in the FreeRTOS timer task
+void LEDTimerCallback(TimerHandle_t Timer)
+{
+  if (LEDStepsLeft == 0) // finished the last pattern, start the next one if there is one
   {
-    WorkingNumber = RawNumber.substring(j - 3, j); // get a block
-    if ((FinalNumber == "") ? FinalNumber = WorkingNumber : FinalNumber = WorkingNumber + FinalNumber)
-      ; // if it is the first then start the string else add it to the existing string
-    if (j > 1)
-      FinalNumber = "," + FinalNumber; // if it is a multiple of 3 and and there is more than 1 character left then add a comma
+    if (xQueueReceive(LEDQueue, &LEDCurrent, 0) != pdTRUE)
+    {
+      digitalWrite(BuiltInLED, LEDOff);
+      return; // leave the timer stopped until FlashLED queues something
+    }
+    LEDStepsLeft = LEDCurrent.Repeat * 2;
+    if (LEDStepsLeft == 0)
+    {
+      xTimerChangePeriod(LEDTimer, 1, 0);
+      return;
+    }
   }
-  if (j <= 3)
-    FinalNumber = RawNumber.substring(0, j) + FinalNumber; // add the last digits (less than 3) to the front of the number
-  return FinalNumber;
+  bool On = (LEDStepsLeft % 2 == 0);
+  digitalWrite(BuiltInLED, On ? LEDOn : LEDOff);
+  LEDStepsLeft--;
+  TickType_t StepTicks = pdMS_TO_TICKS(On ? LEDCurrent.OnTime : LEDCurrent.OffTime);
+  xTimerChangePeriod(LEDTimer, StepTicks > 0 ? StepTicks : 1, 0); // a period of 0 is not allowed
 }
 
 void SerialConnect()
@@ -138,81 +330,154 @@ void SerialConnect()
   vTaskDelay(pdMS_TO_TICKS(SerialStartDelay)); // probably unnecessary
 }
 
-void WiFiConnect()
+// WiFi status as text for the network page
+const char *WiFiStatusText(wl_status_t Status)
 {
-  byte TempLoopCount = 0;               // used to keep track of the number of times through the outer "wifi.disconnect" loop, reboot if exceeded
-  while (WiFi.status() != WL_CONNECTED) // Infinate loop - if wifi is not available then no point carrying on
+  switch (Status)
   {
-    TempLoopCount++;
-    if (TempLoopCount > WiFiLoopCycle) // restart if we have cycled too much
-      ESP.restart();
-    WiFi.disconnect();      // disconnect if we have tried begin too many times
-    byte TempWiFiCount = 0; // used to keep track of the number of times "wifi.begin" is called, wifi disconnect if exceeded
-    Serial.print("Starting WiFi");
-    while ((TempWiFiCount <= WiFiMaxCycle) && (WiFi.status() != WL_CONNECTED)) // try to connect x times
+  case WL_IDLE_STATUS:
+    return "WL_IDLE_STATUS"; // 0
+  case WL_NO_SSID_AVAIL:
+    return "WL_NO_SSID_AVAIL"; // 1
+  case WL_SCAN_COMPLETED:
+    return "WL_SCAN_COMPLETED"; // 2
+  case WL_CONNECTED:
+    return "WL_CONNECTED"; // 3
+  case WL_CONNECT_FAILED:
+    return "WL_CONNECT_FAILED"; // 4
+  case WL_CONNECTION_LOST:
+    return "WL_CONNECTION_LOST"; // 5
+  case WL_DISCONNECTED:
+    return "WL_DISCONNECTED"; // 6
+  case WL_NO_SHIELD:
+    return "WL_NO_SHIELD"; // 255
+  default:
+    return "Undefined WiFi status";
+  }
+}
+
+// runs in the WiFi driver's event task, just records the state and wakes WiFiTask
+void WiFiEvent(WiFiEvent_t Event)
+{
+  if (Event == SYSTEM_EVENT_STA_GOT_IP)
+  {
+    WiFiUp = true;
+    PowerSet(PowerWiFiModemSleep);
+  }
+  else if (Event == SYSTEM_EVENT_STA_DISCONNECTED)
+  {
+    WiFiUp = false;
+    PowerSet(PowerWiFiActive);
+  }
+  else
+    return;
+  if (WiFiTaskHandle != NULL)
+    xTaskNotifyGive(WiFiTaskHandle);
+}
+
+// a copy of the WiFi info, the page handlers run on the web server's task while WiFiTask rewrites it
+void WiFiInfoRead(WiFiInfo &Info)
+{
+  HalEnter(WiFiInfoLock);
+  Info = WiFiShown;
+  HalExit(WiFiInfoLock);
+}
+
+void WiFiStatusSet(wl_status_t Status)
+{
+  HalEnter(WiFiInfoLock);
+  snprintf(WiFiShown.WebStatus, sizeof(WiFiShown.WebStatus), "%s", WiFiStatusText(Status));
+  HalExit(WiFiInfoLock);
+}
+
+// keep the values for the network web page and print them for diagnosis
+void WiFiConnected()
+{
+  WiFiInfo Info; // filled outside the lock, the WiFi calls are too slow for a critical section
+  snprintf(Info.LocalIP, sizeof(Info.LocalIP), "%s", WiFi.localIP().toString().c_str());
+  snprintf(Info.LocalSubNet, sizeof(Info.LocalSubNet), "%s", WiFi.subnetMask().toString().c_str());
+  snprintf(Info.LocalGateway, sizeof(Info.LocalGateway), "%s", WiFi.gatewayIP().toString().c_str());
+  snprintf(Info.LocalMac, sizeof(Info.LocalMac), "%s", WiFi.macAddress().c_str());
+  snprintf(Info.LocalDNS, sizeof(Info.LocalDNS), "%s", WiFi.dnsIP().toString().c_str());
+  snprintf(Info.WebRSSI, sizeof(Info.WebRSSI), "%d", int(WiFi.RSSI()));
+  snprintf(Info.WebStatus, sizeof(Info.WebStatus), "%s", WiFiStatusText(WL_CONNECTED));
+  HalEnter(WiFiInfoLock);
+  WiFiShown = Info;
+  HalExit(WiFiInfoLock);
+  Serial.print("SSID: ");
+  Serial.println(WiFi.SSID());
+  Serial.printf("IP address: %s\n", Info.LocalIP);
+  Serial.printf("Mac Address: %s\n", Info.LocalMac);
+  Serial.printf("Subnet Mask: %s\n", Info.LocalSubNet);
+  Serial.printf("Gateway IP: %s\n", Info.LocalGateway);
+  Serial.printf("DNS: %s\n", Info.LocalDNS);
+  Serial.printf("WiFi RSSI: %s\n", Info.WebRSSI);
+}
+
+// keeps WiFi connected on core 0, sleeping until WiFiEvent says something changed. Failed attempts back off
+// exponentially rather than rebooting, the radio and history carry on regardless
+void WiFiTask(void *p)
+{
+  unsigned long Backoff = WiFiBackoffMin;
+  bool EverConnected = false;
+  WiFiDownSince = millis();
+  while (true)
+  {
+    unsigned long Start = micros();
+    Serial.println("Starting WiFi");
+    ulTaskNotifyTake(pdTRUE, 0); // forget events from the last attempt
+    MetricWiFiConnects.Add();
+    ConfigTake(ConfigWiFi); // this attempt has the latest settings
+    ConfigValues Config;
+    ConfigRead(Config);
+    WiFi.begin(Config.WiFiSSID, Config.WiFiPassword);
+    WiFi.config(IPAddress(Config.WiFiIP), IPAddress(Config.WiFiGateway), IPAddress(Config.WiFiSubnet), IPAddress(Config.WiFiDNS),
+                IPAddress(Config.WiFiDNS2)); // must be after begin else it won't connect
+    TaskBusy(TaskWiFi, Start);
+    unsigned long AttemptStart = millis();
+    while (!WiFiUp && millis() - AttemptStart < WiFiAttemptTimeout)
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(WiFiAttemptTimeout - (millis() - AttemptStart)));
+    Start = micros();
+    if (!WiFiUp)
+    {
+      wl_status_t Status = WiFi.status();
+      WiFiStatusSet(Status);
+      Serial.printf("WiFi Status: %s, trying again in %lums\n", WiFiStatusText(Status), Backoff);
+      WiFi.disconnect();
+      TaskBusy(TaskWiFi, Start);
+      vTaskDelay(pdMS_TO_TICKS(Backoff + random(Backoff / 4 + 1))); // a little jitter so a room of receivers don't retry together
+      Backoff = Backoff * 2 < WiFiBackoffMax ? Backoff * 2 : WiFiBackoffMax;
+      continue;
+    }
+    unsigned long Outage = millis() - WiFiDownSince;
+    MetricWiFiConnect.Observe(Outage);
+    if (EverConnected)
     {
-      Serial.print("@");
-      TempWiFiCount++;
-      WiFi.begin(WiFiSSID, WiFiPassword);
-      WiFi.config(WiFiIP, WiFiGateway, WiFiSubnet, WiFiPrimaryDNS, WiFiSecondaryDNS); // must be after begin else it won't connect
-      vTaskDelay(pdMS_TO_TICKS(WiFiLoopWait));                                        // may not be required
-      // print the status for diagnosis and keep for the web page (which will always be WL_CONNECTED otherwise you won't have web access)
-      switch (WiFi.status())
+      MetricWiFiReconnects.Add();
+      MetricWiFiDowntime.Add(Outage);
+      WiFiLastOutageMillis = Outage;
+    }
+    EverConnected = true;
+    Backoff = WiFiBackoffMin;
+    WiFiConnected();
+    TaskBusy(TaskWiFi, Start);
+    while (WiFiUp)
+    {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY); // sleep until the connection drops or the settings change
+      if (WiFiUp && ConfigTake(ConfigWiFi))
       {
-      case WL_IDLE_STATUS:
-        WebStatus = "WL_IDLE_STATUS"; // 0
-        break;
-      case WL_NO_SSID_AVAIL:
-        WebStatus = "WL_NO_SSID_AVAIL"; // 1
-        WiFi.persistent(false);
-        break;
-      case WL_SCAN_COMPLETED:
-        WebStatus = "WL_SCAN_COMPLETED"; // 2
-        break;
-      case WL_CONNECTED:
-        WebStatus = "WL_CONNECTED"; // 3
-        WiFi.persistent(true);
-        break;
-      case WL_CONNECT_FAILED:
-        WebStatus = "WL_CONNECT_FAILED"; // 4
-        WiFi.persistent(false);
-        break;
-      case WL_CONNECTION_LOST:
-        WebStatus = "WL_CONNECTION_LOST"; // 5
-        WiFi.persistent(false);
-        break;
-      case WL_DISCONNECTED:
-        WebStatus = "WL_DISCONNECTED"; // 6
-        break;
-      case WL_NO_SHIELD:
-        WebStatus = "WL_NO_SHIELD"; // 255
-        break;
-      default:
-        WebStatus = "Undefined WiFi status";
-        break;
+        Serial.println("WiFi settings changed, reconnecting");
+        vTaskDelay(pdMS_TO_TICKS(WiFiConfigDelay));
+        WiFi.disconnect(); // WiFiEvent ends the loop
       }
-      Serial.println();
-      Serial.println("WiFi Status: " + WebStatus); // print the status after each try
     }
+    WiFiDownSince = millis();
+    WiFiStatusSet(WL_CONNECTION_LOST);
+    Serial.println("WiFi lost");
   }
-  // we must be connected, keep the values for the network web page
-  LocalIP = (WiFi.localIP().toString());
-  LocalSubNet = (WiFi.subnetMask().toString());
-  LocalGateway = (WiFi.gatewayIP().toString());
-  LocalMac = WiFi.macAddress();
-  LocalDNS = (WiFi.dnsIP().toString());
-  WebRSSI = String((int(WiFi.RSSI())));
-  // print the info for diagnosis
-  Serial.print("SSID: ");
-  Serial.println(WiFiSSID);
-  Serial.println("IP address: " + LocalIP);
-  Serial.println("Mac Address: " + WiFi.macAddress());
-  Serial.println("Subnet Mask: " + LocalSubNet);
-  Serial.println("Gateway IP: " + LocalGateway);
-  Serial.println("DNS: " + LocalDNS);
-  Serial.println("WiFi RSSI: " + WebRSSI);
 }
 
+// queue an LED pattern and return straight away, LEDTimerCallback plays it
 void FlashLED(int OnTime, int OffTime, int Repeat)
 {
   if (OnTime < 0 || OnTime > 2000)
@@ -221,189 +486,1103 @@ void FlashLED(int OnTime, int OffTime, int Repeat)
     OffTime = 0;
   if (Repeat < 0 || Repeat > 10)
     Repeat = 1;
-  for (int i = 0; i < Repeat; i++)
+  LEDPattern Pattern = {OnTime, OffTime, Repeat};
+  if (xQueueSend(LEDQueue, &Pattern, 0) != pdTRUE)
+    return; // already plenty queued, skip this one
+  if (xTimerIsTimerActive(LEDTimer) == pdFALSE)
+    xTimerChangePeriod(LEDTimer, 1, 0); // kick the player
+}
+
+// read a radio register directly, the same way the LoRa library does it, so the receive callback can avoid float
+byte LoraReadRegister(byte Address)
+{
+  SPI.beginTransaction(SPISettings(8E6, MSBFIRST, SPI_MODE0));
+  digitalWrite(SS, LOW);
+  SPI.transfer(Address & 0x7f);
+  byte Value = SPI.transfer(0x00);
+  digitalWrite(SS, HIGH);
+  SPI.endTransaction();
+  return Value;
+}
+
+void LoraReceiveInterrupt(int packetSize);
+void LoraReconfigure(uint8_t Changed);
+
+// the board side of Hal.h
+class ESP32Radio : public HalRadio
+{
+public:
+  int Available() { return LoRa.available(); }
+  int Read() { return LoRa.read(); }
+  int PacketRSSI() { return LoRa.packetRssi(); }
+  int8_t PacketSNRRaw() { return (int8_t)LoraReadRegister(LoraRegPktSnrValue); }
+  bool Send(const uint8_t *Data, size_t Length)
+  {
+    LoRa.onReceive(NULL); // the receive interrupt uses SPI too, nothing can arrive while sending anyway
+    bool Sent = LoRa.beginPacket() && LoRa.write(Data, Length) == Length && LoRa.endPacket();
+    LoRa.onReceive(LoraReceiveInterrupt);
+    LoRa.receive();
+    return Sent;
+  }
+};
+class ESP32Display : public HalDisplay
+{
+public:
+  void SetLine(byte Line, const char *Text) { OLEDSetLine(Line, Text); }
+  void Update() { OLEDUpdate(); }
+};
+class ESP32Clock : public HalClock
+{
+public:
+  unsigned long Millis() { return millis(); }
+  unsigned long Micros() { return micros(); }
+  unsigned long Cycles() { return ESP.getCycleCount(); }
+  // the system time, which NTPService sets from NTP. The RTC keeps it through a software reset so after a restart it
+  // carries on from the last sync rather than starting at 1970
+  uint32_t UTC() { return time(NULL); }
+  // in the config's time zone
+  void Format(char *Date, size_t DateSize, char *Time, size_t TimeSize)
+  {
+    time_t Now = UTC();
+    struct tm Local;
+    xSemaphoreTake(ClockMutex, portMAX_DELAY);
+    localtime_r(&Now, &Local);
+    xSemaphoreGive(ClockMutex);
+    strftime(Date, DateSize, "%d %B %Y", &Local);
+    strftime(Time, TimeSize, "%T", &Local);
+  }
+};
+class ESP32FileSystem : public HalFileSystem
+{
+public:
+  bool Exists(const char *Path)
+  {
+    xSemaphoreTake(FilesMutex, portMAX_DELAY);
+    bool Exists = FilesMounted && SPIFFS.exists(Path);
+    xSemaphoreGive(FilesMutex);
+    return Exists;
+  }
+  size_t Size(const char *Path)
   {
-    digitalWrite(BuiltInLED, LEDOn);
-    vTaskDelay(pdMS_TO_TICKS(OnTime));
-    digitalWrite(BuiltInLED, LEDOff);
-    vTaskDelay(pdMS_TO_TICKS(OffTime));
+    xSemaphoreTake(FilesMutex, portMAX_DELAY);
+    size_t Size = 0;
+    if (FilesMounted)
+    {
+      File Open = SPIFFS.open(Path, FILE_READ);
+      Size = Open ? Open.size() : 0;
+      Open.close();
+    }
+    xSemaphoreGive(FilesMutex);
+    return Size;
+  }
+  size_t Read(const char *Path, size_t Offset, void *Data, size_t Length)
+  {
+    xSemaphoreTake(FilesMutex, portMAX_DELAY);
+    size_t Read = 0;
+    if (FilesMounted && SPIFFS.exists(Path))
+    {
+      File Open = SPIFFS.open(Path, FILE_READ);
+      if (Open && Open.seek(Offset))
+        Read = Open.read((uint8_t *)Data, Length);
+      Open.close();
+    }
+    xSemaphoreGive(FilesMutex);
+    return Read;
+  }
+  bool Write(const char *Path, const void *Data, size_t Length, bool Append)
+  {
+    xSemaphoreTake(FilesMutex, portMAX_DELAY);
+    bool Written = false;
+    if (FilesMounted)
+    {
+      File Open = SPIFFS.open(Path, Append ? FILE_APPEND : FILE_WRITE);
+      Written = Open && Open.write((const uint8_t *)Data, Length) == Length;
+      Open.close();
+    }
+    xSemaphoreGive(FilesMutex);
+    return Written;
   }
+};
+class ESP32Network : public HalNetwork
+{
+public:
+  bool Connected() { return WiFiUp; }
+  int RSSI() { return WiFi.RSSI(); }
+  std::atomic<size_t> Listening; // Events.count() as EventsTask last saw it, LoraTask mustn't walk the web server's clients
+  size_t Listeners() { return Listening.load(std::memory_order_relaxed); }
+  void Publish(const char *Event, const char *Data, uint32_t ID) { Events.send(Data, Event, ID); } // EventsTask only
+};
+class ESP32Console : public HalConsole
+{
+public:
+  void Print(const char *Text) { Serial.print(Text); }
+};
+// keeps the connection open between requests so a backlog goes out quickly
+class ESP32Uplink : public HalUplink
+{
+public:
+  const char *URL;
+  HTTPClient Http;
+  ESP32Uplink(const char *URL) : URL(URL) {}
+  bool Send(const char *Body, size_t Length)
+  {
+    Http.setReuse(true);
+    Http.setTimeout(UplinkTimeout);
+    if (!Http.begin(URL))
+      return false;
+    Http.addHeader("Content-Type", "application/json");
+    int Code = Http.POST((uint8_t *)Body, Length);
+    Http.end();
+    return Code >= 200 && Code < 300;
+  }
+};
+// the config in NVS, which writes a new copy before letting go of the old one so a reset part way loses nothing
+class ESP32Store : public HalStore
+{
+public:
+  Preferences NVS;
+  size_t Load(void *Data, size_t Size)
+  {
+    if (!NVS.begin("water", true))
+      return 0;
+    size_t Length = NVS.getBytesLength("config") == Size ? NVS.getBytes("config", Data, Size) : 0;
+    NVS.end();
+    return Length;
+  }
+  bool Save(const void *Data, size_t Length)
+  {
+    if (!NVS.begin("water", false))
+      return false;
+    size_t Written = NVS.putBytes("config", Data, Length);
+    NVS.end();
+    return Written == Length;
+  }
+};
+// close SPIFFS for a file system update. New file responses get a 503 and the ones already going get Wait milliseconds
+// to finish, false if some still haven't. FilesUnmount then unmounts it and FilesResume undoes both
+bool FilesQuiesce(unsigned long Wait)
+{
+  WebFilesClosed = true;
+  unsigned long Start = millis();
+  while (WebFilesOpen.load() > 0 && millis() - Start < Wait)
+    vTaskDelay(pdMS_TO_TICKS(10));
+  if (WebFilesOpen.load() == 0)
+    return true;
+  Serial.printf("File system busy, %d responses still reading it\n", WebFilesOpen.load());
+  return false;
 }
 
-void LoraProcessing() // process new packet, called from main loop based on packet flag
+// between two Platform.Files calls, HistoryTask and UplinkTask carry on without it
+void FilesUnmount()
 {
-  LoraPacket = ""; // global as also used in web server
-                   // read packet
-  while (LoRa.available())
+  xSemaphoreTake(FilesMutex, portMAX_DELAY);
+  if (FilesMounted)
+    SPIFFS.end();
+  FilesMounted = false;
+  xSemaphoreGive(FilesMutex);
+  Serial.println("File system unmounted for the update");
+}
+
+void FilesResume()
+{
+  xSemaphoreTake(FilesMutex, portMAX_DELAY);
+  if (!FilesMounted)
   {
-    LoraPacket += (char)LoRa.read();
+    FilesMounted = SPIFFS.begin(true);
+    Serial.println(FilesMounted ? "File system mounted again" : "File system won't mount");
   }
-  LoraRSSI = String(LoRa.packetRssi());  // global as also used in web server
-  LoraSNR = String(LoRa.packetSnr(), 2); // global as also used in web server
-  LoraPackSize = String(LoraPacketSize); // can't use raw LoraPacketSize in OLED display text, must be string, LoraPacketSize set by onReceive routine
-  OLEDDisplay.clear();
-  OLEDDisplay.clear();
-  OLEDDisplay.drawString(0, 0, "RSSI: " + LoraRSSI + ", SNR: " + LoraSNR);
-  OLEDDisplay.drawString(0, 12, "Received " + LoraPackSize + " bytes");
+  xSemaphoreGive(FilesMutex);
+  WebFilesClosed = false;
+}
+
+// /api/v1/update images through the Update library, which only changes the boot partition in end()
+class ESP32Image : public HalImage
+{
+public:
+  byte Target = PatchFirmware;
+  bool Begin(byte ImageTarget, size_t Size)
+  {
+    Target = ImageTarget;
+    if (Target == PatchFileSystem)
+    {
+      if (!FilesQuiesce(0)) // called from the web server's task so it can't wait for its own responses
+      {
+        FilesResume();
+        return false;
+      }
+      FilesUnmount();
+    }
+    if (Update.begin(Size, Target == PatchFileSystem ? U_SPIFFS : U_FLASH))
+      return true;
+    Serial.printf("Update won't start, %s\n", Update.errorString());
+    if (Target == PatchFileSystem)
+      FilesResume();
+    return false;
+  }
+  bool Write(const uint8_t *Data, size_t Length) { return Update.write((uint8_t *)Data, Length) == Length; }
+  size_t ReadBase(size_t Offset, void *Data, size_t Length)
+  {
+    const esp_partition_t *Running = esp_ota_get_running_partition();
+    if (Running == NULL || Offset + Length > Running->size || esp_partition_read(Running, Offset, Data, Length) != ESP_OK)
+      return 0;
+    return Length;
+  }
+  bool End(bool Commit)
+  {
+    bool Done = Commit && Update.end();
+    if (!Commit)
+      Update.abort();
+    else if (!Done)
+      Serial.printf("Update won't finish, %s\n", Update.errorString());
+    if (!Done && Target == PatchFileSystem)
+      FilesResume();
+    return Done;
+  }
+};
+ESP32Radio BoardRadio;
+ESP32Display BoardDisplay;
+ESP32Clock BoardClock;
+ESP32FileSystem BoardFileSystem;
+ESP32Network BoardNetwork;
+ESP32Console BoardConsole;
+ESP32Uplink BoardUplink(UplinkURL);
+ESP32Uplink BoardNotifier(AlertURL);
+ESP32Store BoardStore;
+ESP32Image BoardImage;
+HalPlatform Platform = {&BoardRadio, &BoardDisplay, &BoardClock, &BoardFileSystem, &BoardNetwork, &BoardConsole,
+                        UplinkURL[0] == '\0' ? NULL : &BoardUplink, AlertURL[0] == '\0' ? NULL : &BoardNotifier, &BoardStore, &BoardImage};
+
+// a packet has been received, LoraReceive copies it into the ring then LoraTask is woken straight away
+void LoraReceiveInterrupt(int packetSize)
+{
+  if (LoraReceive(packetSize) && LoraTaskHandle != NULL)
+  {
+    BaseType_t TaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(LoraTaskHandle, &TaskWoken);
+    portYIELD_FROM_ISR(TaskWoken);
+  }
+}
+
+// drain the lora receive ring, OLED display commands can't be in the receive callback so need to process independantly.
+// Also ticks the alerts so only this task ever changes them
+void LoraTask(void *p)
+{
+  uint32_t LastDropped = 0;
+  unsigned long LastAlertTick = 0;
+  LoraFrame Frame;
+  while (true)
+  {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(AlertTickInterval)); // sleep until LoraReceiveInterrupt has queued something
+    unsigned long Start = micros();
+    uint8_t Changed = ConfigTake(ConfigRadio | ConfigPacket);
+    if (Changed != 0)
+      LoraReconfigure(Changed);
+    if (millis() - LastAlertTick >= AlertTickInterval)
+    {
+      AlertTick();
+      LastAlertTick = millis();
+    }
+    while (LoraRingPop(Frame))
+    {
+      unsigned long BlockStart = micros();
+      if (BootFirstPacketMillis == 0)
+        BootFirstPacketMillis = Frame.RxMicros / 1000;
+      LoraProcessing(Frame);
+      WarmSave(BoardWarm);
+      FlashLED(100, 100, 2);
+      if (HistoryFlushDue() && HistoryTaskHandle != NULL)
+        xTaskNotifyGive(HistoryTaskHandle);
+      PacketBlockMicros = micros() - BlockStart;
+      if (PacketBlockMicros > PacketBlockMaxMicros)
+        PacketBlockMaxMicros = PacketBlockMicros;
+      MetricLoraTask.Observe(PacketBlockMicros);
+    }
+    if (EventsPending() && EventsTaskHandle != NULL)
+      xTaskNotifyGive(EventsTaskHandle);
+    uint32_t Dropped = LoraFramesDropped.load(std::memory_order_relaxed);
+    if (Dropped != LastDropped)
+    {
+      Serial.printf("Lora packets dropped: %u of %u\n", Dropped, LoraFramesReceived.load(std::memory_order_relaxed));
+      LastDropped = Dropped;
+    }
+    TaskBusy(TaskLora, Start);
+  }
+}
+
+// sends readings to the backend and alerts to the notifier on core 0, however long either takes LoraTask never waits.
+// Its busy time includes waiting on the network as HTTPClient blocks, so TaskBusy leaves it out of the power figures
+void UplinkTask(void *p)
+{
+  while (true)
+  {
+    unsigned long Start = micros();
+    while (UplinkService()) // a backlog goes out back to back
+      ;
+    while (AlertService())
+      ;
+    TaskBusy(TaskUplink, Start);
+    vTaskDelay(pdMS_TO_TICKS(UplinkServiceInterval));
+  }
+}
+
+// writes history to flash in batches so the radio path never waits on SPIFFS
+void HistoryTask(void *p)
+{
+  while (true)
+  {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(HistoryFlushInterval));
+    unsigned long Start = micros();
+    HistoryFlush();
+    TaskBusy(TaskHistory, Start);
+  }
+}
+
+// sends the live page updates LoraTask queues from core 0, with the web server, so the radio's core never waits on
+// the event source's lock or its copies for each page. Also counts the open pages for Listeners
+void EventsTask(void *p)
+{
+  while (true)
+  {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(EventsListenerRefresh));
+    unsigned long Start = micros();
+    BoardNetwork.Listening.store(Events.count(), std::memory_order_relaxed);
+    while (EventsService())
+      ;
+    TaskBusy(TaskEvents, Start);
+  }
+}
+
+void HousekeepingTask(void *p);
+
+// every task we start. The radio has core 1 to itself apart from drawing the display, everything that talks to the
+// network or flash is on core 0 with the WiFi driver and the web server (AsyncTCP's task, put there by
+// CONFIG_ASYNC_TCP_RUNNING_CORE in platformio.ini). LoraTask outranks all the readers of LoraPublished and Nodes,
+// which SeqLock needs, WiFi, uplink and events come next as they mostly wait on the network, housekeeping is last
+struct TaskInfo
+{
+  const char *Name;
+  TaskFunction_t Function;
+  uint32_t Stack; // bytes
+  UBaseType_t Priority;
+  BaseType_t Core;
+  TaskHandle_t *Handle;
+};
+const TaskInfo Tasks[TaskCount] = {
+    {"LoraTask", LoraTask, 4096, 5, 1, &LoraTaskHandle},
+    {"DisplayTask", DisplayTask, 2048, 1, 1, &DisplayTaskHandle},
+    {"WiFiTask", WiFiTask, 4096, 2, 0, &WiFiTaskHandle},
+    {"UplinkTask", UplinkTask, 8192, 2, 0, &UplinkTaskHandle},
+    {"HistoryTask", HistoryTask, 4096, 1, 0, &HistoryTaskHandle},
+    {"HousekeepingTask", HousekeepingTask, 4096, 1, 0, &HousekeepingTaskHandle},
+    {"EventsTask", EventsTask, 4096, 2, 0, &EventsTaskHandle},
+};
+
+// start one of the tasks in Tasks
+void TaskStart(TaskID Task)
+{
+  const TaskInfo &Info = Tasks[Task];
+  xTaskCreatePinnedToCore(Info.Function, Info.Name, Info.Stack, NULL, Info.Priority, Info.Handle, Info.Core);
+}
+
+// bytes of stack a task has never touched, 0 if it hasn't been started
+uint32_t TaskStackFree(TaskID Task)
+{
+  TaskHandle_t Handle = *Tasks[Task].Handle;
+  return Handle == NULL ? 0 : uxTaskGetStackHighWaterMark(Handle); // bytes on the ESP32, not words
+}
+
+// the API token is in the Authorization header, see ConfigAuthorized
+bool ApiAuthorized(AsyncWebServerRequest *request)
+{
+  return ConfigAuthorized(request->hasHeader("Authorization") ? request->getHeader("Authorization")->value().c_str() : "");
+}
+
+// a response that reads SPIFFS as it goes out, counted until it has finished. False after sending a 503 if SPIFFS is
+// closed for an update
+bool WebFilesHold(AsyncWebServerRequest *request)
+{
+  if (WebFilesClosed)
+  {
+    AsyncWebServerResponse *Response = request->beginResponse(503, "text/plain", "Updating, try again shortly\n");
+    Response->addHeader("Retry-After", "60");
+    request->send(Response);
+    return false;
+  }
+  WebFilesOpen++;
+  request->onDisconnect([]() { WebFilesOpen--; });
+  return true;
+}
+
+// ETag handling so pollers get a cheap 304 when nothing has changed, returns true if the 304 has been sent
+bool ApiNotModified(AsyncWebServerRequest *request, const String &ETag)
+{
+  if (!request->hasHeader("If-None-Match") || request->getHeader("If-None-Match")->value() != ETag)
+    return false;
+  AsyncWebServerResponse *Response = request->beginResponse(304);
+  Response->addHeader("ETag", ETag);
+  request->send(Response);
+  return true;
+}
+
+// start a streamed API response
+void ApiSend(AsyncWebServerRequest *request, std::shared_ptr<ApiStream> Stream, const String &ETag)
+{
+  AsyncWebServerResponse *Response = request->beginChunkedResponse(Stream->CSV ? "text/csv" : "application/json",
+                                                                   [Stream](uint8_t *Buffer, size_t MaxLength, size_t Index) -> size_t {
+                                                                     return ApiFill(*Stream, Buffer, MaxLength);
+                                                                   });
+  Response->addHeader("ETag", ETag);
+  Response->addHeader("Cache-Control", "no-cache");
+  request->send(Response);
+}
 
-  // see if it is valid and for us
-  if (LoraPacketSize <= LoraMaxPacketSize)
+// a new response stream with the options common to all API requests, empty if they were bad and 400 has been sent
+std::shared_ptr<ApiStream> ApiBegin(AsyncWebServerRequest *request, bool History)
+{
+  long NodeID = -1;
+  if (request->hasParam("node")) // a node ID 0-255, anything else is answered with 400 rather than read as node 0
   {
-    OLEDDisplay.drawString(0, 24, LoraPacket);
-    if (LoraPacket.startsWith(LoraPacketPreAmble)) // only process if it has the correct preamble otherwise ignore it as it's not for us
+    const char *Text = request->getParam("node")->value().c_str();
+    char *End;
+    NodeID = strtol(Text, &End, 10);
+    if (End == Text || *End != '\0' || NodeID < 0 || NodeID > 255)
     {
-      // unpack received packet
-      WaterLevel = LoraPacket.substring(3, 4); // global as also used in web server
-      VoltageLevel = LoraPacket.substring(4);
-      Volts = VoltageLevel.toFloat() / 100.0; // global as also used in web server.  Sender has multiplied voltage by 100 to make it an integer so divide to get fraction back
-      LoraRxDate = FormattedDate;             // keep the received date and time
-      LoraRxTime = FormattedTime;
-      LoraLastGoodPacket = LoraPacket;
-      LoraLastGoodPacketSize = LoraPackSize;
-      OLEDDisplay.drawString(0, 36, "Water: " + WaterLevel + ", Voltage: " + Volts);
-      OLEDDisplay.drawString(0, 48, LoraRxDate + " " + LoraRxTime);
-      Serial.println("Packet received: " + LoraRxDate + " " + LoraRxTime + " - Packet:" + LoraPacket + ", Size:" + LoraPacketSize);
-      Serial.println("Lora RSSI: " + LoraRSSI + ", SNR: " + LoraSNR);
-      Serial.println("Water: " + WaterLevel + ", Voltage: " + Volts);
-      Serial.println();
+      request->send(400, "text/plain", "node must be a number from 0 to 255\n");
+      return std::shared_ptr<ApiStream>();
     }
+  }
+  std::shared_ptr<ApiStream> Stream(new ApiStream());
+  Stream->History = History;
+  Stream->CSV = request->hasParam("format") && request->getParam("format")->value() == "csv";
+  Stream->NodeID = NodeID;
+  Stream->First = true;
+  return Stream;
+}
+
+// /api/v1/latest, the latest reading from each sender
+void ApiLatest(AsyncWebServerRequest *request)
+{
+  std::shared_ptr<ApiStream> Stream = ApiBegin(request, false);
+  if (!Stream)
+    return;
+  String ETag = "\"n" + String(NodeUpdates) + "\"";
+  if (ApiNotModified(request, ETag))
+    return;
+  ApiSend(request, Stream, ETag);
+}
+
+// /api/v1/history?from=&to=&node=&tier=raw|hourly|daily&format=json|csv, from and to are UTC seconds
+void ApiHistory(AsyncWebServerRequest *request)
+{
+  std::shared_ptr<ApiStream> Stream = ApiBegin(request, true);
+  if (!Stream)
+    return;
+  Stream->Tier = 0;
+  if (request->hasParam("tier"))
+  {
+    const String &Tier = request->getParam("tier")->value();
+    if (Tier == "hourly")
+      Stream->Tier = 1;
+    else if (Tier == "daily")
+      Stream->Tier = 2;
+  }
+  Stream->From = request->hasParam("from") ? strtoul(request->getParam("from")->value().c_str(), NULL, 10) : 0;
+  Stream->To = request->hasParam("to") ? strtoul(request->getParam("to")->value().c_str(), NULL, 10) : UINT32_MAX;
+  // history on flash only changes when HistoryTask writes to this tier
+  const HistorySegmentState &State = HistoryState[Stream->Tier];
+  String ETag = "\"h" + String(Stream->Tier) + "-" + String(State.Generation) + "-" + String(State.Records) + "\"";
+  if (ApiNotModified(request, ETag) || !WebFilesHold(request))
+    return;
+  Stream->Item = HistoryTiers[Stream->Tier].Segments;
+  Stream->Segment = (State.Segment + 1) % HistoryTiers[Stream->Tier].Segments; // oldest
+  Stream->Offset = sizeof(uint32_t);
+  ApiSend(request, Stream, ETag);
+}
+
+// wake the tasks that own the settings that changed, each applies its own part
+void ConfigWake(uint8_t Changed)
+{
+  if ((Changed & (ConfigRadio | ConfigPacket)) && LoraTaskHandle != NULL)
+    xTaskNotifyGive(LoraTaskHandle);
+  if ((Changed & ConfigWiFi) && WiFiTaskHandle != NULL)
+    xTaskNotifyGive(WiFiTaskHandle);
+  if ((Changed & ConfigClock) && HousekeepingTaskHandle != NULL)
+    xTaskNotifyGive(HousekeepingTaskHandle);
+}
+
+// /api/v1/config, GET for the settings or POST name=value form fields to change some, with "Authorization: Bearer <token>".
+// A POST changes everything it names or, if any is bad, nothing
+void ApiConfig(AsyncWebServerRequest *request)
+{
+  if (!ApiAuthorized(request))
+  {
+    request->send(401, "text/plain", "Unauthorized\n");
+    return;
+  }
+  if (request->method() == HTTP_POST)
+  {
+    const char *Names[ConfigMaxUpdates + 1];
+    const char *Values[ConfigMaxUpdates + 1];
+    byte Count = 0;
+    for (size_t i = 0; i < request->params() && Count <= ConfigMaxUpdates; i++)
+    {
+      AsyncWebParameter *Param = request->getParam(i);
+      if (!Param->isPost())
+        continue;
+      Names[Count] = Param->name().c_str();
+      Values[Count++] = Param->value().c_str();
+    }
+    char Error[96];
+    int Changed = ConfigUpdate(Names, Values, Count, Error, sizeof(Error));
+    if (Changed < 0)
+    {
+      request->send(400, "text/plain", String(Error) + "\n");
+      return;
+    }
+    ConfigWake(Changed);
+  }
+  std::unique_ptr<char[]> Json(new char[ConfigJsonSize]); // too big for the web server's stack
+  ConfigJson(Json.get(), ConfigJsonSize);
+  AsyncWebServerResponse *Response = request->beginResponse(200, "application/json", Json.get());
+  Response->addHeader("Cache-Control", "no-store");
+  request->send(Response);
+}
+
+// /api/v1/update, POST a pack from scripts/ota_pack.py as the body with "Authorization: Bearer <token>". It is
+// decoded and written as it arrives, switched to only if it matches its hash, then the board restarts into it
+void ApiUpdateBody(AsyncWebServerRequest *request, uint8_t *Data, size_t Length, size_t Index, size_t Total)
+{
+  if (Index == 0)
+  {
+    int *Answer = (int *)malloc(sizeof(int)); // the web server frees it with the request
+    if (Answer == NULL)
+      return;
+    request->_tempObject = Answer;
+    if (!ApiAuthorized(request))
+      *Answer = 401;
+    else if (UpdateRequest != NULL || !PatchBegin())
+      *Answer = 409;
     else
-    { // packet doesn't match preamble, can't be for us or is corrupted
-      OLEDDisplay.drawString(0, 36, "Packet not for us");
-      OLEDDisplay.drawString(0, 48, FormattedDate + " " + FormattedTime);
+    {
+      *Answer = 200;
+      UpdateRequest = request;
+      request->onDisconnect([request]() {
+        if (UpdateRequest == request) // went before the end
+        {
+          PatchAbort();
+          UpdateRequest = NULL;
+        }
+      });
+    }
+  }
+  if (request == UpdateRequest)
+    PatchWrite(Data, Length);
+}
+
+// the whole body has arrived
+void ApiUpdate(AsyncWebServerRequest *request)
+{
+  if (request != UpdateRequest)
+  {
+    int Answer = request->_tempObject != NULL ? *(int *)request->_tempObject : ApiAuthorized(request) ? 400 : 401;
+    request->send(Answer, "text/plain", Answer == 401 ? "Unauthorized\n" : Answer == 409 ? "Another update is running\n" : "Send the pack as the body\n");
+    return;
+  }
+  UpdateRequest = NULL;
+  bool Applied = PatchEnd();
+  char Json[256];
+  PatchJson(Json, sizeof(Json));
+  request->send(Applied ? 200 : 400, "application/json", Json);
+  if (Applied)
+  {
+    OLEDMessage("Update applied, restarting");
+    UpdateRestart = true;
+    if (HousekeepingTaskHandle != NULL)
+      xTaskNotifyGive(HousekeepingTaskHandle);
+  }
+}
+
+// board metrics, the pipeline's own are in Receiver.cpp
+double MetricReadUptime(byte Row) { return millis() / 1000.0; }
+double MetricReadFreeHeap(byte Row) { return ESP.getFreeHeap(); }
+double MetricReadMinFreeHeap(byte Row) { return ESP.getMinFreeHeap(); }
+double MetricReadWiFiUp(byte Row) { return WiFiUp; }
+double MetricReadWiFiRSSI(byte Row) { return WiFi.RSSI(); }
+double MetricReadWiFiConnects(byte Row) { return MetricWiFiConnects.Read(); }
+double MetricReadWiFiReconnects(byte Row) { return MetricWiFiReconnects.Read(); }
+double MetricReadWiFiDowntime(byte Row) { return MetricWiFiDowntime.Read() / 1000.0; }
+double MetricReadWiFiLastOutage(byte Row) { return WiFiLastOutageMillis / 1000.0; }
+double MetricReadNTPSyncs(byte Row) { return MetricNTPSyncs.Read(); }
+double MetricReadNTPAge(byte Row) { return (millis() - NTPLastSyncMillis) / 1000.0; }
+double MetricReadListeners(byte Row) { return Events.count(); }
+double MetricReadAssetHits(byte Row) { return AssetHits; }
+double MetricReadAssetMisses(byte Row) { return AssetMisses; }
+double MetricReadOTAStarts(byte Row) { return MetricOTAStarts.Read(); }
+double MetricReadOTAErrors(byte Row) { return MetricOTAErrors.Read(); }
+double MetricReadOTAProgress(byte Row) { return OTAProgress; }
+double MetricReadBootRadio(byte Row) { return BootRadioMillis / 1000.0; }
+double MetricReadBootReady(byte Row) { return BootReadyMillis / 1000.0; }
+double MetricReadBootFirstPacket(byte Row) { return BootFirstPacketMillis / 1000.0; }
+double MetricReadBootWarm(byte Row) { return BootWarm; }
+double MetricReadMaintenanceOpen(byte Row) { return MaintenanceOpen(); }
+double MetricReadCPUFrequency(byte Row) { return ESP.getCpuFreqMHz(); }
+double MetricReadTaskBusy(byte Row) { return TaskBusyMillis[Row].Read() / 1e3; }
+double MetricReadTaskBusyPercent(byte Row) { return TaskBusyPercent[Row]; }
+double MetricReadTaskStackFree(byte Row) { return TaskStackFree((TaskID)Row); }
+bool MetricTaskLabel(byte Row, char *Text, size_t Size)
+{
+  if (Row >= TaskCount)
+    return false;
+  snprintf(Text, Size, "task=\"%s\"", Tasks[Row].Name);
+  return true;
+}
+
+const MetricExport BoardMetrics[] = {
+    {"water_uptime_seconds", "gauge", "Time since boot", MetricReadUptime},
+    {"water_boot_radio_ready_seconds", "gauge", "Time from reset to the radio listening", MetricReadBootRadio},
+    {"water_boot_setup_seconds", "gauge", "Time from reset to setup finishing", MetricReadBootReady},
+    {"water_boot_first_packet_seconds", "gauge", "Time from reset to the first packet arriving, 0 until it does", MetricReadBootFirstPacket},
+    {"water_boot_warm", "gauge", "1 if the sender table and last packet were restored from before a restart", MetricReadBootWarm},
+    {"water_cpu_frequency_mhz", "gauge", "CPU clock", MetricReadCPUFrequency},
+    {"water_maintenance_open", "gauge", "1 while OTA is listening", MetricReadMaintenanceOpen},
+    {"water_heap_free_bytes", "gauge", "Free heap", MetricReadFreeHeap},
+    {"water_heap_min_free_bytes", "gauge", "Lowest free heap since boot", MetricReadMinFreeHeap},
+    {"water_wifi_connected", "gauge", "1 if WiFi is connected", MetricReadWiFiUp},
+    {"water_wifi_rssi_dbm", "gauge", "WiFi signal strength", MetricReadWiFiRSSI},
+    {"water_wifi_connect_attempts_total", "counter", "WiFi.begin calls", MetricReadWiFiConnects},
+    {"water_wifi_reconnects_total", "counter", "Times WiFi came back after being lost", MetricReadWiFiReconnects},
+    {"water_wifi_downtime_seconds_total", "counter", "Time without WiFi since it first connected, up to the last reconnect", MetricReadWiFiDowntime},
+    {"water_wifi_last_outage_seconds", "gauge", "Length of the last WiFi outage", MetricReadWiFiLastOutage},
+    {"water_wifi_connect_seconds", "histogram", "Time from losing WiFi, or boot, to having an address again", NULL, &MetricWiFiConnect, 1e-3},
+    {"water_ntp_syncs_total", "counter", "Times the clock was set from NTP", MetricReadNTPSyncs},
+    {"water_ntp_sync_age_seconds", "gauge", "Time since the clock was last set from NTP", MetricReadNTPAge},
+    {"water_lora_task_seconds", "histogram", "Time LoraTask spent on each packet", NULL, &MetricLoraTask, 1e-6},
+    {"water_web_request_seconds", "histogram", "Time in each web request handler", NULL, &MetricWebRequest, 1e-6},
+    {"water_web_event_listeners", "gauge", "Home pages listening for live updates", MetricReadListeners},
+    {"water_web_asset_hits_total", "counter", "Static files sent from RAM", MetricReadAssetHits},
+    {"water_web_asset_misses_total", "counter", "Static files read from flash", MetricReadAssetMisses},
+    {"water_ota_starts_total", "counter", "OTA updates started", MetricReadOTAStarts},
+    {"water_ota_errors_total", "counter", "OTA updates that failed", MetricReadOTAErrors},
+    {"water_ota_progress_percent", "gauge", "Progress of the current OTA update", MetricReadOTAProgress},
+    {"water_task_busy_seconds_total", "counter", "Time each task spent working rather than waiting", MetricReadTaskBusy, NULL, 0, MetricTaskLabel},
+    {"water_task_busy_percent", "gauge", "Share of its core each task used over the last 10 seconds", MetricReadTaskBusyPercent, NULL, 0, MetricTaskLabel},
+    {"water_task_stack_free_bytes", "gauge", "Stack each task has never used", MetricReadTaskStackFree, NULL, 0, MetricTaskLabel},
+};
+
+// /metrics in Prometheus text format, streamed a line at a time like the API
+void MetricsSend(AsyncWebServerRequest *request)
+{
+  std::shared_ptr<MetricsStream> Stream(new MetricsStream());
+  Stream->Tables[0] = ReceiverMetrics;
+  Stream->TableSizes[0] = ReceiverMetricCount;
+  Stream->Tables[1] = LinkMetrics;
+  Stream->TableSizes[1] = LinkMetricCount;
+  Stream->Tables[2] = UplinkMetrics;
+  Stream->TableSizes[2] = UplinkMetricCount;
+  Stream->Tables[3] = PowerMetrics;
+  Stream->TableSizes[3] = PowerMetricCount;
+  Stream->Tables[4] = AlertMetrics;
+  Stream->TableSizes[4] = AlertMetricCount;
+  Stream->Tables[5] = ConfigMetrics;
+  Stream->TableSizes[5] = ConfigMetricCount;
+  Stream->Tables[6] = PatchMetrics;
+  Stream->TableSizes[6] = PatchMetricCount;
+  Stream->Tables[7] = BoardMetrics;
+  Stream->TableSizes[7] = sizeof(BoardMetrics) / sizeof(BoardMetrics[0]);
+  request->send(request->beginChunkedResponse("text/plain; version=0.0.4", [Stream](uint8_t *Buffer, size_t MaxLength, size_t Index) -> size_t {
+    return MetricsFill(*Stream, Buffer, MaxLength);
+  }));
+}
+
+// time a web handler into MetricWebRequest, all handlers run in the async TCP task so there is one writer
+ArRequestHandlerFunction WebMeasured(ArRequestHandlerFunction Handler)
+{
+  return [Handler](AsyncWebServerRequest *request) {
+    unsigned long Start = micros();
+    Handler(request);
+    MetricWebRequest.Observe(micros() - Start);
+  };
+}
+
+// hash a file so browsers can tell when it has changed, FNV-1a is plenty for that
+uint32_t AssetHash(const char *Path)
+{
+  uint32_t Hash = 2166136261UL;
+  uint8_t Buffer[128];
+  File Asset = SPIFFS.open(Path, FILE_READ);
+  if (!Asset)
+    return 0;
+  size_t Read;
+  while ((Read = Asset.read(Buffer, sizeof(Buffer))) > 0)
+  {
+    for (size_t i = 0; i < Read; i++)
+      Hash = (Hash ^ Buffer[i]) * 16777619UL;
+  }
+  Asset.close();
+  return Hash;
+}
+
+// hash the static files and keep the small ones in RAM, called once SPIFFS is mounted
+void AssetsBegin()
+{
+  for (StaticAsset &Asset : StaticAssets)
+  {
+    Asset.Hash = AssetHash(Asset.Path);
+    Asset.Gzip = SPIFFS.exists(Asset.GzipPath);
+    File Cached = SPIFFS.open(Asset.Gzip ? Asset.GzipPath : Asset.Path, FILE_READ);
+    if (!Cached)
+      continue;
+    size_t Size = Cached.size();
+    if (Size > 0 && Size <= AssetCacheMaxSize)
+    {
+      Asset.Cache = (uint8_t *)malloc(Size);
+      if (Asset.Cache != NULL && Cached.read(Asset.Cache, Size) == Size)
+        Asset.CacheSize = Size;
+      else
+      {
+        free(Asset.Cache);
+        Asset.Cache = NULL;
+      }
     }
+    Cached.close();
+    Serial.printf("Static file %s%s, %u bytes%s\n", Asset.Path, Asset.Gzip ? " gzipped" : "", (unsigned)Size, Asset.Cache ? " cached in RAM" : "");
+  }
+}
+
+// send a static file, the ?v= on page links changes with the file so browsers can keep it for a year
+void AssetSend(AsyncWebServerRequest *request, const StaticAsset &Asset)
+{
+  // each encoding is different bytes so it gets its own tag, or a cache could answer a gzip copy to a plain request
+  bool Gzip = Asset.Gzip && request->hasHeader("Accept-Encoding") && request->getHeader("Accept-Encoding")->value().indexOf("gzip") >= 0;
+  char ETag[16];
+  snprintf(ETag, sizeof(ETag), Gzip ? "\"%08x-gz\"" : "\"%08x\"", Asset.Hash);
+  if (request->hasHeader("If-None-Match") && request->getHeader("If-None-Match")->value() == ETag)
+  {
+    AssetNotModified++;
+    AsyncWebServerResponse *Response = request->beginResponse(304);
+    Response->addHeader("ETag", ETag);
+    request->send(Response);
+    return;
+  }
+  AsyncWebServerResponse *Response;
+  if (Asset.Cache != NULL && Gzip == Asset.Gzip) // RAM copy is in the encoding the browser wants
+  {
+    AssetHits++;
+    Response = request->beginResponse_P(200, Asset.ContentType, Asset.Cache, Asset.CacheSize);
   }
   else
-  { // packet is longer than LoraMaxPacketSize
-    OLEDDisplay.drawString(0, 24, LoraPacket.substring(0, LoraMaxPacketSize));
-    OLEDDisplay.drawString(0, 36, "Packet too long");
-    OLEDDisplay.drawString(0, 48, FormattedDate + " " + FormattedTime);
-  }
-  OLEDDisplay.display();
-}
-
-void LoraReceive(int packetSize) // a packet has been received, set flag for processing. packetSize from Lora.onReceive
-{
-  LoraPacketFlag = true;       // semaphore for lora processing as can not put display commands in same callback as lora processing
-  LoraPacketSize = packetSize; // global as used in Lora and web server
-}
-
-// routines to process web page variables, called iteratively until all page variables have been processed
-String Processor(const String &var) // process the index.html variables
-{
-  if (var == "FormattedDate")
-    return FormattedDate;
-  if (var == "FormattedTime")
-    return FormattedTime;
-  if (var == "Version")
-    return Version;
-  return String();
-}
-
-String ProcessNetwork(const String &var) // process the network.html variables
-{
-  if (var == "FormattedDate")
-    return FormattedDate;
-  if (var == "FormattedTime")
-    return FormattedTime;
-  if (var == "WIFISSID")
-    return WiFiSSID;
-  if (var == "LocalIP")
-    return LocalIP;
-  if (var == "LocalMac")
-    return LocalMac;
-  if (var == "LocalSubNet")
-    return LocalSubNet;
-  if (var == "LocalGateway")
-    return LocalGateway;
-  if (var == "LocalDNS")
-    return LocalDNS;
-  if (var == "WebStatus")
-    return WebStatus;
-  if (var == "WebRSSI")
-    return String(int(WiFi.RSSI()));
-  return String();
-}
-
-String ProcessWater(const String &var) // process the water.html variables
-{
-  if (var == "FormattedDate")
-    return FormattedDate;
-  if (var == "FormattedTime")
-    return FormattedTime;
-  if (var == "Version")
-    return Version;
-  if (var == "RxDate")
-    return LoraRxDate;
-  if (var == "RxTime")
-    return LoraRxTime;
-  if (var == "RSSI")
-    return LoraRSSI;
-  if (var == "SNR")
-    return LoraSNR;
-  if (var == "Packet")
-    return LoraLastGoodPacket;
-  if (var == "PacketSize")
-    return String(LoraLastGoodPacketSize);
-  if (var == "WaterLevel")
-    return WaterLevel;
-  if (var == "Volts")
-    return String(Volts);
-  return String();
-}
-
-String ProcessSystem(const String &var) // process the system.html variables
-{
-  if (var == "ChipID")
-    return String((unsigned long)ESP.getEfuseMac());
-  if (var == "ChipRevision")
-    return String(ESP.getChipRevision());
-  if (var == "ChipFrequency")
-    return FormatString(String(ESP.getCpuFreqMHz())) + "MHz";
-  if (var == "FlashSize")
-    return FormatString(String(ESP.getFlashChipSize())) + "B";
-  if (var == "FlashSpeed")
-    return FormatString(String(ESP.getFlashChipSpeed())) + "Hz";
-  if (var == "HeapSize")
-    return FormatString(String(ESP.getHeapSize())) + "B";
-  if (var == "FreeHeap")
-    return FormatString(String(ESP.getFreeHeap())) + "B";
-  if (var == "SketchSize")
-    return FormatString(String(ESP.getSketchSize())) + "B";
-  if (var == "SketchSpaceFree")
-    return FormatString(String(ESP.getFreeSketchSpace())) + "B";
-  if (var == "FormattedDate")
-    return FormattedDate;
-  if (var == "FreeHeap")
-    return FormatString(String(ESP.getFreeHeap())) + "B";
-  if (var == "FormattedTime")
-    return FormattedTime;
-  return String();
-}
-
-// set up processing on core 0
-void OTACore0(void *p) // run OTA on core 0, makes it responsive
+  {
+    if (!WebFilesHold(request))
+      return;
+    AssetMisses++;
+    Response = request->beginResponse(SPIFFS, Gzip ? Asset.GzipPath : Asset.Path, Asset.ContentType);
+  }
+  if (Gzip)
+    Response->addHeader("Content-Encoding", "gzip");
+  Response->addHeader("Vary", "Accept-Encoding");
+  Response->addHeader("Cache-Control", "public, max-age=31536000");
+  Response->addHeader("ETag", ETag);
+  request->send(Response);
+}
+
+// web pages, sent straight from the compiled templates in Templates.h with the variables filled in as they go out
+// number of rows a board variable has, most are a single value but the task table is a row per task
+byte TemplateRows(TemplateSlot Slot)
+{
+  return Slot == SlotTasks ? TaskCount : 1;
+}
+
+// write a board variable into Text without using String, returns the length. PageValue does the pipeline's
+int TemplateValue(const PageStream &Page, TemplateSlot Slot, byte Row, char *Text, size_t Size)
+{
+  char Number[16];
+  WiFiInfo Info;
+  switch (Slot)
+  {
+  case SlotVersion:
+    return snprintf(Text, Size, "%s", Version.c_str());
+  // network.html
+  case SlotWIFISSID:
+    return snprintf(Text, Size, "%s", WiFi.SSID().c_str());
+  case SlotLocalIP:
+    WiFiInfoRead(Info);
+    return snprintf(Text, Size, "%s", Info.LocalIP);
+  case SlotLocalMac:
+    WiFiInfoRead(Info);
+    return snprintf(Text, Size, "%s", Info.LocalMac);
+  case SlotLocalSubNet:
+    WiFiInfoRead(Info);
+    return snprintf(Text, Size, "%s", Info.LocalSubNet);
+  case SlotLocalGateway:
+    WiFiInfoRead(Info);
+    return snprintf(Text, Size, "%s", Info.LocalGateway);
+  case SlotLocalDNS:
+    WiFiInfoRead(Info);
+    return snprintf(Text, Size, "%s", Info.LocalDNS);
+  case SlotWebStatus:
+    WiFiInfoRead(Info);
+    return snprintf(Text, Size, "%s", Info.WebStatus);
+  case SlotWebRSSI:
+    return snprintf(Text, Size, "%d", int(WiFi.RSSI()));
+  case SlotWiFiReconnects:
+    return snprintf(Text, Size, "%u, %lus down in total, last outage %lus", MetricWiFiReconnects.Read(),
+                    MetricWiFiDowntime.Read() / 1000UL, WiFiLastOutageMillis / 1000);
+  // system.html
+  case SlotChipID:
+    return snprintf(Text, Size, "%lu", (unsigned long)ESP.getEfuseMac());
+  case SlotChipRevision:
+    return snprintf(Text, Size, "%d", ESP.getChipRevision());
+  case SlotChipFrequency:
+    FormatNumber(ESP.getCpuFreqMHz(), Number, sizeof(Number));
+    return snprintf(Text, Size, "%sMHz", Number);
+  case SlotFlashSize:
+    FormatNumber(ESP.getFlashChipSize(), Number, sizeof(Number));
+    return snprintf(Text, Size, "%sB", Number);
+  case SlotFlashSpeed:
+    FormatNumber(ESP.getFlashChipSpeed(), Number, sizeof(Number));
+    return snprintf(Text, Size, "%sHz", Number);
+  case SlotHeapSize:
+    FormatNumber(ESP.getHeapSize(), Number, sizeof(Number));
+    return snprintf(Text, Size, "%sB", Number);
+  case SlotFreeHeap:
+    FormatNumber(ESP.getFreeHeap(), Number, sizeof(Number));
+    return snprintf(Text, Size, "%sB", Number);
+  case SlotSketchSize:
+    FormatNumber(ESP.getSketchSize(), Number, sizeof(Number));
+    return snprintf(Text, Size, "%sB", Number);
+  case SlotSketchSpaceFree:
+    FormatNumber(ESP.getFreeSketchSpace(), Number, sizeof(Number));
+    return snprintf(Text, Size, "%sB", Number);
+  case SlotBootTime:
+    FormatNumber(BootReadyMillis, Number, sizeof(Number));
+    return snprintf(Text, Size, "%sms", Number);
+  case SlotPower:
+    return snprintf(Text, Size, "%s, %uMHz%s, about %.1fmA", PowerSave ? "saving" : "normal", ESP.getCpuFreqMHz(),
+                    PowerLightSleep ? " with light sleep" : "", PowerAverageMilliamps());
+  case SlotMaintenance:
+    if (!PowerSave)
+      return snprintf(Text, Size, "OTA always listening");
+    if (!MaintenanceOpen())
+      return snprintf(Text, Size, "closed, /maintenance opens it");
+    return snprintf(Text, Size, "open for %lu more minutes", (MaintenanceWindowMillis - (millis() - MaintenanceOpenedMillis)) / 60000 + 1);
+  case SlotBootRadio:
+    FormatNumber(BootRadioMillis, Number, sizeof(Number));
+    return snprintf(Text, Size, "%sms, %s start", Number, BootWarm ? "warm" : "cold");
+  case SlotBootFirstPacket:
+    if (BootFirstPacketMillis == 0)
+      return snprintf(Text, Size, "waiting");
+    FormatNumber(BootFirstPacketMillis, Number, sizeof(Number));
+    return snprintf(Text, Size, "%sms after reset", Number);
+  case SlotPacketTime:
+  {
+    char Max[16];
+    FormatNumber(PacketBlockMicros, Number, sizeof(Number));
+    FormatNumber(PacketBlockMaxMicros, Max, sizeof(Max));
+    return snprintf(Text, Size, "%sus, max %sus", Number, Max);
+  }
+  case SlotStyleVersion:
+    return snprintf(Text, Size, "%08x", StaticAssets[StaticAssetStyle].Hash);
+  case SlotFaviconVersion:
+    return snprintf(Text, Size, "%08x", StaticAssets[StaticAssetFavicon].Hash);
+  case SlotAssetCache:
+    return snprintf(Text, Size, "%u RAM, %u flash, %u not modified", AssetHits, AssetMisses, AssetNotModified);
+  case SlotLiveClients:
+    return snprintf(Text, Size, "%u", (unsigned)Events.count());
+  case SlotMinFreeHeap:
+    FormatNumber(ESP.getMinFreeHeap(), Number, sizeof(Number));
+    return snprintf(Text, Size, "%sB", Number);
+  case SlotRadio:
+    return snprintf(Text, Size, "SF%u %luKHz, SF%u recommended", LoraSpreadingFactor, LoraBandwidth / 1000, LinkRecommendedSF());
+  case SlotLinkAcks:
+    return snprintf(Text, Size, "%u, %u failed, %u power changes", MetricLinkAcks.Read(), MetricLinkAckFailures.Read(), MetricLinkPowerChanges.Read());
+  case SlotTasks:
+    FormatNumber(TaskStackFree((TaskID)Row), Number, sizeof(Number));
+    return snprintf(Text, Size, "<tr><td>%s</td><td>%u</td><td>%u</td><td>%.1f%%</td><td>%sB of %u</td></tr>", Tasks[Row].Name,
+                    (unsigned)Tasks[Row].Core, (unsigned)Tasks[Row].Priority, TaskBusyPercent[Row], Number, Tasks[Row].Stack);
+  default:
+    return 0;
+  }
+}
+
+// send one of the compiled pages
+void PageSend(AsyncWebServerRequest *request, const TemplatePart *Parts, byte PartCount)
+{
+  std::shared_ptr<PageStream> Page(new PageStream());
+  PageBegin(*Page, Parts, PartCount);
+  request->send(request->beginChunkedResponse("text/html", [Page](uint8_t *Buffer, size_t MaxLength, size_t Index) -> size_t {
+    return PageFill(*Page, Buffer, MaxLength);
+  }));
+}
+
+// run slower and let the CPU and WiFi modem sleep between events, see POWER_SAVE in platformio.ini. The radio keeps
+// listening, DIO0 wakes the CPU for a packet
+void PowerSaveBegin()
+{
+  setCpuFrequencyMhz(PowerCPUMHz);
+  PowerStates[PowerCPUActive].Milliamps = 31; // datasheet figures at 80MHz
+  PowerStates[PowerCPUIdle].Milliamps = 20;
+#if POWER_SAVE && CONFIG_PM_ENABLE && CONFIG_FREERTOS_USE_TICKLESS_IDLE
+  // light sleep whenever every task is waiting. The Arduino core's prebuilt IDF has neither option on, so this only
+  // happens with an IDF built with them, otherwise the FreeRTOS idle task waits for an interrupt at full power
+  esp_pm_config_esp32_t Config = {};
+  Config.max_freq_mhz = PowerCPUMHz;
+  Config.min_freq_mhz = PowerCPUMinMHz;
+  Config.light_sleep_enable = true;
+  if (esp_pm_configure(&Config) == ESP_OK)
+  {
+    gpio_wakeup_enable((gpio_num_t)DIO0, GPIO_INTR_HIGH_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+    PowerLightSleep = true;
+    PowerStates[PowerCPUIdle].Milliamps = 0.8;
+  }
+#endif
+}
+
+// bring back the sender table, last packet and clock after a software reset, see WarmState. After power on RTC memory
+// holds whatever it came up with, the check would catch it but there is no point looking
+bool WarmBoot()
+{
+  esp_reset_reason_t Reason = esp_reset_reason();
+  if (Reason == ESP_RST_POWERON || Reason == ESP_RST_BROWNOUT || !WarmRestore(BoardWarm))
+    return false;
+  if (time(NULL) < ClockValidUTC && BoardWarm.UTC >= ClockValidUTC) // the RTC lost the time, carry on from when it was saved
+  {
+    timeval Saved = {(time_t)BoardWarm.UTC, 0};
+    settimeofday(&Saved, NULL);
+  }
+  return true;
+}
+
+// start the radio listening. If it won't start the rest still comes up so it can be looked at and updated over the air
+void LoraBegin()
+{
+  ConfigValues Config;
+  ConfigRead(Config);
+  LoraConfigure(Config.LoraPreamble, Config.LoraPacketLimit);
+  ConfigTake(ConfigRadio | ConfigPacket); // started with the latest
+  SPI.begin(SCK, MISO, MOSI, SS);
+  LoRa.setPins(SS, RST, DIO0);
+  if (!LoRa.begin(Config.LoraBand))
+  {
+    OLEDMessage("LoRa failed to start");
+    Serial.println("LoRa failed to start");
+    return;
+  }
+  // start the task that processes received packets on core 1, before the callback that wakes it
+  TaskStart(TaskLora);
+  LoRa.setSpreadingFactor(LoraSpreadingFactor); // set rather than left to the library's defaults, senders have to match
+  LoRa.setSignalBandwidth(LoraBandwidth);
+  LoRa.setCodingRate4(LoraCodingRate);
+  LoRa.setPreambleLength(LoraPreambleLength);
+  LoRa.setTxPower(LoraAckTXPower);
+  LoRa.setSyncWord(Config.LoraSyncWord);
+  LoRa.onReceive(LoraReceiveInterrupt); // setup callback
+  LoRa.receive();              // put into receive mode
+  BootRadioMillis = millis();
+  OLEDMessage(BootWarm ? "Lora started, warm" : "Lora started");
+  Serial.printf("Lora started in %lums\n", BootRadioMillis);
+}
+
+// apply a config change to the radio or the packet checks, only LoraTask touches either once it is running
+void LoraReconfigure(uint8_t Changed)
+{
+  ConfigValues Config;
+  ConfigRead(Config);
+  if (Changed & ConfigRadio)
+  {
+    LoRa.onReceive(NULL); // as in ESP32Radio::Send, the receive interrupt must not use SPI mid retune
+    LoRa.idle();
+    LoRa.setFrequency(Config.LoraBand);
+    LoRa.setSyncWord(Config.LoraSyncWord);
+    LoRa.onReceive(LoraReceiveInterrupt);
+    LoRa.receive();
+  }
+  if (Changed & ConfigPacket)
+    LoraConfigure(Config.LoraPreamble, Config.LoraPacketLimit);
+  Serial.printf("Lora settings changed, %luHz sync word 0x%02X, preamble %s, packets up to %u bytes\n", (unsigned long)Config.LoraBand,
+                Config.LoraSyncWord, Config.LoraPreamble, Config.LoraPacketLimit);
+}
+
+// NTP server and time zone from the config. The new server is asked at the next NTPService, the time zone applies from
+// the next time formatted
+void ClockConfigure()
+{
+  ConfigValues Config;
+  ConfigRead(Config);
+  memcpy(NTPServer, Config.NTPServer, sizeof(NTPServer));
+  NTPTime.ntpServer(NTPServer);
+  NTPTime.updateInterval(MainLoopCycleTime); // back to NTPRefresh once it has answered
+  xSemaphoreTake(ClockMutex, portMAX_DELAY);
+  setenv("TZ", Config.TimeZone, 1);
+  tzset();
+  xSemaphoreGive(ClockMutex);
+}
+
+// keep the clock in sync, this only goes to the network every NTPRefresh. Date and time strings are formatted by UpdateClock when needed.
+// The exchange can wait a second for an answer, or every second while NTP can't be reached, so ClockMutex is only held
+// to set the time and nobody reading it waits on the network
+void NTPService()
+{
+  static bool NTPStarted = false;
+  if (!NTPStarted)
+  {
+    NTPTime.begin(false);
+    NTPStarted = true;
+  }
+  if (!NTPTime.update())
+    return;
+  timeval Now = {(time_t)NTPTime.utc(), 0};
+  xSemaphoreTake(ClockMutex, portMAX_DELAY);
+  settimeofday(&Now, NULL); // kept by the RTC through a software reset
+  xSemaphoreGive(ClockMutex);
+  NTPTime.updateInterval(NTPRefresh);
+  NTPLastSyncMillis = millis();
+  MetricNTPSyncs.Add();
+}
+
+// work out each task's share of a core since the last report from the busy time it recorded
+void TasksReport(unsigned long Elapsed)
+{
+  static uint32_t Last[TaskCount];
+  for (byte i = 0; i < TaskCount; i++)
+  {
+    uint32_t Busy = TaskBusyMillis[i].Read();
+    TaskBusyPercent[i] = (Busy - Last[i]) * 100.0 / Elapsed;
+    Last[i] = Busy;
+  }
+}
+
+// low priority work on core 0, OTA, NTP and task CPU use. When saving power OTA only listens in the maintenance
+// window and the task wakes every PowerHousekeepingInterval the rest of the time
+void HousekeepingTask(void *p)
 {
   // OTA callbacks
   ArduinoOTA.onStart([]() {
+    MetricOTAStarts.Add();
+    OTAProgress = 0;
     OLEDMessage("OTA starting");
     Serial.println("Starting OTA");
     vTaskDelay(pdMS_TO_TICKS(400));
     String type;
     if (ArduinoOTA.getCommand() == U_FLASH)
       type = "sketch";
-    else // U_SPIFFS
+    else // U_SPIFFS, ArduinoOTA can't be told to wait so SPIFFS is unmounted once the web server is done or it gives up
     {
-      SPIFFS.end();
+      if (!FilesQuiesce(FilesQuiesceWait))
+        Serial.println("Unmounting anyway");
+      FilesUnmount();
       type = "filesystem";
-      // NOTE: if updating SPIFFS this would be the place to unmount SPIFFS using SPIFFS.end()
     }
   });
   ArduinoOTA.onEnd([]() { Serial.println("\nEnd"); });
   ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
-    Serial.printf("Progress: %u%%\r", (progress / (total / 100)));
+    OTAProgress = progress / (total / 100);
+    Serial.printf("Progress: %u%%\r", OTAProgress);
   });
   ArduinoOTA.onError([](ota_error_t error) {
+    MetricOTAErrors.Add();
+    if (ArduinoOTA.getCommand() != U_FLASH)
+      FilesResume();
     Serial.printf("Error[%u]: ", error);
     if (error == OTA_AUTH_ERROR)
       Serial.println("Auth Failed");
@@ -416,23 +1595,85 @@ void OTACore0(void *p) // run OTA on core 0, makes it responsive
     else if (error == OTA_END_ERROR)
       Serial.println("End Failed");
   });
-  // start OTA      //
-  ArduinoOTA.begin(); //
-
+  bool OTAStarted = false;
+  unsigned long LastNTP = millis();
+  unsigned long LastReport = millis();
   while (true)
   {
-    // standing section for OTA updates
-    ArduinoOTA.handle();
-    vTaskDelay(pdMS_TO_TICKS(OTALoopCycleTime));
+    // OTA is polled while it listens, otherwise there is nothing to do for a while. /maintenance wakes it early
+    unsigned long Wait = OTAStarted ? OTALoopCycleTime : PowerSave ? PowerHousekeepingInterval : MainLoopCycleTime;
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(Wait));
+    unsigned long Start = micros();
+    if (ConfigTake(ConfigClock))
+      ClockConfigure();
+    if (UpdateRestart)
+    {
+      Serial.println("Restarting into the update");
+      if (HistoryTaskHandle != NULL)
+        xTaskNotifyGive(HistoryTaskHandle); // write out waiting history, if SPIFFS wasn't what was updated
+      vTaskDelay(pdMS_TO_TICKS(XStartDisplayDelay)); // the answer to /api/v1/update has to get out first
+      ESP.restart();
+    }
+    // OTA and NTP need an address, WiFiTask will get one eventually. The clock carries on from the last sync without it
+    if (OTAStarted && !MaintenanceOpen())
+    {
+      ArduinoOTA.end();
+      OTAStarted = false;
+      Serial.println("Maintenance window closed");
+    }
+    if (WiFiUp)
+    {
+      if (!OTAStarted && MaintenanceOpen())
+      {
+        ArduinoOTA.begin();
+        OTAStarted = true;
+        Serial.println("OTA listening");
+      }
+      if (OTAStarted)
+        ArduinoOTA.handle();
+      if (millis() - LastNTP >= MainLoopCycleTime)
+      {
+        LastNTP = millis();
+        NTPService();
+      }
+    }
+    TaskBusy(TaskHousekeeping, Start);
+    if (millis() - LastReport >= TaskReportInterval)
+    {
+      TasksReport(millis() - LastReport);
+      LastReport = millis();
+    }
   }
 }
 
 // main setup
 //-----------------------------
+// the config's defaults, from the constants above and Security.h
+void ConfigDefaults(ConfigValues &Defaults)
+{
+  memset(&Defaults, 0, sizeof(Defaults));
+  snprintf(Defaults.WiFiSSID, sizeof(Defaults.WiFiSSID), "%s", WiFiSSID);
+  snprintf(Defaults.WiFiPassword, sizeof(Defaults.WiFiPassword), "%s", WiFiPassword);
+  memcpy(Defaults.WiFiIP, WiFiIP, 4);
+  memcpy(Defaults.WiFiGateway, WiFiGateway, 4);
+  memcpy(Defaults.WiFiSubnet, WiFiSubnet, 4);
+  memcpy(Defaults.WiFiDNS, WiFiPrimaryDNS, 4);
+  memcpy(Defaults.WiFiDNS2, WiFiSecondaryDNS, 4);
+  snprintf(Defaults.NTPServer, sizeof(Defaults.NTPServer), "%s", NTPServerName);
+  snprintf(Defaults.TimeZone, sizeof(Defaults.TimeZone), "%s", ClockTimeZone);
+  Defaults.LoraBand = LoraBand;
+  Defaults.LoraSyncWord = LoraSyncWord;
+  snprintf(Defaults.LoraPreamble, sizeof(Defaults.LoraPreamble), "%s", LoraPacketPreAmble);
+  Defaults.LoraPacketLimit = LoraMaxPacketSize;
+  snprintf(Defaults.APIToken, sizeof(Defaults.APIToken), "%s", CONFIG_TOKEN);
+}
+
 void setup()
 {
   // set up led
   pinMode(BuiltInLED, OUTPUT);
+  LEDQueue = xQueueCreate(LEDQueueSize, sizeof(LEDPattern));
+  LEDTimer = xTimerCreate("LEDTimer", 1, pdFALSE, NULL, LEDTimerCallback);
 
   //Signal progress
   FlashLED(250, 0, 1);
@@ -445,121 +1686,153 @@ void setup()
   OLEDDisplay.flipScreenVertically();
   OLEDDisplay.setFont(ArialMT_Plain_10);
   OLEDDisplay.setTextAlignment(TEXT_ALIGN_LEFT);
+  OLEDDisplay.clear();
+  TaskStart(TaskDisplay);
   OLEDMessage("OLED started");
-  vTaskDelay(pdMS_TO_TICKS(OLEDDisplayDelay));
 
   // Start serial
   SerialConnect();
   OLEDMessage("Serial started");
   Serial.println("Serial started");
-  vTaskDelay(pdMS_TO_TICKS(OLEDDisplayDelay));
 
-  // Start WiFi
-  OLEDMessage("Wifi starting");
-  WiFiConnect();
-  OLEDMessage("Wifi started");
-  Serial.println("Wifi started");
-  vTaskDelay(pdMS_TO_TICKS(OLEDDisplayDelay));
+  // power accounting from here, WiFi is off until it is started below
+  if (PowerSave)
+    PowerSaveBegin();
+  PowerBegin(PowerCPUIdle, PowerLoraReceive, PowerWiFiOff);
+  Serial.printf("CPU at %uMHz%s\n", ESP.getCpuFreqMHz(), PowerLightSleep ? ", light sleep" : "");
+
+  // settings from flash, before anything uses them
+  ConfigValues Defaults;
+  ConfigDefaults(Defaults);
+  bool ConfigStored = ConfigBegin(Defaults);
+  Serial.printf("Config %s in %luus, generation %u\n", ConfigStored ? "loaded" : "defaulted", ConfigLoadMicros, ConfigGeneration);
+
+  FilesMutex = xSemaphoreCreateMutex(); // before anything can reach Platform.Files
 
   // Start NTP client
-  NTPTime.ntpServer(NTPServerName);
-  NTPTime.updateInterval(NTPRefresh);
-  NTPTime.ruleSTD("NZST", First, Sun, Apr, 2, 12 * 60);     // first sunday in April at 2:00, timezone 12 hours
-  NTPTime.ruleDST("NZDT", Last, Sun, Sep, 3, 12 * 60 + 60); // last sunday in September at 3:00, timezone 13 hours
-  NTPTime.begin();
-  NTPTime.update();
-  OLEDMessage("NTP started");
+  ClockMutex = xSemaphoreCreateMutex();
+  ClockConfigure();
+  // NTPTime.begin is left to HousekeepingTask as it needs the network
   Serial.println("NTP started");
-  vTaskDelay(pdMS_TO_TICKS(OLEDDisplayDelay));
+
+  // bring back the senders and last packet from before a restart, then start the radio before anything slow
+  BootWarm = WarmBoot();
+  if (BootWarm)
+    Serial.printf("Warm start, %u senders restored\n", NodeCount);
+  AlertCompile(AlertDefaultRules, AlertDefaultRuleCount);
+  LoraBegin();
+
+  // Start WiFi in the background on core 0, nothing else waits for it
+  WiFi.mode(WIFI_STA); // also starts the TCP/IP stack so the web server can begin before there is a connection
+  WiFi.persistent(false);
+  WiFi.setAutoReconnect(false); // WiFiTask does this, with backoff
+  WiFi.onEvent(WiFiEvent);
+  if (PowerSave)
+  {
+    esp_wifi_set_ps(WIFI_PS_MAX_MODEM); // wake every listen interval (3 beacons) rather than every beacon
+    PowerStates[PowerWiFiModemSleep].Milliamps = 5;
+  }
+  PowerSet(PowerWiFiActive);
+  TaskStart(TaskWiFi);
+  Serial.println("Wifi starting");
 
   // Start SPIFFS
-  if (!SPIFFS.begin(true)) // if there is an error ignore it
+  FilesMounted = SPIFFS.begin(true);
+  if (!FilesMounted) // if there is an error ignore it
   {
     Serial.println("An Error has occurred while mounting SPIFFS");
   }
   else
   {
     Serial.println("SPIFFS started.");
+    AssetsBegin();
+    // start keeping history on core 0, out of the way of the radio
+    HistoryBegin();
+    TaskStart(TaskHistory);
+    // forward readings to the backend, spooling them in flash while it can't be reached
+    UplinkBegin();
+    TaskStart(TaskUplink);
   }
 
   // callbacks to respond to web request
-  WebServer.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
-    request->send(SPIFFS, "/index.html", String(), false, ProcessWater);
-  });
-  WebServer.on("/favicon.ico", HTTP_GET, [](AsyncWebServerRequest *request) {
-    request->send(SPIFFS, "/favicon.ico", "image/icon");
-  });
-  WebServer.on("/style.css", HTTP_GET, [](AsyncWebServerRequest *request) {
-    request->send(SPIFFS, "/style.css", "text/css");
-  });
-  WebServer.on("/network", HTTP_GET, [](AsyncWebServerRequest *request) {
-    request->send(SPIFFS, "/network.html", String(), false, ProcessNetwork);
-    Serial.println("Network status: " + WebStatus);
-  });
-  WebServer.on("/system", HTTP_GET, [](AsyncWebServerRequest *request) {
-    request->send(SPIFFS, "/system.html", String(), false, ProcessSystem);
-  });
-  WebServer.on("/restart", HTTP_GET, [](AsyncWebServerRequest *request) {
-    request->send(SPIFFS, "/restart.html", String(), false, Processor);
-  });
+  WebServer.on("/", HTTP_GET, WebMeasured([](AsyncWebServerRequest *request) {
+    PageSend(request, TemplateIndex, TemplateIndexParts);
+  }));
+  WebServer.on("/favicon.ico", HTTP_GET, WebMeasured([](AsyncWebServerRequest *request) {
+    AssetSend(request, StaticAssets[StaticAssetFavicon]);
+  }));
+  WebServer.on("/style.css", HTTP_GET, WebMeasured([](AsyncWebServerRequest *request) {
+    AssetSend(request, StaticAssets[StaticAssetStyle]);
+  }));
+  WebServer.on("/network", HTTP_GET, WebMeasured([](AsyncWebServerRequest *request) {
+    PageSend(request, TemplateNetwork, TemplateNetworkParts);
+    WiFiInfo Info;
+    WiFiInfoRead(Info);
+    Serial.printf("Network status: %s\n", Info.WebStatus);
+  }));
+  WebServer.on("/system", HTTP_GET, WebMeasured([](AsyncWebServerRequest *request) {
+    PageSend(request, TemplateSystem, TemplateSystemParts);
+  }));
+  WebServer.on("/restart", HTTP_GET, WebMeasured([](AsyncWebServerRequest *request) {
+    PageSend(request, TemplateRestart, TemplateRestartParts);
+  }));
   // Restart the esP32
   WebServer.on("/xstart", HTTP_GET, [](AsyncWebServerRequest *request) {
     request->send(200, "text/html", "<h1>ESP being restarted</h1>");
+    if (HistoryTaskHandle != NULL)
+      xTaskNotifyGive(HistoryTaskHandle); // write out waiting history, RTC memory only keeps the sender table
     vTaskDelay(pdMS_TO_TICKS(XStartDisplayDelay)); // make sure everything is sent and displayed
     ESP.restart();
   });
+  // open the maintenance window, OTA listens straight away unless saving power
+  WebServer.on("/maintenance", HTTP_GET, [](AsyncWebServerRequest *request) {
+    if (!ApiAuthorized(request)) // opens OTA, so it needs the API token like the other changes
+    {
+      request->send(401, "text/plain", "Unauthorized\n");
+      return;
+    }
+    MaintenanceOpenedMillis = millis();
+    if (HousekeepingTaskHandle != NULL)
+      xTaskNotifyGive(HousekeepingTaskHandle);
+    request->send(200, "text/html", "<h1>OTA listening for " + String(MaintenanceWindowMillis / 60000) + " minutes</h1>");
+  });
+  // live updates for the home page, sent by EventsTask
+  Events.onConnect([](AsyncEventSourceClient *client) {
+    if (EventsTaskHandle != NULL)
+      xTaskNotifyGive(EventsTaskHandle);
+  });
+  WebServer.addHandler(&Events);
+  // machine readable API
+  WebServer.on("/api/v1/latest", HTTP_GET, WebMeasured(ApiLatest));
+  WebServer.on("/api/v1/history", HTTP_GET, WebMeasured(ApiHistory));
+  WebServer.on("/api/v1/config", HTTP_GET | HTTP_POST, WebMeasured(ApiConfig));
+  WebServer.on("/api/v1/update", HTTP_POST, WebMeasured(ApiUpdate), NULL, ApiUpdateBody);
+  WebServer.on("/metrics", HTTP_GET, WebMeasured(MetricsSend));
   // Catch all
   WebServer.onNotFound([](AsyncWebServerRequest *request) {
-    request->send(SPIFFS, "/index.html", String(), false, ProcessWater);
+    PageSend(request, TemplateIndex, TemplateIndexParts);
   });
 
   // start the async web server
   WebServer.begin();
-  OLEDMessage("Web server started");
+  TaskStart(TaskEvents);
   Serial.println("HTTP server started");
-  vTaskDelay(pdMS_TO_TICKS(OLEDDisplayDelay));
 
-  // start lora
-  SPI.begin(SCK, MISO, MOSI, SS);
-  LoRa.setPins(SS, RST, DIO0);
-  if (!LoRa.begin(LoraBand)) // if it doesn't start there is no point carrying on
-  {
-    OLEDMessage("LoRa failed to start");
-    Serial.println("LoRa failed to start");
-    while (true)
-    {
-    }
-  }
-  LoRa.setSyncWord(0xA1);      // ranges from 0-0xFF, default 0x34, see API docs - doesn't seem to work reliably
-  LoRa.onReceive(LoraReceive); // setup callback
-  LoRa.receive();              // put into receive mode
-  OLEDMessage("Lora started");
-  Serial.println("Lora started");
-  vTaskDelay(pdMS_TO_TICKS(OLEDDisplayDelay));
+  // work out what recording a metric costs, for /metrics
+  MetricsCalibrate();
 
-  // start OTA monitoring task on core 0
-  xTaskCreatePinnedToCore(OTACore0, "OTACore0", 4096, NULL, 0, NULL, 0);
-  OLEDMessage("OTA started");
+  // start OTA, NTP and task monitoring on core 0
+  TaskStart(TaskHousekeeping);
   Serial.println("OTA started");
-  vTaskDelay(pdMS_TO_TICKS(OLEDDisplayDelay));
 
   // finished setup
-  OLEDMessage("Setup finished");
-  Serial.println("Setup finished");
+  BootReadyMillis = millis();
+  Serial.printf("Setup finished in %lums\n", BootReadyMillis);
   FlashLED(200, 200, 3);
 }
 
+// everything runs in the tasks started by setup, the Arduino loop task has nothing to do
 void loop()
 {
-  // date and time
-  NTPTime.update(); // setup the date/time strings used for the OLED display, serial out, and web
-  FormattedDate = NTPTime.formattedTime("%d %B %Y");
-  FormattedTime = NTPTime.formattedTime("%T");
-  if (LoraPacketFlag) // if we have a packet then process it, OLED display commands can't be in the receive callback so need to process independantly
-  {
-    LoraPacketFlag = false;
-    FlashLED(100, 100, 2);
-    LoraProcessing();
-  }
-  vTaskDelay(pdMS_TO_TICKS(MainLoopCycleTime)); // probably not needed
+  vTaskDelete(NULL);
 }
\ No newline at end of file
@@ -0,0 +1,1564 @@
+/*
+* Replays a packet trace through the receive pipeline on a PC, build with the native env:
+*   pio run -e native && .pio/build/native/program traces/example.txt
+*
+* Trace format, one event per line, blank lines and # comments are skipped:
+*   <ms> rx <rssi> <snr> <hex bytes>   binary or any other packet, snr in 1/4 dB steps as the radio gives it
+*   <ms> text <rssi> <snr> <text>      old style text packet, i.e. A1A1370
+*   <ms> wifi up|down
+*   <ms> config name=value             change a setting the way /api/v1/config does, see Config.cpp for the names
+* Packets with the same time arrive together, before the pipeline gets to run, the same as a burst on the board.
+* scripts/make_trace.py writes synthetic traces.
+*
+* Options:
+*   -q           only print the summary
+*   -pages n     open home pages (default 1, 0 skips formatting events)
+*   -bench       time the pipeline with the real clock while the trace is replayed as fast as possible,
+*                prints one line of JSON, implies -q
+*   -repeat n    replay the trace n times, the fake clock carries on from where the last replay finished
+*   -json file   append the -bench JSON to file, scripts/bench_compare.py compares the last two lines
+*   -label text  stored in the JSON, i.e. the git commit
+*   -uplink      forward readings to an in memory backend, UplinkService runs every second of fake time
+*   -uplink-url url      POST them to a real server instead, i.e. scripts/uplink_stub.py, implies -uplink
+*   -uplink-fail n       percent of in memory requests that fail
+*   -uplink-ms n         fake time each request takes (default 50)
+*   -channel n   no trace, n senders at increasing distance send a reading every minute over a simulated channel
+*                and follow the TX power in the receiver's acks. Prints how each got on
+*   -channel-fixed       the senders ignore the acks, to compare against
+*   -channel-hours n     how long to run the channel for (default 24)
+*   -channel-fading dB   spread of the fading (default 4)
+*   -seed n      for the channel's random numbers
+*   -restart ms  restart the receiver at ms into the trace, the sender table comes back from the warm state the way
+*                it does from RTC memory on the board
+*   -alert-bench time checking a packet against 4, 16 and 64 alert rules, prints one line of JSON and exits with 1 if
+*                the cost grows with rules that are for other senders or an alert is notified under another rule's name
+*   -config-bench time loading the config and applying a change, prints one line of JSON and exits with 1 if a
+*                change reaches settings it didn't touch or a bad one gets through
+*   -update pack apply a pack from scripts/ota_pack.py the way /api/v1/update does, prints one line of JSON and exits
+*                with 1 if the image doesn't match its hash or a damaged or cut short copy of the pack gets through
+*   -update-base file    the firmware the board is running, for a delta
+*   -update-out file     write the image the pack made
+*   -fuzz n      decode n good packets and n damaged ones, checking nothing is read past the end of a packet and a
+*                damaged one never decodes to something out of range. Also times a decode, prints one line of JSON and
+*                exits with 1 on any failure. Build with -fsanitize=address to have reads past the end caught directly
+*   -page-bench  after the replay load the web pages through the compiled templates and through a model of the old SPIFFS
+*                and template processor path, -pages n at once. Run from the project directory, it reads the html in data.
+*                Prints one line of JSON and exits with 1 if the two paths send different pages
+*   -decode-bench  after the replay decode the trace's packets with LoraDecodePacket and with a model of the old String
+*                path, and check text packets decode as they should. Prints one line of JSON with the time and heap
+*                allocations per packet of each and exits with 1 if a text packet is decoded wrongly
+*   -clients n   n live pages are sent events from another thread, the way the board sends them from core 0 while the
+*                replay runs as LoraTask. Prints one line of JSON with the event latency and peak heap, and exits with 1 if
+*                an event went missing. Each packet waits for the last one's events to be sent, as they are seconds
+*                apart on the board
+*   -tear-check  read the last packet from another thread for the whole replay, the way the web server does on the
+*                other core, and check every copy is whole
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <string>
+#include <thread>
+#include <stdlib.h>
+#include "Simulator.h"
+#include "../Receiver.h"
+#include "../Link.h"
+#include "../Uplink.h"
+#include "../Power.h"
+#include "../Alert.h"
+#include "../Config.h"
+#include "../Patch.h"
+#include "../Page.h"
+
+SimRadio Radio;
+SimDisplay Display;
+SimClock Clock;
+SimFileSystem FileSystem;
+SimNetwork Network;
+SimConsole Console;
+SimUplink Uplink;
+SimUplink Notifier;
+SimStore Store;
+SimImage Image;
+HalPlatform Platform = {&Radio, &Display, &Clock, &FileSystem, &Network, &Console, NULL, &Notifier, &Store, &Image}; // -uplink sets Uplink
+
+// heap use, every new and delete in the program goes through here. Not inlined, gcc can't tell they match
+// and -clients allocates from a thread of its own
+std::atomic<size_t> HeapInUse(0);
+std::atomic<size_t> HeapPeak(0);
+uint32_t PipelineAllocations = 0; // made while the pipeline was running, should stay 0
+thread_local bool InPipeline = false;
+
+__attribute__((noinline)) void *operator new(size_t Size)
+{
+  size_t *Block = (size_t *)malloc(Size + sizeof(max_align_t));
+  if (Block == NULL)
+    throw std::bad_alloc();
+  *Block = Size;
+  size_t InUse = HeapInUse.fetch_add(Size) + Size;
+  size_t Peak = HeapPeak.load();
+  while (InUse > Peak && !HeapPeak.compare_exchange_weak(Peak, InUse))
+    ;
+  if (InPipeline)
+    PipelineAllocations++;
+  return (uint8_t *)Block + sizeof(max_align_t);
+}
+
+__attribute__((noinline)) void operator delete(void *Pointer) noexcept
+{
+  if (Pointer == NULL)
+    return;
+  size_t *Block = (size_t *)((uint8_t *)Pointer - sizeof(max_align_t));
+  HeapInUse.fetch_sub(*Block);
+  free(Block);
+}
+
+void operator delete(void *Pointer, size_t Size) noexcept
+{
+  operator delete(Pointer);
+}
+
+// wall clock time in nanoseconds, only used by -bench
+uint64_t BenchNanos()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct BenchResult
+{
+  bool Enabled;
+  std::vector<uint32_t> Processing; // nanoseconds per LoraProcessing call
+  uint64_t ReceiveMax;              // longest LoraReceive, which runs in the interrupt on the board
+  uint64_t FlushTotal;              // all HistoryFlush calls
+  uint64_t Total;                   // the whole replay
+  double CounterNanos;              // to record one metric
+  double HistogramNanos;
+  size_t HeapPeak;                  // most heap used on top of what was in use when the replay started, the trace itself isn't counted
+  uint64_t UplinkTotal;             // all UplinkService calls, less the time spent in a real server
+  unsigned long UplinkDrainMax;     // longest fake milliseconds from the network coming back to the backlog being sent
+  uint64_t WarmSaveTotal;           // all WarmSave calls, one after each packet as LoraTask does
+  uint64_t WarmRestore;             // one WarmRestore of the final state
+  double AlertNanos;                // AlertEvaluate with AlertMaxRules rules
+};
+BenchResult Bench = BenchResult();
+WarmState SimWarm; // the board's RTC memory
+
+// the config the simulator starts with, the board's come from main.cpp and Security.h
+ConfigValues SimConfigDefaults()
+{
+  ConfigValues Defaults = ConfigValues();
+  snprintf(Defaults.WiFiSSID, sizeof(Defaults.WiFiSSID), "sim");
+  snprintf(Defaults.NTPServer, sizeof(Defaults.NTPServer), "pool.ntp.org");
+  snprintf(Defaults.TimeZone, sizeof(Defaults.TimeZone), "UTC0");
+  Defaults.LoraBand = 915000000;
+  Defaults.LoraSyncWord = 0xA1;
+  snprintf(Defaults.LoraPreamble, sizeof(Defaults.LoraPreamble), "%s", LoraPacketPreAmble);
+  Defaults.LoraPacketLimit = LoraMaxPacketSize;
+  snprintf(Defaults.APIToken, sizeof(Defaults.APIToken), "sim");
+  return Defaults;
+}
+
+// -clients n, n live pages served from a thread of their own the way AsyncTCP serves them on core 0 while the replay
+// is LoraTask. Like AsyncEventSource each event is made into one message then copied onto the heap for each page and
+// freed once written. Latency is from the pipeline starting on the packet that queued an event to every page having it
+struct SimClients
+{
+  std::vector<uint64_t> Queued;    // BenchNanos before each queued event, written by the replay
+  std::vector<uint64_t> Delivered; // and when every page had it, written by the clients' thread
+  uint32_t LastQueued;             // MetricEventsQueued when last looked at
+  size_t HeapMost;                 // most heap the copies of one event took
+  std::atomic<bool> Stop;
+  std::thread Thread;
+};
+SimClients Clients; // zeroed
+
+// what EventsTask does on the board, or the clients' thread with -clients
+void SimEvents(uint64_t Start)
+{
+  if (Network.Clients == 0)
+  {
+    while (EventsService())
+      ;
+    return;
+  }
+  for (; Clients.LastQueued < MetricEventsQueued.Read(); Clients.LastQueued++)
+    Clients.Queued.push_back(Start);
+  while (EventsPending()) // packets arrive seconds apart on the board, the pages have long had the last one's events
+    std::this_thread::yield();
+}
+
+void SimClientsDeliver(const char *Event, const char *Data, uint32_t ID)
+{
+  size_t HeapBefore = HeapInUse;
+  std::string Message = "id: " + std::to_string(ID) + "\r\nevent: " + Event + "\r\ndata: " + Data + "\r\n\r\n";
+  std::vector<std::vector<char> *> Pages(Network.Clients);
+  for (std::vector<char> *&Page : Pages)
+    Page = new std::vector<char>(Message.begin(), Message.end());
+  Clients.HeapMost = std::max(Clients.HeapMost, HeapInUse - HeapBefore); // only this thread allocates while the replay waits
+  static char Socket[1436];
+  for (std::vector<char> *Page : Pages)
+  {
+    for (size_t Offset = 0; Offset < Page->size(); Offset += sizeof(Socket))
+      memcpy(Socket, Page->data() + Offset, std::min(sizeof(Socket), Page->size() - Offset));
+    delete Page;
+  }
+  Clients.Delivered.push_back(BenchNanos());
+}
+
+void SimClientsRun()
+{
+  while (!Clients.Stop.load(std::memory_order_relaxed))
+    if (!EventsService())
+      std::this_thread::yield();
+  while (EventsService())
+    ;
+}
+
+// what LoraTask does when the config changes, the simulated radio has nothing to retune
+void SimConfigure()
+{
+  if (ConfigTake(ConfigRadio | ConfigPacket) == 0)
+    return;
+  ConfigValues Values;
+  ConfigRead(Values);
+  LoraConfigure(Values.LoraPreamble, Values.LoraPacketLimit);
+}
+
+// what setup does, the config from the store or the defaults then the packet settings from it. False if the defaults
+// were used
+bool SimConfigLoad()
+{
+  bool Loaded = ConfigBegin(SimConfigDefaults());
+  ConfigValues Values;
+  ConfigRead(Values);
+  LoraConfigure(Values.LoraPreamble, Values.LoraPacketLimit);
+  return Loaded;
+}
+
+// what LoraTask and HistoryTask do on the board
+void SimDrain()
+{
+  LoraFrame Frame;
+  SimConfigure();
+  while (LoraRingPop(Frame))
+  {
+    uint64_t Start = BenchNanos();
+    InPipeline = true;
+    LoraProcessing(Frame);
+    InPipeline = false;
+    if (Bench.Enabled)
+      Bench.Processing.push_back(BenchNanos() - Start);
+    SimEvents(Start);
+    Start = BenchNanos();
+    WarmSave(SimWarm);
+    Bench.WarmSaveTotal += BenchNanos() - Start;
+    if (HistoryFlushDue())
+    {
+      Start = Bench.Enabled ? BenchNanos() : 0;
+      HistoryFlush();
+      if (Bench.Enabled)
+        Bench.FlushTotal += BenchNanos() - Start;
+    }
+  }
+}
+
+// what UplinkTask does on the board, and how long the spool takes to empty once the network is back
+bool UplinkWasUp = true;
+unsigned long UplinkUpAt = 0; // fake millis the network came back with readings spooled, 0 if not waiting for them to go
+void SimUplinkService()
+{
+  if (Platform.Uplink == NULL)
+    return;
+  if (Network.Up && !UplinkWasUp && UplinkSpoolHead < UplinkSpoolSize)
+    UplinkUpAt = Clock.Millis() | 1;
+  UplinkWasUp = Network.Up;
+  uint64_t Start = BenchNanos();
+  while (UplinkService())
+    ;
+  Bench.UplinkTotal += BenchNanos() - Start;
+  if (UplinkUpAt != 0 && (!Network.Up || UplinkSpoolHead == UplinkSpoolSize))
+  {
+    if (Network.Up)
+      Bench.UplinkDrainMax = std::max(Bench.UplinkDrainMax, Clock.Millis() - UplinkUpAt);
+    UplinkUpAt = 0;
+  }
+}
+
+// move the fake clock on, stopping every UplinkServiceInterval for the uplink as UplinkTask would and every
+// AlertTickInterval for the alerts as LoraTask would
+unsigned long AlertLastTick = 0;
+void SimAdvance(unsigned long Now)
+{
+  while (Clock.Now < Now)
+  {
+    unsigned long Interval = Platform.Uplink == NULL ? AlertTickInterval : UplinkServiceInterval;
+    unsigned long Tick = (Clock.Millis() / Interval + 1) * Interval * 1000;
+    Clock.Now = std::min(Now, Tick);
+    SimUplinkService();
+    if (Clock.Millis() - AlertLastTick >= AlertTickInterval)
+    {
+      uint64_t Start = BenchNanos();
+      AlertTick();
+      SimEvents(Start);
+      AlertLastTick = Clock.Millis();
+    }
+    while (AlertService())
+      ;
+  }
+}
+
+// move the fake clock on to Now, the pipeline catches up with everything that arrived before it
+unsigned long SimLastFlush = 0;
+void SimCatchUp(unsigned long Now)
+{
+  if (Now > Clock.Now)
+  {
+    SimDrain();
+    SimAdvance(Now);
+  }
+  if (Clock.Millis() - SimLastFlush >= HistoryFlushInterval)
+  {
+    uint64_t Start = BenchNanos();
+    HistoryFlush();
+    Bench.FlushTotal += BenchNanos() - Start;
+    SimLastFlush = Clock.Millis();
+  }
+}
+
+// one trace event at Now microseconds on the fake clock
+void SimEvent(const TraceEvent &Event, unsigned long Now)
+{
+  SimCatchUp(Now);
+  if (strcmp(Event.Type, "wifi") == 0)
+  {
+    Network.Up = Event.Up;
+    PowerSet(Network.Up ? PowerWiFiModemSleep : PowerWiFiOff);
+  }
+  else if (strcmp(Event.Type, "config") == 0)
+  {
+    std::string Setting(Event.Packet.begin(), Event.Packet.end());
+    size_t Equals = Setting.find('=');
+    std::string Name = Setting.substr(0, Equals), Value = Setting.substr(Equals + 1);
+    const char *Names[] = {Name.c_str()};
+    const char *Values[] = {Value.c_str()};
+    char Error[96];
+    int Changed = ConfigUpdate(Names, Values, 1, Error, sizeof(Error));
+    if (Changed < 0)
+      ConsolePrintf("config %s refused: %s\n", Name.c_str(), Error);
+    else
+      ConsolePrintf("config %s set, groups %02X changed, generation %u\n", Name.c_str(), Changed, ConfigGeneration);
+  }
+  else
+  {
+    Radio.Deliver(Event.Packet, Event.RSSI, Event.SNRRaw);
+    uint64_t Start = BenchNanos();
+    LoraReceive(Event.Packet.size());
+    Bench.ReceiveMax = std::max(Bench.ReceiveMax, BenchNanos() - Start);
+  }
+}
+
+// -restart, lose the sender table as a reset would and bring it back from SimWarm
+bool SimRestart(unsigned long At)
+{
+  SimDrain();
+  uint32_t Received = 0, Lost = 0;
+  for (byte i = 0; i < NodeCount; i++)
+  {
+    Received += Nodes[i].Received;
+    Lost += Nodes[i].Lost;
+  }
+  memset(Nodes, 0, sizeof(Nodes));
+  NodeCount = 0;
+  uint32_t Generation = ConfigGeneration;
+  bool Loaded = SimConfigLoad() && ConfigGeneration == Generation; // comes back from the store
+  AlertCompile(AlertDefaultRules, AlertDefaultRuleCount); // alerts start again, the same as on the board
+  uint64_t Start = BenchNanos();
+  bool Restored = WarmRestore(SimWarm);
+  uint64_t Nanos = BenchNanos() - Start;
+  for (byte i = 0; i < NodeCount; i++)
+  {
+    Received -= Nodes[i].Received;
+    Lost -= Nodes[i].Lost;
+  }
+  if (Display.Show)
+    printf("restart at %lums: %u senders restored in %lluns\n", At, NodeCount, (unsigned long long)Nanos);
+  return Restored && Loaded && Received == 0 && Lost == 0;
+}
+
+// -channel, senders that follow the receiver's acks over a channel with fading
+const unsigned long ChannelInterval = 60000;   // milliseconds between readings from each sender
+const unsigned long ChannelJitter = 5000;      // random extra wait so senders drift apart like real ones
+const float ChannelPathBest = 0;               // PathSNR of the nearest sender, 14dBm arrives at 14dB
+const float ChannelPathWorst = -26;            // the furthest only just gets through at full power
+const float ChannelEdge = 0.5;                 // dB, how sharply delivery falls off at the demodulation floor
+const float ChannelSNRMax = 10;                // the radio doesn't report a higher SNR than this
+const float ChannelNoiseFloor = -117;          // dBm in 125kHz, RSSI of a packet at 0dB SNR
+const int8_t ChannelStartPower = 14;           // dBm the senders start at, the sender sketch's default
+struct ChannelState
+{
+  std::vector<SimSender> Senders;
+  bool Fixed;    // senders ignore the acks
+  float Fading;  // dB standard deviation
+  std::mt19937 Random;
+};
+ChannelState Channel = ChannelState();
+
+// SNR of one packet over a path, and whether it got through
+bool ChannelPass(float PathSNR, int TXPower, byte SpreadingFactor, float &SNR)
+{
+  std::normal_distribution<float> Fading(0, Channel.Fading);
+  std::uniform_real_distribution<float> Chance(0, 1);
+  SNR = PathSNR + TXPower + Fading(Channel.Random);
+  return Chance(Channel.Random) < 1 / (1 + expf(-(SNR - LinkFloor(SpreadingFactor)) / ChannelEdge));
+}
+
+// TX current of the sender's radio, a rough straight line through the SX1276 PA_BOOST figures
+float ChannelMilliamps(int TXPower)
+{
+  return 20 + 5 * TXPower;
+}
+
+void ChannelBegin(unsigned Count)
+{
+  for (unsigned i = 0; i < Count; i++)
+  {
+    SimSender Sender = SimSender();
+    Sender.ID = i + 1;
+    Sender.PathSNR = Count == 1 ? ChannelPathBest : ChannelPathBest + (ChannelPathWorst - ChannelPathBest) * i / (Count - 1);
+    Sender.TXPower = ChannelStartPower;
+    Sender.SpreadingFactor = LoraSpreadingFactor;
+    Sender.NextMillis = i * ChannelInterval / Count;
+    Channel.Senders.push_back(Sender);
+  }
+}
+
+// hand the senders the acks the receiver has sent since the last packet, if they hear them
+void ChannelAcks()
+{
+  for (const std::vector<uint8_t> &Packet : Radio.Sent)
+  {
+    NodeAck Ack;
+    if (!NodeAckDecode(Packet.data(), Packet.size(), Ack) || Ack.NodeID == 0 || Ack.NodeID > Channel.Senders.size())
+      continue;
+    SimSender &Sender = Channel.Senders[Ack.NodeID - 1];
+    float SNR;
+    if (Ack.Sequence != Sender.Sequence || !ChannelPass(Sender.PathSNR, LoraAckTXPower, Sender.SpreadingFactor, SNR))
+      continue;
+    Sender.AcksHeard++;
+    if (Channel.Fixed)
+      continue;
+    Sender.TXPower = Ack.TXPower;
+    Sender.SpreadingFactor = Ack.SpreadingFactor;
+  }
+  Radio.Sent.clear();
+}
+
+// the next reading from whichever sender is due, over the channel
+void ChannelSend(SimSender &Sender)
+{
+  NodeFrame Frame = NodeFrame();
+  Frame.NodeID = Sender.ID;
+  Frame.Sequence = ++Sender.Sequence;
+  Frame.FieldCount = 3;
+  Frame.Fields[0] = {NodeFieldWater, 1};
+  Frame.Fields[1] = {NodeFieldVolts, 412};
+  Frame.Fields[2] = {NodeFieldLink, (int16_t)(Sender.SpreadingFactor << 8 | (uint8_t)Sender.TXPower)};
+  TraceEvent Event = TraceEvent();
+  strcpy(Event.Type, "rx");
+  Event.Packet.resize(NodeFrameMaxSize);
+  Event.Packet.resize(NodeFrameEncode(Frame, Event.Packet.data(), Event.Packet.size()));
+  Sender.Sent++;
+  Sender.ChargeMilliampSeconds += ChannelMilliamps(Sender.TXPower) * LinkAirtimeMicros(Sender.SpreadingFactor, Event.Packet.size()) / 1e6;
+  float SNR;
+  if (ChannelPass(Sender.PathSNR, Sender.TXPower, Sender.SpreadingFactor, SNR))
+  {
+    Sender.Delivered++;
+    float Reported = std::max(-32.0f, std::min(SNR, ChannelSNRMax));
+    Event.SNRRaw = lroundf(Reported * 4);
+    Event.RSSI = lroundf(ChannelNoiseFloor + std::max(SNR, 0.0f));
+    SimEvent(Event, Clock.Now);
+  }
+}
+
+// run the senders for Millis of fake time
+void ChannelRun(unsigned long Millis)
+{
+  std::uniform_int_distribution<unsigned long> Jitter(0, ChannelJitter);
+  while (!Channel.Senders.empty())
+  {
+    SimSender *Next = &Channel.Senders[0];
+    for (SimSender &Sender : Channel.Senders)
+      if (Sender.NextMillis < Next->NextMillis)
+        Next = &Sender;
+    if (Next->NextMillis >= Millis)
+      break;
+    SimCatchUp(Next->NextMillis * 1000); // the pipeline sends acks for earlier packets as it catches up
+    ChannelAcks();
+    ChannelSend(*Next);
+    Next->NextMillis += ChannelInterval + Jitter(Channel.Random);
+  }
+  SimDrain();
+  ChannelAcks();
+}
+
+// how each sender got on, and the totals to compare with -channel-fixed
+void ChannelReport()
+{
+  uint32_t Sent = 0, Delivered = 0;
+  double Charge = 0;
+  for (const SimSender &Sender : Channel.Senders)
+  {
+    printf("sender %u: path %.0fdB, now %ddBm SF%u, delivered %u of %u (%.1f%%), heard %u acks, TX charge %.0fmAs\n", Sender.ID,
+           Sender.PathSNR, Sender.TXPower, Sender.SpreadingFactor, Sender.Delivered, Sender.Sent,
+           Sender.Sent == 0 ? 0.0 : Sender.Delivered * 100.0 / Sender.Sent, Sender.AcksHeard, Sender.ChargeMilliampSeconds);
+    Sent += Sender.Sent;
+    Delivered += Sender.Delivered;
+    Charge += Sender.ChargeMilliampSeconds;
+  }
+  printf("channel%s: delivered %u of %u (%.1f%%), TX charge %.0fmAs, %u power changes, recommended SF%u\n", Channel.Fixed ? " (fixed power)" : "",
+         Delivered, Sent, Sent == 0 ? 0.0 : Delivered * 100.0 / Sent, Charge, MetricLinkPowerChanges.Read(), LinkRecommendedSF());
+}
+
+// stream an API response the way the web server would, in small chunks so the carry over gets used
+void SimApi(bool History, bool CSV)
+{
+  ApiStream Stream = ApiStream();
+  Stream.History = History;
+  Stream.CSV = CSV;
+  Stream.NodeID = -1;
+  Stream.First = true;
+  Stream.To = UINT32_MAX;
+  if (History)
+  {
+    Stream.Item = HistoryTiers[0].Segments;
+    Stream.Segment = (HistoryState[0].Segment + 1) % HistoryTiers[0].Segments; // oldest
+    Stream.Offset = sizeof(uint32_t);
+  }
+  uint8_t Chunk[64];
+  size_t Length;
+  while ((Length = ApiFill(Stream, Chunk, sizeof(Chunk))) > 0)
+    fwrite(Chunk, 1, Length, stdout);
+  printf("\n");
+}
+
+// what recording a metric costs on this machine, MetricsCalibrate can't time it as the fake clock doesn't move
+void BenchMetrics()
+{
+  static MetricCounter Counter;
+  static MetricHistogram Histogram;
+  uint64_t Start = BenchNanos();
+  for (int i = 0; i < MetricCalibrateRuns * 100; i++)
+    Counter.Add();
+  Bench.CounterNanos = (double)(BenchNanos() - Start) / (MetricCalibrateRuns * 100);
+  Start = BenchNanos();
+  for (int i = 0; i < MetricCalibrateRuns * 100; i++)
+    Histogram.Observe(i * 37);
+  Bench.HistogramNanos = (double)(BenchNanos() - Start) / (MetricCalibrateRuns * 100);
+}
+
+// nanoseconds for AlertEvaluate on a healthy sender with Count rules, the ones past the defaults are for other senders.
+// Leaves the alerts compiled from the bench rules
+double BenchAlerts(byte Count)
+{
+  static AlertRuleConfig Rules[AlertMaxRules];
+  NodeState *Node = NodeCount > 0 ? &Nodes[0] : NodeFind(1);
+  for (byte i = 0; i < Count; i++)
+  {
+    AlertRuleConfig Other = {"Bench", (int16_t)((Node->ID + i) & 0xFF), AlertVolts, AlertBelow, 3.5, 0.1, 300};
+    Rules[i] = i < AlertDefaultRuleCount ? AlertDefaultRules[i] : Other;
+  }
+  if (!AlertCompile(Rules, Count))
+    return 0;
+  Node->Water = 1;
+  Node->VoltageRaw = 400;
+  const int Runs = 1000000;
+  uint64_t Start = BenchNanos();
+  for (int i = 0; i < Runs; i++)
+    AlertEvaluate(*Node);
+  return (double)(BenchNanos() - Start) / Runs;
+}
+
+// a rule for one sender written before a rule for every sender is compiled after it, the notification for the every
+// sender rule must still have its own name and units
+bool AlertOrderCheck()
+{
+  static const AlertRuleConfig Rules[] = {
+      {"Node 7 battery low", 7, AlertVolts, AlertBelow, 3.5, 0, 0},
+      {"Weak signal", -1, AlertRSSI, AlertBelow, -120, 0, 0},
+  };
+  if (!AlertCompile(Rules, 2))
+    return false;
+  NodeState *Node = NodeFind(9);
+  Node->Water = 1;
+  Node->VoltageRaw = 400;
+  Node->RSSI = -130;
+  Display.Show = Console.Show = Notifier.Show = false;
+  AlertEvaluate(*Node);
+  while (AlertService())
+    ;
+  const char *Expected = "{\"alert\":\"Weak signal\",\"node\":9,\"active\":true,\"value\":-130,";
+  if (Notifier.Last.compare(0, strlen(Expected), Expected) == 0)
+    return true;
+  fprintf(stderr, "alert notified as %s, expected %s...\n", Notifier.Last.c_str(), Expected);
+  return false;
+}
+
+// -alert-bench, a packet should cost the same however many rules there are for other senders. Also checks the
+// notification names the rule that fired
+int AlertBench()
+{
+  if (!AlertOrderCheck())
+    return 1;
+  const byte Counts[] = {4, 16, AlertMaxRules};
+  double Nanos[3];
+  for (byte i = 0; i < 3; i++)
+    Nanos[i] = BenchAlerts(Counts[i]);
+  printf("{\"alert_rules\":[%u,%u,%u],\"alert_eval_ns\":[%.1f,%.1f,%.1f]}\n", Counts[0], Counts[1], Counts[2], Nanos[0], Nanos[1], Nanos[2]);
+  double Least = *std::min_element(Nanos, Nanos + 3);
+  double Most = *std::max_element(Nanos, Nanos + 3);
+  if (Least == 0 || Most > 2 * Least) // twice allows for noise, a scan of every rule would be about ten times
+  {
+    fprintf(stderr, "alert evaluation grows with the number of rules\n");
+    return 1;
+  }
+  return 0;
+}
+
+// stream /metrics the way the web server would
+void SimMetrics()
+{
+  MetricsStream Stream = MetricsStream();
+  Stream.Tables[0] = ReceiverMetrics;
+  Stream.TableSizes[0] = ReceiverMetricCount;
+  Stream.Tables[1] = LinkMetrics;
+  Stream.TableSizes[1] = LinkMetricCount;
+  Stream.Tables[2] = UplinkMetrics;
+  Stream.TableSizes[2] = Platform.Uplink == NULL ? 0 : UplinkMetricCount;
+  Stream.Tables[3] = PowerMetrics;
+  Stream.TableSizes[3] = PowerMetricCount;
+  Stream.Tables[4] = AlertMetrics;
+  Stream.TableSizes[4] = AlertMetricCount;
+  Stream.Tables[5] = ConfigMetrics;
+  Stream.TableSizes[5] = ConfigMetricCount;
+  Stream.Tables[6] = PatchMetrics;
+  Stream.TableSizes[6] = PatchMetricCount;
+  Stream.Table = 0; // the board's metrics need the board
+  uint8_t Chunk[64];
+  size_t Length;
+  while ((Length = MetricsFill(Stream, Chunk, sizeof(Chunk))) > 0)
+    fwrite(Chunk, 1, Length, stdout);
+}
+
+// -config-bench, how long the config takes to load at boot and a change to reach LoraProcessing. Also checks a change
+// only reaches the groups it touches, a bad one changes nothing and a damaged blob is caught
+int ConfigBench()
+{
+  const int Runs = 100000;
+  ConfigValues Defaults = SimConfigDefaults();
+  Console.Show = false;
+  ConfigBegin(Defaults); // nothing stored yet, saves the defaults
+  uint64_t Start = BenchNanos();
+  bool Good = true;
+  for (int i = 0; i < Runs; i++)
+    Good &= ConfigBegin(Defaults);
+  double Load = (double)(BenchNanos() - Start) / Runs;
+  const char *Preamble[] = {"lora_preamble"};
+  const char *Preambles[] = {"A1B", "A1A"};
+  char Error[96];
+  Start = BenchNanos();
+  for (int i = 0; i < Runs; i++)
+  {
+    Good &= ConfigUpdate(Preamble, &Preambles[i & 1], 1, Error, sizeof(Error)) == ConfigPacket;
+    SimConfigure();
+  }
+  double Apply = (double)(BenchNanos() - Start) / Runs;
+  const char *Names[] = {"ntp_server", "lora_band"};
+  const char *Bad[] = {"time.example.com", "12"};
+  const char *Same[] = {"time.example.com", "915000000"};
+  uint32_t Generation = ConfigGeneration;
+  Good &= ConfigUpdate(Names, Bad, 2, Error, sizeof(Error)) < 0 && ConfigGeneration == Generation;
+  Good &= ConfigUpdate(Names, Same, 2, Error, sizeof(Error)) == ConfigClock;
+  const char *Limit[] = {"lora_packet_limit"};
+  const char *Short[] = {"19"}; // one under the longest binary frame
+  Good &= ConfigUpdate(Limit, Short, 1, Error, sizeof(Error)) < 0 && ConfigGeneration == Generation + 1;
+  const char *Token[] = {"api_token"};
+  const char *Empty[] = {""};
+  Good &= ConfigUpdate(Token, Empty, 1, Error, sizeof(Error)) < 0 && ConfigGeneration == Generation + 1;
+  Good &= ConfigAuthorized("Bearer sim") && !ConfigAuthorized("Bearer six") && !ConfigAuthorized("sim");
+  Store.Blob[Store.Blob.size() / 2] ^= 1;
+  Good &= !ConfigBegin(Defaults);
+  printf("{\"config_load_ns\":%.0f,\"config_apply_ns\":%.0f,\"config_blob_bytes\":%u}\n", Load, Apply, (unsigned)sizeof(ConfigBlob));
+  if (!Good)
+    fprintf(stderr, "config checks failed\n");
+  return Good ? 0 : 1;
+}
+
+// a whole file, false after saying why not
+bool SimReadFile(const char *Name, std::vector<uint8_t> &Data)
+{
+  FILE *File = fopen(Name, "rb");
+  if (File == NULL)
+  {
+    perror(Name);
+    return false;
+  }
+  uint8_t Buffer[4096];
+  size_t Read;
+  while ((Read = fread(Buffer, 1, sizeof(Buffer), File)) > 0)
+    Data.insert(Data.end(), Buffer, Buffer + Read);
+  fclose(File);
+  return true;
+}
+
+// feed a pack to the decoder in pieces the size of a TCP segment, the way the web server hands them over
+bool UpdateApply(const std::vector<uint8_t> &Pack, size_t Length)
+{
+  const size_t Segment = 1436;
+  if (!PatchBegin())
+    return false;
+  for (size_t Offset = 0; Offset < Length; Offset += Segment)
+    PatchWrite(Pack.data() + Offset, std::min(Segment, Length - Offset));
+  return PatchEnd();
+}
+
+// -update, how long a pack takes to decode and whether it makes the image it should. A damaged pack has to be caught,
+// or make the same image if the damage happens not to matter, and a pack cut short must never be switched to
+int UpdateBench(const char *PackName, const char *BaseName, const char *OutName)
+{
+  std::vector<uint8_t> Pack;
+  if (!SimReadFile(PackName, Pack) || (BaseName != NULL && !SimReadFile(BaseName, Image.Base)))
+    return 1;
+  Console.Show = false;
+  uint64_t Start = BenchNanos();
+  bool Applied = UpdateApply(Pack, Pack.size());
+  double Millis = (BenchNanos() - Start) / 1e6;
+  char Json[256];
+  PatchJson(Json, sizeof(Json));
+  if (!Applied)
+  {
+    fprintf(stderr, "update failed: %s\n", Json);
+    return 1;
+  }
+  std::vector<uint8_t> Made = Image.Image;
+  if (OutName != NULL)
+  {
+    FILE *Out = fopen(OutName, "wb");
+    if (Out == NULL || fwrite(Made.data(), 1, Made.size(), Out) != Made.size())
+      perror(OutName);
+    if (Out != NULL)
+      fclose(Out);
+  }
+  bool Good = true;
+  std::vector<uint8_t> Damaged = Pack;
+  for (size_t Offset = sizeof(PatchHeader); Offset < Pack.size(); Offset += (Pack.size() - sizeof(PatchHeader)) / 7 + 1)
+  {
+    Damaged[Offset] ^= 0x5A;
+    Good &= !UpdateApply(Damaged, Damaged.size()) || Image.Image == Made;
+    Damaged[Offset] ^= 0x5A;
+  }
+  Good &= !UpdateApply(Pack, Pack.size() - 1) && !Image.Committed;
+  printf("{\"update_pack_bytes\":%u,\"update_image_bytes\":%u,\"update_ratio\":%.3f,\"update_apply_ms\":%.1f,\"update_mb_per_s\":%.1f}\n",
+         (unsigned)Pack.size(), (unsigned)Made.size(), (double)Pack.size() / Made.size(), Millis, Made.size() / Millis / 1000);
+  if (!Good)
+    fprintf(stderr, "update checks failed, a damaged or short pack got through\n");
+  return Good ? 0 : 1;
+}
+
+// what the two decoders made of a packet
+struct FuzzDecoded
+{
+  bool IsFrame;
+  NodeFrame Frame;
+  bool IsReading;
+  LoraReading Reading;
+};
+
+void FuzzDecode(const uint8_t *Packet, size_t Length, FuzzDecoded &Decoded)
+{
+  Decoded = FuzzDecoded();
+  Decoded.IsFrame = NodeFrameDecode(Packet, Length, Decoded.Frame);
+  Decoded.IsReading = LoraDecodePacket((const char *)Packet, Length, Decoded.Reading);
+}
+
+bool FuzzSame(const FuzzDecoded &A, const FuzzDecoded &B)
+{
+  if (A.IsFrame != B.IsFrame || A.IsReading != B.IsReading)
+    return false;
+  if (A.IsFrame && (A.Frame.NodeID != B.Frame.NodeID || A.Frame.Sequence != B.Frame.Sequence || A.Frame.FieldCount != B.Frame.FieldCount))
+    return false;
+  for (uint8_t i = 0; A.IsFrame && i < A.Frame.FieldCount; i++)
+    if (A.Frame.Fields[i].Type != B.Frame.Fields[i].Type || A.Frame.Fields[i].Value != B.Frame.Fields[i].Value)
+      return false;
+  const LoraReading &RA = A.Reading, &RB = B.Reading;
+  return !A.IsReading || (RA.NodeID == RB.NodeID && RA.HasSequence == RB.HasSequence && RA.Sequence == RB.Sequence && RA.Water == RB.Water &&
+                          RA.VoltageRaw == RB.VoltageRaw && RA.SpreadingFactor == RB.SpreadingFactor && RA.TXPower == RB.TXPower);
+}
+
+// one packet through both decoders, false if they read past its end or let through something they shouldn't. The packet
+// is decoded from a heap block of exactly its size, which a -fsanitize=address build catches a read past, then again
+// followed by zeros and by digits, which only change the result if something past the end was read
+bool FuzzCheck(const std::vector<uint8_t> &Packet, FuzzDecoded &Decoded)
+{
+  std::vector<uint8_t> Exact(Packet);
+  FuzzDecode(Exact.data(), Exact.size(), Decoded);
+  const uint8_t Tails[] = {0x00, '9'};
+  for (uint8_t Tail : Tails)
+  {
+    std::vector<uint8_t> Padded(Packet);
+    Padded.resize(Packet.size() + NodeFrameMaxSize, Tail);
+    FuzzDecoded Again;
+    FuzzDecode(Padded.data(), Packet.size(), Again);
+    if (!FuzzSame(Decoded, Again))
+      return false;
+  }
+  if (Decoded.IsFrame) // anything accepted has to encode back to the same bytes
+  {
+    uint8_t Encoded[NodeFrameMaxSize];
+    size_t Length = NodeFrameEncode(Decoded.Frame, Encoded, sizeof(Encoded));
+    if (Length != Packet.size() || memcmp(Encoded, Packet.data(), Length) != 0)
+      return false;
+  }
+  const LoraReading &Reading = Decoded.Reading;
+  if (Decoded.IsReading && (Reading.VoltageRaw < INT16_MIN || Reading.VoltageRaw > INT16_MAX)) // has to fit NodeState
+    return false;
+  return !Decoded.IsReading || Reading.HasSequence || (Reading.Water >= -1 && Reading.Water <= 9);
+}
+
+// -fuzz n, n good packets alternately binary and text are decoded, then damaged a few bytes at a time and decoded again.
+// Prints one line of JSON with how long a decode takes and exits with 1 if a good packet didn't decode to what was sent
+// or a damaged one was read past its end or got through wrongly
+int FuzzBench(int Runs, unsigned Seed)
+{
+  std::mt19937 Random(Seed);
+  uint32_t Accepted = 0;
+  uint32_t Failures = 0;
+  std::vector<uint8_t> Packet;
+  FuzzDecoded Decoded;
+  for (int Run = 0; Run < Runs; Run++)
+  {
+    NodeFrame Frame = NodeFrame();
+    int Water = Random() % 10;
+    int Volts = (int)(Random() % 65535) - INT16_MAX;
+    if (Run & 1)
+    {
+      Frame.NodeID = Random();
+      Frame.Sequence = Random();
+      Frame.FieldCount = Random() % (NodeFrameMaxFields + 1);
+      for (uint8_t i = 0; i < Frame.FieldCount; i++)
+        Frame.Fields[i] = {(uint8_t)(1 + Random() % 6), (int16_t)Random()}; // 5 and 6 are types this receiver doesn't know
+      Packet.resize(NodeFrameMaxSize);
+      Packet.resize(NodeFrameEncode(Frame, Packet.data(), Packet.size()));
+    }
+    else
+    {
+      char Text[LoraMaxPacketSize + 1];
+      int Length = snprintf(Text, sizeof(Text), "%s%d%d", LoraPacketPreAmble, Water, Volts);
+      Packet.assign(Text, Text + Length);
+    }
+    bool Good = FuzzCheck(Packet, Decoded) && Decoded.IsReading;
+    if (Run & 1)
+      Good &= Decoded.Reading.NodeID == Frame.NodeID && Decoded.Reading.Sequence == Frame.Sequence;
+    else
+      Good &= Decoded.Reading.Water == Water && Decoded.Reading.VoltageRaw == Volts;
+    int Changes = 1 + Random() % 3;
+    for (int i = 0; i < Changes; i++)
+    {
+      switch (Random() % 4)
+      {
+      case 0:
+        if (!Packet.empty())
+          Packet[Random() % Packet.size()] ^= 1 << (Random() % 8);
+        break;
+      case 1:
+        if (!Packet.empty())
+          Packet[Random() % Packet.size()] = Random();
+        break;
+      case 2:
+        Packet.resize(Random() % (Packet.size() + 1)); // cut short
+        break;
+      default:
+        Packet.push_back(Random() & 1 ? '0' + Random() % 10 : Random()); // often another digit, to push the voltage past int16
+        break;
+      }
+    }
+    if (Packet.size() > LoraMaxPacketSize) // the most LoraReceive keeps
+      Packet.resize(LoraMaxPacketSize);
+    Good &= FuzzCheck(Packet, Decoded);
+    Accepted += Decoded.IsReading;
+    if (!Good && Failures++ == 0)
+    {
+      fprintf(stderr, "fuzz: run %d, damaged packet", Run);
+      for (uint8_t Byte : Packet)
+        fprintf(stderr, " %02x", Byte);
+      fprintf(stderr, "\n");
+    }
+  }
+
+  const int BenchRuns = 1000000;
+  NodeFrame Frame = {7, 1234, 4, {{NodeFieldWater, 1}, {NodeFieldVolts, 412}, {NodeFieldTemperature, 215}, {NodeFieldLink, 0x0A0E}}};
+  uint8_t Binary[NodeFrameMaxSize];
+  size_t BinaryLength = NodeFrameEncode(Frame, Binary, sizeof(Binary));
+  const char Text[] = "A1A1370";
+  LoraReading Reading;
+  uint32_t Decodes = 0;
+  uint64_t Start = BenchNanos();
+  for (int i = 0; i < BenchRuns; i++)
+    Decodes += LoraDecodePacket((const char *)Binary, BinaryLength, Reading);
+  double BinaryNanos = (double)(BenchNanos() - Start) / BenchRuns;
+  Start = BenchNanos();
+  for (int i = 0; i < BenchRuns; i++)
+    Decodes += LoraDecodePacket(Text, sizeof(Text) - 1, Reading);
+  double TextNanos = (double)(BenchNanos() - Start) / BenchRuns;
+  if (Decodes != 2 * BenchRuns)
+    Failures++;
+  printf("{\"fuzz_runs\":%d,\"fuzz_accepted\":%u,\"fuzz_failures\":%u,\"decode_binary_ns\":%.1f,\"decode_text_ns\":%.1f}\n", Runs,
+         Accepted, Failures, BinaryNanos, TextNanos);
+  if (Failures > 0)
+    fprintf(stderr, "fuzz: %u packets decoded wrongly\n", Failures);
+  return Failures > 0 ? 1 : 0;
+}
+
+// the board's own page variables, fixed text about as long as the board's
+byte TemplateRows(TemplateSlot Slot)
+{
+  return Slot == SlotTasks ? 7 : 1; // the board's tasks
+}
+
+int TemplateValue(const PageStream &Page, TemplateSlot Slot, byte Row, char *Text, size_t Size)
+{
+  switch (Slot)
+  {
+  case SlotLocalIP:
+  case SlotLocalGateway:
+  case SlotLocalDNS:
+    return snprintf(Text, Size, "192.168.0.1");
+  case SlotLocalSubNet:
+    return snprintf(Text, Size, "255.255.255.0");
+  case SlotLocalMac:
+    return snprintf(Text, Size, "24:0A:C4:00:00:00");
+  case SlotTasks:
+    return snprintf(Text, Size, "<tr><td>LoraTask</td><td>1</td><td>3</td><td>0.4%%</td><td>2,048B of 4096</td></tr>");
+  default:
+    return snprintf(Text, Size, "%s", TemplateSlotNames[Slot]);
+  }
+}
+
+// the page path before the templates were compiled, modelled on AsyncWebServer's template processor: each chunk is read
+// from the html file and every %Variable% is looked up by name and comes back as a String, which lives on the heap.
+// A value that doesn't fit the chunk waits in a cache. Reading the file costs far less here than from SPIFFS on the board
+struct OldPageStream
+{
+  const char *Path = NULL;
+  size_t Offset = 0; // next byte of the file
+  std::vector<uint8_t> Cache;
+};
+PageStream OldPageValues; // the old processor read globals, this stands in for them
+
+// the old processor, a name compared against each variable in turn and the value returned as a String
+std::vector<char> OldPageValue(const char *Name)
+{
+  std::vector<char> Value;
+  for (byte Slot = 0; Slot < SlotNone; Slot++)
+  {
+    if (strcmp(Name, TemplateSlotNames[Slot]) != 0)
+      continue;
+    char Text[WebCarrySize];
+    for (byte Row = 0; Row < PageRows((TemplateSlot)Slot); Row++) // tables were built up one row at a time
+    {
+      int Length = std::max(0, std::min(PageValue(OldPageValues, (TemplateSlot)Slot, Row, Text, sizeof(Text)), WebCarrySize - 1));
+      Value.insert(Value.end(), Text, Text + Length);
+    }
+    break;
+  }
+  return Value;
+}
+
+size_t OldPageFill(OldPageStream &Page, uint8_t *Buffer, size_t MaxLength)
+{
+  size_t Used = std::min(Page.Cache.size(), MaxLength);
+  memcpy(Buffer, Page.Cache.data(), Used);
+  Page.Cache.erase(Page.Cache.begin(), Page.Cache.begin() + Used);
+  while (Used < MaxLength && Page.Cache.empty())
+  {
+    size_t Read = FileSystem.Read(Page.Path, Page.Offset, Buffer + Used, MaxLength - Used);
+    if (Read == 0)
+      break;
+    uint8_t *Percent = (uint8_t *)memchr(Buffer + Used, '%', Read);
+    if (Percent == NULL)
+    {
+      Used += Read;
+      Page.Offset += Read;
+      continue;
+    }
+    size_t Before = Percent - (Buffer + Used); // text up to the %, the rest is read again after the variable
+    Used += Before;
+    Page.Offset += Before;
+    char Name[33]; // TEMPLATE_PARAM_NAME_LENGTH
+    size_t NameLength = FileSystem.Read(Page.Path, Page.Offset + 1, Name, sizeof(Name) - 1);
+    Name[NameLength] = '\0';
+    size_t End = strspn(Name, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_");
+    if (End == 0 || End == NameLength || Name[End] != '%') // not a variable, the % is sent as it is
+    {
+      Buffer[Used++] = '%';
+      Page.Offset++;
+      continue;
+    }
+    Name[End] = '\0';
+    Page.Offset += End + 2;
+    std::vector<char> Value = OldPageValue(Name);
+    size_t Fits = std::min(Value.size(), MaxLength - Used);
+    memcpy(Buffer + Used, Value.data(), Fits);
+    Used += Fits;
+    Page.Cache.insert(Page.Cache.end(), Value.begin() + Fits, Value.end());
+  }
+  return Used;
+}
+
+// the pages, their html is put in the simulated SPIFFS for the old path
+const byte PageBenchPages = 4;
+const char *const PageBenchNames[PageBenchPages] = {"index", "network", "system", "restart"};
+const TemplatePart *const PageBenchParts[PageBenchPages] = {TemplateIndex, TemplateNetwork, TemplateSystem, TemplateRestart};
+const byte PageBenchPartCounts[PageBenchPages] = {TemplateIndexParts, TemplateNetworkParts, TemplateSystemParts, TemplateRestartParts};
+char PageBenchPaths[PageBenchPages][16];
+
+void PageBenchBegin(PageStream &Page, byte Which)
+{
+  PageBegin(Page, PageBenchParts[Which], PageBenchPartCounts[Which]);
+}
+
+void OldPageBenchBegin(OldPageStream &Page, byte Which)
+{
+  Page.Path = PageBenchPaths[Which];
+}
+
+// Loads page loads through either path with Clients going at once, taking turns a chunk at a time the way the web
+// server serves them. Each starts with a new stream and each chunk buffer is allocated, as the web server does. The
+// pages are appended to Sent unless it is NULL
+template <class Stream>
+void PageLoads(void (*Begin)(Stream &, byte), size_t (*Fill)(Stream &, uint8_t *, size_t), size_t Clients, size_t Loads,
+               std::string *Sent)
+{
+  const size_t Segment = 1436;
+  std::vector<Stream *> Open(Clients, NULL);
+  size_t Started = 0;
+  size_t Running;
+  do
+  {
+    Running = 0;
+    for (Stream *&Load : Open)
+    {
+      if (Load == NULL && Started < Loads)
+      {
+        Load = new Stream();
+        Begin(*Load, Started++ % PageBenchPages);
+      }
+      if (Load == NULL)
+        continue;
+      Running++;
+      uint8_t *Chunk = new uint8_t[Segment];
+      size_t Length = Fill(*Load, Chunk, Segment);
+      if (Sent != NULL)
+        Sent->append((const char *)Chunk, Length);
+      delete[] Chunk;
+      if (Length == 0)
+      {
+        delete Load;
+        Load = NULL;
+      }
+    }
+  } while (Running > 0);
+}
+
+// -page-bench, after the trace has been replayed the pages are loaded through the compiled templates and through a model
+// of the old SPIFFS and template processor path. Prints one line of JSON with the requests per second and the most
+// heap in use with -pages n loads at once, and exits with 1 if the two paths don't send the same pages
+int PageBench(const char *DataDir)
+{
+  for (byte i = 0; i < PageBenchPages; i++)
+  {
+    char Name[256];
+    snprintf(Name, sizeof(Name), "%s/%s.html", DataDir, PageBenchNames[i]);
+    snprintf(PageBenchPaths[i], sizeof(PageBenchPaths[i]), "/%s.html", PageBenchNames[i]);
+    if (!SimReadFile(Name, FileSystem.Files[PageBenchPaths[i]]))
+      return 1;
+  }
+  PageBegin(OldPageValues, NULL, 0);
+  std::string Sent;
+  std::string OldSent;
+  PageLoads(PageBenchBegin, PageFill, 1, PageBenchPages, &Sent);
+  PageLoads(OldPageBenchBegin, OldPageFill, 1, PageBenchPages, &OldSent);
+  size_t Clients = std::max((size_t)1, Network.OpenPages);
+  const size_t Loads = 20000;
+  double Nanos[2];
+  size_t Heap[2];
+  for (byte Path = 0; Path < 2; Path++)
+  {
+    size_t HeapBefore = HeapInUse;
+    HeapPeak = HeapInUse.load();
+    uint64_t Start = BenchNanos();
+    if (Path == 0)
+      PageLoads(PageBenchBegin, PageFill, Clients, Loads, NULL);
+    else
+      PageLoads(OldPageBenchBegin, OldPageFill, Clients, Loads, NULL);
+    Nanos[Path] = BenchNanos() - Start;
+    Heap[Path] = HeapPeak - HeapBefore;
+  }
+  printf("{\"page_clients\":%u,\"page_bytes\":%u,\"page_requests_per_second\":%.0f,\"page_heap_peak_bytes\":%u,"
+         "\"page_old_requests_per_second\":%.0f,\"page_old_heap_peak_bytes\":%u}\n",
+         (unsigned)Clients, (unsigned)(Sent.size() / PageBenchPages), Loads * 1e9 / Nanos[0], (unsigned)Heap[0], Loads * 1e9 / Nanos[1], (unsigned)Heap[1]);
+  if (Sent != OldSent)
+    fprintf(stderr, "page bench: the compiled pages differ from the old path's\n");
+  return Sent == OldSent ? 0 : 1;
+}
+
+// the decode before LoraDecodePacket, modelled on what LoraProcessing did with Strings: the packet was built up a
+// character at a time, checked for the preamble and cut into the water level and voltage, which toFloat read. A String
+// here is a vector holding its terminator, grown by exactly what is added as String does, so each character is a new block
+bool OldDecode(const uint8_t *Packet, size_t Length, float &Volts)
+{
+  std::vector<char> Text(1, '\0'); // LoraPacket = ""
+  for (size_t i = 0; i < Length; i++)
+  {
+    Text.reserve(Text.size() + 1);
+    Text.insert(Text.end() - 1, (char)Packet[i]);
+  }
+  size_t Preamble = strlen(LoraPacketPreAmble);
+  if (Length > LoraMaxPacketSize || strncmp(Text.data(), LoraPacketPreAmble, Preamble) != 0)
+    return false;
+  std::vector<char> Water(Text.begin() + std::min(Preamble, Length), Text.begin() + std::min(Preamble + 1, Length)); // substring(3, 4)
+  Water.push_back('\0');
+  std::vector<char> Voltage(Text.begin() + std::min(Preamble + 1, Length), Text.end()); // substring(4)
+  Volts = atof(Voltage.data()) / 100.0;
+  return true;
+}
+
+// text packets with what LoraDecodePacket must make of them, after the default preamble
+struct DecodeCase
+{
+  const char *Packet;
+  bool Good;
+  int Water;
+  long VoltageRaw;
+};
+const DecodeCase DecodeCases[] = {
+    {"1370", true, 1, 370},
+    {"0412", true, 0, 412},
+    {"1-5", true, 1, -5},          // a sign
+    {"1+412", true, 1, 412},
+    {"132767", true, 1, 32767},    // the most NodeState keeps
+    {"132768", false, 0, 0},       // past int16, a garbled packet
+    {"1999999999999", false, 0, 0}, // past long too
+    {"13.7", true, 1, 3},          // a '.' ends the number, String.toFloat() read 3.7
+    {"1", true, 1, 0},             // no voltage
+    {"x370", true, -1, 370},       // the water level isn't a digit
+    {"", false, 0, 0},             // only the preamble
+};
+const byte DecodeCaseCount = sizeof(DecodeCases) / sizeof(DecodeCases[0]);
+
+// -decode-bench, after the trace has been replayed its packets are decoded by LoraDecodePacket and by a model of the old
+// String path. Prints one line of JSON with the nanoseconds and heap allocations per packet for each and exits with 1 if
+// a text case doesn't decode as it should or the two paths read a different voltage from a packet both accept
+int DecodeBench(const std::vector<TraceEvent> &Events)
+{
+  LoraConfigure(LoraPacketPreAmble, LoraMaxPacketSize); // the cases and the old path are for the default preamble
+  uint32_t Failures = 0;
+  std::vector<std::vector<uint8_t>> Packets;
+  for (const TraceEvent &Event : Events)
+    if (strcmp(Event.Type, "rx") == 0 || strcmp(Event.Type, "text") == 0)
+      Packets.push_back(Event.Packet);
+  bool Timed = !Packets.empty(); // the good cases are timed if the trace had no packets
+  LoraReading Reading;
+  for (byte i = 0; i < DecodeCaseCount; i++)
+  {
+    const DecodeCase &Case = DecodeCases[i];
+    char Packet[LoraMaxPacketSize + 1];
+    int Length = snprintf(Packet, sizeof(Packet), "%s%s", LoraPacketPreAmble, Case.Packet);
+    bool Good = LoraDecodePacket(Packet, Length, Reading);
+    if (Good != Case.Good || (Good && (Reading.Water != Case.Water || Reading.VoltageRaw != Case.VoltageRaw || Reading.HasSequence ||
+                                       Reading.NodeID != NodeLegacyID)))
+    {
+      fprintf(stderr, "decode bench: \"%s\" decoded as %s, water %d voltage %ld\n", Packet, Good ? "good" : "bad", Good ? Reading.Water : 0,
+              Good ? Reading.VoltageRaw : 0);
+      Failures++;
+    }
+    if (Case.Good && !Timed)
+      Packets.push_back(std::vector<uint8_t>(Packet, Packet + Length));
+  }
+  for (const std::vector<uint8_t> &Packet : Packets) // whole hundredths, where the two should agree
+  {
+    float Volts;
+    if (LoraDecodePacket((const char *)Packet.data(), Packet.size(), Reading) && !Reading.HasSequence &&
+        memchr(Packet.data(), '.', Packet.size()) == NULL && (!OldDecode(Packet.data(), Packet.size(), Volts) || std::fabs(Volts - Reading.Volts) > 0.001))
+    {
+      fprintf(stderr, "decode bench: \"%.*s\" read as %.2fV, the old path read it differently\n", (int)Packet.size(), Packet.data(), Reading.Volts);
+      Failures++;
+    }
+  }
+  size_t Runs = std::max((size_t)1, 1000000 / Packets.size());
+  double Nanos[2];
+  double Allocations[2];
+  for (byte Path = 0; Path < 2; Path++)
+  {
+    uint32_t AllocationsBefore = PipelineAllocations;
+    InPipeline = true;
+    uint64_t Start = BenchNanos();
+    for (size_t Run = 0; Run < Runs; Run++)
+      for (const std::vector<uint8_t> &Packet : Packets)
+      {
+        float Volts;
+        if (Path == 0)
+          LoraDecodePacket((const char *)Packet.data(), Packet.size(), Reading);
+        else
+          OldDecode(Packet.data(), Packet.size(), Volts);
+      }
+    Nanos[Path] = (double)(BenchNanos() - Start) / (Runs * Packets.size());
+    InPipeline = false;
+    Allocations[Path] = (double)(PipelineAllocations - AllocationsBefore) / (Runs * Packets.size());
+  }
+  printf("{\"decode_packets\":%u,\"decode_cases\":%u,\"decode_failures\":%u,\"decode_packet_ns\":%.1f,\"decode_packet_allocations\":%.2f,"
+         "\"decode_old_packet_ns\":%.1f,\"decode_old_packet_allocations\":%.2f}\n",
+         (unsigned)Packets.size(), DecodeCaseCount, Failures, Nanos[0], Allocations[0], Nanos[1], Allocations[1]);
+  return Failures > 0 ? 1 : 0;
+}
+
+// reads the last packet as fast as it can until Stop is set, like a web page on the other core
+struct TearCheck
+{
+  std::atomic<bool> Stop;
+  uint32_t Reads;
+  uint32_t Backwards; // copies older than the one before, should never happen either
+};
+
+void TearCheckRun(TearCheck &Check)
+{
+  LoraLatest Latest;
+  uint32_t LastPublished = 0;
+  while (!Check.Stop.load(std::memory_order_relaxed))
+  {
+    LatestRead(Latest);
+    if (Latest.Published < LastPublished)
+      Check.Backwards++;
+    LastPublished = Latest.Published;
+    Check.Reads++;
+  }
+}
+
+// nanoseconds at a percentile of the sorted processing times
+uint32_t BenchPercentile(const std::vector<uint32_t> &Sorted, unsigned Percent)
+{
+  if (Sorted.empty())
+    return 0;
+  return Sorted[std::min(Sorted.size() - 1, Sorted.size() * Percent / 100)];
+}
+
+// one line of JSON so results can be kept and compared across commits
+void BenchReport(const char *TraceName, const char *Label, const char *JsonName)
+{
+  std::vector<uint32_t> Sorted = Bench.Processing;
+  std::sort(Sorted.begin(), Sorted.end());
+  uint64_t Busy = 0;
+  for (uint32_t Nanos : Sorted)
+    Busy += Nanos;
+  const SimFlash &Flash = FileSystem.Flash;
+  uint32_t Readings = std::max(1u, MetricPacketsGood.Read());
+  char Json[1280];
+  snprintf(Json, sizeof(Json),
+           "{\"label\":\"%s\",\"trace\":\"%s\",\"received\":%u,\"processed\":%u,\"dropped\":%u,\"senders\":%u,\"table_full\":%u,"
+           "\"packets_per_second\":%.0f,\"p50_ns\":%u,\"p99_ns\":%u,\"max_ns\":%u,\"receive_max_ns\":%llu,"
+           "\"history_flush_ns\":%llu,\"history_bytes\":%u,\"history_dropped\":%u,\"events\":%u,"
+           "\"heap_peak_bytes\":%u,\"pipeline_allocations\":%u,\"metric_counter_ns\":%.2f,\"metric_histogram_ns\":%.2f,"
+           "\"uplink_sent\":%u,\"uplink_failures\":%u,\"uplink_readings_per_second\":%.0f,\"uplink_drain_ms\":%lu,"
+           "\"warm_save_ns\":%llu,\"warm_restore_ns\":%llu,\"alert_eval_ns\":%.1f,\"flash_bytes_per_reading\":%.1f,"
+           "\"flash_write_amplification\":%.2f,\"flash_erases\":%u,\"flash_block_erases_max\":%u,\"total_ns\":%llu}",
+           Label, TraceName, LoraFramesReceived.load(), (unsigned)Sorted.size(), LoraFramesDropped.load(), NodeCount, NodeTableFull,
+           Busy == 0 ? 0.0 : Sorted.size() * 1e9 / Busy, BenchPercentile(Sorted, 50), BenchPercentile(Sorted, 99),
+           Sorted.empty() ? 0 : Sorted.back(), (unsigned long long)Bench.ReceiveMax,
+           (unsigned long long)Bench.FlushTotal, HistoryBytesWritten, HistoryDropped, Network.Published,
+           (unsigned)Bench.HeapPeak, PipelineAllocations, Bench.CounterNanos, Bench.HistogramNanos,
+           MetricUplinkSent.Read(), MetricUplinkFailures.Read(), Bench.UplinkTotal == 0 ? 0.0 : MetricUplinkSent.Read() * 1e9 / Bench.UplinkTotal,
+           Bench.UplinkDrainMax, (unsigned long long)(Sorted.empty() ? 0 : Bench.WarmSaveTotal / Sorted.size()),
+           (unsigned long long)Bench.WarmRestore, Bench.AlertNanos, (double)Flash.BytesProgrammed / Readings,
+           FileSystem.BytesWritten == 0 ? 0.0 : (double)Flash.BytesProgrammed / FileSystem.BytesWritten, Flash.Erases,
+           *std::max_element(Flash.BlockErases.begin(), Flash.BlockErases.end()), (unsigned long long)Bench.Total);
+  printf("%s\n", Json);
+  if (JsonName == NULL)
+    return;
+  FILE *Results = fopen(JsonName, "a");
+  if (Results == NULL)
+  {
+    perror(JsonName);
+    return;
+  }
+  fprintf(Results, "%s\n", Json);
+  fclose(Results);
+}
+
+// -clients, one line of JSON. Exits with 1 if an event was lost
+int SimClientsReport()
+{
+  size_t Count = std::min(Clients.Queued.size(), Clients.Delivered.size());
+  std::vector<uint32_t> Latency(Count);
+  for (size_t i = 0; i < Count; i++)
+    Latency[i] = Clients.Delivered[i] - Clients.Queued[i];
+  std::sort(Latency.begin(), Latency.end());
+  printf("{\"clients\":%u,\"events\":%u,\"events_dropped\":%u,\"event_p50_ns\":%u,\"event_p99_ns\":%u,\"event_max_ns\":%u,"
+         "\"event_heap_bytes\":%u,\"heap_peak_bytes\":%u,\"pipeline_allocations\":%u}\n",
+         (unsigned)Network.Clients, Network.Published, MetricEventsDropped.Read(), BenchPercentile(Latency, 50),
+         BenchPercentile(Latency, 99), Latency.empty() ? 0 : Latency.back(), (unsigned)Clients.HeapMost, (unsigned)Bench.HeapPeak, PipelineAllocations);
+  bool Lost = Clients.Queued.size() != Clients.Delivered.size() || Network.Published != MetricEventsQueued.Read() ||
+              MetricEventsDropped.Read() > 0;
+  if (Lost)
+    fprintf(stderr, "clients: %u events queued, %u sent\n", MetricEventsQueued.Read(), Network.Published);
+  return Lost ? 1 : 0;
+}
+
+// read a whole trace, false after printing what is wrong with it
+bool TraceLoad(const char *TraceName, std::vector<TraceEvent> &Events)
+{
+  FILE *Trace = fopen(TraceName, "r");
+  if (Trace == NULL)
+  {
+    perror(TraceName);
+    return false;
+  }
+  TraceEvent Event;
+  unsigned long Line = 0;
+  while (TraceRead(Trace, Event, Line))
+  {
+    if (!Events.empty() && Event.Millis < Events.back().Millis)
+    {
+      fprintf(stderr, "%s:%lu: time goes backwards\n", TraceName, Line);
+      return false;
+    }
+    Events.push_back(Event);
+  }
+  bool AtEnd = feof(Trace);
+  if (!AtEnd)
+    fprintf(stderr, "%s:%lu: can't read this line\n", TraceName, Line);
+  fclose(Trace);
+  return AtEnd;
+}
+
+int main(int argc, char **argv)
+{
+  const char *TraceName = NULL;
+  const char *JsonName = NULL;
+  const char *Label = "";
+  int Repeat = 1;
+  bool Tear = false;
+  unsigned Senders = 0;
+  unsigned long ChannelHours = 24;
+  unsigned Seed = 1;
+  long RestartAt = -1;
+  bool AlertsOnly = false;
+  bool ConfigOnly = false;
+  const char *UpdateName = NULL;
+  const char *UpdateBase = NULL;
+  const char *UpdateOut = NULL;
+  int FuzzRuns = 0;
+  bool Pages = false;
+  bool Decodes = false;
+  Channel.Fading = 4;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-q") == 0)
+      Display.Show = Network.Show = Console.Show = Uplink.Show = Notifier.Show = false;
+    else if (strcmp(argv[i], "-bench") == 0)
+      Bench.Enabled = true;
+    else if (strcmp(argv[i], "-pages") == 0 && i + 1 < argc)
+      Network.OpenPages = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-repeat") == 0 && i + 1 < argc)
+      Repeat = std::max(1, atoi(argv[++i]));
+    else if (strcmp(argv[i], "-json") == 0 && i + 1 < argc)
+      JsonName = argv[++i];
+    else if (strcmp(argv[i], "-label") == 0 && i + 1 < argc)
+      Label = argv[++i];
+    else if (strcmp(argv[i], "-uplink") == 0)
+      Platform.Uplink = &Uplink;
+    else if (strcmp(argv[i], "-uplink-url") == 0 && i + 1 < argc)
+    {
+      Platform.Uplink = &Uplink;
+      Uplink.URL = argv[++i];
+    }
+    else if (strcmp(argv[i], "-uplink-fail") == 0 && i + 1 < argc)
+      Uplink.FailPercent = std::min(100, atoi(argv[++i]));
+    else if (strcmp(argv[i], "-uplink-ms") == 0 && i + 1 < argc)
+      Uplink.RequestMillis = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-restart") == 0 && i + 1 < argc)
+      RestartAt = atol(argv[++i]);
+    else if (strcmp(argv[i], "-tear-check") == 0)
+      Tear = true;
+    else if (strcmp(argv[i], "-alert-bench") == 0)
+      AlertsOnly = true;
+    else if (strcmp(argv[i], "-config-bench") == 0)
+      ConfigOnly = true;
+    else if (strcmp(argv[i], "-clients") == 0 && i + 1 < argc)
+      Network.Clients = std::max(1, atoi(argv[++i]));
+    else if (strcmp(argv[i], "-page-bench") == 0)
+      Pages = true;
+    else if (strcmp(argv[i], "-decode-bench") == 0)
+      Decodes = true;
+    else if (strcmp(argv[i], "-fuzz") == 0 && i + 1 < argc)
+      FuzzRuns = std::max(1, atoi(argv[++i]));
+    else if (strcmp(argv[i], "-update") == 0 && i + 1 < argc)
+      UpdateName = argv[++i];
+    else if (strcmp(argv[i], "-update-base") == 0 && i + 1 < argc)
+      UpdateBase = argv[++i];
+    else if (strcmp(argv[i], "-update-out") == 0 && i + 1 < argc)
+      UpdateOut = argv[++i];
+    else if (strcmp(argv[i], "-channel") == 0 && i + 1 < argc)
+      Senders = std::max(1, atoi(argv[++i]));
+    else if (strcmp(argv[i], "-channel-fixed") == 0)
+      Channel.Fixed = true;
+    else if (strcmp(argv[i], "-channel-hours") == 0 && i + 1 < argc)
+      ChannelHours = std::max(1, atoi(argv[++i]));
+    else if (strcmp(argv[i], "-channel-fading") == 0 && i + 1 < argc)
+      Channel.Fading = atof(argv[++i]);
+    else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc)
+      Seed = atoi(argv[++i]);
+    else
+      TraceName = argv[i];
+  }
+  Notifier.Clock = &Clock;
+  Notifier.Name = "alert";
+  Notifier.RequestMillis = 0;
+  if (AlertsOnly)
+    return AlertBench();
+  if (ConfigOnly)
+    return ConfigBench();
+  if (UpdateName != NULL)
+    return UpdateBench(UpdateName, UpdateBase, UpdateOut);
+  if (FuzzRuns > 0)
+    return FuzzBench(FuzzRuns, Seed);
+  if ((TraceName == NULL) == (Senders == 0))
+  {
+    fprintf(stderr, "usage: %s [-q] [-pages n] [-bench] [-repeat n] [-json file] [-label text]\n"
+                    "       [-uplink] [-uplink-url url] [-uplink-fail n] [-uplink-ms n] [-restart ms] [-tear-check] [-page-bench] [-decode-bench]\n"
+                    "       [-clients n] trace.txt\n"
+                    "   or: %s [options] -channel n [-channel-fixed] [-channel-hours n] [-channel-fading dB] [-seed n]\n"
+                    "   or: %s -alert-bench\n"
+                    "   or: %s -config-bench\n"
+                    "   or: %s -update pack [-update-base file] [-update-out file]\n"
+                    "   or: %s -fuzz n [-seed n]\n", argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+    return 2;
+  }
+  if (Bench.Enabled || Pages || Decodes || Network.Clients > 0)
+    Display.Show = Network.Show = Console.Show = Uplink.Show = Notifier.Show = false;
+  Uplink.Clock = &Clock;
+
+  // read the whole trace first so file reading isn't timed
+  std::vector<TraceEvent> Events;
+  if (TraceName != NULL && !TraceLoad(TraceName, Events))
+    return 1;
+  if (Bench.Enabled)
+    Bench.Processing.reserve(Events.size() * Repeat);
+
+  SimConfigLoad();
+  HistoryBegin();
+  UplinkBegin();
+  AlertCompile(AlertDefaultRules, AlertDefaultRuleCount);
+  PowerBegin(PowerCPUIdle, PowerLoraReceive, Network.Up ? PowerWiFiModemSleep : PowerWiFiOff);
+  Channel.Random.seed(Seed);
+  ChannelBegin(Senders);
+  unsigned long Offset = 0; // start of this replay on the fake clock
+  Network.Deliver = SimClientsDeliver;
+  if (Network.Clients > 0)
+  {
+    size_t Room = 2 * Events.size() * Repeat + 1024; // alerts add to the packets' events. Reallocating would show up
+    Clients.Queued.reserve(Room);                      // as latency and heap
+    Clients.Delivered.reserve(Room);
+    Clients.Thread = std::thread(SimClientsRun);
+  }
+  uint64_t ReplayStart = BenchNanos();
+  size_t HeapBefore = HeapInUse;
+  HeapPeak = HeapInUse.load();
+  static TearCheck Check; // zeroed
+  std::thread Reader;
+  if (Tear)
+    Reader = std::thread(TearCheckRun, std::ref(Check));
+  for (int Pass = 0; Pass < Repeat; Pass++)
+  {
+    for (const TraceEvent &Event : Events)
+    {
+      if (Pass == 0 && RestartAt >= 0 && Event.Millis >= (unsigned long)RestartAt)
+      {
+        RestartAt = -1;
+        if (!SimRestart(Event.Millis))
+        {
+          fprintf(stderr, "restart: the sender table didn't come back the same\n");
+          return 1;
+        }
+      }
+      SimEvent(Event, (Offset + Event.Millis) * 1000);
+    }
+    if (Senders != 0)
+      ChannelRun(Clock.Millis() + ChannelHours * 3600000);
+    Offset = Clock.Millis() + 1000;
+  }
+  SimDrain();
+  if (Tear)
+  {
+    Check.Stop = true;
+    Reader.join();
+  }
+  HistoryFlush();
+  if (Platform.Uplink != NULL && Network.Up) // give the uplink up to an hour to send what is left
+    SimAdvance(Clock.Now + 3600000000UL);
+  if (Network.Clients > 0)
+  {
+    Clients.Stop = true;
+    Clients.Thread.join();
+  }
+  Bench.Total = BenchNanos() - ReplayStart;
+  Bench.HeapPeak = HeapPeak - HeapBefore;
+
+  if (Tear)
+    fprintf(stderr, "tear check: %u reads, %u retried, %u torn, %u out of order\n", Check.Reads, MetricSnapshotRetries.Read(),
+            MetricSnapshotTorn.Read(), Check.Backwards);
+  if (Tear && MetricSnapshotTorn.Read() + Check.Backwards > 0)
+    return 1;
+  if (Pages)
+    return PageBench("data");
+  if (Decodes)
+    return DecodeBench(Events);
+  if (Network.Clients > 0)
+    return SimClientsReport();
+  if (Bench.Enabled)
+  {
+    uint64_t Start = BenchNanos();
+    if (!WarmRestore(SimWarm))
+    {
+      fprintf(stderr, "warm state didn't restore\n");
+      return 1;
+    }
+    Bench.WarmRestore = BenchNanos() - Start;
+    BenchMetrics();
+    Bench.AlertNanos = BenchAlerts(AlertMaxRules);
+    BenchReport(TraceName != NULL ? TraceName : "channel", Label, JsonName);
+    return 0;
+  }
+  printf("/api/v1/latest\n");
+  SimApi(false, false);
+  printf("/api/v1/history?format=csv\n");
+  SimApi(true, true);
+  printf("/metrics\n");
+  SimMetrics();
+  printf("received %u, dropped %u, senders %u, table full %u, display frames %u, events %u, history %u flushes %u bytes\n",
+         LoraFramesReceived.load(), LoraFramesDropped.load(), NodeCount, NodeTableFull, Display.Frames, Network.Published,
+         HistoryFlushes, HistoryBytesWritten);
+  const SimFlash &Flash = FileSystem.Flash;
+  printf("flash %llu bytes programmed for %u bytes written, %.1f per reading, %u erases, %.2f per 4KB block, most %u\n",
+         (unsigned long long)Flash.BytesProgrammed, FileSystem.BytesWritten,
+         (double)Flash.BytesProgrammed / std::max(1u, MetricPacketsGood.Read()), Flash.Erases, (double)Flash.Erases / SimFlash::Blocks,
+         *std::max_element(Flash.BlockErases.begin(), Flash.BlockErases.end()));
+  if (Platform.Uplink != NULL)
+    printf("uplink sent %u in %u requests, %u failed, %u spooled, %u lost, %u waiting, %llu bytes, longest backlog drain %lums\n",
+           MetricUplinkSent.Read(), Uplink.Requests, Uplink.Failed, MetricUplinkSpooled.Read(),
+           MetricUplinkRingFull.Read() + MetricUplinkSpoolFull.Read(), UplinkBacklog(), (unsigned long long)Uplink.BodyBytes,
+           Bench.UplinkDrainMax);
+  if (Senders != 0)
+    ChannelReport();
+  return 0;
+}
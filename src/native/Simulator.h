@@ -0,0 +1,500 @@
+/*
+* Linux stand-ins for Hal.h so the receive pipeline runs on a PC.
+* The radio replays a packet trace, the clock only moves when the trace says so,
+* the display is a text framebuffer and files are kept in RAM.
+*/
+
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "../Hal.h"
+
+const uint32_t SimStartUTC = 1546300800; // 1 January 2019, where the fake clock starts
+const unsigned long SimCyclesPerMicro = 240; // same as the board's CPU clock
+
+// hands LoraReceive the packet the trace has just delivered, and keeps what the pipeline sends until -channel takes it
+class SimRadio : public HalRadio
+{
+public:
+  std::vector<uint8_t> Packet;
+  size_t Position = 0;
+  int RSSI = 0;
+  int8_t SNRRaw = 0;
+  std::vector<std::vector<uint8_t>> Sent;
+  void Deliver(const std::vector<uint8_t> &Bytes, int PacketRSSI, int8_t PacketSNRRaw)
+  {
+    Packet = Bytes;
+    Position = 0;
+    RSSI = PacketRSSI;
+    SNRRaw = PacketSNRRaw;
+  }
+  int Available() { return Packet.size() - Position; }
+  int Read() { return Position < Packet.size() ? Packet[Position++] : -1; }
+  int PacketRSSI() { return RSSI; }
+  int8_t PacketSNRRaw() { return SNRRaw; }
+  bool Send(const uint8_t *Data, size_t Length)
+  {
+    Sent.push_back(std::vector<uint8_t>(Data, Data + Length));
+    return true;
+  }
+};
+
+// the OLED as lines of text, printed in a box whenever it is updated and something changed
+class SimDisplay : public HalDisplay
+{
+public:
+  char Lines[OLEDLines][OLEDLineLength] = {};
+  bool Dirty = false;
+  bool Show = true;
+  uint32_t Frames = 0; // updates that changed something
+  void SetLine(byte Line, const char *Text)
+  {
+    if (Line >= OLEDLines || strncmp(Lines[Line], Text, OLEDLineLength - 1) == 0)
+      return;
+    strncpy(Lines[Line], Text, OLEDLineLength - 1);
+    Lines[Line][OLEDLineLength - 1] = '\0';
+    Dirty = true;
+  }
+  void Update()
+  {
+    if (!Dirty)
+      return;
+    Dirty = false;
+    Frames++;
+    if (!Show)
+      return;
+    printf("+%.*s+\n", OLEDLineLength - 1, "---------------------------------------");
+    for (byte i = 0; i < OLEDLines; i++)
+      printf("|%-*.*s|\n", OLEDLineLength - 1, OLEDLineLength - 1, Lines[i]);
+    printf("+%.*s+\n", OLEDLineLength - 1, "---------------------------------------");
+  }
+};
+
+// fake time, moved on by the trace, so a replay gives the same output every run
+class SimClock : public HalClock
+{
+public:
+  unsigned long Now = 0; // microseconds since the simulated boot
+  unsigned long Millis() { return Now / 1000; }
+  unsigned long Micros() { return Now; }
+  unsigned long Cycles() { return Now * SimCyclesPerMicro; }
+  uint32_t UTC() { return SimStartUTC + Now / 1000000; }
+  void Format(char *Date, size_t DateSize, char *Time, size_t TimeSize)
+  {
+    time_t Seconds = UTC();
+    struct tm Parts;
+    gmtime_r(&Seconds, &Parts);
+    strftime(Date, DateSize, "%d %B %Y", &Parts);
+    strftime(Time, TimeSize, "%T", &Parts);
+  }
+};
+
+// files kept in RAM, lost when the simulator exits
+// wear on the board's SPIFFS partition, 4KB erase blocks of 16 pages of 256 bytes. Data goes into the next free page,
+// an append fills the end of the file's last page first, and every write puts a new copy of the file's index page down
+// as SPIFFS keeps the size there. When only one block is left free the block with the most deleted pages has its live
+// pages moved and is erased, the way SPIFFS collects garbage. A model for comparing write patterns, not exact to the byte
+class SimFlash
+{
+public:
+  static const size_t PageSize = 256;
+  static const size_t BlockPages = 16;
+  static const size_t Blocks = 0x160000 / (PageSize * BlockPages); // the spiffs partition in the board's default.csv
+  uint64_t BytesProgrammed = 0; // data, index pages and pages moved by garbage collection
+  uint32_t Erases = 0;
+  uint32_t Full = 0; // writes that didn't fit, the model stops counting them
+  std::vector<uint32_t> BlockErases = std::vector<uint32_t>(Blocks);
+  void Write(const std::string &Path, size_t Length, bool Append)
+  {
+    SimFlashFile &File = Files[Path];
+    if (!Append)
+    {
+      for (size_t Page : File.Pages)
+        Free(Page);
+      File.Pages.clear();
+      File.LastFill = PageSize;
+    }
+    size_t Fill = std::min(Length, PageSize - File.LastFill); // rest of the last page, still erased
+    BytesProgrammed += Fill;
+    File.LastFill += Fill;
+    for (Length -= Fill; Length > 0; Length -= Fill)
+    {
+      size_t Page;
+      if (!Allocate(Path, Page))
+        return;
+      File.Pages.push_back(Page);
+      Fill = std::min(Length, size_t(PageSize)); // a copy, PageSize has no definition to bind a reference to
+      BytesProgrammed += Fill;
+      File.LastFill = Fill;
+    }
+    size_t Index;
+    if (!Allocate(Path, Index))
+      return;
+    if (File.HasIndex)
+      Free(File.Index);
+    File.Index = Index;
+    File.HasIndex = true;
+    BytesProgrammed += PageSize;
+  }
+
+private:
+  struct SimFlashFile
+  {
+    std::vector<size_t> Pages;
+    size_t LastFill = PageSize; // bytes used in the last page
+    size_t Index = 0;
+    bool HasIndex = false;
+  };
+  enum PageState : uint8_t
+  {
+    PageErased,
+    PageUsed,
+    PageDeleted
+  };
+  std::map<std::string, SimFlashFile> Files;
+  std::vector<PageState> Pages = std::vector<PageState>(Blocks * BlockPages, PageErased);
+  std::vector<std::string> Owners = std::vector<std::string>(Blocks * BlockPages);
+  size_t ErasedPages = Blocks * BlockPages;
+  size_t Next = 0; // pages are handed out in order from here, spreading the writes
+  bool Collecting = false; // moving pages out of a block, which may use the block kept free
+  void Free(size_t Page)
+  {
+    Pages[Page] = PageDeleted;
+  }
+  bool Allocate(const std::string &Path, size_t &Page)
+  {
+    while (!Collecting && ErasedPages <= BlockPages && Collect())
+      ;
+    if (ErasedPages == 0)
+    {
+      Full++;
+      return false;
+    }
+    while (Pages[Next] != PageErased)
+      Next = (Next + 1) % Pages.size();
+    Page = Next;
+    Pages[Page] = PageUsed;
+    Owners[Page] = Path;
+    ErasedPages--;
+    return true;
+  }
+  // erase the block with the most deleted pages, the least worn of those that tie, false if none has any
+  bool Collect()
+  {
+    size_t Best = Blocks;
+    size_t BestDeleted = 0;
+    for (size_t Block = 0; Block < Blocks; Block++)
+    {
+      size_t Deleted = std::count(Pages.begin() + Block * BlockPages, Pages.begin() + (Block + 1) * BlockPages, PageDeleted);
+      if (Deleted > BestDeleted || (Deleted == BestDeleted && Deleted > 0 && BlockErases[Block] < BlockErases[Best]))
+      {
+        Best = Block;
+        BestDeleted = Deleted;
+      }
+    }
+    if (Best == Blocks)
+      return false;
+    size_t First = Best * BlockPages;
+    for (size_t Page = First; Page < First + BlockPages; Page++) // nothing erased is handed out of here while it is moved
+      if (Pages[Page] == PageErased)
+      {
+        Pages[Page] = PageDeleted;
+        ErasedPages--;
+      }
+    Collecting = true;
+    for (size_t Page = First; Page < First + BlockPages; Page++)
+    {
+      if (Pages[Page] != PageUsed)
+        continue;
+      SimFlashFile &File = Files[Owners[Page]];
+      size_t Moved = 0;
+      Allocate(Owners[Page], Moved); // always room, a block is kept free for this
+      if (File.HasIndex && File.Index == Page)
+        File.Index = Moved;
+      else
+        *std::find(File.Pages.begin(), File.Pages.end(), Page) = Moved;
+      BytesProgrammed += PageSize;
+    }
+    Collecting = false;
+    std::fill(Pages.begin() + First, Pages.begin() + First + BlockPages, PageErased);
+    ErasedPages += BlockPages;
+    BlockErases[Best]++;
+    Erases++;
+    return true;
+  }
+};
+
+class SimFileSystem : public HalFileSystem
+{
+public:
+  std::map<std::string, std::vector<uint8_t>> Files;
+  uint32_t BytesWritten = 0;
+  SimFlash Flash;
+  bool Exists(const char *Path) { return Files.count(Path) != 0; }
+  size_t Size(const char *Path) { return Exists(Path) ? Files[Path].size() : 0; }
+  size_t Read(const char *Path, size_t Offset, void *Data, size_t Length)
+  {
+    if (!Exists(Path))
+      return 0;
+    const std::vector<uint8_t> &File = Files[Path];
+    if (Offset >= File.size())
+      return 0;
+    if (Length > File.size() - Offset)
+      Length = File.size() - Offset;
+    memcpy(Data, File.data() + Offset, Length);
+    return Length;
+  }
+  bool Write(const char *Path, const void *Data, size_t Length, bool Append)
+  {
+    std::vector<uint8_t> &File = Files[Path];
+    if (!Append)
+      File.clear();
+    File.insert(File.end(), (const uint8_t *)Data, (const uint8_t *)Data + Length);
+    BytesWritten += Length;
+    Flash.Write(Path, Length, Append);
+    return true;
+  }
+};
+
+// Wi-Fi that the trace can take down and bring back, events are counted and optionally printed
+class SimNetwork : public HalNetwork
+{
+public:
+  bool Up = true;
+  int SignalRSSI = -60;
+  size_t OpenPages = 1; // pretend a home page is open so events get formatted
+  size_t Clients = 0;   // -clients, pages that Deliver sends events to rather than printing them
+  void (*Deliver)(const char *Event, const char *Data, uint32_t ID) = NULL;
+  bool Show = true;
+  uint32_t Published = 0;
+  bool Connected() { return Up; }
+  int RSSI() { return Up ? SignalRSSI : 0; }
+  size_t Listeners() { return Up ? (Clients > 0 ? Clients : OpenPages) : 0; }
+  void Publish(const char *Event, const char *Data, uint32_t ID)
+  {
+    Published++;
+    if (Clients > 0)
+      Deliver(Event, Data, ID);
+    else if (Show)
+      printf("event: %s\nid: %u\ndata: %s\n\n", Event, ID, Data);
+  }
+};
+
+// the backend, either kept in memory or a real HTTP server such as scripts/uplink_stub.py.
+// Each request moves the fake clock on by RequestMillis, the same as UplinkTask waiting for an answer
+class SimUplink : public HalUplink
+{
+public:
+  SimClock *Clock = NULL;
+  const char *Name = "uplink";
+  const char *URL = NULL;        // http://host:port/path, NULL keeps everything in memory
+  unsigned FailPercent = 0;      // in memory requests that fail, every n/100 spread evenly
+  unsigned long RequestMillis = 50;
+  bool Show = true;
+  uint32_t Requests = 0;
+  uint32_t Failed = 0;
+  uint64_t BodyBytes = 0;
+  std::string Last; // body of the last request
+  bool Send(const char *Body, size_t Length)
+  {
+    Requests++;
+    Last.assign(Body, Length);
+    if (Clock != NULL)
+      Clock->Now += RequestMillis * 1000;
+    bool Sent = URL == NULL ? (Requests * FailPercent) / 100 == ((Requests - 1) * FailPercent) / 100 : Post(Body, Length);
+    if (!Sent)
+      Failed++;
+    else
+      BodyBytes += Length;
+    if (Show)
+      printf("%s %s: %.*s\n", Name, Sent ? "sent" : "failed", (int)Length, Body);
+    return Sent;
+  }
+  // HTTP/1.0 POST, true for a 2xx answer
+  bool Post(const char *Body, size_t Length)
+  {
+    char Host[128] = "", Port[8] = "80", Path[128] = "/";
+    if (sscanf(URL, "http://%127[^:/]:%7[0-9]%127s", Host, Port, Path) < 2 && sscanf(URL, "http://%127[^:/]%127s", Host, Path) < 1)
+      return false;
+    struct addrinfo Hints = {}, *Address;
+    Hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(Host, Port, &Hints, &Address) != 0)
+      return false;
+    int Socket = socket(Address->ai_family, Address->ai_socktype, Address->ai_protocol);
+    bool Connected = Socket >= 0 && connect(Socket, Address->ai_addr, Address->ai_addrlen) == 0;
+    freeaddrinfo(Address);
+    char Reply[64] = "";
+    if (Connected)
+    {
+      char Header[400];
+      int HeaderLength = snprintf(Header, sizeof(Header), "POST %s HTTP/1.0\r\nHost: %s\r\nContent-Type: application/json\r\nContent-Length: %u\r\n\r\n",
+                                  Path, Host, (unsigned)Length);
+      if (write(Socket, Header, HeaderLength) == HeaderLength && write(Socket, Body, Length) == (ssize_t)Length)
+        if (read(Socket, Reply, sizeof(Reply) - 1) < 0)
+          Reply[0] = '\0';
+    }
+    if (Socket >= 0)
+      close(Socket);
+    int Code = 0;
+    sscanf(Reply, "HTTP/%*s %d", &Code);
+    return Code >= 200 && Code < 300;
+  }
+};
+
+// the config blob, kept in RAM so it survives -restart the way NVS survives a reset
+class SimStore : public HalStore
+{
+public:
+  std::vector<uint8_t> Blob;
+  uint32_t Saves = 0;
+  size_t Load(void *Data, size_t Size)
+  {
+    if (Blob.size() > Size)
+      return 0;
+    memcpy(Data, Blob.data(), Blob.size());
+    return Blob.size();
+  }
+  bool Save(const void *Data, size_t Length)
+  {
+    Blob.assign((const uint8_t *)Data, (const uint8_t *)Data + Length);
+    Saves++;
+    return true;
+  }
+};
+
+// an update's image in memory, the running firmware is whatever -update-base read
+class SimImage : public HalImage
+{
+public:
+  std::vector<uint8_t> Base;
+  std::vector<uint8_t> Image;
+  bool Writing = false;
+  bool Committed = false;
+  bool Begin(byte Target, size_t Size)
+  {
+    Image.clear();
+    Image.reserve(Size);
+    Writing = true;
+    Committed = false;
+    return true;
+  }
+  bool Write(const uint8_t *Data, size_t Length)
+  {
+    Image.insert(Image.end(), Data, Data + Length);
+    return Writing;
+  }
+  size_t ReadBase(size_t Offset, void *Data, size_t Length)
+  {
+    if (Offset > Base.size() || Length > Base.size() - Offset)
+      return 0;
+    memcpy(Data, Base.data() + Offset, Length);
+    return Length;
+  }
+  bool End(bool Commit)
+  {
+    Committed = Commit && Writing;
+    Writing = false;
+    return Committed;
+  }
+};
+
+class SimConsole : public HalConsole
+{
+public:
+  bool Show = true;
+  void Print(const char *Text)
+  {
+    if (Show)
+      fputs(Text, stdout);
+  }
+};
+
+// a sender for -channel. The channel is a fixed path loss with log normal fading, a packet gets through with a
+// probability that rises from 0 to 1 over a couple of dB around the demodulation floor, acks the same in reverse
+struct SimSender
+{
+  uint8_t ID;
+  float PathSNR; // mean SNR at the other end when sending at 0dBm
+  int8_t TXPower;
+  uint8_t SpreadingFactor;
+  uint16_t Sequence;
+  unsigned long NextMillis;
+  uint32_t Sent;
+  uint32_t Delivered;
+  uint32_t AcksHeard;
+  double ChargeMilliampSeconds; // spent transmitting
+};
+
+// one line of a packet trace, see Simulator.cpp for the format
+struct TraceEvent
+{
+  unsigned long Millis;
+  char Type[8];                // rx, text, wifi or config
+  int RSSI;
+  int SNRRaw;                  // 1/4 dB steps, as the radio register
+  std::vector<uint8_t> Packet; // rx and text, name=value for config
+  bool Up;                     // wifi
+};
+
+// read the next event from a trace, skipping blank lines and # comments. Returns false at the end or on a bad line
+inline bool TraceRead(FILE *Trace, TraceEvent &Event, unsigned long &Line)
+{
+  char Text[600];
+  while (fgets(Text, sizeof(Text), Trace) != NULL)
+  {
+    Line++;
+    Text[strcspn(Text, "\r\n")] = '\0';
+    char *Start = Text + strspn(Text, " \t");
+    if (*Start == '\0' || *Start == '#')
+      continue;
+    char Payload[520] = "";
+    int Fields = sscanf(Start, "%lu %7s", &Event.Millis, Event.Type);
+    if (Fields != 2)
+      return false;
+    Event.Packet.clear();
+    if (strcmp(Event.Type, "wifi") == 0)
+    {
+      char State[8] = "";
+      sscanf(Start, "%*s %*s %7s", State);
+      Event.Up = strcmp(State, "up") == 0;
+      return Event.Up || strcmp(State, "down") == 0;
+    }
+    if (strcmp(Event.Type, "config") == 0)
+    {
+      if (sscanf(Start, "%*s %*s %519s", Payload) != 1 || strchr(Payload, '=') == NULL)
+        return false;
+      Event.Packet.assign(Payload, Payload + strlen(Payload));
+      return true;
+    }
+    if (sscanf(Start, "%*s %*s %d %d %519s", &Event.RSSI, &Event.SNRRaw, Payload) != 3)
+      return false;
+    if (strcmp(Event.Type, "text") == 0)
+    {
+      Event.Packet.assign(Payload, Payload + strlen(Payload));
+      return true;
+    }
+    if (strcmp(Event.Type, "rx") != 0 || strlen(Payload) % 2 != 0)
+      return false;
+    for (size_t i = 0; Payload[i] != '\0'; i += 2)
+    {
+      unsigned int Byte;
+      if (sscanf(Payload + i, "%2x", &Byte) != 1)
+        return false;
+      Event.Packet.push_back(Byte);
+    }
+    return true;
+  }
+  return false;
+}
+
+#endif